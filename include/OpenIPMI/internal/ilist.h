@@ -141,6 +141,13 @@ void ilist_iter_rev(ilist_t *list, ilist_iter_cb handler, void *cb_data);
 /* Initialize a statically declared iterator. */
 void ilist_init_iter(ilist_iter_t *iter, ilist_t *list);
 
+/* Initialize a statically declared iterator positioned on the given
+   entry, which must be the entry supplied when the item was added to
+   the list.  This lets the user find an item some other way and then
+   move around the list from it without searching. */
+void ilist_init_iter_at(ilist_iter_t *iter, ilist_t *list,
+			ilist_item_t *entry);
+
 /* Return -1 if item1 < item2, 0 if item1 == item2, and 1 if item1 > item2 */
 typedef int (*ilist_sort_cb)(void *item1, void *item2);
 
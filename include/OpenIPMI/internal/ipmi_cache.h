@@ -0,0 +1,116 @@
+/*
+ * ipmi_cache.h
+ *
+ * On-disk cache format for SDR and FRU data.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2002 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef _IPMI_CACHE_H
+#define _IPMI_CACHE_H
+
+#include <stdint.h>
+#include <OpenIPMI/os_handler.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cached data is stored as a fixed header followed by an array of
+ * fixed-size elements, in native byte order and alignment so that a
+ * mapped image can be used directly without parsing or copying.  A
+ * cache written by a different version, byte order, or element
+ * layout is rejected and the data is simply fetched again.
+ */
+#define IPMI_CACHE_MAGIC	0x4f495043 /* "OIPC" */
+#define IPMI_CACHE_VERSION	1
+
+/* The kinds of data stored, so one can't be mistaken for another. */
+#define IPMI_CACHE_SDR		1
+#define IPMI_CACHE_FRU		2
+
+typedef struct ipmi_cache_hdr_s
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t kind;
+    uint32_t hdr_len;	/* Offset of the element array. */
+    uint32_t elem_size;
+    uint32_t count;
+    /* Kind-specific values used to tell if the cache is stale, the
+       SDR repository add and erase timestamps, for instance. */
+    uint32_t stamp1;
+    uint32_t stamp2;
+    uint32_t checksum;	/* Adler-32 of the element array. */
+} ipmi_cache_hdr_t;
+
+typedef struct ipmi_cache_s ipmi_cache_t;
+
+/* Write count elements of elem_size bytes from data under the key.
+   Uses the OS handler's cache if it has one, otherwise the
+   database. */
+int ipmi_cache_store(os_handler_t *os_hnd,
+		     const char   *key,
+		     unsigned int kind,
+		     unsigned int elem_size,
+		     unsigned int count,
+		     uint32_t     stamp1,
+		     uint32_t     stamp2,
+		     const void   *data);
+
+/* Map the cached data for the key in place.  Returns ENOSYS if the
+   OS handler cannot map data, and an error if the data is not there
+   or not valid for the kind and element size.  The data stays valid
+   until ipmi_cache_release() is called, and must not be modified. */
+int ipmi_cache_map(os_handler_t *os_hnd,
+		   const char   *key,
+		   unsigned int kind,
+		   unsigned int elem_size,
+		   ipmi_cache_t **cache);
+const void *ipmi_cache_data(ipmi_cache_t *cache);
+unsigned int ipmi_cache_count(ipmi_cache_t *cache);
+uint32_t ipmi_cache_stamp1(ipmi_cache_t *cache);
+uint32_t ipmi_cache_stamp2(ipmi_cache_t *cache);
+void ipmi_cache_release(ipmi_cache_t *cache);
+
+/* Validate a cache image fetched some other way (from
+   database_find(), for instance).  On success the header is copied
+   into hdr and the elements start hdr->hdr_len bytes into data. */
+int ipmi_cache_check(const unsigned char *data,
+		     unsigned int        len,
+		     unsigned int        kind,
+		     unsigned int        elem_size,
+		     ipmi_cache_hdr_t    *hdr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IPMI_CACHE_H */
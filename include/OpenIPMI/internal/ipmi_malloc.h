@@ -67,6 +67,33 @@ void ipmi_mem_free(void *data);
 char *ipmi_strdup(const char *str);
 char *ipmi_strndup(const char *str, int n);
 
+/* Pools of fixed-size objects, for things that are allocated and
+   freed all the time.  Freed objects are kept (up to max_free of
+   them) and handed out again instead of going back to the allocator.
+   Objects from a pool are ordinary ipmi_mem_alloc() memory, so it
+   doesn't hurt if one gets freed with ipmi_mem_free() or something
+   allocated with ipmi_mem_alloc() gets put into the pool, as long as
+   the size is right.  Objects are not cached when malloc debugging
+   is on. */
+typedef struct ipmi_mem_pool_s ipmi_mem_pool_t;
+struct os_handler_s;
+ipmi_mem_pool_t *ipmi_mem_pool_alloc(struct os_handler_s *os_hnd,
+				     const char          *name,
+				     unsigned int        size,
+				     unsigned int        max_free);
+void ipmi_mem_pool_destroy(ipmi_mem_pool_t *pool);
+void *ipmi_mem_pool_get(ipmi_mem_pool_t *pool);
+void ipmi_mem_pool_put(ipmi_mem_pool_t *pool, void *obj);
+
+/* Report the number of gets from each pool and how many of those had
+   to allocate a new object. */
+typedef void (*ipmi_mem_pool_cb)(ipmi_mem_pool_t *pool,
+				 const char      *name,
+				 unsigned long   gets,
+				 unsigned long   misses,
+				 void            *cb_data);
+void ipmi_mem_pool_iterate(ipmi_mem_pool_cb handler, void *cb_data);
+
 /* If you have debug allocations on, then you should call this to
    check for data you haven't freed (after you have freed all the
    data, of course).  It's safe to call even if malloc debugging is
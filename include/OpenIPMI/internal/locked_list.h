@@ -61,6 +61,9 @@
  * add items and remove items while the list is being iterated, and
  * iterate by multiple threads simultaneously.  The handlers are
  * called without any locks being held.
+ *
+ * Once a list gets long it is indexed by (item1, item2), so adding,
+ * removing and duplicate checks do not have to search the list.
  */
 
 typedef struct locked_list_s locked_list_t;
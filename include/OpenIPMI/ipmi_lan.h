@@ -172,7 +172,9 @@ int ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
    this is 2, but 2 may even be too much for some systems.  A larger
    number may improve performance for systems that can handle it.  The
    maximum value is 63, but that's way bigger than anyone should need.
-   5-6 should be enough for anything.  The value is set in parm_val */
+   5-6 should be enough for anything.  The value is set in parm_val.
+   This is an upper limit, the number actually used is cut down when
+   messages time out and grows back as responses come in. */
 #define IPMI_LANP_MAX_OUTSTANDING_MSG_COUNT	12
 
 /* Address family, integer value, generally AF_INET or AF_INET6.  If
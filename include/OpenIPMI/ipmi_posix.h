@@ -102,10 +102,20 @@ void ipmi_posix_os_handler_set_sel(os_handler_t *os_hnd,
  * the selector.
  *********************************************************************/
 /* Set up a selector.  wake_sig is used to wake up selects when things
-   change and they need to wake up.  It must be some unused signal (it
-   does not have to be queued); a signal handler will be installed for
-   it. */
+   change and they need to wake up, if the selector cannot get a wake
+   fd.  It must be some unused signal (it does not have to be queued);
+   a signal handler will be installed for it.  Pass 0 to not use a
+   signal at all. */
 os_handler_t *ipmi_posix_thread_setup_os_handler(int wake_sig);
+/* Like the above, but spread the work over num_loops event loops,
+   each with its own selector, fd table and timer heap.  The first
+   loop is the selector returned by
+   ipmi_posix_thread_os_handler_get_sel() and is run by the user as
+   usual; a thread is started for each of the others.  New fds and
+   timers go on the loop of the calling thread if it is running one,
+   otherwise on the least-loaded loop. */
+os_handler_t *ipmi_posix_thread_setup_os_handler_loops(int wake_sig,
+						       unsigned int num_loops);
 /* Gets the selector associated with the OS handler. */
 struct selector_s *ipmi_posix_thread_os_handler_get_sel(os_handler_t *os_hnd);
 
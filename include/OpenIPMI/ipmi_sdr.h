@@ -95,6 +95,11 @@ int ipmi_sdr_fetch(ipmi_sdr_info_t     *sdrs,
 		   ipmi_sdrs_fetched_t handler,
 		   void                *cb_data);
 
+/* Set the maximum number of Get SDR commands to have outstanding at
+   once while fetching, 1 to 32.  The default is 6.  This may be
+   called while a fetch is in progress. */
+int ipmi_sdr_set_fetch_window(ipmi_sdr_info_t *sdrs, unsigned int window);
+
 /* Return the number of SDRs in the sdr repository. */
 int ipmi_get_sdr_count(ipmi_sdr_info_t *sdr,
 		       unsigned int    *count);
@@ -109,6 +114,15 @@ int ipmi_get_sdr_by_type(ipmi_sdr_info_t *sdr,
 			 int             type,
 			 ipmi_sdr_t      *return_sdr);
 
+/* Find the sensor SDR (full, compact, or event-only) holding the
+   given sensor.  Shared SDRs are found by any of the sensor numbers
+   they cover. */
+int ipmi_get_sdr_by_sensor(ipmi_sdr_info_t *sdr,
+			   unsigned int    owner,
+			   unsigned int    lun,
+			   unsigned int    num,
+			   ipmi_sdr_t      *return_sdr);
+
 /* Find the SDR with the given index. The indexes are the internal
    array indexes for the SDR, this can be used to iterate through the
    SDRs. */
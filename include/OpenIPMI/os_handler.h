@@ -347,6 +347,29 @@ struct os_handler_s
 
     int (*get_monotonic_time)(os_handler_t *handler, struct timeval *tv);
     int (*get_real_time)(os_handler_t *handler, struct timeval *tv);
+
+    /* Cache storage that can be used in place.  These are like the
+       database routines, but cache_map() returns a read-only view of
+       the stored data (mapping a file, for instance) that stays
+       valid until cache_unmap() is called on the returned handle,
+       even if the key is stored again in the meantime.  They are
+       optional; if they are not present the database routines are
+       used and the data is copied. */
+    int (*cache_store)(os_handler_t        *handler,
+		       const char          *key,
+		       const unsigned char *data,
+		       unsigned int        data_len);
+    int (*cache_map)(os_handler_t        *handler,
+		     const char          *key,
+		     const unsigned char **data,
+		     unsigned int        *data_len,
+		     void                **handle);
+    void (*cache_unmap)(os_handler_t *handler,
+			void         *handle);
+    /* Set the directory holding the cache.  On *nix systems it
+       defaults to $HOME/.OpenIPMI_cache. */
+    int (*cache_set_dir)(os_handler_t *handler,
+			 const char   *dir);
 };
 
 /* Only use these to allocate/free OS handlers. */
@@ -52,7 +52,9 @@ typedef struct selector_s selector_t;
 /* You have to create a selector before you can use it. */
 
 /* Create a selector for use with threads.  You have to pass in the
-   lock functions and a signal used to wake waiting threads. */
+   lock functions.  Waiting threads are woken with an internal eventfd
+   (or pipe); wake_sig is only used if that cannot be allocated and
+   may be 0, in which case allocation fails instead. */
 typedef struct sel_lock_s sel_lock_t;
 int sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 			      sel_lock_t *(*sel_lock_alloc)(void *cb_data),
@@ -69,6 +71,32 @@ int sel_alloc_selector_nothread(struct selector_s **new_selector);
 /* Used to destroy a selector. */
 int sel_free_selector(struct selector_s *new_selector);
 
+/* Tuning for the epoll backend.  These return ENOSYS if the selector
+   is not using epoll.
+
+   sel_set_epoll_batch() sets the maximum number of events pulled from
+   the kernel and dispatched per wakeup (1 to 256, 32 by default).
+
+   sel_set_epoll_oneshot() chooses how fds are registered.  In
+   one-shot mode (the default for selectors allocated with locks) an
+   fd is disabled in the kernel when it fires and re-armed after its
+   handlers run, so two threads will never run handlers for the same
+   fd at the same time.  Otherwise fds are level triggered and only
+   touched when their handlers are enabled or disabled, saving a
+   system call per event.  Only turn one-shot off if a single thread
+   calls sel_select() on the selector. */
+int sel_set_epoll_batch(struct selector_s *sel, unsigned int max_events);
+int sel_set_epoll_oneshot(struct selector_s *sel, int oneshot);
+
+/* Use a hierarchical timer wheel instead of a heap for the timers on
+   this selector.  Starting and stopping a timer is then O(1) instead
+   of O(log n), which matters with many timers that are mostly
+   stopped before they go off, like message timeouts.  Timers go off
+   up to one tick late; tick_ns is rounded up to a power of two and 0
+   gives about a millisecond.  Call this right after allocating the
+   selector, it returns EBUSY if any timers are running. */
+int sel_set_timer_wheel(struct selector_s *sel, unsigned long tick_ns);
+
 
 /* A function to call when select sees something on a file
    descriptor. */
@@ -139,7 +167,8 @@ int sel_run(sel_runner_t *runner, sel_runner_func_t func, void *cb_data);
    mask.  This code should send a signal to the thread that calls
    sel-select_loop.  The user will have to allocate the signal, set
    the handlers, etc.  The thread_id and cb_data are just the values
-   passed into sel_select_loop(). */
+   passed into sel_select_loop().  Threaded selectors normally wake
+   waiters through their wake fd and do not call this. */
 typedef void (*sel_send_sig_cb)(long thread_id, void *cb_data);
 
 /*
@@ -94,6 +94,38 @@ int iterate_persist(persist_t *p,
 void free_persist_data(void *data);
 void free_persist_str(char *str);
 
+/*
+ * An append-only journal of changes to a persist, so a single change
+ * does not require rewriting the whole persist file.  Each record
+ * sets or deletes one named value.  read_persist() applies the
+ * journal for the name on top of the persist file it reads, so
+ * readers do not need to know about it.  The journal keeps growing
+ * until persist_journal_compact() is called with the full contents,
+ * which writes them with write_persist() and empties the journal.
+ * The user should compact after reading the persist at startup if
+ * persist_journal_replayed() says the journal had anything in it, and
+ * whenever persist_journal_count() gets large relative to the number
+ * of values.
+ */
+typedef struct persist_journal_s persist_journal_t;
+
+persist_journal_t *alloc_persist_journal(const char *name, ...);
+void free_persist_journal(persist_journal_t *j);
+
+int persist_journal_data(persist_journal_t *j, void *data, unsigned int len,
+			 const char *name, ...);
+int persist_journal_int(persist_journal_t *j, long val, const char *name, ...);
+int persist_journal_del(persist_journal_t *j, const char *name, ...);
+
+/* Number of journal records read_persist() applied to p. */
+unsigned int persist_journal_replayed(persist_t *p);
+
+/* Number of records appended since the last compaction. */
+unsigned int persist_journal_count(persist_journal_t *j);
+
+/* Write p as the new persist file and empty the journal. */
+int persist_journal_compact(persist_journal_t *j, persist_t *p);
+
 /* Can be set to zero to disable persistence. */
 extern int persist_enable;
 
@@ -390,6 +390,16 @@ struct sys_data_s {
 
     int (*gen_rand)(sys_data_t *sys, void *data, int len);
 
+    /*
+     * If set, MCs may be run in different threads, and anything one
+     * MC changes in another MC (like delivering an event) must be
+     * done by passing func to this to run in the context of mc.
+     * func may be called before this returns.  Returns an error if
+     * func could not be queued, in which case it will not be called.
+     */
+    int (*mc_run)(sys_data_t *sys, lmc_data_t *mc,
+		  void (*func)(lmc_data_t *mc, void *cb_data), void *cb_data);
+
     /* Called by interface code to report that the target did a reset. */
     /* FIXME - move */
     void (*target_reset)(sys_data_t *sys);
@@ -427,6 +437,8 @@ zero_extend_ascii(uint8_t *c, unsigned int len)
 typedef struct ipmi_tick_handler_s {
     void (*handler)(void *info, unsigned int seconds);
     void *info;
+    /* The MC whose state the handler works on, NULL if it may be any. */
+    lmc_data_t *mc;
     struct ipmi_tick_handler_s *next;
 } ipmi_tick_handler_t;
 
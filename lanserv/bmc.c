@@ -61,6 +61,7 @@
 #include <OpenIPMI/ipmi_mc.h>
 #include <OpenIPMI/ipmi_lan.h>
 #include <OpenIPMI/extcmd.h>
+#include <OpenIPMI/persist.h>
 
 static void ipmi_mc_start_cmd(lmc_data_t *mc);
 
@@ -300,20 +301,48 @@ ipmi_emu_tick(emu_data_t *emu, unsigned int seconds)
     }
 }
 
+lmc_data_t *
+ipmi_emu_get_msg_mc(emu_data_t *emu, lmc_data_t *srcmc, msg_t *msg)
+{
+    unsigned char *data;
+    lmc_data_t    *mc;
+
+    if (msg->netfn != IPMI_APP_NETFN || msg->cmd != IPMI_SEND_MSG_CMD)
+	return srcmc;
+
+    /* Errors are reported by srcmc, so use the same checks as below. */
+    if (msg->len < 8)
+	return srcmc;
+    data = msg->data + 1;
+    if (data[0] == 0) {
+	if (msg->len < 9)
+	    return srcmc;
+	data++;
+    }
+    mc = emu->sysinfo->ipmb_addrs[data[0]];
+    if (!mc || !mc->enabled)
+	return srcmc;
+    return mc;
+}
+
 void
-ipmi_emu_handle_msg(emu_data_t    *emu,
-		    lmc_data_t    *srcmc,
-		    msg_t         *omsg,
-		    unsigned char *ordata,
-		    unsigned int  *ordata_len)
+ipmi_emu_handle_msg_start(emu_data_t    *emu,
+			  lmc_data_t    *srcmc,
+			  lmc_data_t    *mc,
+			  msg_t         *omsg,
+			  unsigned char *ordata,
+			  unsigned int  *ordata_len,
+			  msg_t         **rbridged,
+			  int           *rints_on)
 {
-    lmc_data_t *mc;
     msg_t smsg, *rmsg = NULL;
     msg_t *msg;
     unsigned char *data = NULL;
     unsigned char *rdata;
     unsigned int  *rdata_len;
 
+    *rbridged = NULL;
+    *rints_on = 0;
     if (emu->sysinfo->debug & DEBUG_MSG)
 	emu->sysinfo->log(emu->sysinfo, DEBUG, omsg, "Receive message:");
     if (omsg->netfn == IPMI_APP_NETFN && omsg->cmd == IPMI_SEND_MSG_CMD) {
@@ -343,8 +372,8 @@ ipmi_emu_handle_msg(emu_data_t    *emu,
 	    }
 	}
 	slave = data[0];
-	mc = emu->sysinfo->ipmb_addrs[slave];
-	if (!mc || !mc->enabled) {
+	/* mc is srcmc if the target was not there when it was picked. */
+	if (!mc || ipmi_mc_get_ipmb(mc) != slave || !mc->enabled) {
 	    ordata[0] = 0x83; /* NAK on Write */
 	    *ordata_len = 1;
 	    return;
@@ -385,7 +414,6 @@ ipmi_emu_handle_msg(emu_data_t    *emu,
 	smsg.sid = omsg->sid;
 	msg = &smsg;
     } else {
-	mc = srcmc;
 	if (!mc || !mc->enabled) {
 	    ordata[0] = 0xff;
 	    *ordata_len = 1;
@@ -412,9 +440,25 @@ ipmi_emu_handle_msg(emu_data_t    *emu,
     } else
 	handle_invalid_cmd(mc, rdata, rdata_len);
 
-    if (omsg->netfn == IPMI_APP_NETFN && omsg->cmd == IPMI_SEND_MSG_CMD) {
-	/* An encapsulated command, put the response into the receive q. */
-	channel_t *bchan = srcmc->channels[15];
+    if (rmsg) {
+	*rbridged = rmsg;
+	*rints_on = IPMI_MC_MSG_INTS_ON(mc);
+    } else if (emu->sysinfo->debug & DEBUG_MSG)
+	debug_log_raw_msg(emu->sysinfo, ordata, *ordata_len,
+			  "Response message:");
+}
+
+void
+ipmi_emu_handle_msg_finish(emu_data_t    *emu,
+			   lmc_data_t    *srcmc,
+			   msg_t         *omsg,
+			   msg_t         *rmsg,
+			   int           ints_on,
+			   unsigned char *ordata,
+			   unsigned int  *ordata_len)
+{
+    /* An encapsulated command, put the response into the receive q. */
+    channel_t *bchan = srcmc->channels[15];
 
     if ((omsg->data[0] & IPMI_MSG_BRIDGE_TRACK_MASK) == (IPMI_MSG_BRIDGE_NO_TRACK << IPMI_MSG_BRIDGE_SHIFT)) {
 	if (bchan->recv_in_q) {
@@ -423,34 +467,45 @@ ipmi_emu_handle_msg(emu_data_t    *emu,
 	}
     }
 
-	ordata[0] = 0;
-	*ordata_len = 1;
+    ordata[0] = 0;
+    *ordata_len = 1;
 
-	if (emu->sysinfo->debug & DEBUG_MSG)
-	    debug_log_raw_msg(emu->sysinfo, rdata, *rdata_len,
-			      "Response message:");
-
-	rmsg->len += 6;
-	rmsg->data[rmsg->len] = -ipmb_checksum(rmsg->data, rmsg->len, 0);
-	rmsg->len += 1;
-	if (srcmc->recv_q_tail) {
-	    rmsg->next = srcmc->recv_q_tail;
-	    srcmc->recv_q_tail = rmsg;
-	} else {
-	    channel_t *bchan = srcmc->channels[15];
+    if (emu->sysinfo->debug & DEBUG_MSG)
+	debug_log_raw_msg(emu->sysinfo, rmsg->data + 6, rmsg->len,
+			  "Response message:");
 
-	    rmsg->next = NULL;
-	    srcmc->recv_q_head = rmsg;
-	    srcmc->recv_q_tail = rmsg;
-	}
-	srcmc->msg_flags |= IPMI_MC_MSG_FLAG_RCV_MSG_QUEUE;
+    rmsg->len += 6;
+    rmsg->data[rmsg->len] = -ipmb_checksum(rmsg->data, rmsg->len, 0);
+    rmsg->len += 1;
+    rmsg->next = NULL;
+    if (srcmc->recv_q_tail)
+	srcmc->recv_q_tail->next = rmsg;
+    else
+	srcmc->recv_q_head = rmsg;
+    srcmc->recv_q_tail = rmsg;
+    srcmc->msg_flags |= IPMI_MC_MSG_FLAG_RCV_MSG_QUEUE;
     if ((omsg->data[0] & IPMI_MSG_BRIDGE_TRACK_MASK) == (IPMI_MSG_BRIDGE_NO_TRACK << IPMI_MSG_BRIDGE_SHIFT)) {
 	if (bchan->set_atn)
-		bchan->set_atn(bchan, 1, IPMI_MC_MSG_INTS_ON(mc));
+		bchan->set_atn(bchan, 1, ints_on);
     }
-    } else if (emu->sysinfo->debug & DEBUG_MSG)
-	debug_log_raw_msg(emu->sysinfo, ordata, *ordata_len,
-			  "Response message:");
+}
+
+void
+ipmi_emu_handle_msg(emu_data_t    *emu,
+		    lmc_data_t    *srcmc,
+		    msg_t         *omsg,
+		    unsigned char *ordata,
+		    unsigned int  *ordata_len)
+{
+    lmc_data_t *mc = ipmi_emu_get_msg_mc(emu, srcmc, omsg);
+    msg_t *rmsg;
+    int ints_on;
+
+    ipmi_emu_handle_msg_start(emu, srcmc, mc, omsg, ordata, ordata_len,
+			      &rmsg, &ints_on);
+    if (rmsg)
+	ipmi_emu_handle_msg_finish(emu, srcmc, omsg, rmsg, ints_on,
+				   ordata, ordata_len);
 }
 
 msg_t *
@@ -533,13 +588,14 @@ ipmi_emu_get_user_data(emu_data_t *emu)
 void
 ipmi_mc_destroy(lmc_data_t *mc)
 {
-    sel_entry_t *entry, *n_entry;
+    unsigned int i;
 
-    entry = mc->sel.entries;
-    while (entry) {
-	n_entry = entry->next;
-	free(entry);
-	entry = n_entry;
+    free_mc_sel(mc);
+    if (mc->main_sdrs.journal)
+	free_persist_journal(mc->main_sdrs.journal);
+    for (i = 0; i < 4; i++) {
+	if (mc->device_sdrs[i].journal)
+	    free_persist_journal(mc->device_sdrs[i].journal);
     }
     free(mc);
 }
@@ -944,6 +1000,7 @@ ipmi_emu_add_mc(emu_data_t    *emu,
 	ipmi_register_child_quit_handler(&mc->child_quit_handler);
 	mc->tick_handler.info = mc;
 	mc->tick_handler.handler = handle_tick;
+	mc->tick_handler.mc = mc;
 	ipmi_register_tick_handler(&mc->tick_handler);
 	mc->channels[15]->start_cmd = chan_start_cmd;
 	mc->channels[15]->stop_cmd = chan_stop_cmd;
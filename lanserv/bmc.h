@@ -69,12 +69,29 @@ typedef struct sel_entry_s
 {
     uint16_t           record_id;
     unsigned char      data[16];
+
+    /* Entries in SEL order.  Free slots are chained through next. */
     struct sel_entry_s *next;
+    struct sel_entry_s *prev;
+
+    /* Next entry in the same record id hash bucket. */
+    struct sel_entry_s *hash_next;
 } sel_entry_t;
 
 typedef struct sel_s
 {
+    /*
+     * The entries live in a fixed table of max_count slots allocated
+     * when the SEL is enabled, so adding and deleting never allocate.
+     * They are linked in SEL order from entries to last, and hashed
+     * by record id for lookups.
+     */
     sel_entry_t   *entries;
+    sel_entry_t   *last;
+    sel_entry_t   *free_entries;
+    sel_entry_t   *slots;
+    sel_entry_t   **hash;
+    unsigned int  hash_mask;
     int           count;
     int           max_count;
     uint32_t      last_add_time;
@@ -83,6 +100,9 @@ typedef struct sel_s
     uint16_t      reservation;
     uint16_t      next_entry;
     long          time_offset;
+
+    /* Changes since the persistent SEL was last written in full. */
+    struct persist_journal_s *journal;
 } sel_t;
 
 #define MAX_SDR_LENGTH 261
@@ -91,8 +111,9 @@ typedef struct sdr_s
 {
     uint16_t      record_id;
     unsigned int  length;
-    unsigned char *data;
+    unsigned char *data; /* Allocated along with the sdr_t. */
     struct sdr_s  *next;
+    struct sdr_s  *prev;
 } sdr_t;
 
 typedef struct sdrs_s
@@ -109,6 +130,17 @@ typedef struct sdrs_s
 
     /* A linked list of SDR entries. */
     sdr_t         *sdrs;
+    sdr_t         *last;
+
+    /*
+     * The entries in the list indexed by record id.  The size is a
+     * power of two, grown to cover the largest record id added.
+     */
+    sdr_t         **index;
+    unsigned int  index_size;
+
+    /* Changes since the persistent SDRs were last written in full. */
+    struct persist_journal_s *journal;
 } sdrs_t;
 
 typedef struct sensor_s sensor_t;
@@ -152,8 +184,9 @@ struct sensor_s
     /* Called when the sensor changes values. */
     void (*sensor_update_handler)(lmc_data_t *mc, sensor_t *sensor);
 
-    ipmi_timer_t *poll_timer;
-    struct timeval poll_timer_time;
+    /* Polled sensors with the same poll period share a timer. */
+    struct sensor_poll_group_s *poll_group;
+    sensor_t *poll_next;
     int (*poll)(void *cb_data, unsigned int *val, const char **errstr);
     void *cb_data;
 };
@@ -412,6 +445,7 @@ sdr_t *find_sdr_by_recid(sdrs_t     *sdrs,
 
 sdr_t *new_sdr_entry(sdrs_t *sdrs, unsigned char length);
 void add_sdr_entry(lmc_data_t *mc, sdrs_t *sdrs, sdr_t *entry);
+void free_mc_sel(lmc_data_t *mc);
 void read_mc_sdrs(lmc_data_t *mc, sdrs_t *sdrs, const char *sdrtype);
 
 void iterate_sdrs(lmc_data_t *mc,
@@ -198,12 +198,7 @@ handle_get_device_sdr(lmc_data_t    *mc,
     if (record_id == 0) {
 	entry = mc->device_sdrs[msg->rs_lun].sdrs;
     } else if (record_id == 0xffff) {
-	entry = mc->device_sdrs[msg->rs_lun].sdrs;
-	if (entry) {
-	    while (entry->next) {
-		entry = entry->next;
-	    }
-	}
+	entry = mc->device_sdrs[msg->rs_lun].last;
     } else {
 	entry = find_sdr_by_recid(&mc->device_sdrs[msg->rs_lun],
 				  record_id, NULL);
@@ -1179,8 +1174,19 @@ ipmi_mc_add_sensor(lmc_data_t    *mc,
     return 0;
 }
 
+/*
+ * How many polls a file sensor goes between checking that its file
+ * hasn't been removed or replaced.  The open fd would keep reading
+ * the old file, but checking every time costs as much as reopening.
+ */
+#define FILE_SENSOR_RECHECK_POLLS 10
+
 struct file_data {
     char *filename;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    unsigned int polls_since_check;
     unsigned int offset;
     unsigned int length;
     unsigned int mask;
@@ -1200,11 +1206,82 @@ struct file_data {
     unsigned char depends_sensor_bit;
 };
 
+static void
+file_close(struct file_data *f)
+{
+    if (f->fd != -1) {
+	close(f->fd);
+	f->fd = -1;
+    }
+}
+
+static int
+file_open(struct file_data *f)
+{
+    struct stat st;
+
+    f->fd = open(f->filename, O_RDONLY);
+    if (f->fd == -1)
+	return errno;
+    fcntl(f->fd, F_SETFD, FD_CLOEXEC);
+    if (fstat(f->fd, &st) == 0) {
+	f->dev = st.st_dev;
+	f->ino = st.st_ino;
+    }
+    f->polls_since_check = 0;
+    return 0;
+}
+
+/*
+ * Read from the sensor's file, keeping it open between polls.  If the
+ * read fails the file may have gone away (a removed sysfs device
+ * returns ENODEV, for instance), so reopen it and try once more.
+ */
+static int
+file_read(struct file_data *f, void *data, size_t len, int *errv,
+	  const char **errstr)
+{
+    struct stat st;
+    int rv;
+
+    if (f->fd != -1
+	&& ++f->polls_since_check >= FILE_SENSOR_RECHECK_POLLS)
+    {
+	f->polls_since_check = 0;
+	if (stat(f->filename, &st) != 0
+	    || st.st_dev != f->dev || st.st_ino != f->ino)
+	    file_close(f);
+    }
+
+    if (f->fd == -1) {
+	*errv = file_open(f);
+	if (*errv) {
+	    *errstr = "Unable to open sensor file";
+	    return -1;
+	}
+    }
+
+    rv = pread(f->fd, data, len, f->offset);
+    if (rv == -1) {
+	file_close(f);
+	*errv = file_open(f);
+	if (*errv) {
+	    *errstr = "Unable to open sensor file";
+	    return -1;
+	}
+	rv = pread(f->fd, data, len, f->offset);
+    }
+    if (rv == -1) {
+	*errv = errno;
+	*errstr = "No data read from file";
+    }
+    return rv;
+}
+
 static int
 file_poll(void *cb_data, unsigned int *rval, const char **errstr)
 {
     struct file_data *f = cb_data;
-    int fd;
     int rv;
     int val;
     char *end;
@@ -1235,22 +1312,6 @@ file_poll(void *cb_data, unsigned int *rval, const char **errstr)
 	    return 0;
     }
 
-    fd = open(f->filename, O_RDONLY);
-    if (fd == -1) {
-	errv = errno;
-	*errstr = "Unable to open sensor file";
-	return errv;
-    }
-
-    if (f->offset) {
-	if (lseek(fd, f->offset, SEEK_SET) == -1) {
-	    errv = errno;
-	    close(fd);
-	    *errstr = "Unable to seek file";
-	    return errv;
-	}
-    }
-
     if (f->is_raw) {
 	unsigned char data[4];
 	int i;
@@ -1258,11 +1319,8 @@ file_poll(void *cb_data, unsigned int *rval, const char **errstr)
 
 	if (length > 4)
 	    length = 4;
-	rv = read(fd, data, length);
-	errv = errno;
-	close(fd);
+	rv = file_read(f, data, length, &errv, errstr);
 	if (rv == -1) {
-	    *errstr = "No data read from file";
 	    return errv;
 	} else if (rv < length) {
 	    *errstr = "Short data read from file";
@@ -1274,13 +1332,9 @@ file_poll(void *cb_data, unsigned int *rval, const char **errstr)
     } else {
 	char data[100];
 
-	rv = read(fd, data, sizeof(data) - 1);
-	errv = errno;
-	close(fd);
-	if (rv == -1) {
-	    *errstr = "No data read from file";
+	rv = file_read(f, data, sizeof(data) - 1, &errv, errstr);
+	if (rv == -1)
 	    return errv;
-	}
 	data[rv] = '\0';
 
 	val = strtol(data, &end, f->base);
@@ -1331,6 +1385,7 @@ file_init(lmc_data_t *mc,
 	return ENOMEM;
     }
     memset(f, 0, sizeof(*f));
+    f->fd = -1;
     f->emu = mc->emu;
     f->sensor_mc = mc;
     f->sensor_lun = lun;
@@ -1509,6 +1564,69 @@ free_sensor(lmc_data_t *mc, sensor_t *sensor)
     free(sensor);
 }
 
+/*
+ * Polled sensors are grouped by poll period, each group has one
+ * timer and polls all its sensors together on each tick.  This keeps
+ * hundreds of sensors polling at the same rate from each running a
+ * timer of their own.
+ */
+typedef struct sensor_poll_group_s sensor_poll_group_t;
+struct sensor_poll_group_s {
+    sys_data_t *sysinfo;
+    struct timeval period;
+    ipmi_timer_t *timer;
+    sensor_t *sensors;
+    sensor_poll_group_t *next;
+};
+
+static sensor_poll_group_t *poll_groups;
+
+static void
+sensor_poll_group_tick(void *cb_data)
+{
+    sensor_poll_group_t *group = cb_data;
+    sensor_t *sensor;
+
+    for (sensor = group->sensors; sensor; sensor = sensor->poll_next)
+	sensor_poll(sensor);
+
+    group->sysinfo->start_timer(group->timer, &group->period);
+}
+
+static sensor_poll_group_t *
+sensor_poll_group_get(sys_data_t *sysinfo, unsigned int poll_rate)
+{
+    sensor_poll_group_t *group;
+    int err;
+
+    for (group = poll_groups; group; group = group->next) {
+	if (group->sysinfo == sysinfo
+	    && group->period.tv_sec == poll_rate / 1000
+	    && group->period.tv_usec == (poll_rate % 1000) * 1000)
+	    return group;
+    }
+
+    group = malloc(sizeof(*group));
+    if (!group)
+	return NULL;
+    memset(group, 0, sizeof(*group));
+    group->sysinfo = sysinfo;
+    group->period.tv_sec = poll_rate / 1000;
+    group->period.tv_usec = (poll_rate % 1000) * 1000;
+    err = sysinfo->alloc_timer(sysinfo, sensor_poll_group_tick, group,
+			       &group->timer);
+    if (err) {
+	free(group);
+	return NULL;
+    }
+    sysinfo->start_timer(group->timer, &group->period);
+
+    group->next = poll_groups;
+    poll_groups = group;
+    return group;
+}
+
+/* Poll a single sensor now, the timers are handled by its group. */
 static void
 sensor_poll(void *cb_data)
 {
@@ -1526,7 +1644,7 @@ sensor_poll(void *cb_data)
 			     "Error getting sensor value (%2.2x,%d,%d): %s, %s",
 			     ipmi_mc_get_ipmb(mc), sensor->lun, sensor->num,
 			     strerror(err), errstr);
-	    goto out_restart;
+	    return;
 	}
 	
 	if (sensor->event_reading_code == IPMI_EVENT_READING_TYPE_THRESHOLD) {
@@ -1540,9 +1658,6 @@ sensor_poll(void *cb_data)
 		set_sensor_bit(mc, sensor,
 			       i, ((val >> i) & 1), 0, 0xff, 0xff, 1);
 	}
-
-      out_restart:
-	mc->sysinfo->start_timer(sensor->poll_timer, &sensor->poll_timer_time);
     }
 }
 
@@ -1558,6 +1673,7 @@ ipmi_mc_add_polled_sensor(lmc_data_t    *mc,
 			  void *cb_data)
 {
     sensor_t *sensor;
+    sensor_poll_group_t *group;
     int err;
 
     err = ipmi_mc_add_sensor(mc, lun, sens_num, type, event_reading_code, 0);
@@ -1567,18 +1683,16 @@ ipmi_mc_add_polled_sensor(lmc_data_t    *mc,
     sensor = mc->sensors[lun][sens_num];
 
     sensor->poll = poll;
-    sensor->poll_timer_time.tv_sec = poll_rate / 1000;
-    sensor->poll_timer_time.tv_usec = (poll_rate % 1000) * 1000;
     sensor->cb_data = cb_data;
-    
-    err = mc->sysinfo->alloc_timer(mc->sysinfo, sensor_poll, sensor,
-				   &sensor->poll_timer);
-    if (err) {
+
+    group = sensor_poll_group_get(mc->sysinfo, poll_rate);
+    if (!group) {
 	free_sensor(mc, sensor);
-	return err;
+	return ENOMEM;
     }
-
-    mc->sysinfo->start_timer(sensor->poll_timer, &sensor->poll_timer_time);
+    sensor->poll_group = group;
+    sensor->poll_next = group->sensors;
+    group->sensors = sensor;
 
     return 0;
 }
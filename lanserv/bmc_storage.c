@@ -70,31 +70,113 @@
 #define IPMI_SEL_SUPPORTS_RESERVE        (1 << 1)
 #define IPMI_SEL_SUPPORTS_GET_ALLOC_INFO (1 << 0)
 
+/*
+ * Record ids are normally handed out in sequence, so indexing the
+ * hash by the low bits of the id spreads them perfectly.
+ */
 static sel_entry_t *
 find_sel_event_by_recid(lmc_data_t  *mc,
-			uint16_t    record_id,
-			sel_entry_t **prev)
+			uint16_t    record_id)
 {
     sel_entry_t *entry;
-    sel_entry_t *p_entry = NULL;
 
-    entry = mc->sel.entries;
+    if (!mc->sel.hash)
+	return NULL;
+    entry = mc->sel.hash[record_id & mc->sel.hash_mask];
     while (entry) {
 	if (record_id == entry->record_id)
 	    break;
-	p_entry = entry;
-	entry = entry->next;
+	entry = entry->hash_next;
     }
-    if (prev)
-	*prev = p_entry;
     return entry;
 }
 
+static sel_entry_t *
+sel_entry_alloc(lmc_data_t *mc)
+{
+    sel_entry_t *e = mc->sel.free_entries;
+
+    if (e)
+	mc->sel.free_entries = e->next;
+    return e;
+}
+
+/* Add an entry to the end of the SEL and to the record id hash. */
+static void
+sel_entry_link(lmc_data_t *mc, sel_entry_t *e)
+{
+    sel_entry_t **bucket = &mc->sel.hash[e->record_id & mc->sel.hash_mask];
+
+    e->hash_next = *bucket;
+    *bucket = e;
+
+    e->next = NULL;
+    e->prev = mc->sel.last;
+    if (mc->sel.last)
+	mc->sel.last->next = e;
+    else
+	mc->sel.entries = e;
+    mc->sel.last = e;
+    mc->sel.count++;
+}
+
+/* Remove an entry from the SEL and return its slot to the free list. */
+static void
+sel_entry_free(lmc_data_t *mc, sel_entry_t *e)
+{
+    sel_entry_t **p = &mc->sel.hash[e->record_id & mc->sel.hash_mask];
+
+    while (*p != e)
+	p = &(*p)->hash_next;
+    *p = e->hash_next;
+
+    if (e->prev)
+	e->prev->next = e->next;
+    else
+	mc->sel.entries = e->next;
+    if (e->next)
+	e->next->prev = e->prev;
+    else
+	mc->sel.last = e->prev;
+    mc->sel.count--;
+
+    e->next = mc->sel.free_entries;
+    mc->sel.free_entries = e;
+}
+
+void
+free_mc_sel(lmc_data_t *mc)
+{
+    if (mc->sel.slots)
+	free(mc->sel.slots);
+    if (mc->sel.hash)
+	free(mc->sel.hash);
+    mc->sel.slots = NULL;
+    mc->sel.hash = NULL;
+    mc->sel.entries = NULL;
+    mc->sel.last = NULL;
+    mc->sel.free_entries = NULL;
+    mc->sel.count = 0;
+    if (mc->sel.journal) {
+	free_persist_journal(mc->sel.journal);
+	mc->sel.journal = NULL;
+    }
+}
+
+/*
+ * Compact a persistence journal once it has this many more records
+ * than there are live entries.
+ */
+#define JOURNAL_COMPACT_SLACK 64
+
+static void rewrite_sels(lmc_data_t *mc);
+
 static int
 handle_sel(const char *name, void *data, unsigned int len, void *cb_data)
 {
-    sel_entry_t *e, *n;
+    sel_entry_t *n;
     lmc_data_t *mc = cb_data;
+    uint16_t record_id;
 
     if (len != 16) {
 	mc->sysinfo->log(mc->sysinfo, INFO, NULL,
@@ -103,23 +185,26 @@ handle_sel(const char *name, void *data, unsigned int len, void *cb_data)
 	goto out;
     }
 
-    n = malloc(sizeof(*n));
-    if (!n)
-	return ENOMEM;
-
-    memcpy(n->data, data, 16);
-    n->record_id = n->data[0] | (n->data[1] << 8);
-    n->next = NULL;
+    record_id = ((unsigned char *) data)[0]
+	| (((unsigned char *) data)[1] << 8);
+    if (find_sel_event_by_recid(mc, record_id)) {
+	mc->sysinfo->log(mc->sysinfo, INFO, NULL,
+			 "Got duplicate SEL entry for %2.2x, name is %s",
+			 ipmi_mc_get_ipmb(mc), name);
+	goto out;
+    }
 
-    e = mc->sel.entries;
-    if (!e)
-	mc->sel.entries = n;
-    else {
-	while (e->next)
-	    e = e->next;
-	e->next = n;
+    n = sel_entry_alloc(mc);
+    if (!n) {
+	mc->sysinfo->log(mc->sysinfo, INFO, NULL,
+			 "SEL for %2.2x is full, dropping entry %s",
+			 ipmi_mc_get_ipmb(mc), name);
+	goto out;
     }
-    mc->sel.count++;
+
+    memcpy(n->data, data, 16);
+    n->record_id = record_id;
+    sel_entry_link(mc, n);
 
   out:
     return ITER_PERSIST_CONTINUE;
@@ -149,9 +234,35 @@ ipmi_mc_enable_sel(lmc_data_t    *mc,
 		   unsigned char flags)
 {
     persist_t *p;
+    unsigned int hash_size, replayed;
+    int i;
+
+    /* Record ids 0 and 0xffff are reserved, so that's all there can be. */
+    if (max_entries > 0xfffe)
+	max_entries = 0xfffe;
+    if (max_entries < 0)
+	max_entries = 0;
+
+    free_mc_sel(mc);
+    for (hash_size = 16; hash_size < (unsigned int) max_entries; )
+	hash_size <<= 1;
+    mc->sel.hash = calloc(hash_size, sizeof(*mc->sel.hash));
+    if (!mc->sel.hash)
+	return ENOMEM;
+    mc->sel.hash_mask = hash_size - 1;
+    if (max_entries > 0) {
+	mc->sel.slots = calloc(max_entries, sizeof(*mc->sel.slots));
+	if (!mc->sel.slots) {
+	    free(mc->sel.hash);
+	    mc->sel.hash = NULL;
+	    return ENOMEM;
+	}
+	for (i = max_entries - 1; i >= 0; i--) {
+	    mc->sel.slots[i].next = mc->sel.free_entries;
+	    mc->sel.free_entries = &mc->sel.slots[i];
+	}
+    }
 
-    mc->sel.entries = NULL;
-    mc->sel.count = 0;
     mc->sel.max_count = max_entries;
     mc->sel.last_add_time = 0;
     mc->sel.last_erase_time = 0;
@@ -164,10 +275,15 @@ ipmi_mc_enable_sel(lmc_data_t    *mc,
 	return 0;
 
     iterate_persist(p, mc, handle_sel, handle_sel_time);
+    replayed = persist_journal_replayed(p);
     free_persist(p);
+
+    /* Fold anything replayed from the journal into the main file. */
+    if (replayed)
+	rewrite_sels(mc);
     return 0;
 }
-		    
+
 static void
 rewrite_sels(lmc_data_t *mc)
 {
@@ -175,6 +291,10 @@ rewrite_sels(lmc_data_t *mc)
     sel_entry_t *e;
     int err;
 
+    if (!mc->sel.journal)
+	mc->sel.journal = alloc_persist_journal("sel.%2.2x",
+						ipmi_mc_get_ipmb(mc));
+
     p = alloc_persist("sel.%2.2x", ipmi_mc_get_ipmb(mc));
     if (!p) {
 	err = ENOMEM;
@@ -195,7 +315,10 @@ rewrite_sels(lmc_data_t *mc)
 	    goto out_err;
     }
 
-    err = write_persist(p);
+    if (mc->sel.journal)
+	err = persist_journal_compact(mc->sel.journal, p);
+    else
+	err = write_persist(p);
     if (err)
 	goto out_err;
     free_persist(p);
@@ -209,6 +332,37 @@ rewrite_sels(lmc_data_t *mc)
 	free_persist(p);
 }
 
+/*
+ * Record a single added or deleted SEL entry in the journal instead
+ * of rewriting the whole SEL.  The full rewrite is still done if the
+ * journal can't be written, and every so often to keep the journal
+ * from growing without bound.
+ */
+static void
+journal_sel_entry(lmc_data_t *mc, sel_entry_t *e, int deleted)
+{
+    persist_journal_t *j = mc->sel.journal;
+    int err;
+
+    if (!j) {
+	rewrite_sels(mc);
+	return;
+    }
+
+    if (deleted) {
+	err = persist_journal_del(j, "%d", e->record_id);
+    } else {
+	err = persist_journal_data(j, e->data, 16, "%d", e->record_id);
+	if (!err)
+	    err = persist_journal_int(j, mc->sel.last_add_time,
+				      "last_add_time");
+    }
+
+    if (err || (persist_journal_count(j)
+		> (unsigned int) mc->sel.count + JOURNAL_COMPACT_SLACK))
+	rewrite_sels(mc);
+}
+
 int
 ipmi_mc_add_to_sel(lmc_data_t    *mc,
 		   unsigned char record_type,
@@ -217,7 +371,7 @@ ipmi_mc_add_to_sel(lmc_data_t    *mc,
 {
     sel_entry_t    *e;
     struct timeval t;
-    uint16_t       start_record_id;
+    uint16_t       record_id;
 
     if (!(mc->device_support & IPMI_DEVID_SEL_DEVICE))
 	return ENOTSUP;
@@ -227,22 +381,20 @@ ipmi_mc_add_to_sel(lmc_data_t    *mc,
 	return EAGAIN;
     }
 
-    e = malloc(sizeof(*e));
-    if (!e)
-	return ENOMEM;
+    /*
+     * Take the next record id that isn't reserved or in use.  There
+     * are fewer entries than usable ids, so this always finds one,
+     * and it's normally the first one tried.
+     */
+    do {
+	record_id = mc->sel.next_entry++;
+    } while ((record_id == 0) || (record_id == 0xffff)
+	     || find_sel_event_by_recid(mc, record_id));
 
-    /* FIXME - this is inefficient, but simple */
-    e->record_id = mc->sel.next_entry;
-    mc->sel.next_entry++;
-    start_record_id = e->record_id;
-    while ((mc->sel.next_entry == 0)
-	   || find_sel_event_by_recid(mc, e->record_id, NULL))
-    {
-	e->record_id++;
-	if (e->record_id == start_record_id)
-	    return EAGAIN;
-	mc->sel.next_entry++;
-    }
+    e = sel_entry_alloc(mc);
+    if (!e)
+	return EAGAIN;
+    e->record_id = record_id;
 
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
 
@@ -255,32 +407,22 @@ ipmi_mc_add_to_sel(lmc_data_t    *mc,
 	memcpy(e->data+3, event, 13);
     }
 
-    e->next = NULL;
-    if (!mc->sel.entries) {
-	mc->sel.entries = e;
-    } else {
-	sel_entry_t *f = mc->sel.entries;
-	while (f->next)
-	    f = f->next;
-	f->next = e;
-    }
-
-    mc->sel.count++;
+    sel_entry_link(mc, e);
 
     mc->sel.last_add_time = t.tv_sec + mc->sel.time_offset;
 
     if (recid)
 	*recid = e->record_id;
 
-    rewrite_sels(mc);
+    journal_sel_entry(mc, e, 0);
 
     return 0;
 }
 
-void
-mc_new_event(lmc_data_t *mc,
-	     unsigned char record_type,
-	     unsigned char event[13])
+static void
+mc_new_event_now(lmc_data_t *mc,
+		 unsigned char record_type,
+		 unsigned char event[13])
 {
     unsigned int recid;
     int rv;
@@ -303,6 +445,48 @@ mc_new_event(lmc_data_t *mc,
     }
 }
 
+typedef struct mc_new_event_s
+{
+    unsigned char record_type;
+    unsigned char event[13];
+} mc_new_event_t;
+
+static void
+mc_new_event_deferred(lmc_data_t *mc, void *cb_data)
+{
+    mc_new_event_t *ev = cb_data;
+
+    mc_new_event_now(mc, ev->record_type, ev->event);
+    free(ev);
+}
+
+void
+mc_new_event(lmc_data_t *mc,
+	     unsigned char record_type,
+	     unsigned char event[13])
+{
+    sys_data_t *sys = mc->sysinfo;
+    mc_new_event_t *ev;
+
+    if (!sys->mc_run) {
+	mc_new_event_now(mc, record_type, event);
+	return;
+    }
+
+    /* The event may come from another MC, let mc handle it. */
+    ev = malloc(sizeof(*ev));
+    if (!ev) {
+	sys->log(sys, OS_ERROR, NULL, "Out of memory delivering event");
+	return;
+    }
+    ev->record_type = record_type;
+    memcpy(ev->event, event, 13);
+    if (sys->mc_run(sys, mc, mc_new_event_deferred, ev)) {
+	sys->log(sys, OS_ERROR, NULL, "Unable to deliver event");
+	free(ev);
+    }
+}
+
 static void
 handle_get_sel_info(lmc_data_t    *mc,
 		    msg_t         *msg,
@@ -421,14 +605,9 @@ handle_get_sel_entry(lmc_data_t    *mc,
     if (record_id == 0) {
 	entry = mc->sel.entries;
     } else if (record_id == 0xffff) {
-	entry = mc->sel.entries;
-	if (entry) {
-	    while (entry->next) {
-		entry = entry->next;
-	    }
-	}
+	entry = mc->sel.last;
     } else {
-	entry = find_sel_event_by_recid(mc, record_id, NULL);
+	entry = find_sel_event_by_recid(mc, record_id);
     }
 
     if (entry == NULL) {
@@ -489,7 +668,7 @@ handle_delete_sel_entry(lmc_data_t    *mc,
 			void          *cb_data)
 {
     uint16_t    record_id;
-    sel_entry_t *entry, *p_entry;
+    sel_entry_t *entry;
 
     if (!(mc->device_support & IPMI_DEVID_SEL_DEVICE)) {
 	handle_invalid_cmd(mc, rdata, rdata_len);
@@ -518,18 +697,10 @@ handle_delete_sel_entry(lmc_data_t    *mc,
 
     if (record_id == 0) {
 	entry = mc->sel.entries;
-	p_entry = NULL;
     } else if (record_id == 0xffff) {
-	entry = mc->sel.entries;
-	p_entry = NULL;
-	if (entry) {
-	    while (entry->next) {
-		p_entry = entry;
-		entry = entry->next;
-	    }
-	}
+	entry = mc->sel.last;
     } else {
-	entry = find_sel_event_by_recid(mc, record_id, &p_entry);
+	entry = find_sel_event_by_recid(mc, record_id);
     }
     if (!entry) {
 	rdata[0] = IPMI_NOT_PRESENT_CC;
@@ -537,11 +708,6 @@ handle_delete_sel_entry(lmc_data_t    *mc,
 	return;
     }
 
-    if (p_entry)
-	p_entry->next = entry->next;
-    else
-	mc->sel.entries = entry->next;
-
     /* Clear the overflow flag. */
     mc->sel.flags &= ~0x80;
 
@@ -549,10 +715,9 @@ handle_delete_sel_entry(lmc_data_t    *mc,
     ipmi_set_uint16(rdata+1, entry->record_id);
     *rdata_len = 3;
 
-    mc->sel.count--;
-    free(entry);
-
-    rewrite_sels(mc);
+    /* The slot isn't reused until the next add, so entry stays valid. */
+    sel_entry_free(mc, entry);
+    journal_sel_entry(mc, entry, 1);
 }
 
 static void
@@ -603,13 +768,9 @@ handle_clear_sel(lmc_data_t    *mc,
 
     rdata[1] = 1;
     if (op == 0xaa) {
-	entry = mc->sel.entries;
-	mc->sel.entries = NULL;
-	mc->sel.count = 0;
-	while (entry) {
+	for (entry = mc->sel.entries; entry; entry = n_entry) {
 	    n_entry = entry->next;
-	    free(entry);
-	    entry = n_entry;
+	    sel_entry_free(mc, entry);
 	}
     }
 
@@ -700,20 +861,75 @@ find_sdr_by_recid(sdrs_t     *sdrs,
 		  sdr_t      **prev)
 {
     sdr_t *entry;
-    sdr_t *p_entry = NULL;
 
-    entry = sdrs->sdrs;
-    while (entry) {
-	if (record_id == entry->record_id)
-	    break;
-	p_entry = entry;
-	entry = entry->next;
+    if (record_id < sdrs->index_size) {
+	entry = sdrs->index[record_id];
+    } else {
+	/*
+	 * Only possible if growing the index failed, the entries that
+	 * didn't fit are only on the list.
+	 */
+	for (entry = sdrs->sdrs; entry; entry = entry->next) {
+	    if (record_id == entry->record_id)
+		break;
+	}
     }
     if (prev)
-	*prev = p_entry;
+	*prev = entry ? entry->prev : NULL;
     return entry;
 }
 
+static void
+sdr_index_add(sdrs_t *sdrs, sdr_t *entry)
+{
+    if (entry->record_id >= sdrs->index_size) {
+	unsigned int new_size = sdrs->index_size ? sdrs->index_size : 64;
+	sdr_t        **new_index;
+
+	while (new_size <= entry->record_id)
+	    new_size <<= 1;
+	new_index = realloc(sdrs->index, new_size * sizeof(*new_index));
+	if (!new_index)
+	    return; /* find_sdr_by_recid() will search the list. */
+	memset(new_index + sdrs->index_size, 0,
+	       (new_size - sdrs->index_size) * sizeof(*new_index));
+	sdrs->index = new_index;
+	sdrs->index_size = new_size;
+    }
+    sdrs->index[entry->record_id] = entry;
+}
+
+/* Put an entry on the end of the list and in the index. */
+static void
+sdr_link(sdrs_t *sdrs, sdr_t *entry)
+{
+    entry->next = NULL;
+    entry->prev = sdrs->last;
+    if (sdrs->last)
+	sdrs->last->next = entry;
+    else
+	sdrs->sdrs = entry;
+    sdrs->last = entry;
+    sdr_index_add(sdrs, entry);
+    sdrs->sdr_count++;
+}
+
+static void
+sdr_unlink(sdrs_t *sdrs, sdr_t *entry)
+{
+    if (entry->prev)
+	entry->prev->next = entry->next;
+    else
+	sdrs->sdrs = entry->next;
+    if (entry->next)
+	entry->next->prev = entry->prev;
+    else
+	sdrs->last = entry->prev;
+    if (entry->record_id < sdrs->index_size)
+	sdrs->index[entry->record_id] = NULL;
+    sdrs->sdr_count--;
+}
+
 sdr_t *
 new_sdr_entry(sdrs_t *sdrs, unsigned char length)
 {
@@ -729,13 +945,10 @@ new_sdr_entry(sdrs_t *sdrs, unsigned char length)
 	    return NULL;
     }
 
-    entry = malloc(sizeof(*entry));
+    entry = malloc(sizeof(*entry) + length + 6);
     if (!entry)
 	return NULL;
-
-    entry->data = malloc(length + 6);
-    if (!entry->data)
-	return NULL;
+    entry->data = (unsigned char *) (entry + 1);
 
     entry->record_id = sdrs->next_entry;
 
@@ -745,9 +958,21 @@ new_sdr_entry(sdrs_t *sdrs, unsigned char length)
 
     entry->length = length + 6;
     entry->next = NULL;
+    entry->prev = NULL;
     return entry;
 }
 
+static const char *
+sdrs_persist_type(lmc_data_t *mc, sdrs_t *sdrs)
+{
+    static const char *device_types[4] = { "device0", "device1",
+					   "device2", "device3" };
+
+    if (sdrs == &mc->main_sdrs)
+	return "main";
+    return device_types[sdrs - mc->device_sdrs];
+}
+
 static void
 rewrite_sdrs(lmc_data_t *mc, sdrs_t *sdrs)
 {
@@ -755,7 +980,13 @@ rewrite_sdrs(lmc_data_t *mc, sdrs_t *sdrs)
     sdr_t *sdr;
     int err;
 
-    p = alloc_persist("sdr.%2.2x.main", ipmi_mc_get_ipmb(mc));
+    if (!sdrs->journal)
+	sdrs->journal = alloc_persist_journal("sdr.%2.2x.%s",
+					      ipmi_mc_get_ipmb(mc),
+					      sdrs_persist_type(mc, sdrs));
+
+    p = alloc_persist("sdr.%2.2x.%s", ipmi_mc_get_ipmb(mc),
+		      sdrs_persist_type(mc, sdrs));
     if (!p) {
 	err = ENOMEM;
 	goto out_err;
@@ -776,7 +1007,10 @@ rewrite_sdrs(lmc_data_t *mc, sdrs_t *sdrs)
 	    goto out_err;
     }
 
-    err = write_persist(p);
+    if (sdrs->journal)
+	err = persist_journal_compact(sdrs->journal, p);
+    else
+	err = write_persist(p);
     if (err)
 	goto out_err;
     free_persist(p);
@@ -790,57 +1024,69 @@ rewrite_sdrs(lmc_data_t *mc, sdrs_t *sdrs)
 	free_persist(p);
 }
 
+/* Like journal_sel_entry(), but for an SDR repository. */
+static void
+journal_sdr_entry(lmc_data_t *mc, sdrs_t *sdrs, sdr_t *sdr, int deleted)
+{
+    persist_journal_t *j = sdrs->journal;
+    unsigned int recid = ipmi_get_uint16(sdr->data);
+    int err;
+
+    if (!j) {
+	rewrite_sdrs(mc, sdrs);
+	return;
+    }
+
+    if (deleted) {
+	err = persist_journal_del(j, "%d", recid);
+	if (!err)
+	    err = persist_journal_int(j, sdrs->last_erase_time,
+				      "last_erase_time");
+    } else {
+	err = persist_journal_data(j, sdr->data, sdr->length, "%d", recid);
+	if (!err)
+	    err = persist_journal_int(j, sdrs->last_add_time,
+				      "last_add_time");
+    }
+
+    if (err || (persist_journal_count(j)
+		> (unsigned int) sdrs->sdr_count + JOURNAL_COMPACT_SLACK))
+	rewrite_sdrs(mc, sdrs);
+}
+
 void
 add_sdr_entry(lmc_data_t *mc, sdrs_t *sdrs, sdr_t *entry)
 {
-    sdr_t          *p;
     struct timeval t;
 
-    entry->next = NULL;
-    p = sdrs->sdrs;
-    if (!p)
-	sdrs->sdrs = entry;
-    else {
-	while (p->next)
-	    p = p->next;
-	p->next = entry;
-    }
+    sdr_link(sdrs, entry);
 
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
     sdrs->last_add_time = t.tv_sec + mc->main_sdrs.time_offset;
-    sdrs->sdr_count++;
 
-    rewrite_sdrs(mc, sdrs);
+    journal_sdr_entry(mc, sdrs, entry, 0);
 }
 
 static void
 free_sdr(sdr_t *sdr)
 {
-    free(sdr->data);
     free(sdr);
 }
 
 static int
 handle_sdr(const char *name, void *data, unsigned int len, void *cb_data)
 {
-    sdr_t *sdr, *p;
+    sdr_t *sdr;
     sdrs_t *sdrs = cb_data;
 
-    sdr = new_sdr_entry(sdrs, len);
+    /* The stored record includes the 6 bytes new_sdr_entry() adds. */
+    if (len < 6 || len > 255 + 6)
+	return ITER_PERSIST_CONTINUE;
+    sdr = new_sdr_entry(sdrs, len - 6);
     if (!sdr)
 	return ENOMEM;
     memcpy(sdr->data, data, len);
-
-    sdr->next = NULL;
-    p = sdrs->sdrs;
-    if (!p)
-	sdrs->sdrs = sdr;
-    else {
-	while (p->next)
-	    p = p->next;
-	p->next = sdr;
-    }
-    sdrs->sdr_count++;
+    sdr_link(sdrs, sdr);
 
     return ITER_PERSIST_CONTINUE;
 }
@@ -861,13 +1107,19 @@ void
 read_mc_sdrs(lmc_data_t *mc, sdrs_t *sdrs, const char *sdrtype)
 {
     persist_t *p;
+    unsigned int replayed;
 
     p = read_persist("sdr.%2.2x.%s", ipmi_mc_get_ipmb(mc), sdrtype);
     if (!p)
 	return;
 
     iterate_persist(p, sdrs, handle_sdr, handle_sdr_time);
+    replayed = persist_journal_replayed(p);
     free_persist(p);
+
+    /* Fold anything replayed from the journal into the main file. */
+    if (replayed)
+	rewrite_sdrs(mc, sdrs);
 }
 
 int
@@ -914,10 +1166,10 @@ ipmi_mc_add_device_sdr(lmc_data_t    *mc,
     if (!entry)
 	return ENOMEM;
 
-    add_sdr_entry(mc, &mc->device_sdrs[lun], entry);
-
     memcpy(entry->data+2, data+2, data_len-2);
 
+    add_sdr_entry(mc, &mc->device_sdrs[lun], entry);
+
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
     mc->sensor_population_change_time = t.tv_sec + mc->main_sdrs.time_offset;
     mc->lun_has_sensors[lun] = 1;
@@ -1048,12 +1300,7 @@ handle_get_sdr(lmc_data_t    *mc,
     if (record_id == 0) {
 	entry = mc->main_sdrs.sdrs;
     } else if (record_id == 0xffff) {
-	entry = mc->main_sdrs.sdrs;
-	if (entry) {
-	    while (entry->next) {
-		entry = entry->next;
-	    }
-	}
+	entry = mc->main_sdrs.last;
     } else {
 	entry = find_sdr_by_recid(&mc->main_sdrs, record_id, NULL);
     }
@@ -1130,10 +1377,10 @@ handle_add_sdr(lmc_data_t    *mc,
 	*rdata_len = 1;
 	return;
     }
-    add_sdr_entry(mc, &mc->main_sdrs, entry);
-
     memcpy(entry->data+2, msg->data+2, entry->length-2);
 
+    add_sdr_entry(mc, &mc->main_sdrs, entry);
+
     rdata[0] = 0;
     ipmi_set_uint16(rdata+1, entry->record_id);
     *rdata_len = 3;
@@ -1269,7 +1516,7 @@ handle_delete_sdr(lmc_data_t    *mc,
 		  void          *cb_data)
 {
     uint16_t       record_id;
-    sdr_t          *entry, *p_entry;
+    sdr_t          *entry;
     struct timeval t;
 
     if (!(mc->device_support & IPMI_DEVID_SDR_REPOSITORY_DEV)) {
@@ -1294,18 +1541,10 @@ handle_delete_sdr(lmc_data_t    *mc,
 
     if (record_id == 0) {
 	entry = mc->main_sdrs.sdrs;
-	p_entry = NULL;
     } else if (record_id == 0xffff) {
-	entry = mc->main_sdrs.sdrs;
-	p_entry = NULL;
-	if (entry) {
-	    while (entry->next) {
-		p_entry = entry;
-		entry = entry->next;
-	    }
-	}
+	entry = mc->main_sdrs.last;
     } else {
-	entry = find_sdr_by_recid(&mc->main_sdrs, record_id, &p_entry);
+	entry = find_sdr_by_recid(&mc->main_sdrs, record_id, NULL);
     }
     if (!entry) {
 	rdata[0] = IPMI_NOT_PRESENT_CC;
@@ -1313,21 +1552,16 @@ handle_delete_sdr(lmc_data_t    *mc,
 	return;
     }
 
-    if (p_entry)
-	p_entry->next = entry->next;
-    else
-	mc->main_sdrs.sdrs = entry->next;
+    sdr_unlink(&mc->main_sdrs, entry);
 
     rdata[0] = 0;
     ipmi_set_uint16(rdata+1, entry->record_id);
     *rdata_len = 3;
 
-    free_sdr(entry);
-
     mc->emu->sysinfo->get_monotonic_time(mc->emu->sysinfo, &t);
     mc->main_sdrs.last_erase_time = t.tv_sec + mc->main_sdrs.time_offset;
-    mc->main_sdrs.sdr_count--;
-    rewrite_sdrs(mc, &mc->main_sdrs);
+    journal_sdr_entry(mc, &mc->main_sdrs, entry, 1);
+    free_sdr(entry);
 }
 
 static void
@@ -1378,11 +1612,10 @@ handle_clear_sdr_repository(lmc_data_t    *mc,
 
     rdata[1] = 1;
     if (op == 0) {
-	entry = mc->main_sdrs.sdrs;
-	while (entry) {
+	for (entry = mc->main_sdrs.sdrs; entry; entry = n_entry) {
 	    n_entry = entry->next;
+	    sdr_unlink(&mc->main_sdrs, entry);
 	    free_sdr(entry);
-	    entry = n_entry;
 	}
     }
 
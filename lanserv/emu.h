@@ -77,6 +77,35 @@ void ipmi_emu_handle_msg(emu_data_t    *emu,
 			 unsigned char *rdata,
 			 unsigned int  *rdata_len);
 
+/*
+ * The same as ipmi_emu_handle_msg(), split for users that run each
+ * MC in its own context.  ipmi_emu_get_msg_mc() returns the MC that
+ * handles the message, which is not srcmc for a bridged Send Message.
+ * ipmi_emu_handle_msg_start() must be passed that MC and run in its
+ * context.  If it returns a bridged response in rbridged,
+ * ipmi_emu_handle_msg_finish() must then be called in srcmc's context
+ * with rbridged and rints_on to queue it and fill in the response;
+ * otherwise the response is already complete.  Nothing in the target
+ * MC is looked at again after ipmi_emu_handle_msg_start().
+ */
+lmc_data_t *ipmi_emu_get_msg_mc(emu_data_t *emu, lmc_data_t *srcmc,
+				msg_t *msg);
+void ipmi_emu_handle_msg_start(emu_data_t    *emu,
+			       lmc_data_t    *srcmc,
+			       lmc_data_t    *mc,
+			       msg_t         *msg,
+			       unsigned char *rdata,
+			       unsigned int  *rdata_len,
+			       msg_t         **rbridged,
+			       int           *rints_on);
+void ipmi_emu_handle_msg_finish(emu_data_t    *emu,
+				lmc_data_t    *srcmc,
+				msg_t         *msg,
+				msg_t         *rbridged,
+				int           ints_on,
+				unsigned char *rdata,
+				unsigned int  *rdata_len);
+
 #define IPMI_MC_DYNAMIC_SENSOR_POPULATION	(1 << 0)
 #define IPMI_MC_PERSIST_SDR			(1 << 1)
 
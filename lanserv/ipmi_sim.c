@@ -74,6 +74,7 @@
 #include <termios.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <pthread.h>
 
 #include <config.h>
 
@@ -103,6 +104,7 @@ static char *command_string = NULL;
 static char *command_file = NULL;
 static int debug = 0;
 static int nostdio = 0;
+static int num_workers = 0;
 
 /*
  * Keep track of open sockets so we can close them on exec().
@@ -190,12 +192,290 @@ typedef struct sim_addr_s
     int             xmit_fd;
 } sim_addr_t;
 
+/*
+ * With worker threads (-w), the work for each MC is queued per MC and
+ * run by a pool of threads.  Only one thread runs a given MC at a
+ * time, so each MC sees its work in order, but different MCs run in
+ * parallel.  An MC's state, including its channels and their LAN and
+ * serial sessions, is only touched by the thread running that MC.  So
+ * the main loop only reads incoming LAN and serial data and queues it
+ * on the MC that owns the channel, and responses are queued back to
+ * that MC to send.
+ *
+ * Everything else the main loop does (the console, timers, ticks, I/O
+ * handlers, adding MCs) can touch any MC, so it holds sim_state_lock
+ * for writing, which waits for the running work to finish and keeps
+ * the workers out.  The workers hold it for reading.
+ */
+static pthread_rwlock_t sim_state_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* Keeps new readers out while the main loop waits for the lock. */
+static pthread_mutex_t sim_state_gate = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int sim_state_depth;
+
+static void
+sim_lock(void)
+{
+    if (!num_workers)
+	return;
+    /* The main loop can nest, when sleeping in a command for instance. */
+    if (sim_state_depth++ > 0)
+	return;
+    pthread_mutex_lock(&sim_state_gate);
+    pthread_rwlock_wrlock(&sim_state_lock);
+    pthread_mutex_unlock(&sim_state_gate);
+}
+
+static void
+sim_unlock(void)
+{
+    if (!num_workers)
+	return;
+    if (--sim_state_depth > 0)
+	return;
+    pthread_rwlock_unlock(&sim_state_lock);
+}
+
+typedef struct sim_work_s sim_work_t;
+struct sim_work_s
+{
+    void (*handler)(sim_work_t *work, lmc_data_t *mc);
+    sim_work_t *next;
+};
+
+typedef struct sim_mc_queue_s sim_mc_queue_t;
+struct sim_mc_queue_s
+{
+    lmc_data_t *mc;
+    sim_work_t *head;
+    sim_work_t *tail;
+    /* Set while on the run queue or being run by a worker. */
+    int scheduled;
+    sim_mc_queue_t *next_run;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    sim_mc_queue_t queues[IPMI_MAX_MCS];
+    sim_mc_queue_t *run_head;
+    sim_mc_queue_t *run_tail;
+    /* The MC a worker is currently running. */
+    pthread_key_t cur_mc;
+} sim_workers = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+typedef struct sim_msg_work_s
+{
+    sim_work_t work;
+    channel_t *chan;
+    /* The MC that handles msg, picked when it was queued. */
+    lmc_data_t *mc;
+    msg_t *msg;
+    msg_t *rbridged;
+    int ints_on;
+    unsigned char rsp[36];
+    unsigned int rsp_len;
+} sim_msg_work_t;
+
+typedef struct sim_call_work_s
+{
+    sim_work_t work;
+    void (*func)(lmc_data_t *mc, void *cb_data);
+    void *cb_data;
+} sim_call_work_t;
+
+static void
+sim_queue_work(lmc_data_t *mc, sim_work_t *work)
+{
+    sim_mc_queue_t *q = &sim_workers.queues[ipmi_mc_get_ipmb(mc)];
+
+    work->next = NULL;
+    pthread_mutex_lock(&sim_workers.lock);
+    q->mc = mc;
+    if (q->tail)
+	q->tail->next = work;
+    else
+	q->head = work;
+    q->tail = work;
+    if (!q->scheduled) {
+	q->scheduled = 1;
+	q->next_run = NULL;
+	if (sim_workers.run_tail)
+	    sim_workers.run_tail->next_run = q;
+	else
+	    sim_workers.run_head = q;
+	sim_workers.run_tail = q;
+	pthread_cond_signal(&sim_workers.cond);
+    }
+    pthread_mutex_unlock(&sim_workers.lock);
+}
+
+static void *
+sim_worker(void *cb_data)
+{
+    sim_mc_queue_t *q;
+    sim_work_t *work;
+    lmc_data_t *mc;
+
+    pthread_mutex_lock(&sim_workers.lock);
+    for (;;) {
+	while (!sim_workers.run_head)
+	    pthread_cond_wait(&sim_workers.cond, &sim_workers.lock);
+	q = sim_workers.run_head;
+	sim_workers.run_head = q->next_run;
+	if (!sim_workers.run_head)
+	    sim_workers.run_tail = NULL;
+	mc = q->mc;
+	work = q->head;
+	q->head = work->next;
+	if (!q->head)
+	    q->tail = NULL;
+	pthread_mutex_unlock(&sim_workers.lock);
+
+	pthread_mutex_lock(&sim_state_gate);
+	pthread_rwlock_rdlock(&sim_state_lock);
+	pthread_mutex_unlock(&sim_state_gate);
+	pthread_setspecific(sim_workers.cur_mc, mc);
+	work->handler(work, mc);
+	pthread_setspecific(sim_workers.cur_mc, NULL);
+	pthread_rwlock_unlock(&sim_state_lock);
+
+	/*
+	 * Go to the back of the run queue so a busy MC does not hold
+	 * a worker while other MCs wait.
+	 */
+	pthread_mutex_lock(&sim_workers.lock);
+	if (q->head) {
+	    q->next_run = NULL;
+	    if (sim_workers.run_tail)
+		sim_workers.run_tail->next_run = q;
+	    else
+		sim_workers.run_head = q;
+	    sim_workers.run_tail = q;
+	    pthread_cond_signal(&sim_workers.cond);
+	} else {
+	    q->scheduled = 0;
+	}
+    }
+    return NULL;
+}
+
+static void
+sim_msg_respond(sim_work_t *work, lmc_data_t *mc)
+{
+    sim_msg_work_t *w = (sim_msg_work_t *) work;
+
+    ipmi_handle_smi_rsp(w->chan, w->msg, w->rsp, w->rsp_len);
+    free(w);
+}
+
+static void
+sim_msg_finish(sim_work_t *work, lmc_data_t *mc)
+{
+    sim_msg_work_t *w = (sim_msg_work_t *) work;
+    misc_data_t *data = w->chan->oem.user_data;
+
+    ipmi_emu_handle_msg_finish(data->emu, mc, w->msg, w->rbridged,
+			       w->ints_on, w->rsp, &w->rsp_len);
+    sim_msg_respond(work, mc);
+}
+
+static void
+sim_msg_handle(sim_work_t *work, lmc_data_t *mc)
+{
+    sim_msg_work_t *w = (sim_msg_work_t *) work;
+    misc_data_t *data = w->chan->oem.user_data;
+
+    ipmi_emu_handle_msg_start(data->emu, w->chan->mc, w->mc, w->msg,
+			      w->rsp, &w->rsp_len, &w->rbridged, &w->ints_on);
+    if (w->rbridged)
+	/* The bridged response goes into the sender's receive queue. */
+	w->work.handler = sim_msg_finish;
+    else
+	w->work.handler = sim_msg_respond;
+
+    /* The rest runs as the MC that owns the channel. */
+    if (w->chan->mc == mc)
+	w->work.handler(work, mc);
+    else
+	sim_queue_work(w->chan->mc, &w->work);
+}
+
+static void
+sim_call_handle(sim_work_t *work, lmc_data_t *mc)
+{
+    sim_call_work_t *w = (sim_call_work_t *) work;
+
+    w->func(mc, w->cb_data);
+    free(w);
+}
+
+static int
+sim_mc_run(sys_data_t *sys, lmc_data_t *mc,
+	   void (*func)(lmc_data_t *mc, void *cb_data), void *cb_data)
+{
+    lmc_data_t *cur = pthread_getspecific(sim_workers.cur_mc);
+    sim_call_work_t *w;
+
+    /* The main loop (cur is NULL) may touch any MC. */
+    if (!cur || cur == mc) {
+	func(mc, cb_data);
+	return 0;
+    }
+
+    w = malloc(sizeof(*w));
+    if (!w)
+	return ENOMEM;
+    w->work.handler = sim_call_handle;
+    w->func = func;
+    w->cb_data = cb_data;
+    sim_queue_work(mc, &w->work);
+    return 0;
+}
+
+static int
+sim_start_workers(misc_data_t *data)
+{
+    pthread_t thread;
+    int i, err;
+
+    err = pthread_key_create(&sim_workers.cur_mc, NULL);
+    if (err)
+	return err;
+
+    for (i = 0; i < num_workers; i++) {
+	err = pthread_create(&thread, NULL, sim_worker, NULL);
+	if (err)
+	    return err;
+	pthread_detach(thread);
+    }
+
+    data->sys->mc_run = sim_mc_run;
+    return 0;
+}
+
 static int
 smi_send(channel_t *chan, msg_t *msg)
 {
     misc_data_t      *data = chan->oem.user_data;
     unsigned char    msgd[36];
     unsigned int     msgd_len = sizeof(msgd);
+    sim_msg_work_t   *w;
+
+    if (num_workers) {
+	w = malloc(sizeof(*w));
+	if (!w)
+	    return ENOMEM;
+	w->work.handler = sim_msg_handle;
+	w->chan = chan;
+	w->mc = ipmi_emu_get_msg_mc(data->emu, chan->mc, msg);
+	w->msg = msg;
+	w->rsp_len = sizeof(w->rsp);
+	sim_queue_work(w->mc, &w->work);
+	return 0;
+    }
 
     ipmi_emu_handle_msg(data->emu, chan->mc, msg, msgd, &msgd_len);
 
@@ -261,6 +541,40 @@ lan_send(lanserv_data_t *lan,
     }
 }
 
+typedef struct sim_lan_work_s
+{
+    sim_work_t work;
+    lanserv_data_t *lan;
+    sim_addr_t l;
+    int len;
+    unsigned char msgd[256];
+} sim_lan_work_t;
+
+static void
+lan_handle_data(lanserv_data_t *lan, unsigned char *msgd, int len,
+		sim_addr_t *l)
+{
+    /* Check the message class. */
+    switch (msgd[3]) {
+	case 6:
+	    handle_asf(lan, msgd, len, l, sizeof(*l));
+	    break;
+
+	case 7:
+	    ipmi_handle_lan_msg(lan, msgd, len, l, sizeof(*l));
+	    break;
+    }
+}
+
+static void
+sim_lan_handle(sim_work_t *work, lmc_data_t *mc)
+{
+    sim_lan_work_t *w = (sim_lan_work_t *) work;
+
+    lan_handle_data(w->lan, w->msgd, w->len, &w->l);
+    free(w);
+}
+
 static void
 lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
 {
@@ -268,6 +582,7 @@ lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
     int           len;
     sim_addr_t    l;
     unsigned char msgd[256];
+    sim_lan_work_t *w;
 
     l.addr_len = sizeof(l.addr);
     len = recvfrom(lan_fd, msgd, sizeof(msgd), 0,
@@ -294,16 +609,26 @@ lan_data_ready(int lan_fd, void *cb_data, os_hnd_fd_id_t *id)
     if (msgd[0] != 6)
 	goto out; /* Invalid version */
 
-    /* Check the message class. */
-    switch (msgd[3]) {
-	case 6:
-	    handle_asf(lan, msgd, len, &l, sizeof(l));
-	    break;
-
-	case 7:
-	    ipmi_handle_lan_msg(lan, msgd, len, &l, sizeof(l));
-	    break;
+    if (num_workers) {
+	/*
+	 * The session code runs as the MC that owns the channel, so
+	 * the main loop does not have to lock everything out for it.
+	 */
+	w = malloc(sizeof(*w));
+	if (w) {
+	    w->work.handler = sim_lan_handle;
+	    w->lan = lan;
+	    w->l = l;
+	    w->len = len;
+	    memcpy(w->msgd, msgd, len);
+	    sim_queue_work(lan->channel.mc, &w->work);
+	    goto out;
+	}
     }
+
+    sim_lock();
+    lan_handle_data(lan, msgd, len, &l);
+    sim_unlock();
  out:
     return;
 }
@@ -409,27 +734,73 @@ ser_send(serserv_data_t *ser, unsigned char *data, unsigned int data_len)
     }
 }
 
+typedef struct sim_ser_work_s
+{
+    sim_work_t work;
+    serserv_data_t *ser;
+    int fd;
+    int len;
+    unsigned char msgd[256];
+} sim_ser_work_t;
+
+/* A zero len means the other end went away. */
+static void
+ser_handle_data(serserv_data_t *ser, int fd, unsigned char *msgd, int len)
+{
+    if (len > 0) {
+	serserv_handle_data(ser, msgd, len);
+	return;
+    }
+
+    if (ser->codec->disconnected)
+	ser->codec->disconnected(ser);
+    close(fd);
+    ser->con_fd = -1;
+}
+
+static void
+sim_ser_handle(sim_work_t *work, lmc_data_t *mc)
+{
+    sim_ser_work_t *w = (sim_ser_work_t *) work;
+
+    ser_handle_data(w->ser, w->fd, w->msgd, w->len);
+    free(w);
+}
+
 static void
 ser_data_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
 {
     serserv_data_t *ser = cb_data;
     int           len;
     unsigned char msgd[256];
+    sim_ser_work_t *w;
 
     len = read(fd, msgd, sizeof(msgd));
     if (len <= 0) {
 	if ((len < 0) && (errno == EINTR))
 	    return;
 
-	if (ser->codec->disconnected)
-	    ser->codec->disconnected(ser);
 	ser->os_hnd->remove_fd_to_wait_for(ser->os_hnd, id);
-	close(fd);
-	ser->con_fd = -1;
-	return;
+	len = 0;
     }
 
-    serserv_handle_data(ser, msgd, len);
+    if (num_workers) {
+	/* Like LAN, this runs as the MC that owns the channel. */
+	w = malloc(sizeof(*w));
+	if (w) {
+	    w->work.handler = sim_ser_handle;
+	    w->ser = ser;
+	    w->fd = fd;
+	    w->len = len;
+	    memcpy(w->msgd, msgd, len);
+	    sim_queue_work(ser->channel.mc, &w->work);
+	    return;
+	}
+    }
+
+    sim_lock();
+    ser_handle_data(ser, fd, msgd, len);
+    sim_unlock();
 }
 
 static void
@@ -449,7 +820,9 @@ ser_bind_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
 	exit(1);
     }
 
+    sim_lock();
     if (ser->con_fd >= 0) {
+	sim_unlock();
 	close(rv);
 	return;
     }
@@ -470,6 +843,7 @@ ser_bind_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
 	if (ser->codec->connected)
 	    ser->codec->connected(ser);
     }
+    sim_unlock();
 }
 
 static int
@@ -567,6 +941,9 @@ ser_channel_init(void *info, channel_t *chan)
     return err;
 }
 
+/* Workers for different MCs may log at the same time. */
+static pthread_mutex_t isim_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void
 isim_log(sys_data_t *sys, int logtype, msg_t *msg, const char *format,
 	 va_list ap, int len)
@@ -605,6 +982,7 @@ isim_log(sys_data_t *sys, int logtype, msg_t *msg, const char *format,
 	vsprintf(str, format, ap);
     }
 
+    pthread_mutex_lock(&isim_log_lock);
     con = data->consoles;
     while (con) {
 	con->out.printf(&con->out, "%s", str);
@@ -617,6 +995,7 @@ isim_log(sys_data_t *sys, int logtype, msg_t *msg, const char *format,
     else
 	syslog(LOG_NOTICE, "%s", str);
 #endif
+    pthread_mutex_unlock(&isim_log_lock);
     free(str);
 }
 
@@ -688,6 +1067,15 @@ static struct poptOption poptOpts[]=
 	"state directory",
 	""
     },
+    {
+	"workers",
+	'w',
+	POPT_ARG_INT,
+	&num_workers,
+	'w',
+	"number of threads handling MC messages, 0 to handle them in the main loop",
+	""
+    },
     {
 	"debug",
 	'd',
@@ -892,6 +1280,7 @@ user_data_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
     int         count;
 
     count = read(fd, rc, sizeof(rc));
+    sim_lock();
     if (count == 0)
 	goto closeit;
     while (count > 0) {
@@ -900,11 +1289,13 @@ user_data_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
 	c++;
 	count--;
     }
+    sim_unlock();
     return;
 
  closeit:
     if (info->shutdown_on_close) {
 	ipmi_emu_shutdown(info->data->emu);
+	sim_unlock();
 	return;
     }
 
@@ -917,6 +1308,7 @@ user_data_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
     if (info->next)
 	info->next->prev = info->prev;
     free(info);
+    sim_unlock();
 }
 
 static void
@@ -973,11 +1365,13 @@ console_bind_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
 	return;
     }
 
+    sim_lock();
     newcon->next = misc->consoles;
     if (newcon->next)
 	newcon->next->prev = newcon;
     newcon->prev = NULL;
     misc->consoles = newcon;
+    sim_unlock();
 
     err = write(rv, telnet_init_seq, sizeof(telnet_init_seq));
     err = write(rv, "> ", 2);
@@ -1056,21 +1450,30 @@ static void
 io_read_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
 {
     ipmi_io_t *io = cb_data;
+
+    sim_lock();
     io->read_cb(fd, io->cb_data);
+    sim_unlock();
 }
 
 static void
 io_write_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
 {
     ipmi_io_t *io = cb_data;
+
+    sim_lock();
     io->write_cb(fd, io->cb_data);
+    sim_unlock();
 }
 
 static void
 io_except_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
 {
     ipmi_io_t *io = cb_data;
+
+    sim_lock();
     io->except_cb(fd, io->cb_data);
+    sim_unlock();
 }
 
 static void
@@ -1131,6 +1534,13 @@ struct ipmi_timer_s
     misc_data_t *data;
     void (*cb)(void *cb_data);
     void *cb_data;
+    /*
+     * A worker may stop or restart the timer after it has expired but
+     * before timer_cb gets the lock, so timer_cb checks that the timer
+     * is still running and that its current expiry has been reached.
+     */
+    int running;
+    struct timeval expiry;
 };
 
 static int
@@ -1148,6 +1558,7 @@ ipmi_alloc_timer(sys_data_t *sys, void (*cb)(void *cb_data),
     timer->cb = cb;
     timer->cb_data = cb_data;
     timer->data = data;
+    timer->running = 0;
     err = data->os_hnd->alloc_timer(data->os_hnd, &timer->id);
     if (err) {
 	free(timer);
@@ -1162,20 +1573,52 @@ static void
 timer_cb(void *cb_data, os_hnd_timer_id_t *id)
 {
     ipmi_timer_t *timer = cb_data;
+    os_handler_t *os_hnd = timer->data->os_hnd;
+    struct timeval now, left;
+
+    sim_lock();
+    if (!timer->running)
+	goto out;
 
+    os_hnd->get_monotonic_time(os_hnd, &now);
+    if (timercmp(&now, &timer->expiry, <)) {
+	/*
+	 * Restarted while this expiry was waiting for the lock, so the
+	 * timer is already running again for the new expiry and this
+	 * fails with EBUSY.  If it just went off a little early, wait
+	 * for the rest.
+	 */
+	timersub(&timer->expiry, &now, &left);
+	os_hnd->start_timer(os_hnd, timer->id, &left, timer_cb, timer);
+	goto out;
+    }
+
+    timer->running = 0;
     timer->cb(timer->cb_data);
+ out:
+    sim_unlock();
 }
 
 static int
 ipmi_start_timer(ipmi_timer_t *timer, struct timeval *timeout)
 {
-    return timer->data->os_hnd->start_timer(timer->data->os_hnd, timer->id,
-					    timeout, timer_cb, timer);
+    os_handler_t *os_hnd = timer->data->os_hnd;
+    struct timeval now;
+    int rv;
+
+    os_hnd->get_monotonic_time(os_hnd, &now);
+    rv = os_hnd->start_timer(os_hnd, timer->id, timeout, timer_cb, timer);
+    if (!rv) {
+	timeradd(&now, timeout, &timer->expiry);
+	timer->running = 1;
+    }
+    return rv;
 }
 
 static int
 ipmi_stop_timer(ipmi_timer_t *timer)
 {
+    timer->running = 0;
     return timer->data->os_hnd->stop_timer(timer->data->os_hnd, timer->id);
 }
 
@@ -1194,6 +1637,14 @@ ipmi_register_tick_handler(ipmi_tick_handler_t *handler)
     tick_handlers = handler;
 }
 
+static void
+sim_tick_handle(lmc_data_t *mc, void *cb_data)
+{
+    ipmi_tick_handler_t *h = cb_data;
+
+    h->handler(h->info, 1);
+}
+
 static void
 tick(void *cb_data, os_hnd_timer_id_t *id)
 {
@@ -1201,14 +1652,28 @@ tick(void *cb_data, os_hnd_timer_id_t *id)
     struct timeval tv;
     int err;
     ipmi_tick_handler_t *h;
+    sim_call_work_t *w;
 
+    sim_lock();
     h = tick_handlers;
     while(h) {
-	h->handler(h->info, 1);
+	w = NULL;
+	if (num_workers && h->mc)
+	    w = malloc(sizeof(*w));
+	if (w) {
+	    /* Run it as its MC, so a busy MC does not hold up the rest. */
+	    w->work.handler = sim_call_handle;
+	    w->func = sim_tick_handle;
+	    w->cb_data = h;
+	    sim_queue_work(h->mc, &w->work);
+	} else {
+	    h->handler(h->info, 1);
+	}
 	h = h->next;
     }
 
     ipmi_emu_tick(data->emu, 1);
+    sim_unlock();
 
     tv.tv_sec = 1;
     tv.tv_usec = 0;
@@ -1263,11 +1728,13 @@ sigchld_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
     if (rv == -1)
 	return;
 
+    sim_lock();
     h = child_quit_handlers;
     while (h) {
 	h->handler(h->info, rv);
 	h = h->next;
     }
+    sim_unlock();
 }
 
 static ipmi_shutdown_t *shutdown_handlers;
@@ -1382,9 +1849,18 @@ main(int argc, const char *argv[])
 
     printf("IPMI Simulator version %s\n", PVERSION);
 
+    if (num_workers < 0) {
+	fprintf(stderr, "Invalid number of workers: %d\n", num_workers);
+	exit(1);
+    }
+
     global_misc_data = &data;
 
-    data.os_hnd = ipmi_posix_setup_os_handler();
+    /* The workers use the OS handler, so it must be thread-safe for them. */
+    if (num_workers)
+	data.os_hnd = ipmi_posix_thread_setup_os_handler(0);
+    else
+	data.os_hnd = ipmi_posix_setup_os_handler();
     if (!data.os_hnd) {
 	fprintf(stderr, "Unable to allocate OS handler\n");
 	exit(1);
@@ -1614,6 +2090,14 @@ main(int argc, const char *argv[])
 
     post_init_dynamic_libs(&sysinfo);
 
+    if (num_workers) {
+	err = sim_start_workers(&data);
+	if (err) {
+	    fprintf(stderr, "Unable to start workers: %s\n", strerror(err));
+	    goto out;
+	}
+    }
+
     act.sa_handler = shutdown_handler;
     act.sa_flags = SA_RESETHAND;
     for (i = 0; shutdown_sigs[i]; i++) {
@@ -3199,6 +3199,7 @@ ipmi_lan_init(lanserv_data_t *lan)
 
     lan->tick_handler.handler = ipmi_lan_tick;
     lan->tick_handler.info = lan;
+    lan->tick_handler.mc = lan->channel.mc;
     ipmi_register_tick_handler(&lan->tick_handler);
 
  out:
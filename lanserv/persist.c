@@ -61,6 +61,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <OpenIPMI/persist.h>
 
 enum pitem_type {
@@ -81,6 +83,26 @@ struct persist_s {
     char *name;
 
     struct pitem *items;
+
+    /* Journal records applied by read_persist(). */
+    unsigned int replayed;
+};
+
+/*
+ * Journal records are binary, all numbers are little endian:
+ *   1 byte   operation, a pitem_type to set a value or PJOURNAL_DEL
+ *   2 bytes  length of the item name
+ *   4 bytes  length of the value (0 for deletes, 8 for integers)
+ *   the item name, then the value.
+ * A record cut short by a crash ends the journal when it is replayed.
+ */
+#define PJOURNAL_DEL 'x'
+#define PJOURNAL_HDR_LEN 7
+
+struct persist_journal_s {
+    char *name;
+    int fd;
+    unsigned int count;
 };
 
 int persist_enable = 1;
@@ -174,6 +196,7 @@ alloc_vpersist(const char *iname, va_list ap)
 	return NULL;
     }
     p->items = NULL;
+    p->replayed = 0;
     return p;
 }
 
@@ -268,13 +291,157 @@ write_data(void *idata, unsigned int len, FILE *f)
     }
 }
 
+static struct pitem *
+find_pi_name(persist_t *p, const char *name, struct pitem ***prev)
+{
+    struct pitem **pp = &p->items;
+
+    while (*pp) {
+	if (strcmp((*pp)->iname, name) == 0)
+	    break;
+	pp = &(*pp)->next;
+    }
+    if (prev)
+	*prev = pp;
+    return *pp;
+}
+
+static void
+free_pi(struct pitem *pi)
+{
+    if (pi->data)
+	free(pi->data);
+    free(pi->iname);
+    free(pi);
+}
+
+static unsigned long
+get_le(unsigned char *d, unsigned int len)
+{
+    unsigned long v = 0;
+
+    while (len > 0) {
+	len--;
+	v = (v << 8) | d[len];
+    }
+    return v;
+}
+
+static void
+put_le(unsigned char *d, unsigned long v, unsigned int len)
+{
+    while (len > 0) {
+	*d++ = v & 0xff;
+	v >>= 8;
+	len--;
+    }
+}
+
+/*
+ * Apply one journal record to the items.  Values that are set again
+ * are replaced in place, new values go on the end so the order they
+ * were added in is kept.
+ */
+static int
+apply_journal_rec(persist_t *p, unsigned char op, char *name,
+		  unsigned char *val, unsigned int len)
+{
+    struct pitem *pi, **pp;
+
+    pi = find_pi_name(p, name, &pp);
+    if (op == PJOURNAL_DEL) {
+	if (pi) {
+	    *pp = pi->next;
+	    free_pi(pi);
+	}
+	return 0;
+    }
+
+    if (!pi) {
+	pi = malloc(sizeof(*pi));
+	if (!pi)
+	    return ENOMEM;
+	pi->iname = strdup(name);
+	if (!pi->iname) {
+	    free(pi);
+	    return ENOMEM;
+	}
+	pi->data = NULL;
+	pi->next = NULL;
+	*pp = pi;
+    } else if (pi->data) {
+	free(pi->data);
+	pi->data = NULL;
+    }
+
+    pi->type = op;
+    if (op == PITEM_INT) {
+	pi->dval = (long) get_le(val, len);
+    } else {
+	pi->data = malloc(len + 1);
+	if (!pi->data) {
+	    /* Don't leave a value with no data behind. */
+	    *pp = pi->next;
+	    free_pi(pi);
+	    return ENOMEM;
+	}
+	memcpy(pi->data, val, len);
+	((char *) pi->data)[len] = '\0';
+	pi->dval = len;
+    }
+    return 0;
+}
+
+static int
+replay_journal(persist_t *p, FILE *f)
+{
+    unsigned char hdr[PJOURNAL_HDR_LEN];
+    unsigned char *buf = NULL;
+    unsigned int namelen, len;
+    int rv = 0;
+
+    while (fread(hdr, PJOURNAL_HDR_LEN, 1, f) == 1) {
+	namelen = get_le(hdr + 1, 2);
+	len = get_le(hdr + 3, 4);
+	if (namelen == 0 || len > 0x10000)
+	    break;
+	if ((hdr[0] == PITEM_INT && len != 8)
+	    || (hdr[0] == PJOURNAL_DEL && len != 0)
+	    || (hdr[0] != PITEM_INT && hdr[0] != PITEM_DATA
+		&& hdr[0] != PITEM_STR && hdr[0] != PJOURNAL_DEL))
+	    break;
+
+	buf = malloc(namelen + 1 + len);
+	if (!buf) {
+	    rv = ENOMEM;
+	    break;
+	}
+	if (fread(buf, namelen + len, 1, f) != 1)
+	    break; /* Partially written record, the journal ends here. */
+	buf[namelen + len] = '\0';
+	memmove(buf + namelen + 1, buf + namelen, len);
+	buf[namelen] = '\0';
+
+	rv = apply_journal_rec(p, hdr[0], (char *) buf,
+			       buf + namelen + 1, len);
+	free(buf);
+	buf = NULL;
+	if (rv)
+	    break;
+	p->replayed++;
+    }
+    if (buf)
+	free(buf);
+    return rv;
+}
+
 persist_t *
 read_persist(const char *name, ...)
 {
     char *fname;
     va_list ap;
     persist_t *p;
-    FILE *f;
+    FILE *f, *jf;
     char *line;
     char *end;
     size_t n;
@@ -284,6 +451,7 @@ read_persist(const char *name, ...)
 
     va_start(ap, name);
     p = alloc_vpersist(name, ap);
+    va_end(ap);
     if (!p)
 	return NULL;
     fname = get_fname(p, "");
@@ -293,12 +461,24 @@ read_persist(const char *name, ...)
     }
     f = fopen(fname, "r");
     free(fname);
-    if (!f) {
+
+    fname = get_fname(p, ".jnl");
+    if (!fname) {
+	if (f)
+	    fclose(f);
+	free_persist(p);
+	return NULL;
+    }
+    jf = fopen(fname, "r");
+    free(fname);
+
+    if (!f && !jf) {
 	free_persist(p);
 	return NULL;
     }
 
-    for (line = NULL; getline(&line, &n, f) != -1; free(line), line = NULL) {
+    for (line = NULL; f && getline(&line, &n, f) != -1;
+	 free(line), line = NULL) {
 	char *name = line;
 	char *type = strchr(name, ':');
 	char *val;
@@ -313,18 +493,13 @@ read_persist(const char *name, ...)
 	val = type + 2;
 
 	pi = malloc(sizeof(*pi));
-	if (!pi) {
-	    free(line);
-	    free_persist(p);
-	    return NULL;
-	}
+	if (!pi)
+	    goto out_err;
 
 	pi->iname = strdup(name);
 	if (!pi->iname) {
 	    free(pi);
-	    free(line);
-	    free_persist(p);
-	    return NULL;
+	    goto out_err;
 	}
 	pi->type = type[0];
 
@@ -355,8 +530,30 @@ read_persist(const char *name, ...)
 	pi->next = p->items;
 	p->items = pi;
     }
+    if (line)
+	free(line);
+    if (f)
+	fclose(f);
+
+    if (jf) {
+	int rv = replay_journal(p, jf);
+
+	fclose(jf);
+	if (rv) {
+	    free_persist(p);
+	    return NULL;
+	}
+    }
 
     return p;
+
+ out_err:
+    free(line);
+    fclose(f);
+    if (jf)
+	fclose(jf);
+    free_persist(p);
+    return NULL;
 }
 
 int
@@ -461,12 +658,9 @@ free_persist(persist_t *p)
     while (p->items) {
 	pi = p->items;
 	p->items = pi->next;
-
-	if (pi->data)
-	    free(pi->data);
-	free(pi->iname);
-	free(pi);
+	free_pi(pi);
     }
+    free(p->name);
     free(p);
 }
 
@@ -638,3 +832,183 @@ void free_persist_str(char *str)
 {
     free(str);
 }
+
+persist_journal_t *
+alloc_persist_journal(const char *name, ...)
+{
+    persist_journal_t *j = malloc(sizeof(*j));
+    va_list ap;
+
+    if (!j)
+	return NULL;
+    va_start(ap, name);
+    j->name = do_va_nameit(name, ap);
+    va_end(ap);
+    if (!j->name) {
+	free(j);
+	return NULL;
+    }
+    j->fd = -1;
+    j->count = 0;
+    return j;
+}
+
+void
+free_persist_journal(persist_journal_t *j)
+{
+    if (j->fd >= 0)
+	close(j->fd);
+    free(j->name);
+    free(j);
+}
+
+static int
+journal_open(persist_journal_t *j, int trunc)
+{
+    persist_t p;
+    char *fname;
+
+    if (j->fd >= 0) {
+	if (trunc && ftruncate(j->fd, 0) != 0)
+	    return errno;
+	return 0;
+    }
+
+    p.name = j->name;
+    fname = get_fname(&p, ".jnl");
+    if (!fname)
+	return ENOMEM;
+    j->fd = open(fname, O_WRONLY | O_APPEND | O_CREAT | (trunc ? O_TRUNC : 0),
+		 0644);
+    free(fname);
+    if (j->fd < 0)
+	return errno;
+    return 0;
+}
+
+static int
+journal_append(persist_journal_t *j, unsigned char op,
+	       const char *iname, va_list ap,
+	       const void *data, unsigned int len)
+{
+    unsigned char *rec;
+    unsigned int namelen, reclen;
+    char *name;
+    ssize_t rv;
+    int err;
+
+    if (!persist_enable)
+	return 0;
+
+    err = journal_open(j, 0);
+    if (err)
+	return err;
+
+    name = do_va_nameit(iname, ap);
+    if (!name)
+	return ENOMEM;
+    namelen = strlen(name);
+    if (namelen == 0 || namelen > 0xffff) {
+	free(name);
+	return EINVAL;
+    }
+
+    /* Build the whole record so it goes out in a single write. */
+    reclen = PJOURNAL_HDR_LEN + namelen + len;
+    rec = malloc(reclen);
+    if (!rec) {
+	free(name);
+	return ENOMEM;
+    }
+    rec[0] = op;
+    put_le(rec + 1, namelen, 2);
+    put_le(rec + 3, len, 4);
+    memcpy(rec + PJOURNAL_HDR_LEN, name, namelen);
+    if (len)
+	memcpy(rec + PJOURNAL_HDR_LEN + namelen, data, len);
+    free(name);
+
+    do {
+	rv = write(j->fd, rec, reclen);
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0)
+	err = errno;
+    else if ((unsigned int) rv != reclen)
+	err = EIO;
+    free(rec);
+    if (!err)
+	j->count++;
+    return err;
+}
+
+int
+persist_journal_data(persist_journal_t *j, void *data, unsigned int len,
+		     const char *name, ...)
+{
+    va_list ap;
+    int rv;
+
+    va_start(ap, name);
+    rv = journal_append(j, PITEM_DATA, name, ap, data, len);
+    va_end(ap);
+    return rv;
+}
+
+int
+persist_journal_int(persist_journal_t *j, long val, const char *name, ...)
+{
+    unsigned char d[8];
+    va_list ap;
+    int rv;
+
+    put_le(d, (unsigned long) val, sizeof(d));
+    va_start(ap, name);
+    rv = journal_append(j, PITEM_INT, name, ap, d, sizeof(d));
+    va_end(ap);
+    return rv;
+}
+
+int
+persist_journal_del(persist_journal_t *j, const char *name, ...)
+{
+    va_list ap;
+    int rv;
+
+    va_start(ap, name);
+    rv = journal_append(j, PJOURNAL_DEL, name, ap, NULL, 0);
+    va_end(ap);
+    return rv;
+}
+
+unsigned int
+persist_journal_replayed(persist_t *p)
+{
+    return p->replayed;
+}
+
+unsigned int
+persist_journal_count(persist_journal_t *j)
+{
+    return j->count;
+}
+
+int
+persist_journal_compact(persist_journal_t *j, persist_t *p)
+{
+    int rv;
+
+    rv = write_persist(p);
+    if (rv || !persist_enable)
+	return rv;
+
+    /*
+     * The new file has everything, so the journal can go.  If we
+     * crash before the truncate, replaying the journal on top of the
+     * new file is harmless since every record just sets or deletes a
+     * value.
+     */
+    rv = journal_open(j, 1);
+    if (!rv)
+	j->count = 0;
+    return rv;
+}
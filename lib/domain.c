@@ -119,9 +119,33 @@ typedef struct ll_msg_s
 
     int                          side_effects;
 
-    ilist_item_t link;
+    /* Links for the domain's sequence hash table and for the list of
+       messages outstanding on the connection. */
+    struct ll_msg_s *hnext, *hprev;
+    struct ll_msg_s *cnext, *cprev;
 } ll_msg_t;
 
+/* Initial size of the outstanding command hash table, it doubles as
+   needed.  Must be a power of two. */
+#define CMDS_HASH_MIN 64
+
+/* ll_msg_t is allocated for every command, keep some around. */
+#define LL_MSG_POOL_MAX_FREE	256
+static ipmi_mem_pool_t *ll_msg_pool;
+
+/* Each domain's view of the library-wide memory pool statistics, see
+   domain_pool_stat_update(). */
+typedef struct domain_pool_stat_s
+{
+    ipmi_mem_pool_t    *pool;
+    ipmi_domain_stat_t *gets;
+    ipmi_domain_stat_t *misses;
+    unsigned long      last_gets;
+    unsigned long      last_misses;
+
+    struct domain_pool_stat_s *next;
+} domain_pool_stat_t;
+
 typedef struct activate_timer_info_s
 {
     int           cancelled;
@@ -197,10 +221,15 @@ struct ipmi_domain_s
     ipmi_mc_t *sys_intf_mcs[MAX_CONS];
     ipmi_lock_t *mc_lock;
 
-    /* A list of outstanding messages.  We use this so we can reroute
-       messages to another connection in case a connection fails. */
-    ilist_t     *cmds;
-    ipmi_lock_t *cmds_lock;
+    /* The outstanding messages, hashed by sequence number so
+       responses can be matched quickly, and kept in a list per
+       connection so we can reroute messages to another connection in
+       case a connection fails. */
+    ll_msg_t     **cmds_hash;
+    unsigned int cmds_hash_size;
+    unsigned int num_cmds;
+    ll_msg_t     *con_cmds[MAX_CONS];
+    ipmi_lock_t  *cmds_lock;
     long        cmds_seq; /* Sequence number for messages to avoid
 			     reuse problems. */
     long        conn_seq[MAX_CONS]; /* Sequence number for connection
@@ -320,6 +349,9 @@ struct ipmi_domain_s
     /* Statistics for the domain. */
     locked_list_t *stats;
 
+    /* Memory pool statistics, protected by the stats list lock. */
+    domain_pool_stat_t *pool_stats;
+
     /* Keep a linked-list of these. */
     ipmi_domain_t *next, *prev;
 
@@ -551,6 +583,8 @@ ipmi_domain_set_oem_shutdown_handler(ipmi_domain_t           *domain,
 
 static int destroy_attr(void *cb_data, void *item1, void *item2);
 static int destroy_stat(void *cb_data, void *item1, void *item2);
+static void domain_update_pool_stats(ipmi_domain_t *domain);
+static void cmds_remove(ipmi_domain_t *domain, ll_msg_t *nmsg);
 static void call_mc_upd_cl_handlers(ipmi_domain_t         *domain,
 				    ipmi_domain_mc_upd_cb handler,
 				    void                  *handler_data);
@@ -598,6 +632,15 @@ cleanup_domain(ipmi_domain_t *domain)
 	domain->attr = NULL;
     }
 
+    while (domain->pool_stats) {
+	domain_pool_stat_t *ps = domain->pool_stats;
+
+	domain->pool_stats = ps->next;
+	ipmi_domain_stat_put(ps->gets);
+	ipmi_domain_stat_put(ps->misses);
+	ipmi_mem_free(ps);
+    }
+
     if (domain->stats) {
 	locked_list_iterate(domain->stats, destroy_stat, domain);
 	locked_list_destroy(domain->stats);
@@ -605,38 +648,35 @@ cleanup_domain(ipmi_domain_t *domain)
     }
 
     /* Nuke all outstanding messages. */
-    if ((domain->cmds_lock) && (domain->cmds)) {
-	ll_msg_t     *nmsg;
-	int          ok;
-	ilist_iter_t iter;
+    if ((domain->cmds_lock) && (domain->cmds_hash)) {
+	ll_msg_t *nmsg;
+	int      i;
 
 	ipmi_lock(domain->cmds_lock);
 
-	ilist_init_iter(&iter, domain->cmds);
-	ok = ilist_first(&iter);
-	while (ok) {
-	    ipmi_msgi_t *rspi;
-
-	    nmsg = ilist_get(&iter);
-	    rspi = nmsg->rsp_item;
-
-	    rspi->msg.netfn = nmsg->msg.netfn | 1;
-	    rspi->msg.cmd = nmsg->msg.cmd;
-	    rspi->msg.data = rspi->data;
-	    rspi->msg.data_len = 1;
-	    rspi->msg.data[0] = IPMI_UNKNOWN_ERR_CC;
-	    deliver_rsp(domain, nmsg->rsp_handler, rspi);
-	    
-	    ilist_delete(&iter);
-	    ipmi_mem_free(nmsg);
-	    ok = ilist_first(&iter);
+	for (i=0; i<MAX_CONS; i++) {
+	    while ((nmsg = domain->con_cmds[i])) {
+		ipmi_msgi_t *rspi;
+
+		cmds_remove(domain, nmsg);
+		rspi = nmsg->rsp_item;
+
+		rspi->msg.netfn = nmsg->msg.netfn | 1;
+		rspi->msg.cmd = nmsg->msg.cmd;
+		rspi->msg.data = rspi->data;
+		rspi->msg.data_len = 1;
+		rspi->msg.data[0] = IPMI_UNKNOWN_ERR_CC;
+		deliver_rsp(domain, nmsg->rsp_handler, rspi);
+
+		ipmi_mem_pool_put(ll_msg_pool, nmsg);
+	    }
 	}
 	ipmi_unlock(domain->cmds_lock);
     }
     if (domain->cmds_lock)
 	ipmi_destroy_lock(domain->cmds_lock);
-    if (domain->cmds)
-	free_ilist(domain->cmds);
+    if (domain->cmds_hash)
+	ipmi_mem_free(domain->cmds_hash);
 
     /* Shutdown code called here. */
     if (domain->shutdown_handler)
@@ -987,6 +1027,9 @@ setup_domain(const char         *name,
 	return ENOMEM;
     }
 
+    /* Register the memory pool statistics. */
+    domain_update_pool_stats(domain);
+
     domain->con_stat_info = ipmi_ll_con_alloc_stat_info();
     if (!domain->con_stat_info) {
 	locked_list_destroy(domain->stats);
@@ -1107,11 +1150,13 @@ setup_domain(const char         *name,
     if (rv)
 	goto out_err;
 
-    domain->cmds = alloc_ilist();
-    if (! domain->cmds) {
+    domain->cmds_hash = ipmi_mem_alloc(sizeof(ll_msg_t *) * CMDS_HASH_MIN);
+    if (! domain->cmds_hash) {
 	rv = ENOMEM;
 	goto out_err;
     }
+    memset(domain->cmds_hash, 0, sizeof(ll_msg_t *) * CMDS_HASH_MIN);
+    domain->cmds_hash_size = CMDS_HASH_MIN;
 
     domain->con_change_cl_handlers = locked_list_alloc(domain->os_hnd);
     if (! domain->con_change_cl_handlers) {
@@ -2003,31 +2048,115 @@ _ipmi_find_or_create_mc_by_slave_addr(ipmi_domain_t *domain,
  *
  **********************************************************************/
 
-static int cmp_nmsg(void *item, void *cb_data)
+/* The sequence numbers are handed out in order, so the low bits
+   spread the outstanding messages evenly over the table. */
+#define cmds_hash_slot(domain, seq) \
+	((unsigned long) (seq) & ((domain)->cmds_hash_size - 1))
+
+static void
+cmds_hash_insert(ll_msg_t **table, unsigned int size, ll_msg_t *nmsg)
 {
-    ll_msg_t *nmsg1 = item;
-    ll_msg_t *nmsg2 = cb_data;
+    unsigned int slot = (unsigned long) nmsg->seq & (size - 1);
 
-    return ((nmsg1 == nmsg2)
-	    && (nmsg1->domain == nmsg2->domain));
+    nmsg->hprev = NULL;
+    nmsg->hnext = table[slot];
+    if (nmsg->hnext)
+	nmsg->hnext->hprev = nmsg;
+    table[slot] = nmsg;
+}
+
+/* Double the size of the hash table.  If we can't get the memory,
+   just keep using the old table, it will only be slower. */
+static void
+cmds_hash_grow(ipmi_domain_t *domain)
+{
+    unsigned int size = domain->cmds_hash_size * 2;
+    ll_msg_t     **table;
+    ll_msg_t     *nmsg;
+    unsigned int i;
+
+    table = ipmi_mem_alloc(sizeof(ll_msg_t *) * size);
+    if (!table)
+	return;
+    memset(table, 0, sizeof(ll_msg_t *) * size);
+
+    for (i=0; i<domain->cmds_hash_size; i++) {
+	while ((nmsg = domain->cmds_hash[i])) {
+	    domain->cmds_hash[i] = nmsg->hnext;
+	    cmds_hash_insert(table, size, nmsg);
+	}
+    }
+    ipmi_mem_free(domain->cmds_hash);
+    domain->cmds_hash = table;
+    domain->cmds_hash_size = size;
+}
+
+/* Must be called with the cmds_lock held. */
+static void
+cmds_add(ipmi_domain_t *domain, ll_msg_t *nmsg)
+{
+    if (domain->num_cmds >= domain->cmds_hash_size * 2)
+	cmds_hash_grow(domain);
+    cmds_hash_insert(domain->cmds_hash, domain->cmds_hash_size, nmsg);
+    domain->num_cmds++;
+
+    nmsg->cprev = NULL;
+    nmsg->cnext = domain->con_cmds[nmsg->con];
+    if (nmsg->cnext)
+	nmsg->cnext->cprev = nmsg;
+    domain->con_cmds[nmsg->con] = nmsg;
+}
+
+static void
+cmds_hash_remove(ipmi_domain_t *domain, ll_msg_t *nmsg)
+{
+    if (nmsg->hnext)
+	nmsg->hnext->hprev = nmsg->hprev;
+    if (nmsg->hprev)
+	nmsg->hprev->hnext = nmsg->hnext;
+    else
+	domain->cmds_hash[cmds_hash_slot(domain, nmsg->seq)] = nmsg->hnext;
+    domain->num_cmds--;
 }
 
 /* Must be called with the cmds_lock held. */
+static void
+cmds_remove(ipmi_domain_t *domain, ll_msg_t *nmsg)
+{
+    cmds_hash_remove(domain, nmsg);
+
+    if (nmsg->cnext)
+	nmsg->cnext->cprev = nmsg->cprev;
+    if (nmsg->cprev)
+	nmsg->cprev->cnext = nmsg->cnext;
+    else
+	domain->con_cmds[nmsg->con] = nmsg->cnext;
+}
+
+/* Must be called with the cmds_lock held.  The message pointer from
+   the response may be stale, so it is only compared and not used
+   until it is found in the table. */
 static int
-find_and_remove_msg(ipmi_domain_t *domain, ll_msg_t *nmsg, long seq)
+find_and_remove_msg(ipmi_domain_t *domain, ll_msg_t *nmsg, long seq,
+		    long conn_seq)
 {
-    ilist_iter_t iter;
-    int          rv = 0;
+    ll_msg_t *item;
 
-    ilist_init_iter(&iter, domain->cmds);
-    ilist_unpositioned(&iter);
-    if ((ilist_search_iter(&iter, cmp_nmsg, nmsg) != NULL)
-	&& (nmsg->seq == seq))
-    {
-	ilist_delete(&iter);
-	rv = 1;
+    item = domain->cmds_hash[cmds_hash_slot(domain, seq)];
+    while (item) {
+	if ((item == nmsg) && (item->seq == seq))
+	    break;
+	item = item->hnext;
     }
-    return rv;
+    if (!item)
+	return 0;
+
+    if (conn_seq != domain->conn_seq[nmsg->con])
+	/* The message has been rerouted, just ignore this response. */
+	return 0;
+
+    cmds_remove(domain, nmsg);
+    return 1;
 }
 
 static int
@@ -2048,13 +2177,7 @@ ll_rsp_handler(ipmi_con_t   *ipmi,
 	return IPMI_MSG_ITEM_NOT_USED;
 
     ipmi_lock(domain->cmds_lock);
-    if (conn_seq != domain->conn_seq[nmsg->con]) {
-	/* The message has been rerouted, just ignore this response. */
-	ipmi_unlock(domain->cmds_lock);
-	goto out_unlock;
-    }
-
-    if (!find_and_remove_msg(domain, nmsg, seq)) {
+    if (!find_and_remove_msg(domain, nmsg, seq, conn_seq)) {
 	ipmi_unlock(domain->cmds_lock);
 	goto out_unlock;
     }
@@ -2068,7 +2191,7 @@ ll_rsp_handler(ipmi_con_t   *ipmi,
 	deliver_rsp(domain, nmsg->rsp_handler, rspi);
     } else
 	ipmi_free_msg_item(rspi);
-    ipmi_mem_free(nmsg);
+    ipmi_mem_pool_put(ll_msg_pool, nmsg);
  out_unlock:
     _ipmi_domain_put(domain);
     return IPMI_MSG_ITEM_NOT_USED;
@@ -2100,7 +2223,7 @@ ll_si_rsp_handler(ipmi_con_t *ipmi, ipmi_msgi_t *orspi)
 	deliver_rsp(domain, nmsg->rsp_handler, rspi);
     } else
 	ipmi_free_msg_item(rspi);
-    ipmi_mem_free(nmsg);
+    ipmi_mem_pool_put(ll_msg_pool, nmsg);
 
     _ipmi_domain_put(domain);
     return IPMI_MSG_ITEM_NOT_USED;
@@ -2201,12 +2324,12 @@ send_command_addr(ipmi_domain_t                *domain,
 
     CHECK_DOMAIN_LOCK(domain);
 
-    nmsg = ipmi_mem_alloc(sizeof(*nmsg));
+    nmsg = ipmi_mem_pool_get(ll_msg_pool);
     if (!nmsg)
 	return ENOMEM;
     nmsg->rsp_item = ipmi_alloc_msg_item();
     if (!nmsg->rsp_item) {
-	ipmi_mem_free(nmsg);
+	ipmi_mem_pool_put(ll_msg_pool, nmsg);
 	return ENOMEM;
     }
 
@@ -2298,7 +2421,7 @@ send_command_addr(ipmi_domain_t                *domain,
 	/* If it's a system interface we don't add it to the list of
 	   commands running, because it will never need to be
 	   rerouted. */
-	ilist_add_tail(domain->cmds, nmsg, &nmsg->link);
+	cmds_add(domain, nmsg);
     }
  out_unlock:
     ipmi_unlock(domain->cmds_lock);
@@ -2306,7 +2429,7 @@ send_command_addr(ipmi_domain_t                *domain,
  out:
     if (rv) {
 	ipmi_free_msg_item(nmsg->rsp_item);
-	ipmi_mem_free(nmsg);
+	ipmi_mem_pool_put(ll_msg_pool, nmsg);
     }
     return rv;
 }
@@ -2342,68 +2465,70 @@ ipmi_send_command_addr_sideeff(ipmi_domain_t                *domain,
 static void
 reroute_cmds(ipmi_domain_t *domain, int old_con, int new_con)
 {
-    ilist_iter_t iter;
     int          rv;
-    ll_msg_t     *nmsg;
+    ll_msg_t     *nmsg, *next;
 
     ipmi_lock(domain->cmds_lock);
-    ilist_init_iter(&iter, domain->cmds);
-    rv = ilist_first(&iter);
     (domain->conn_seq[old_con])++;
-    while (rv) {
-	nmsg = ilist_get(&iter);
-	if (nmsg->con == old_con) {
-	    ipmi_msgi_t       *rspi;
-	    ipmi_con_option_t opt_data[2];
-	    ipmi_con_option_t *options = NULL;
-
-	    nmsg->seq = domain->cmds_seq;
-	    domain->cmds_seq++; /* Make the message unique so a
-                                   response from the other connection
-                                   will not match. */
-	    nmsg->con = new_con;
-
-	    rspi = ipmi_alloc_msg_item();
-	    if (!rspi)
-		goto send_err;
-
-	    if (nmsg->side_effects) {
-		options = opt_data;
-		options[0].option = IPMI_CON_MSG_OPTION_SIDE_EFFECTS;
-		options[0].ival = 1;
-		options[1].option = IPMI_CON_OPTION_LIST_END;
-	    }
 
-	    rspi->data1 = domain;
-	    rspi->data2 = nmsg;
-	    rspi->data3 = (void *) nmsg->seq;
-	    rspi->data4 = (void *) domain->conn_seq[new_con];
-	    rv = send_command_option(domain, new_con,
-				     &nmsg->rsp_item->addr,
-				     nmsg->rsp_item->addr_len,
-				     &nmsg->msg,
-				     options,
-				     ll_rsp_handler,
-				     rspi);
-	    if (rv) {
-		ipmi_free_msg_item(rspi);
-	    send_err:
-		/* Couldn't send the message, just fail it. */
-		if (nmsg->rsp_handler) {
-		    rspi = nmsg->rsp_item;
-		    rspi->msg.netfn = nmsg->msg.netfn | 1;
-		    rspi->msg.cmd = nmsg->msg.cmd;
-		    rspi->msg.data = rspi->data;
-		    rspi->msg.data_len = 1;
-		    rspi->data[0] = IPMI_UNKNOWN_ERR_CC;
-		    deliver_rsp(domain, nmsg->rsp_handler, rspi);
-		}
-		rv = ilist_delete(&iter);
-		ipmi_mem_free(nmsg);
-		continue;
+    /* Take the old connection's messages off its list first, a
+       response may come in (and remove a message) while sending. */
+    next = domain->con_cmds[old_con];
+    domain->con_cmds[old_con] = NULL;
+    while (next) {
+	ipmi_msgi_t       *rspi;
+	ipmi_con_option_t opt_data[2];
+	ipmi_con_option_t *options = NULL;
+
+	nmsg = next;
+	next = nmsg->cnext;
+
+	cmds_hash_remove(domain, nmsg);
+	nmsg->seq = domain->cmds_seq;
+	domain->cmds_seq++; /* Make the message unique so a
+			       response from the other connection
+			       will not match. */
+	nmsg->con = new_con;
+	cmds_add(domain, nmsg);
+
+	rspi = ipmi_alloc_msg_item();
+	if (!rspi)
+	    goto send_err;
+
+	if (nmsg->side_effects) {
+	    options = opt_data;
+	    options[0].option = IPMI_CON_MSG_OPTION_SIDE_EFFECTS;
+	    options[0].ival = 1;
+	    options[1].option = IPMI_CON_OPTION_LIST_END;
+	}
+
+	rspi->data1 = domain;
+	rspi->data2 = nmsg;
+	rspi->data3 = (void *) nmsg->seq;
+	rspi->data4 = (void *) domain->conn_seq[new_con];
+	rv = send_command_option(domain, new_con,
+				 &nmsg->rsp_item->addr,
+				 nmsg->rsp_item->addr_len,
+				 &nmsg->msg,
+				 options,
+				 ll_rsp_handler,
+				 rspi);
+	if (rv) {
+	    ipmi_free_msg_item(rspi);
+	send_err:
+	    /* Couldn't send the message, just fail it. */
+	    if (nmsg->rsp_handler) {
+		rspi = nmsg->rsp_item;
+		rspi->msg.netfn = nmsg->msg.netfn | 1;
+		rspi->msg.cmd = nmsg->msg.cmd;
+		rspi->msg.data = rspi->data;
+		rspi->msg.data_len = 1;
+		rspi->data[0] = IPMI_UNKNOWN_ERR_CC;
+		deliver_rsp(domain, nmsg->rsp_handler, rspi);
 	    }
+	    cmds_remove(domain, nmsg);
+	    ipmi_mem_pool_put(ll_msg_pool, nmsg);
 	}
-	rv = ilist_next(&iter);
     }
     ipmi_unlock(domain->cmds_lock);
 }
@@ -6188,7 +6313,7 @@ ipmi_domain_stat_register(ipmi_domain_t      *domain,
 
  out_unlock:    
     locked_list_unlock(domain->stats);
-    return 0;
+    return rv;
 }
 
 int
@@ -6314,6 +6439,64 @@ domain_stat_iter(void *cb_data, void *item1, void *item2)
     return LOCKED_LIST_ITER_CONTINUE;
 }
 
+/* The memory pools are shared by every domain in the library, so the
+   "mem_pool_gets" and "mem_pool_misses" statistics (the instance is
+   the pool name) count all of their traffic, not just this domain's,
+   and show the same totals in every domain.  The pools only keep
+   running totals, so each update adds what they have done since the
+   last one; that way ipmi_domain_stat_get_and_zero() still works. */
+static void
+domain_pool_stat_update(ipmi_mem_pool_t *pool,
+			const char      *name,
+			unsigned long   gets,
+			unsigned long   misses,
+			void            *cb_data)
+{
+    ipmi_domain_t      *domain = cb_data;
+    domain_pool_stat_t *ps;
+
+    for (ps = domain->pool_stats; ps; ps = ps->next) {
+	if (ps->pool == pool)
+	    break;
+    }
+
+    if (!ps) {
+	ps = ipmi_mem_alloc(sizeof(*ps));
+	if (!ps)
+	    return;
+	memset(ps, 0, sizeof(*ps));
+	if (ipmi_domain_stat_register(domain, "mem_pool_gets", name,
+				      &ps->gets))
+	{
+	    ipmi_mem_free(ps);
+	    return;
+	}
+	if (ipmi_domain_stat_register(domain, "mem_pool_misses", name,
+				      &ps->misses))
+	{
+	    ipmi_domain_stat_put(ps->gets);
+	    ipmi_mem_free(ps);
+	    return;
+	}
+	ps->pool = pool;
+	ps->next = domain->pool_stats;
+	domain->pool_stats = ps;
+    }
+
+    ipmi_domain_stat_add(ps->gets, gets - ps->last_gets);
+    ipmi_domain_stat_add(ps->misses, misses - ps->last_misses);
+    ps->last_gets = gets;
+    ps->last_misses = misses;
+}
+
+static void
+domain_update_pool_stats(ipmi_domain_t *domain)
+{
+    locked_list_lock(domain->stats);
+    ipmi_mem_pool_iterate(domain_pool_stat_update, domain);
+    locked_list_unlock(domain->stats);
+}
+
 void
 ipmi_domain_stat_iterate(ipmi_domain_t *domain,
 			 const char    *name,
@@ -6323,6 +6506,8 @@ ipmi_domain_stat_iterate(ipmi_domain_t *domain,
 {
     stat_iterate_t info;
 
+    domain_update_pool_stats(domain);
+
     info.domain = domain;
     info.name = name;
     info.instance = instance;
@@ -6368,8 +6553,22 @@ _ipmi_domain_init(void)
 	return ENOMEM;
     }
 
+    ll_msg_pool = ipmi_mem_pool_alloc(ipmi_get_global_os_handler(),
+				      "ll_msg", sizeof(ll_msg_t),
+				      LL_MSG_POOL_MAX_FREE);
+    if (!ll_msg_pool) {
+	locked_list_destroy(domain_change_handlers);
+	locked_list_destroy(domains_list);
+	domains_list = NULL;
+	free_ilist(oem_handlers);
+	oem_handlers = NULL;
+	return ENOMEM;
+    }
+
     rv = ipmi_create_global_lock(&domains_lock);
     if (rv) {
+	ipmi_mem_pool_destroy(ll_msg_pool);
+	ll_msg_pool = NULL;
 	locked_list_destroy(domain_change_handlers);
 	locked_list_destroy(domains_list);
 	domains_list = NULL;
@@ -6396,6 +6595,8 @@ _ipmi_domain_shutdown(void)
     oem_handlers = NULL;
     ipmi_destroy_lock(domains_lock);
     domains_lock = NULL;
+    ipmi_mem_pool_destroy(ll_msg_pool);
+    ll_msg_pool = NULL;
 }
 
 
@@ -147,6 +147,9 @@ struct ipmi_entity_s
 
     dlr_ref_t key;
 
+    /* Next entity in the same bucket of the entity info's hash. */
+    ipmi_entity_t *hash_next;
+
     /* Lock used for protecting misc data. */
     ipmi_lock_t *elock;
 
@@ -324,12 +327,22 @@ struct ipmi_entity_info_s
     ipmi_domain_t         *domain;
     ipmi_domain_id_t      domain_id;
     locked_list_t         *entities;
+
+    /* Index of the entities by key, so lookups do not have to search
+       the list.  Like the list, this is protected by the domain
+       entity lock.  The size is always a power of two. */
+    unsigned int          hash_size;
+    unsigned int          hash_count;
+    ipmi_entity_t         **hash;
 };
 
+#define ENTITY_HASH_INIT_SIZE 64
+
 #define ent_lock(e) ipmi_lock(e->elock)
 #define ent_unlock(e) ipmi_unlock(e->elock)
 
 static void entity_mc_active(ipmi_mc_t *mc, int active, void *cb_data);
+static void entity_hash_remove(ipmi_entity_info_t *ents, ipmi_entity_t *ent);
 static void call_presence_handlers(ipmi_entity_t *ent, int present);
 static void call_fully_up_handlers(ipmi_entity_t *ent);
 
@@ -442,10 +455,21 @@ ipmi_entity_info_alloc(ipmi_domain_t *domain, ipmi_entity_info_t **new_info)
 
     ents->domain = domain;
     ents->domain_id = ipmi_domain_convert_to_id(domain);
+
+    ents->hash_size = ENTITY_HASH_INIT_SIZE;
+    ents->hash_count = 0;
+    ents->hash = ipmi_mem_alloc(sizeof(*ents->hash) * ents->hash_size);
+    if (! ents->hash) {
+	ipmi_mem_free(ents);
+	return ENOMEM;
+    }
+    memset(ents->hash, 0, sizeof(*ents->hash) * ents->hash_size);
+
     ents->entities = locked_list_alloc_my_lock(entities_lock,
 					       entities_unlock,
 					       domain);
     if (! ents->entities) {
+	ipmi_mem_free(ents->hash);
 	ipmi_mem_free(ents);
 	return ENOMEM;
     }
@@ -453,6 +477,7 @@ ipmi_entity_info_alloc(ipmi_domain_t *domain, ipmi_entity_info_t **new_info)
     ents->update_handlers = locked_list_alloc(ipmi_domain_get_os_hnd(domain));
     if (! ents->update_handlers) {
 	locked_list_destroy(ents->entities);
+	ipmi_mem_free(ents->hash);
 	ipmi_mem_free(ents);
 	return ENOMEM;
     }
@@ -462,6 +487,7 @@ ipmi_entity_info_alloc(ipmi_domain_t *domain, ipmi_entity_info_t **new_info)
     if (! ents->update_cl_handlers) {
 	locked_list_destroy(ents->update_handlers);
 	locked_list_destroy(ents->entities);
+	ipmi_mem_free(ents->hash);
 	ipmi_mem_free(ents);
 	return ENOMEM;
     }
@@ -842,6 +868,7 @@ ipmi_entity_info_destroy(ipmi_entity_info_t *ents)
     locked_list_destroy(ents->update_cl_handlers);
     locked_list_iterate(ents->entities, destroy_entity, NULL);
     locked_list_destroy(ents->entities);
+    ipmi_mem_free(ents->hash);
     ipmi_mem_free(ents);
     return 0;
 }
@@ -909,6 +936,7 @@ cleanup_entity(ipmi_entity_t *ent)
 
 	/* Remove it from the entities list. */
 	locked_list_remove_nolock(ent->ents->entities, ent, NULL);
+	entity_hash_remove(ent->ents, ent);
 
 	/* The sensor, control, parent, and child lists should be empty
 	   now, we can just destroy it. */
@@ -1235,27 +1263,74 @@ ipmi_entity_info_remove_update_handler_cl(ipmi_entity_info_t       *ents,
 	return EINVAL;
 }
 
-typedef struct search_info_s {
-    dlr_ref_t         key;
-    ipmi_entity_t     *ent;
-} search_info_t;
+static unsigned int
+entity_hash(ipmi_device_num_t device_num,
+	    int               entity_id,
+	    int               entity_instance,
+	    unsigned int      size)
+{
+    unsigned int key;
 
-static int
-search_entity(void *cb_data, void *item1, void *item2)
+    key = ((device_num.channel << 24) | (device_num.address << 16)
+	   | ((entity_id & 0xff) << 8) | (entity_instance & 0xff));
+    return ((key * 2654435761U) >> 7) & (size - 1);
+}
+
+/* Must be called with the domain entity lock held. */
+static void
+entity_hash_add(ipmi_entity_info_t *ents, ipmi_entity_t *ent)
+{
+    unsigned int idx;
+
+    if (ents->hash_count >= ents->hash_size * 2) {
+	/* Grow the table.  If that fails, just use the old one, it
+	   still works, the chains are just longer. */
+	unsigned int  new_size = ents->hash_size * 2;
+	ipmi_entity_t **new_hash;
+	ipmi_entity_t *e, *next;
+	unsigned int  i;
+
+	new_hash = ipmi_mem_alloc(sizeof(*new_hash) * new_size);
+	if (new_hash) {
+	    memset(new_hash, 0, sizeof(*new_hash) * new_size);
+	    for (i=0; i<ents->hash_size; i++) {
+		for (e=ents->hash[i]; e; e=next) {
+		    next = e->hash_next;
+		    idx = entity_hash(e->key.device_num, e->key.entity_id,
+				      e->key.entity_instance, new_size);
+		    e->hash_next = new_hash[idx];
+		    new_hash[idx] = e;
+		}
+	    }
+	    ipmi_mem_free(ents->hash);
+	    ents->hash = new_hash;
+	    ents->hash_size = new_size;
+	}
+    }
+
+    idx = entity_hash(ent->key.device_num, ent->key.entity_id,
+		      ent->key.entity_instance, ents->hash_size);
+    ent->hash_next = ents->hash[idx];
+    ents->hash[idx] = ent;
+    ents->hash_count++;
+}
+
+/* Must be called with the domain entity lock held. */
+static void
+entity_hash_remove(ipmi_entity_info_t *ents, ipmi_entity_t *ent)
 {
-    ipmi_entity_t *ent = (ipmi_entity_t *) item1;
-    search_info_t *info = (search_info_t *) cb_data;
-    int           same;
+    ipmi_entity_t **p;
+    unsigned int  idx;
 
-    same = ((ent->key.device_num.channel == info->key.device_num.channel)
-	    && (ent->key.device_num.address == info->key.device_num.address)
-	    && (ent->key.entity_id == info->key.entity_id)
-	    && (ent->key.entity_instance == info->key.entity_instance));
-    if (same) {
-	info->ent = ent;
-	return LOCKED_LIST_ITER_STOP;
+    idx = entity_hash(ent->key.device_num, ent->key.entity_id,
+		      ent->key.entity_instance, ents->hash_size);
+    for (p=&ents->hash[idx]; *p; p=&(*p)->hash_next) {
+	if (*p == ent) {
+	    *p = ent->hash_next;
+	    ents->hash_count--;
+	    break;
+	}
     }
-    return LOCKED_LIST_ITER_CONTINUE;
 }
 
 static int
@@ -1265,19 +1340,25 @@ entity_find(ipmi_entity_info_t *ents,
 	    int                entity_instance,
 	    ipmi_entity_t      **found_ent)
 {
-    search_info_t info = { {device_num, entity_id, entity_instance}, NULL};
-    int           rv = 0;
-
-    locked_list_iterate_nolock(ents->entities, search_entity, &info);
-    if (info.ent == NULL) {
-	rv = ENOENT;
-    } else {
-	info.ent->usecount++;
-	if (found_ent)
-	    *found_ent = info.ent;
+    ipmi_entity_t *ent;
+    unsigned int  idx;
+
+    idx = entity_hash(device_num, entity_id, entity_instance,
+		      ents->hash_size);
+    for (ent=ents->hash[idx]; ent; ent=ent->hash_next) {
+	if ((ent->key.device_num.channel == device_num.channel)
+	    && (ent->key.device_num.address == device_num.address)
+	    && (ent->key.entity_id == entity_id)
+	    && (ent->key.entity_instance == entity_instance))
+	    break;
     }
+    if (ent == NULL)
+	return ENOENT;
 
-    return rv;
+    ent->usecount++;
+    if (found_ent)
+	*found_ent = ent;
+    return 0;
 }
 
 int
@@ -1471,6 +1552,7 @@ entity_add(ipmi_entity_info_t *ents,
 
     if (! locked_list_add_nolock(ents->entities, ent, NULL))
 	goto out_err;
+    entity_hash_add(ents, ent);
 
     _ipmi_domain_entity_unlock(ent->domain);
 
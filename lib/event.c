@@ -31,6 +31,7 @@
  *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <config.h>
 #include <string.h>
 #include <errno.h>
 
@@ -41,15 +42,23 @@
 #include <OpenIPMI/internal/ipmi_mc.h>
 #include <OpenIPMI/internal/ipmi_domain.h>
 
+/* Events are immutable once allocated except for the refcount (and
+   the mcid and old flag, which are only set by the owner), so the
+   refcount is all that needs protecting.  It is handled with atomic
+   operations where the compiler has them, so an event needs no lock
+   and it and its data are a single allocation; a large SEL holds a
+   lot of these.  Otherwise each event gets a lock for it. */
 struct ipmi_event_s
 {
     ipmi_mcid_t   mcid; /* The MC this event is stored in. */
 
+    ipmi_time_t   timestamp;
+#ifndef HAVE_SYNC_BUILTINS
     ipmi_lock_t   *lock;
+#endif
     unsigned int  refcount;
     unsigned int  record_id;
     unsigned int  type;
-    ipmi_time_t   timestamp;
     unsigned int  data_len;
     unsigned char old;
     unsigned char data[0];
@@ -69,10 +78,12 @@ ipmi_event_alloc(ipmi_mcid_t   mcid,
     if (!rv)
 	return NULL;
 
+#ifndef HAVE_SYNC_BUILTINS
     if (ipmi_create_global_lock(&rv->lock)) {
 	ipmi_mem_free(rv);
 	return NULL;
     }
+#endif
     rv->mcid = mcid;
     rv->record_id = record_id;
     rv->type = type;
@@ -91,26 +102,36 @@ ipmi_event_dup(ipmi_event_t *event)
 {
     if (!event)
 	return NULL;
+#ifdef HAVE_SYNC_BUILTINS
+    __sync_add_and_fetch(&event->refcount, 1);
+#else
     ipmi_lock(event->lock);
     event->refcount++;
     ipmi_unlock(event->lock);
+#endif
     return event;
 }
 
 void
 ipmi_event_free(ipmi_event_t *event)
 {
+    unsigned int refcount;
+
     if (!event)
 	return;
+#ifdef HAVE_SYNC_BUILTINS
+    refcount = __sync_sub_and_fetch(&event->refcount, 1);
+#else
     ipmi_lock(event->lock);
-    event->refcount--;
-    if (event->refcount == 0) {
-	ipmi_unlock(event->lock);
+    refcount = --event->refcount;
+    ipmi_unlock(event->lock);
+#endif
+    if (refcount == 0) {
+#ifndef HAVE_SYNC_BUILTINS
 	ipmi_destroy_lock(event->lock);
+#endif
 	ipmi_mem_free(event);
-	return;
     }
-    ipmi_unlock(event->lock);
 }
 
 ipmi_mcid_t
@@ -48,10 +48,12 @@
 
 #include <OpenIPMI/internal/locked_list.h>
 #include <OpenIPMI/internal/ipmi_domain.h>
+#include <OpenIPMI/internal/ipmi_mc.h>
 #include <OpenIPMI/internal/ipmi_int.h>
 #include <OpenIPMI/internal/ipmi_utils.h>
 #include <OpenIPMI/internal/ipmi_oem.h>
 #include <OpenIPMI/internal/ipmi_fru.h>
+#include <OpenIPMI/internal/ipmi_cache.h>
 
 #define MAX_FRU_DATA_FETCH 32
 #define FRU_DATA_FETCH_DECR 8
@@ -62,6 +64,15 @@
 
 #define MAX_FRU_FETCH_RETRIES 5
 
+/* Number of reads to keep outstanding while fetching FRU data.  A
+   device that fails a read while others are outstanding is read one
+   at a time from then on. */
+#define FRU_FETCH_WINDOW 4
+
+/* The common header plus the checksums of the chassis, board, and
+   product areas and the first multi-record header. */
+#define MAX_FRU_CACHE_PROBES 5
+
 #define IPMI_FRU_ATTR_NAME "ipmi_fru"
 
 /*
@@ -85,6 +96,19 @@ struct fru_update_s
     fru_update_t   *next;
 };
 
+/* A read of FRU data.  Each covers a disjoint range of the data, which
+   is put in place as it arrives. */
+#define FRU_READ_FREE		0
+#define FRU_READ_SENT		1
+#define FRU_READ_WAITING	2
+typedef struct fru_read_s
+{
+    int          state;
+    unsigned int offset;
+    unsigned int length;
+    unsigned int sent_len;
+} fru_read_t;
+
 /* Operations registered by the decode for a FRU. */
 typedef struct ipmi_fru_op_s
 {
@@ -153,6 +177,14 @@ struct ipmi_fru_s
 
     int           fetch_size;
 
+    /* Pipelined reading of the FRU data.  curr_pos is the number of
+       bytes received so far. */
+    fru_read_t    reads[FRU_FETCH_WINDOW];
+    unsigned int  fetch_window;
+    unsigned int  reads_sent;
+    unsigned int  next_read_pos;
+    int           fetch_err;
+
     /* Is this in the list of FRUs? */
     int in_frulist;
 
@@ -183,6 +215,23 @@ struct ipmi_fru_s
     char iname[IPMI_FRU_NAME_LEN+1];
 
     unsigned int options;
+
+    /* Persistent cache handling.  A cached copy is only used if the
+       area size matches and the probes (the common header and the
+       area checksums) read from the device match the cached data. */
+    char          cache_key[80];
+    int           cache_key_set;
+    unsigned char *cache_data;
+    int           from_cache;
+    struct {
+	unsigned short offset;
+	unsigned short length;
+    } probes[MAX_FRU_CACHE_PROBES];
+    unsigned int  num_probes;
+    unsigned int  curr_probe;
+
+    ipmi_domain_stat_t *fru_cache_hits;
+    ipmi_domain_stat_t *fru_cache_misses;
 };
 
 #define FRU_DOMAIN_NAME(fru) (fru ? fru->iname : "")
@@ -516,6 +565,12 @@ final_fru_destroy(ipmi_fru_t *fru)
     }
     if (fru->setup_data_cleanup)
 	fru->setup_data_cleanup(fru, fru->setup_data);
+    if (fru->cache_data)
+	ipmi_mem_free(fru->cache_data);
+    if (fru->fru_cache_hits)
+	ipmi_domain_stat_put(fru->fru_cache_hits);
+    if (fru->fru_cache_misses)
+	ipmi_domain_stat_put(fru->fru_cache_misses);
     ipmi_destroy_lock(fru->lock);
     ipmi_mem_free(fru);
 }
@@ -620,6 +675,11 @@ start_fru_fetch(ipmi_fru_t *fru, ipmi_domain_t *domain)
     int rv;
 
     fru->curr_pos = 0;
+    fru->from_cache = 0;
+    if (fru->cache_data) {
+	ipmi_mem_free(fru->cache_data);
+	fru->cache_data = NULL;
+    }
 
     if (fru->is_logical)
 	rv = start_logical_fru_fetch(domain, fru);
@@ -658,6 +718,43 @@ fetch_got_timestamp(ipmi_fru_t    *fru,
     return;
 }
 
+/* Set up the key for the persistent cache.  The cache is keyed by
+   the GUID of the MC holding the FRU, so it is only used if the MC
+   has one. */
+static void
+fru_cache_setup(ipmi_domain_t *domain, ipmi_fru_t *fru)
+{
+    ipmi_mc_t     *mc;
+    unsigned char guid[16];
+    char          *s;
+    int           i;
+    int           rv;
+
+    if (!ipmi_option_use_cache(domain))
+	return;
+
+    mc = _ipmi_find_mc_by_addr(domain, &fru->addr, fru->addr_len);
+    if (!mc)
+	return;
+    rv = ipmi_mc_get_guid(mc, guid);
+    _ipmi_mc_put(mc);
+    if (rv)
+	return;
+
+    s = fru->cache_key;
+    s += sprintf(s, "fru-");
+    for (i=0; i<16; i++)
+	s += sprintf(s, "%2.2x", guid[i]);
+    sprintf(s, "-%d.%x.%d.%d.%d.%d", fru->is_logical, fru->device_address,
+	    fru->device_id, fru->lun, fru->private_bus, fru->channel);
+    fru->cache_key_set = 1;
+
+    ipmi_domain_stat_register(domain, "fru_cache_hits", fru->iname,
+			      &fru->fru_cache_hits);
+    ipmi_domain_stat_register(domain, "fru_cache_misses", fru->iname,
+			      &fru->fru_cache_misses);
+}
+
 static int
 ipmi_fru_alloc_internal(ipmi_domain_t       *domain,
 			unsigned char       is_logical,
@@ -700,6 +797,7 @@ ipmi_fru_alloc_internal(ipmi_domain_t       *domain,
     fru->channel = channel;
     fru->fetch_mask = fetch_mask;
     fru->fetch_size = MAX_FRU_DATA_FETCH;
+    fru->fetch_window = FRU_FETCH_WINDOW;
     fru->os_hnd = ipmi_domain_get_os_hnd(domain);
     fru->write_cb = fru_normal_write;
 
@@ -731,6 +829,8 @@ ipmi_fru_alloc_internal(ipmi_domain_t       *domain,
     if (err)
 	goto out_err;
 
+    fru_cache_setup(domain, fru);
+
     _ipmi_fru_lock(fru);
     if (fru->timestamp_cb) {
 	err = fru->timestamp_cb(fru, domain, fetch_got_timestamp);
@@ -747,6 +847,10 @@ ipmi_fru_alloc_internal(ipmi_domain_t       *domain,
 
  out_err:
     _ipmi_fru_unlock(fru);
+    if (fru->fru_cache_hits)
+	ipmi_domain_stat_put(fru->fru_cache_hits);
+    if (fru->fru_cache_misses)
+	ipmi_domain_stat_put(fru->fru_cache_misses);
     ipmi_destroy_lock(fru->lock);
     ipmi_mem_free(fru);
     return err;
@@ -903,6 +1007,148 @@ ipmi_fru_alloc_notrack(ipmi_domain_t *domain,
  *
  **********************************************************************/
 
+static void
+fru_stat_add(ipmi_domain_stat_t *stat, int amount)
+{
+    if (stat)
+	ipmi_domain_stat_add(stat, amount);
+}
+
+static void
+fru_cache_store(ipmi_fru_t *fru)
+{
+    if (fru->cache_key_set && fru->data)
+	ipmi_cache_store(fru->os_hnd, fru->cache_key, IPMI_CACHE_FRU, 1,
+			 fru->data_len, fru->access_by_words,
+			 fru->last_timestamp, fru->data);
+}
+
+static void
+fru_cache_add_probe(ipmi_fru_t   *fru,
+		    unsigned int offset,
+		    unsigned int length)
+{
+    if (fru->access_by_words) {
+	if (offset & 1) {
+	    offset -= 1;
+	    length += 1;
+	}
+	if (length & 1)
+	    length += 1;
+    }
+    if ((offset + length) > fru->data_len)
+	return;
+    fru->probes[fru->num_probes].offset = offset;
+    fru->probes[fru->num_probes].length = length;
+    fru->num_probes++;
+}
+
+static void
+fru_cache_setup_probes(ipmi_fru_t *fru)
+{
+    unsigned char *d = fru->cache_data;
+    unsigned int  i, off;
+
+    fru->num_probes = 0;
+    fru->curr_probe = 0;
+
+    /* The common header holds the area offsets and its own checksum. */
+    fru_cache_add_probe(fru, 0, 8);
+
+    /* The chassis, board, and product areas end with a checksum of
+       the area.  The internal use area has no checksum. */
+    for (i=2; i<=4; i++) {
+	off = d[i] * 8;
+	if (off && ((off + 1) < fru->data_len) && d[off+1])
+	    fru_cache_add_probe(fru, off + (d[off+1] * 8) - 1, 1);
+    }
+
+    /* The first multi-record header has checksums of itself and its
+       record. */
+    off = d[5] * 8;
+    if (off)
+	fru_cache_add_probe(fru, off, 5);
+}
+
+static void
+fru_db_fetched(void          *cb_data,
+	       int           err,
+	       unsigned char *data,
+	       unsigned int  data_len)
+{
+    os_handler_t *os_hnd = cb_data;
+
+    /* Too late to use it, the data is being fetched from the device. */
+    if (!err)
+	os_hnd->database_free(os_hnd, data);
+}
+
+/* Get the cached copy of the FRU data and set up the probes to check
+   it against the device.  Returns 0 if the cached data is usable. */
+static int
+fru_cache_load(ipmi_fru_t *fru)
+{
+    os_handler_t        *os_hnd = fru->os_hnd;
+    ipmi_cache_t        *cache = NULL;
+    ipmi_cache_hdr_t    hdr;
+    const unsigned char *data;
+    unsigned char       *db_data = NULL;
+    unsigned int        db_data_len;
+    unsigned int        fetched = 0;
+    unsigned int        count;
+    uint32_t            words, timestamp;
+    int                 rv;
+
+    if (ipmi_cache_map(os_hnd, fru->cache_key, IPMI_CACHE_FRU, 1, &cache)
+	== 0)
+    {
+	data = ipmi_cache_data(cache);
+	count = ipmi_cache_count(cache);
+	words = ipmi_cache_stamp1(cache);
+	timestamp = ipmi_cache_stamp2(cache);
+    } else if (os_hnd->database_find) {
+	rv = os_hnd->database_find(os_hnd, fru->cache_key, &fetched,
+				   &db_data, &db_data_len,
+				   fru_db_fetched, os_hnd);
+	if (rv || !fetched)
+	    return ENOENT;
+	rv = ipmi_cache_check(db_data, db_data_len, IPMI_CACHE_FRU, 1, &hdr);
+	if (rv) {
+	    os_hnd->database_free(os_hnd, db_data);
+	    return rv;
+	}
+	data = db_data + hdr.hdr_len;
+	count = hdr.count;
+	words = hdr.stamp1;
+	timestamp = hdr.stamp2;
+    } else
+	return ENOSYS;
+
+    if ((count != fru->data_len)
+	|| (words != (uint32_t) fru->access_by_words)
+	|| (timestamp != fru->last_timestamp))
+    {
+	rv = EINVAL;
+    } else {
+	fru->cache_data = ipmi_mem_alloc(count);
+	if (!fru->cache_data)
+	    rv = ENOMEM;
+	else {
+	    memcpy(fru->cache_data, data, count);
+	    rv = 0;
+	}
+    }
+
+    if (cache)
+	ipmi_cache_release(cache);
+    else
+	os_hnd->database_free(os_hnd, db_data);
+
+    if (!rv)
+	fru_cache_setup_probes(fru);
+    return rv;
+}
+
 static void
 fetch_complete(ipmi_domain_t *domain, ipmi_fru_t *fru, int err)
 {
@@ -916,8 +1162,13 @@ fetch_complete(ipmi_domain_t *domain, ipmi_fru_t *fru, int err)
 		     _ipmi_fru_get_iname(fru));
 	}
 	_ipmi_fru_lock(fru);
+	if (!err && !fru->from_cache)
+	    fru_cache_store(fru);
     }
 
+    if (fru->cache_data)
+	ipmi_mem_free(fru->cache_data);
+    fru->cache_data = NULL;
     if (fru->data)
 	ipmi_mem_free(fru->data);
     fru->data = NULL;
@@ -932,10 +1183,7 @@ fetch_complete(ipmi_domain_t *domain, ipmi_fru_t *fru, int err)
     fru_put(fru);
 }
 
-static int request_next_data(ipmi_domain_t *domain,
-			     ipmi_fru_t    *fru,
-			     ipmi_addr_t   *addr,
-			     unsigned int  addr_len);
+static void fru_start_data_fetch(ipmi_domain_t *domain, ipmi_fru_t *fru);
 
 static void
 end_fru_fetch(ipmi_fru_t    *fru,
@@ -976,24 +1224,167 @@ end_fru_fetch(ipmi_fru_t    *fru,
     return;
 }
 
+static int fru_data_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi);
+
+static int
+fru_send_read(ipmi_domain_t *domain, ipmi_fru_t *fru, fru_read_t *rd)
+{
+    unsigned char cmd_data[4];
+    ipmi_msg_t    msg;
+    unsigned int  to_read;
+    int           rv;
+
+    /* We only request as much as we have to.  Don't always reqeust
+       the maximum amount, some machines don't like this. */
+    to_read = rd->length;
+    if (to_read > (unsigned int) fru->fetch_size)
+	to_read = fru->fetch_size;
+
+    cmd_data[0] = fru->device_id;
+    ipmi_set_uint16(cmd_data+1, rd->offset >> fru->access_by_words);
+    cmd_data[3] = to_read >> fru->access_by_words;
+    msg.netfn = IPMI_STORAGE_NETFN;
+    msg.cmd = IPMI_READ_FRU_DATA_CMD;
+    msg.data = cmd_data;
+    msg.data_len = 4;
+
+    rv = ipmi_send_command_addr(domain,
+				&fru->addr, fru->addr_len,
+				&msg,
+				fru_data_handler,
+				fru,
+				rd);
+    if (!rv) {
+	rd->state = FRU_READ_SENT;
+	rd->sent_len = to_read;
+	fru->reads_sent++;
+    }
+    return rv;
+}
+
+/* Must be called with the FRU locked, returns with it unlocked.
+   Sends reads until the window is full, resending reads that need it
+   first, and finishes the fetch once nothing is outstanding. */
+static void
+fru_fetch_continue(ipmi_domain_t *domain, ipmi_fru_t *fru)
+{
+    fru_read_t   *rd;
+    unsigned int i;
+    int          rv;
+
+    for (i=0; i<FRU_FETCH_WINDOW; i++) {
+	rd = &fru->reads[i];
+	if (rd->state != FRU_READ_WAITING)
+	    continue;
+	if (fru->fetch_err || (rd->offset >= fru->data_len)) {
+	    /* Failed or truncated, this is no longer needed. */
+	    rd->state = FRU_READ_FREE;
+	    continue;
+	}
+	if (fru->reads_sent >= fru->fetch_window)
+	    break;
+	rv = fru_send_read(domain, fru, rd);
+	if (rv) {
+	    rd->state = FRU_READ_FREE;
+	    fru->fetch_err = rv;
+	}
+    }
+
+    for (i=0; i<fru->fetch_window; i++) {
+	if (fru->fetch_err
+	    || (fru->reads_sent >= fru->fetch_window)
+	    || (fru->next_read_pos >= fru->data_len))
+	    break;
+	rd = &fru->reads[i];
+	if (rd->state != FRU_READ_FREE)
+	    continue;
+	rd->offset = fru->next_read_pos;
+	rd->length = fru->data_len - fru->next_read_pos;
+	if (rd->length > (unsigned int) fru->fetch_size)
+	    rd->length = fru->fetch_size;
+	fru->next_read_pos += rd->length;
+	rv = fru_send_read(domain, fru, rd);
+	if (rv)
+	    fru->fetch_err = rv;
+    }
+
+    if (fru->reads_sent > 0) {
+	_ipmi_fru_unlock(fru);
+	return;
+    }
+
+    if (fru->fetch_err) {
+	ipmi_log(IPMI_LOG_ERR_INFO,
+		 "%sfru.c(fru_fetch_continue): "
+		 "Error fetching FRU data: %x",
+		 FRU_DOMAIN_NAME(fru), fru->fetch_err);
+	fetch_complete(domain, fru, fru->fetch_err);
+	return;
+    }
+
+    if (fru->timestamp_cb) {
+	rv = fru->timestamp_cb(fru, domain, end_fru_fetch);
+	if (rv)
+	    fetch_complete(domain, fru, rv);
+	else
+	    _ipmi_fru_unlock(fru);
+    } else
+	fetch_complete(domain, fru, 0);
+}
+
+/* Must be called with the FRU locked, returns with it unlocked. */
+static void
+fru_start_data_fetch(ipmi_domain_t *domain, ipmi_fru_t *fru)
+{
+    memset(fru->reads, 0, sizeof(fru->reads));
+    fru->curr_pos = 0;
+    fru->next_read_pos = 0;
+    fru->reads_sent = 0;
+    fru->fetch_err = 0;
+    fru_fetch_continue(domain, fru);
+}
+
+/* Is everything before the given read's offset already here? */
+static int
+fru_read_is_first(ipmi_fru_t *fru, fru_read_t *rd)
+{
+    unsigned int i;
+
+    if (fru->next_read_pos < rd->offset)
+	return 0;
+    for (i=0; i<FRU_FETCH_WINDOW; i++) {
+	if ((&fru->reads[i] != rd)
+	    && (fru->reads[i].state != FRU_READ_FREE)
+	    && (fru->reads[i].offset < rd->offset))
+	    return 0;
+    }
+    return 1;
+}
+
 static int
 fru_data_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 {
-    ipmi_addr_t   *addr = &rspi->addr;
-    unsigned int  addr_len = rspi->addr_len;
     ipmi_msg_t    *msg = &rspi->msg;
     ipmi_fru_t    *fru = rspi->data1;
+    fru_read_t    *rd = rspi->data2;
     unsigned char *data = msg->data;
-    int           count;
-    int           err;
+    unsigned int  count;
 
     _ipmi_fru_lock(fru);
 
+    fru->reads_sent--;
+    rd->state = FRU_READ_FREE;
+
     if (fru->deleted) {
-	fetch_complete(domain, fru, ECANCELED);
+	if (!fru->fetch_err)
+	    fru->fetch_err = ECANCELED;
 	goto out;
     }
 
+    /* Another read failed, just wait for the rest to finish. */
+    if (fru->fetch_err)
+	goto out;
+
     /* The timeout and unknown errors should not be necessary, but
        some broken systems just don't return anything if the response
        is too big. */
@@ -1002,47 +1393,43 @@ fru_data_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 	 || (data[0] == IPMI_REQUEST_DATA_LENGTH_INVALID_CC)
 	 || (data[0] == IPMI_TIMEOUT_CC)
 	 || (data[0] == IPMI_UNKNOWN_ERR_CC))
-	&& (fru->fetch_size > MIN_FRU_DATA_FETCH))
+	&& ((fru->fetch_size > MIN_FRU_DATA_FETCH)
+	    || (rd->sent_len > (unsigned int) fru->fetch_size)))
     {
 	/* System couldn't support the given size, try decreasing and
-	   starting again. */
-	fru->fetch_size -= FRU_DATA_FETCH_DECR;
-	err = request_next_data(domain, fru, addr, addr_len);
-	if (err) {
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "%sfru.c(fru_data_handler): "
-		     "Error requesting next FRU data (2)",
-		     FRU_DOMAIN_NAME(fru));
-	    fetch_complete(domain, fru, err);
-	    goto out;
-	}
-	goto out_unlock;
+	   try again.  Other reads may have already decreased it. */
+	if (rd->sent_len <= (unsigned int) fru->fetch_size)
+	    fru->fetch_size -= FRU_DATA_FETCH_DECR;
+	rd->state = FRU_READ_WAITING;
+	goto out;
     }
 
     if (data[0] != 0) {
-	if (fru->curr_pos >= 8) {
+	if ((fru->fetch_window > 1) || (fru->reads_sent > 0)) {
+	    /* The device may not handle more than one read at a time,
+	       read it serially and try again. */
+	    if (fru->fetch_window > 1)
+		ipmi_log(IPMI_LOG_WARNING,
+			 "%sfru.c(fru_data_handler): "
+			 "IPMI error getting FRU data with multiple reads"
+			 " outstanding: %x, reading serially",
+			 FRU_DOMAIN_NAME(fru), data[0]);
+	    fru->fetch_window = 1;
+	    rd->state = FRU_READ_WAITING;
+	} else if ((rd->offset >= 8) && fru_read_is_first(fru, rd)) {
 	    /* Some screwy cards give more size in the info than they
 	       really have, if we have enough, try to process it. */
 	    ipmi_log(IPMI_LOG_WARNING,
 		     "%sfru.c(fru_data_handler): "
 		     "IPMI error getting FRU data: %x",
 		     FRU_DOMAIN_NAME(fru), data[0]);
-	    fru->data_len = fru->curr_pos;
-	    if (fru->timestamp_cb) {
-		err = fru->timestamp_cb(fru, domain, end_fru_fetch);
-		if (err)
-		    fetch_complete(domain, fru, err);
-		else
-		    goto out_unlock;
-	    } else {
-		fetch_complete(domain, fru, 0);
-	    }
+	    fru->data_len = rd->offset;
 	} else {
 	    ipmi_log(IPMI_LOG_ERR_INFO,
 		     "%sfru.c(fru_data_handler): "
 		     "IPMI error getting FRU data: %x",
 		     FRU_DOMAIN_NAME(fru), data[0]);
-	    fetch_complete(domain, fru, IPMI_IPMI_ERR_VAL(data[0]));
+	    fru->fetch_err = IPMI_IPMI_ERR_VAL(data[0]);
 	}
 	goto out;
     }
@@ -1052,7 +1439,7 @@ fru_data_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 		 "%sfru.c(fru_data_handler): "
 		 "FRU data response too small",
 		 FRU_DOMAIN_NAME(fru));
-	fetch_complete(domain, fru, EINVAL);
+	fru->fetch_err = EINVAL;
 	goto out;
     }
 
@@ -1063,71 +1450,52 @@ fru_data_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 		 "%sfru.c(fru_data_handler): "
 		 "FRU got zero-sized data, must make progress!",
 		 FRU_DOMAIN_NAME(fru));
-	fetch_complete(domain, fru, EINVAL);
+	fru->fetch_err = EINVAL;
 	goto out;
     }
 
-    if (count > msg->data_len-2) {
+    if (count > (unsigned int) (msg->data_len-2)) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "%sfru.c(fru_data_handler): "
 		 "FRU data count mismatch",
 		 FRU_DOMAIN_NAME(fru));
-	fetch_complete(domain, fru, EINVAL);
+	fru->fetch_err = EINVAL;
 	goto out;
     }
 
-    memcpy(fru->data+fru->curr_pos, data+2, count);
-    fru->curr_pos += count;
+    /* Don't let a device that returns too much overrun the range. */
+    if (count > rd->length)
+	count = rd->length;
 
-    if (fru->curr_pos < fru->data_len) {
-	/* More to fetch. */
-	err = request_next_data(domain, fru, addr, addr_len);
-	if (err) {
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "%sfru.c(fru_data_handler): "
-		     "Error requesting next FRU data",
-		     FRU_DOMAIN_NAME(fru));
-	    fetch_complete(domain, fru, err);
-	    goto out;
-	}
-    } else {
-	if (fru->timestamp_cb) {
-	    err = fru->timestamp_cb(fru, domain, end_fru_fetch);
-	    if (err) {
-		fetch_complete(domain, fru, err);
-		goto out;
-	    }
-	} else {
-	    fetch_complete(domain, fru, 0);
-	    goto out;
-	}
-    }
+    memcpy(fru->data+rd->offset, data+2, count);
+    fru->curr_pos += count;
+    rd->offset += count;
+    rd->length -= count;
+    if (rd->length > 0)
+	/* Short read, get the rest. */
+	rd->state = FRU_READ_WAITING;
 
- out_unlock:
-    _ipmi_fru_unlock(fru);
  out:
+    fru_fetch_continue(domain, fru);
     return IPMI_MSG_ITEM_NOT_USED;
 }
 
+static int fru_probe_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi);
+
 static int
-request_next_data(ipmi_domain_t *domain,
-		  ipmi_fru_t    *fru,
-		  ipmi_addr_t   *addr,
-		  unsigned int  addr_len)
+request_next_probe(ipmi_domain_t *domain,
+		   ipmi_fru_t    *fru,
+		   ipmi_addr_t   *addr,
+		   unsigned int  addr_len)
 {
     unsigned char cmd_data[4];
     ipmi_msg_t    msg;
-    int           to_read;
-
-    /* We only request as much as we have to.  Don't always reqeust
-       the maximum amount, some machines don't like this. */
-    to_read = fru->data_len - fru->curr_pos;
-    if (to_read > fru->fetch_size)
-	to_read = fru->fetch_size;
+    unsigned int  offset = fru->probes[fru->curr_probe].offset;
+    unsigned int  length = fru->probes[fru->curr_probe].length;
 
     cmd_data[0] = fru->device_id;
-    ipmi_set_uint16(cmd_data+1, fru->curr_pos >> fru->access_by_words);
-    cmd_data[3] = to_read >> fru->access_by_words;
+    ipmi_set_uint16(cmd_data+1, offset >> fru->access_by_words);
+    cmd_data[3] = length >> fru->access_by_words;
     msg.netfn = IPMI_STORAGE_NETFN;
     msg.cmd = IPMI_READ_FRU_DATA_CMD;
     msg.data = cmd_data;
@@ -1136,11 +1504,81 @@ request_next_data(ipmi_domain_t *domain,
     return ipmi_send_command_addr(domain,
 				  addr, addr_len,
 				  &msg,
-				  fru_data_handler,
+				  fru_probe_handler,
 				  fru,
 				  NULL);
 }
 
+static int
+fru_probe_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
+{
+    ipmi_addr_t   *addr = &rspi->addr;
+    unsigned int  addr_len = rspi->addr_len;
+    ipmi_msg_t    *msg = &rspi->msg;
+    ipmi_fru_t    *fru = rspi->data1;
+    unsigned char *data = msg->data;
+    unsigned int  offset = fru->probes[fru->curr_probe].offset;
+    unsigned int  length = fru->probes[fru->curr_probe].length;
+    int           err;
+
+    _ipmi_fru_lock(fru);
+
+    if (fru->deleted) {
+	fetch_complete(domain, fru, ECANCELED);
+	goto out;
+    }
+
+    if ((data[0] != 0)
+	|| (msg->data_len < 2)
+	|| ((unsigned int) (data[1] << fru->access_by_words) < length)
+	|| ((unsigned int) (msg->data_len - 2) < length)
+	|| (memcmp(data+2, fru->cache_data+offset, length) != 0))
+    {
+	/* The device doesn't match the cache (or can't tell us), so
+	   read it all. */
+	fru_stat_add(fru->fru_cache_misses, 1);
+	ipmi_mem_free(fru->cache_data);
+	fru->cache_data = NULL;
+	fru_start_data_fetch(domain, fru);
+	goto out;
+    }
+
+    fru->curr_probe++;
+    if (fru->curr_probe < fru->num_probes) {
+	err = request_next_probe(domain, fru, addr, addr_len);
+	if (err) {
+	    ipmi_log(IPMI_LOG_ERR_INFO,
+		     "%sfru.c(fru_probe_handler): "
+		     "Error requesting next FRU probe",
+		     FRU_DOMAIN_NAME(fru));
+	    fetch_complete(domain, fru, err);
+	    goto out;
+	}
+	goto out_unlock;
+    }
+
+    /* Everything matched, use the cached data. */
+    fru_stat_add(fru->fru_cache_hits, 1);
+    memcpy(fru->data, fru->cache_data, fru->data_len);
+    fru->curr_pos = fru->data_len;
+    fru->from_cache = 1;
+    if (fru->timestamp_cb) {
+	err = fru->timestamp_cb(fru, domain, end_fru_fetch);
+	if (err) {
+	    fetch_complete(domain, fru, err);
+	    goto out;
+	}
+    } else {
+	fetch_complete(domain, fru, 0);
+	goto out;
+    }
+
+ out_unlock:
+    _ipmi_fru_unlock(fru);
+ out:
+    return IPMI_MSG_ITEM_NOT_USED;
+}
+
 static int
 fru_inventory_area_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 {
@@ -1198,11 +1636,20 @@ fru_inventory_area_handler(ipmi_domain_t *domain, ipmi_msgi_t *rspi)
 	goto out;
     }
 
-    err = request_next_data(domain, fru, addr, addr_len);
+    /* If there is a cached copy, check it against the device instead
+       of reading the whole thing. */
+    if (!fru->cache_key_set || (fru_cache_load(fru) != 0)) {
+	if (fru->cache_key_set)
+	    fru_stat_add(fru->fru_cache_misses, 1);
+	fru_start_data_fetch(domain, fru);
+	goto out;
+    }
+
+    err = request_next_probe(domain, fru, addr, addr_len);
     if (err) {
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "%sfru.c(fru_inventory_area_handler): "
-		 "Error requesting next FRU data",
+		 "Error requesting FRU probe",
 		 FRU_DOMAIN_NAME(fru));
 	fetch_complete(domain, fru, err);
 	goto out;
@@ -1321,6 +1768,9 @@ write_complete(ipmi_domain_t *domain, ipmi_fru_t *fru, int err)
 	/* If we succeed, set everything unchanged. */
 	if (fru->ops.write_complete)
 	    fru->ops.write_complete(fru);
+	/* The device now holds what was written, keep the cache in
+	   sync with it. */
+	fru_cache_store(fru);
     }
     if (fru->data)
 	ipmi_mem_free(fru->data);
@@ -433,6 +433,7 @@ int _ipmi_rakp_init(void);
 int _ipmi_aes_cbc_init(void);
 int _ipmi_hmac_init(void);
 int _ipmi_md5_init(void);
+int _ipmi_sensor_init(void);
 int _ipmi_fru_init(void);
 int _ipmi_normal_fru_init(void);
 int _ipmi_fru_spd_decoder_init(void);
@@ -452,11 +453,29 @@ void ipmi_oem_atca_shutdown(void);
 int _ipmi_smi_shutdown(void);
 int _ipmi_lan_shutdown(void);
 void _ipmi_sol_shutdown(void);
+void _ipmi_sensor_shutdown(void);
 
 
 static locked_list_t *con_type_list;
 static int ipmi_initialized;
 
+/* Message items are allocated and freed for every command and
+   response, keep some around. */
+#define MSG_ITEM_POOL_MAX_FREE	256
+static ipmi_mem_pool_t *msg_item_pool;
+
+/* Message data from ipmi_alloc_msg_item_data() of up to
+   IPMI_MAX_MSG_LENGTH bytes comes from a pool, anything bigger is
+   allocated.  A header in front of the data says which. */
+#define MSG_DATA_POOL_MAX_FREE	64
+static ipmi_mem_pool_t *msg_data_pool;
+typedef union msg_data_hdr_u
+{
+    int    pooled;
+    void   *align_p;
+    double align_d;
+} msg_data_hdr_t;
+
 int
 ipmi_init(os_handler_t *handler)
 {
@@ -475,9 +494,24 @@ ipmi_init(os_handler_t *handler)
 
     con_type_list = locked_list_alloc(handler);
 
+    msg_item_pool = ipmi_mem_pool_alloc(handler, "msg_item",
+					sizeof(ipmi_msgi_t),
+					MSG_ITEM_POOL_MAX_FREE);
+    if (!msg_item_pool)
+	return ENOMEM;
+
+    msg_data_pool = ipmi_mem_pool_alloc(handler, "msg_data",
+					sizeof(msg_data_hdr_t)
+					+ IPMI_MAX_MSG_LENGTH,
+					MSG_DATA_POOL_MAX_FREE);
+    if (!msg_data_pool) {
+	rv = ENOMEM;
+	goto out_err_pools;
+    }
+
     rv = _ipmi_conn_init(handler);
     if (rv)
-	return rv;
+	goto out_err_pools;
 
     ipmi_initialized = 1;
 
@@ -502,6 +536,10 @@ ipmi_init(os_handler_t *handler)
     _ipmi_domain_init();
     _ipmi_mc_init();
 
+    rv = _ipmi_sensor_init();
+    if (rv)
+	goto out_err;
+
     rv = _ipmi_rakp_init();
     if (rv)
 	goto out_err;
@@ -545,6 +583,15 @@ ipmi_init(os_handler_t *handler)
  out_err:
     ipmi_shutdown();
     return rv;
+
+ out_err_pools:
+    if (msg_data_pool) {
+	ipmi_mem_pool_destroy(msg_data_pool);
+	msg_data_pool = NULL;
+    }
+    ipmi_mem_pool_destroy(msg_item_pool);
+    msg_item_pool = NULL;
+    return rv;
 }
 
 void
@@ -568,6 +615,7 @@ ipmi_shutdown(void)
     ipmi_oem_kontron_conn_shutdown();
     _ipmi_mc_shutdown();
     _ipmi_domain_shutdown();
+    _ipmi_sensor_shutdown();
     _ipmi_fru_spd_decoder_shutdown();
     _ipmi_conn_shutdown();
     _ipmi_normal_fru_shutdown();
@@ -576,6 +624,14 @@ ipmi_shutdown(void)
 	ipmi_os_handler->destroy_lock(ipmi_os_handler, seq_lock);
     if (con_type_list)
 	locked_list_destroy(con_type_list);
+    if (msg_item_pool) {
+	ipmi_mem_pool_destroy(msg_item_pool);
+	msg_item_pool = NULL;
+    }
+    if (msg_data_pool) {
+	ipmi_mem_pool_destroy(msg_data_pool);
+	msg_data_pool = NULL;
+    }
 
     ipmi_os_handler = NULL;
 
@@ -1188,7 +1244,10 @@ ipmi_alloc_msg_item(void)
 {
     ipmi_msgi_t *rv;
 
-    rv = ipmi_mem_alloc(sizeof(ipmi_msgi_t));
+    if (msg_item_pool)
+	rv = ipmi_mem_pool_get(msg_item_pool);
+    else
+	rv = ipmi_mem_alloc(sizeof(ipmi_msgi_t));
     if (!rv)
 	return NULL;
     memset(rv, 0, sizeof(*rv));
@@ -1201,19 +1260,42 @@ ipmi_free_msg_item(ipmi_msgi_t *item)
 {
     if (item->msg.data && (item->msg.data != item->data))
 	ipmi_free_msg_item_data(item->msg.data);
-    ipmi_mem_free(item);
+    if (msg_item_pool)
+	ipmi_mem_pool_put(msg_item_pool, item);
+    else
+	ipmi_mem_free(item);
 }
 
 void *
 ipmi_alloc_msg_item_data(unsigned int size)
 {
-    return ipmi_mem_alloc(size);
+    msg_data_hdr_t *hdr;
+
+    if (msg_data_pool && (size <= IPMI_MAX_MSG_LENGTH)) {
+	hdr = ipmi_mem_pool_get(msg_data_pool);
+	if (!hdr)
+	    return NULL;
+	hdr->pooled = 1;
+    } else {
+	hdr = ipmi_mem_alloc(sizeof(*hdr) + size);
+	if (!hdr)
+	    return NULL;
+	hdr->pooled = 0;
+    }
+    return hdr + 1;
 }
 
 void
 ipmi_free_msg_item_data(void *data)
 {
-    ipmi_mem_free(data);
+    msg_data_hdr_t *hdr = ((msg_data_hdr_t *) data) - 1;
+
+    /* Pool objects are plain allocations, so this is fine if the
+       pool is already gone. */
+    if (hdr->pooled && msg_data_pool)
+	ipmi_mem_pool_put(msg_data_pool, hdr);
+    else
+	ipmi_mem_free(hdr);
 }
 
 void
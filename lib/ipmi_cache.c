@@ -0,0 +1,218 @@
+/*
+ * ipmi_cache.c
+ *
+ * On-disk cache format for SDR and FRU data.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2002 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+
+#include <OpenIPMI/os_handler.h>
+
+#include <OpenIPMI/internal/ipmi_cache.h>
+#include <OpenIPMI/internal/ipmi_malloc.h>
+
+/* The element array is aligned so it can be used in place. */
+#define CACHE_HDR_LEN ((sizeof(ipmi_cache_hdr_t) + 7) & ~7)
+
+struct ipmi_cache_s
+{
+    os_handler_t        *os_hnd;
+    void                *handle;
+    const unsigned char *data;
+    ipmi_cache_hdr_t    hdr;
+};
+
+static uint32_t
+cache_checksum(const unsigned char *data, unsigned int len)
+{
+    uint32_t a = 1, b = 0;
+    unsigned int n;
+
+    while (len > 0) {
+	/* 5552 is the most bytes that can be summed before b can
+	   overflow 32 bits. */
+	n = len > 5552 ? 5552 : len;
+	len -= n;
+	while (n--) {
+	    a += *data++;
+	    b += a;
+	}
+	a %= 65521;
+	b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+int
+ipmi_cache_check(const unsigned char *data,
+		 unsigned int        len,
+		 unsigned int        kind,
+		 unsigned int        elem_size,
+		 ipmi_cache_hdr_t    *hdr)
+{
+    if ((len < sizeof(*hdr)) || (elem_size == 0))
+	return EINVAL;
+    memcpy(hdr, data, sizeof(*hdr));
+
+    if ((hdr->magic != IPMI_CACHE_MAGIC)
+	|| (hdr->version != IPMI_CACHE_VERSION)
+	|| (hdr->kind != kind)
+	|| (hdr->elem_size != elem_size)
+	|| (hdr->hdr_len != CACHE_HDR_LEN))
+	return EINVAL;
+
+    if (hdr->count > ((len - hdr->hdr_len) / elem_size))
+	return EINVAL;
+    if ((hdr->hdr_len + (hdr->count * elem_size)) != len)
+	return EINVAL;
+
+    if (cache_checksum(data + hdr->hdr_len, len - hdr->hdr_len)
+	!= hdr->checksum)
+	return EINVAL;
+
+    return 0;
+}
+
+int
+ipmi_cache_store(os_handler_t *os_hnd,
+		 const char   *key,
+		 unsigned int kind,
+		 unsigned int elem_size,
+		 unsigned int count,
+		 uint32_t     stamp1,
+		 uint32_t     stamp2,
+		 const void   *data)
+{
+    ipmi_cache_hdr_t *hdr;
+    unsigned char    *buf;
+    unsigned int     data_len = elem_size * count;
+    int              rv;
+
+    if (!os_hnd->cache_store && !os_hnd->database_store)
+	return ENOSYS;
+
+    buf = ipmi_mem_alloc(CACHE_HDR_LEN + data_len);
+    if (!buf)
+	return ENOMEM;
+    memset(buf, 0, CACHE_HDR_LEN);
+    hdr = (ipmi_cache_hdr_t *) buf;
+    hdr->magic = IPMI_CACHE_MAGIC;
+    hdr->version = IPMI_CACHE_VERSION;
+    hdr->kind = kind;
+    hdr->hdr_len = CACHE_HDR_LEN;
+    hdr->elem_size = elem_size;
+    hdr->count = count;
+    hdr->stamp1 = stamp1;
+    hdr->stamp2 = stamp2;
+    if (data_len)
+	memcpy(buf + CACHE_HDR_LEN, data, data_len);
+    hdr->checksum = cache_checksum(buf + CACHE_HDR_LEN, data_len);
+
+    if (os_hnd->cache_store)
+	rv = os_hnd->cache_store(os_hnd, key, buf, CACHE_HDR_LEN + data_len);
+    else
+	rv = os_hnd->database_store(os_hnd, (char *) key, buf,
+				    CACHE_HDR_LEN + data_len);
+    ipmi_mem_free(buf);
+    return rv;
+}
+
+int
+ipmi_cache_map(os_handler_t *os_hnd,
+	       const char   *key,
+	       unsigned int kind,
+	       unsigned int elem_size,
+	       ipmi_cache_t **cache)
+{
+    ipmi_cache_t        *c;
+    const unsigned char *data;
+    unsigned int        len;
+    void                *handle;
+    int                 rv;
+
+    if (!os_hnd->cache_map || !os_hnd->cache_unmap)
+	return ENOSYS;
+
+    c = ipmi_mem_alloc(sizeof(*c));
+    if (!c)
+	return ENOMEM;
+
+    rv = os_hnd->cache_map(os_hnd, key, &data, &len, &handle);
+    if (rv) {
+	ipmi_mem_free(c);
+	return rv;
+    }
+
+    rv = ipmi_cache_check(data, len, kind, elem_size, &c->hdr);
+    if (rv) {
+	os_hnd->cache_unmap(os_hnd, handle);
+	ipmi_mem_free(c);
+	return rv;
+    }
+
+    c->os_hnd = os_hnd;
+    c->handle = handle;
+    c->data = data + c->hdr.hdr_len;
+    *cache = c;
+    return 0;
+}
+
+const void *
+ipmi_cache_data(ipmi_cache_t *cache)
+{
+    return cache->data;
+}
+
+unsigned int
+ipmi_cache_count(ipmi_cache_t *cache)
+{
+    return cache->hdr.count;
+}
+
+uint32_t
+ipmi_cache_stamp1(ipmi_cache_t *cache)
+{
+    return cache->hdr.stamp1;
+}
+
+uint32_t
+ipmi_cache_stamp2(ipmi_cache_t *cache)
+{
+    return cache->hdr.stamp2;
+}
+
+void
+ipmi_cache_release(ipmi_cache_t *cache)
+{
+    cache->os_hnd->cache_unmap(cache->os_hnd, cache->handle);
+    ipmi_mem_free(cache);
+}
@@ -33,6 +33,9 @@
 
 #include <config.h>
 
+/* Get recvmmsg and sendmmsg for GNU. */
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -95,6 +98,15 @@ dump_hex(void *vdata, int len)
 #define DEFAULT_MAX_OUTSTANDING_MSG_COUNT 2
 #define MAX_POSSIBLE_OUTSTANDING_MSG_COUNT 63
 
+/* The number of messages actually allowed outstanding adapts between
+   1 and the maximum above.  It is halved (at most once per
+   LAN_WINDOW_BACKOFF_TIME microseconds) when a message times out,
+   and grows by one after a window's worth of responses come back, as
+   long as the round trip time stays under LAN_WINDOW_RTT_FACTOR times
+   the best seen, meaning the remote end is not just queueing them. */
+#define LAN_WINDOW_BACKOFF_TIME LAN_RSP_TIMEOUT
+#define LAN_WINDOW_RTT_FACTOR 2
+
 typedef struct lan_data_s lan_data_t;
 
 typedef struct audit_timer_info_s
@@ -125,6 +137,12 @@ typedef struct lan_wait_queue_s
     struct lan_wait_queue_s *next;
 } lan_wait_queue_t;
 
+/* Every command sent allocates a timer info, and a wait queue entry
+   if the window is full, so keep them in pools. */
+#define LAN_POOL_MAX_FREE	256
+static ipmi_mem_pool_t *lan_timer_pool;
+static ipmi_mem_pool_t *lan_wait_pool;
+
 #define MAX_IP_ADDR 2
 
 /* We must keep this number small, if it's too big and a failure
@@ -375,6 +393,9 @@ struct lan_data_s
 
 	/* The number of the last IP address sent on. */
 	int                   last_ip_num;
+
+	/* When the message was first sent, for round trip times. */
+	struct timeval        send_time;
     } seq_table[64];
     ipmi_lock_t               *seq_num_lock;
 
@@ -391,6 +412,14 @@ struct lan_data_s
        sequence zero. */
     unsigned int max_outstanding_msg_count;
 
+    /* The current adaptive limit on outstanding messages, and the
+       data used to adjust it.  Round trip times are in
+       microseconds. */
+    unsigned int   cur_window;
+    unsigned int   window_rsps;
+    long           min_rtt;
+    struct timeval window_backoff_time;
+
     /* Address family specified at startup. */
     unsigned int addr_family;
 
@@ -1069,21 +1098,68 @@ ipmi_rmcpp_auth_set_k2_len(ipmi_rmcpp_auth_t *ainfo,
 
 
 static void check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan);
+static void lan_window_loss(ipmi_con_t *ipmi, lan_data_t *lan);
 static int send_auth_cap(ipmi_con_t *ipmi, lan_data_t *lan, int addr_num,
 			 int force_ipmiv15);
 
 static os_handler_t *lan_os_hnd;
 
+#define IPMI_MAX_LAN_LEN    (IPMI_MAX_MSG_LENGTH + 128)
+#define IPMI_LAN_MAX_HEADER 128
+
+/* Maximum number of packets read from a socket with one call. */
+#define LAN_RECV_BATCH 16
+
+#ifdef HAVE_RECVMMSG
+/* The buffers for one recvmmsg() call.  These are too big for the
+   stack, so they come from a pool and are reused. */
+typedef struct lan_recv_batch_s
+{
+    unsigned char  data[LAN_RECV_BATCH][IPMI_MAX_LAN_LEN];
+    sockaddr_ip_t  addr[LAN_RECV_BATCH];
+    struct mmsghdr msgs[LAN_RECV_BATCH];
+    struct iovec   iov[LAN_RECV_BATCH];
+} lan_recv_batch_t;
+
+#define LAN_RECV_POOL_MAX_FREE	8
+static ipmi_mem_pool_t *lan_recv_pool;
+#endif
+
+#ifdef HAVE_SENDMMSG
+/* Maximum number of packets collected for one send call. */
+#define LAN_XMIT_BATCH 16
+
+struct lan_xmit_s
+{
+    unsigned char data[IPMI_MAX_LAN_LEN+IPMI_LAN_MAX_HEADER];
+    unsigned int  len;
+    sockaddr_ip_t addr;
+};
+#endif
+
 #define MAX_CONS_PER_FD	32
 struct lan_fd_s
 {
     int            fd;
     os_hnd_fd_id_t *fd_wait_id;
     unsigned int   cons_in_use;
+    /* Receive handlers running on the fd.  It is not closed until
+       these are done, even if the last connection goes away. */
+    unsigned int   recv_users;
     lan_data_t     *lan[MAX_CONS_PER_FD];
     lan_fd_t       *next, *prev;
     ipmi_lock_t    *con_lock;
 
+#ifdef HAVE_SENDMMSG
+    /* While something is holding the transmit side (see
+       lan_xmit_hold()), outgoing packets are collected here and sent
+       together when the last holder releases it. */
+    ipmi_lock_t       *xmit_lock;
+    unsigned int      xmit_hold;
+    unsigned int      xmit_count;
+    struct lan_xmit_s *xmit;
+#endif
+
     /* Main list info. */
     ipmi_lock_t    *lock;
     lan_fd_t       **free_list;
@@ -1182,6 +1258,17 @@ move_to_lan_list_head(lan_fd_t *item)
     list->next = item;
 }
 
+static void
+free_lan_fd(lan_fd_t *item)
+{
+    ipmi_destroy_lock(item->con_lock);
+#ifdef HAVE_SENDMMSG
+    ipmi_destroy_lock(item->xmit_lock);
+    ipmi_mem_free(item->xmit);
+#endif
+    ipmi_mem_free(item);
+}
+
 static lan_fd_t *
 find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 {
@@ -1268,6 +1355,24 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
 		    ipmi_mem_free(item);
 		    goto out_unlock;
 		}
+#ifdef HAVE_SENDMMSG
+		item->xmit = ipmi_mem_alloc(sizeof(*item->xmit)
+					    * LAN_XMIT_BATCH);
+		if (!item->xmit) {
+		    ipmi_destroy_lock(item->con_lock);
+		    ipmi_mem_free(item);
+		    item = NULL;
+		    goto out_unlock;
+		}
+		rv = ipmi_create_global_lock(&item->xmit_lock);
+		if (rv) {
+		    ipmi_mem_free(item->xmit);
+		    ipmi_destroy_lock(item->con_lock);
+		    ipmi_mem_free(item);
+		    item = NULL;
+		    goto out_unlock;
+		}
+#endif
 		item->lock = lock;
 		item->free_list = free_list;
 		item->list = list;
@@ -1325,24 +1430,34 @@ find_free_lan_fd(int family, lan_data_t *lan, int *slot)
     return item;
 }
 
+/* Close the fd and put the item on the free list if nothing is using
+   it.  Must be called with the list lock held.  Returns true if the
+   item was freed. */
+static int
+close_unused_lan_fd(lan_fd_t *item)
+{
+    if (item->cons_in_use != 0 || item->recv_users != 0)
+	return 0;
+
+    lan_os_hnd->remove_fd_to_wait_for(lan_os_hnd, item->fd_wait_id);
+    close(item->fd);
+    item->next->prev = item->prev;
+    item->prev->next = item->next;
+    item->next = *(item->free_list);
+    *(item->free_list) = item;
+    return 1;
+}
+
 static void
 release_lan_fd(lan_fd_t *item, int slot)
 {
     ipmi_lock(item->lock);
     item->lan[slot] = NULL;
     item->cons_in_use--;
-    if (item->cons_in_use == 0) {
-	lan_os_hnd->remove_fd_to_wait_for(lan_os_hnd, item->fd_wait_id);
-	close(item->fd);
-	item->next->prev = item->prev;
-	item->prev->next = item->next;
-	item->next = *(item->free_list);
-	*(item->free_list) = item;
-    } else {
+    if (!close_unused_lan_fd(item))
 	/* This has free connections, move it to the head of the
 	   list. */
 	move_to_lan_list_head(item);
-    }
     ipmi_unlock(item->lock);
 }
 
@@ -1585,8 +1700,101 @@ auth_check(lan_data_t    *lan,
     return rv;
 }
 
-#define IPMI_MAX_LAN_LEN    (IPMI_MAX_MSG_LENGTH + 128)
-#define IPMI_LAN_MAX_HEADER 128
+#ifdef HAVE_SENDMMSG
+/* Must be called with the xmit lock held. */
+static void
+lan_xmit_flush(lan_fd_t *item)
+{
+    struct mmsghdr msgs[LAN_XMIT_BATCH];
+    struct iovec   iov[LAN_XMIT_BATCH];
+    unsigned int   i, sent = 0;
+    int            rv;
+
+    for (i=0; i<item->xmit_count; i++) {
+	iov[i].iov_base = item->xmit[i].data;
+	iov[i].iov_len = item->xmit[i].len;
+	memset(&msgs[i], 0, sizeof(msgs[i]));
+	msgs[i].msg_hdr.msg_name = &item->xmit[i].addr.s_ipsock;
+	msgs[i].msg_hdr.msg_namelen = item->xmit[i].addr.ip_addr_len;
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (sent < item->xmit_count) {
+	rv = sendmmsg(item->fd, msgs + sent, item->xmit_count - sent, 0);
+	if (rv <= 0) {
+	    /* The messages will time out and be resent, just like a
+	       lost packet. */
+	    if (DEBUG_RAWMSG || DEBUG_MSG_ERR)
+		ipmi_log(IPMI_LOG_DEBUG, "ipmi_lan: Dropped %d outgoing"
+			 " packets, error %d", item->xmit_count - sent,
+			 rv < 0 ? errno : 0);
+	    break;
+	}
+	sent += rv;
+    }
+    item->xmit_count = 0;
+}
+
+/* Hold outgoing packets on the fd until lan_xmit_release() is
+   called, so they can all be sent with one call.  These nest. */
+static void
+lan_xmit_hold(lan_fd_t *item)
+{
+    ipmi_lock(item->xmit_lock);
+    item->xmit_hold++;
+    ipmi_unlock(item->xmit_lock);
+}
+
+static void
+lan_xmit_release(lan_fd_t *item)
+{
+    ipmi_lock(item->xmit_lock);
+    item->xmit_hold--;
+    if ((item->xmit_hold == 0) && (item->xmit_count > 0))
+	lan_xmit_flush(item);
+    ipmi_unlock(item->xmit_lock);
+}
+#else
+#define lan_xmit_hold(item) do { } while (0)
+#define lan_xmit_release(item) do { } while (0)
+#endif
+
+static int
+lan_xmit(lan_data_t *lan, unsigned char *data, unsigned int len,
+	 int addr_num)
+{
+    sockaddr_ip_t *addr = &lan->cparm.ip_addr[addr_num];
+    int           rv;
+
+#ifdef HAVE_SENDMMSG
+    lan_fd_t *item = lan->fd;
+
+    ipmi_lock(item->xmit_lock);
+    if (item->xmit_hold > 0) {
+	struct lan_xmit_s *x = &item->xmit[item->xmit_count];
+
+	memcpy(x->data, data, len);
+	x->len = len;
+	x->addr = *addr;
+	item->xmit_count++;
+	if (item->xmit_count >= LAN_XMIT_BATCH)
+	    lan_xmit_flush(item);
+	ipmi_unlock(item->xmit_lock);
+	return 0;
+    }
+    ipmi_unlock(item->xmit_lock);
+#endif
+
+    rv = sendto(lan->fd->fd, data, len, 0,
+		(struct sockaddr *) &addr->s_ipsock, addr->ip_addr_len);
+    if (rv == -1)
+	rv = errno;
+    else
+	rv = 0;
+
+    return rv;
+}
 
 static int
 rmcpp_format_msg(lan_data_t *lan, int addr_num,
@@ -1900,15 +2108,7 @@ lan_send_addr(lan_data_t              *lan,
 
     add_stat(lan->ipmi, STAT_XMIT_PACKETS, 1);
 
-    rv = sendto(lan->fd->fd, tmsg, pos, 0,
-		(struct sockaddr *) &(lan->cparm.ip_addr[addr_num].s_ipsock),
-		lan->cparm.ip_addr[addr_num].ip_addr_len);
-    if (rv == -1)
-	rv = errno;
-    else
-	rv = 0;
-
-    return rv;
+    return lan_xmit(lan, tmsg, pos, addr_num);
 }
 
 static int
@@ -2436,6 +2636,7 @@ rsp_timeout_handler(void              *cb_data,
 	lan->seq_table[seq].retries_left--;
 
 	add_stat(ipmi, STAT_REXMITS, 1);
+	lan_window_loss(ipmi, lan);
 
 	/* Note that we will need a new session seq # here, we can't reuse
 	   the old one.  If the message got lost on the way back, the other
@@ -2483,6 +2684,7 @@ rsp_timeout_handler(void              *cb_data,
 	}
     } else {
 	add_stat(ipmi, STAT_TIMED_OUT, 1);
+	lan_window_loss(ipmi, lan);
 
 	rspi->data[0] = IPMI_TIMEOUT_CC;
     }
@@ -2524,7 +2726,7 @@ rsp_timeout_handler(void              *cb_data,
 
  out:
     lan_put(ipmi);
-    ipmi_mem_free(info);
+    ipmi_mem_pool_put(lan_timer_pool, info);
 }
 
 typedef struct call_event_handler_s
@@ -2614,6 +2816,67 @@ handle_async_event(ipmi_con_t        *ipmi,
 	ipmi_event_free(event);
 }
 
+/* A message timed out, back off.  Must be called with the message
+   sequence lock held. */
+static void
+lan_window_loss(ipmi_con_t *ipmi, lan_data_t *lan)
+{
+    struct timeval now;
+
+    ipmi->os_hnd->get_monotonic_time(ipmi->os_hnd, &now);
+    if (cmp_timeval(&now, &lan->window_backoff_time) < 0)
+	/* Already backed off for this loss. */
+	return;
+
+    lan->cur_window /= 2;
+    if (lan->cur_window < 1)
+	lan->cur_window = 1;
+    lan->window_rsps = 0;
+
+    lan->window_backoff_time = now;
+    lan->window_backoff_time.tv_sec += LAN_WINDOW_BACKOFF_TIME / 1000000;
+    lan->window_backoff_time.tv_usec += LAN_WINDOW_BACKOFF_TIME % 1000000;
+    if (lan->window_backoff_time.tv_usec >= 1000000) {
+	lan->window_backoff_time.tv_sec += 1;
+	lan->window_backoff_time.tv_usec -= 1000000;
+    }
+}
+
+/* A response came back for the message with the given sequence
+   number.  Must be called with the message sequence lock held. */
+static void
+lan_window_rsp(ipmi_con_t *ipmi, lan_data_t *lan, unsigned int seq)
+{
+    struct timeval now;
+    long           rtt = -1;
+
+    /* Only use messages that were not resent for timing, we can't
+       tell which send the response belongs to. */
+    if (lan->seq_table[seq].retries_left == LAN_RSP_RETRIES) {
+	ipmi->os_hnd->get_monotonic_time(ipmi->os_hnd, &now);
+	rtt = ((now.tv_sec - lan->seq_table[seq].send_time.tv_sec) * 1000000
+	       + (now.tv_usec - lan->seq_table[seq].send_time.tv_usec));
+	if (rtt < 0)
+	    rtt = 0;
+	if ((lan->min_rtt < 0) || (rtt < lan->min_rtt))
+	    lan->min_rtt = rtt;
+    }
+
+    if (lan->cur_window >= lan->max_outstanding_msg_count)
+	return;
+
+    lan->window_rsps++;
+    if (lan->window_rsps < lan->cur_window)
+	return;
+    lan->window_rsps = 0;
+
+    if ((rtt >= 0) && (rtt > lan->min_rtt * LAN_WINDOW_RTT_FACTOR))
+	/* Responses are slowing down, the window is big enough. */
+	return;
+
+    lan->cur_window++;
+}
+
 /* Must be called with the message sequence lock held. */
 static int
 handle_msg_send(lan_timer_info_t      *info,
@@ -2681,7 +2944,7 @@ handle_msg_send(lan_timer_info_t      *info,
 
 	if (ipmb->channel >= MAX_IPMI_USED_CHANNELS) {
 	    ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-	    ipmi_mem_free(info);
+	    ipmi_mem_pool_put(lan_timer_pool, info);
 	    rv = EINVAL;
 	    goto out;
 	}
@@ -2746,12 +3009,15 @@ handle_msg_send(lan_timer_info_t      *info,
 	ipmi->os_hnd->free_timer(ipmi->os_hnd,
 				 lan->seq_table[seq].timer);
 	lan->seq_table[seq].timer = NULL;
-	ipmi_mem_free(info);
+	ipmi_mem_pool_put(lan_timer_pool, info);
 	goto out;
     }
 
     lan->last_seq = seq;
 
+    ipmi->os_hnd->get_monotonic_time(ipmi->os_hnd,
+				     &lan->seq_table[seq].send_time);
+
     if (addr_num >= 0) {
 	rv = lan_send_addr(lan, addr, addr_len, msg, seq, addr_num, NULL);
 	lan->seq_table[seq].last_ip_num = addr_num;
@@ -2775,21 +3041,31 @@ handle_msg_send(lan_timer_info_t      *info,
 	    ipmi->os_hnd->free_timer(ipmi->os_hnd,
 				     lan->seq_table[seq].timer);
 	    lan->seq_table[seq].timer = NULL;
-	    ipmi_mem_free(info);
+	    ipmi_mem_pool_put(lan_timer_pool, info);
 	}
     }
  out:
     return rv;
 }
 
+/* A message has finished, start as many waiting commands as the
+   window now allows.  Must be called with the message sequence lock
+   held. */
 static void
 check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
 {
     int              rv;
     lan_wait_queue_t *q_item;
-    int              started = 0;
 
-    while (!started && (lan->wait_q != NULL)) {
+    lan->outstanding_msg_count--;
+
+    if (lan->wait_q == NULL)
+	return;
+
+    lan_xmit_hold(lan->fd);
+    while ((lan->wait_q != NULL)
+	   && (lan->outstanding_msg_count < lan->cur_window))
+    {
 	/* Commands are waiting to be started, remove the queue item
            and start it. */
 	q_item = lan->wait_q;
@@ -2801,6 +3077,8 @@ check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
 			     &(q_item->msg), q_item->rsp_handler,
 			     q_item->rsp_item, q_item->side_effects);
 	if (rv) {
+	    /* Don't hold other packets back while the user runs. */
+	    lan_xmit_release(lan->fd);
 	    ipmi_unlock(lan->seq_num_lock);
 
 	    /* Send an error response to the user. */
@@ -2817,15 +3095,13 @@ check_command_queue(ipmi_con_t *ipmi, lan_data_t *lan)
 					 &q_item->addr, q_item->addr_len,
 					 &q_item->msg, q_item->rsp_handler);
 	    ipmi_lock(lan->seq_num_lock);
+	    lan_xmit_hold(lan->fd);
 	} else {
-	    /* We successfully sent a message, break out of the loop. */
-	    started = 1;
+	    lan->outstanding_msg_count++;
 	}
-	ipmi_mem_free(q_item);
+	ipmi_mem_pool_put(lan_wait_pool, q_item);
     }
-
-    if (!started)
-	lan->outstanding_msg_count--;
+    lan_xmit_release(lan->fd);
 }
 
 /* Per the spec, RMCP and RMCP+ have different allowed sequence number
@@ -2978,9 +3254,12 @@ handle_payload(ipmi_con_t    *ipmi,
 	/* Timer is cancelled, free its data. */
 	ipmi->os_hnd->free_timer(ipmi->os_hnd,
 				 lan->seq_table[seq].timer);
-	ipmi_mem_free(lan->seq_table[seq].timer_info);
+	ipmi_mem_pool_put(lan_timer_pool,
+			  lan->seq_table[seq].timer_info);
     }
 
+    lan_window_rsp(ipmi, lan, seq);
+
     handler = lan->seq_table[seq].rsp_handler;
     rspi = lan->seq_table[seq].rsp_item;
     lan->seq_table[seq].inuse = 0;
@@ -3452,31 +3731,18 @@ rmcp_find_ipmi(lan_fd_t      *item,
 }
 
 static void
-data_handler(int            fd,
-	     void           *cb_data,
-	     os_hnd_fd_id_t *id)
+handle_lan_packet(lan_fd_t      *item,
+		  unsigned char *data,
+		  int           len,
+		  sockaddr_ip_t *ipaddrd)
 {
-    lan_fd_t           *item = cb_data;
     ipmi_con_t         *ipmi;
     lan_data_t         *lan;
-    unsigned char      data[IPMI_MAX_LAN_LEN];
-    sockaddr_ip_t      ipaddrd;
-    socklen_t          from_len;
-    int                len;
     int                addr_num = 0; /* Keep gcc happy and initialize */
 
-    from_len = sizeof(ipaddrd.s_ipsock);
-    len = recvfrom(fd, data, sizeof(data), 0, (struct sockaddr *)&ipaddrd, 
-		   &from_len);
-
-    if (len < 0)
-	/* Got an error, probably no data, just return. */
-	return;
-
-    ipaddrd.ip_addr_len = from_len;
     if (DEBUG_RAWMSG) {
 	ipmi_log(IPMI_LOG_DEBUG_START, "incoming\n addr = ");
-	dump_hex((unsigned char *) &ipaddrd, from_len);
+	dump_hex((unsigned char *) ipaddrd, ipaddrd->ip_addr_len);
 	if (len) {
 	    ipmi_log(IPMI_LOG_DEBUG_CONT, "\n data =\n  ");
 	    dump_hex(data, len);
@@ -3501,9 +3767,9 @@ data_handler(int            fd,
     }
 
     if ((data[4] & 0x0f) == IPMI_AUTHTYPE_RMCP_PLUS) {
-	ipmi = rmcpp_find_ipmi(item, data, len, &ipaddrd, &addr_num);
+	ipmi = rmcpp_find_ipmi(item, data, len, ipaddrd, &addr_num);
     } else {
-	ipmi = rmcp_find_ipmi(item, data, len, &ipaddrd, &addr_num);
+	ipmi = rmcp_find_ipmi(item, data, len, ipaddrd, &addr_num);
     }
 
     if (!lan_valid_ipmi(ipmi))
@@ -3525,6 +3791,77 @@ data_handler(int            fd,
     return;
 }
 
+#ifdef HAVE_RECVMMSG
+/* Read one batch of packets from the socket and handle them.  If
+   more are waiting the fd is still readable and this gets called
+   again.  A handler may end the last connection on the fd, so hold
+   it open until the whole batch is handled. */
+static void
+data_handler(int            fd,
+	     void           *cb_data,
+	     os_hnd_fd_id_t *id)
+{
+    lan_fd_t         *item = cb_data;
+    lan_recv_batch_t *b;
+    int              i, count;
+
+    b = ipmi_mem_pool_get(lan_recv_pool);
+    if (!b)
+	return;
+
+    for (i=0; i<LAN_RECV_BATCH; i++) {
+	b->iov[i].iov_base = b->data[i];
+	b->iov[i].iov_len = sizeof(b->data[i]);
+	memset(&b->msgs[i], 0, sizeof(b->msgs[i]));
+	b->msgs[i].msg_hdr.msg_name = &b->addr[i].s_ipsock;
+	b->msgs[i].msg_hdr.msg_namelen = sizeof(b->addr[i].s_ipsock);
+	b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+	b->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    ipmi_lock(item->lock);
+    item->recv_users++;
+    ipmi_unlock(item->lock);
+
+    count = recvmmsg(fd, b->msgs, LAN_RECV_BATCH, MSG_DONTWAIT, NULL);
+    /* On an error, probably no data, there is nothing to do. */
+    for (i=0; i<count; i++) {
+	b->addr[i].ip_addr_len = b->msgs[i].msg_hdr.msg_namelen;
+	handle_lan_packet(item, b->data[i], b->msgs[i].msg_len, &b->addr[i]);
+    }
+
+    ipmi_lock(item->lock);
+    item->recv_users--;
+    close_unused_lan_fd(item);
+    ipmi_unlock(item->lock);
+
+    ipmi_mem_pool_put(lan_recv_pool, b);
+}
+#else
+static void
+data_handler(int            fd,
+	     void           *cb_data,
+	     os_hnd_fd_id_t *id)
+{
+    lan_fd_t           *item = cb_data;
+    unsigned char      data[IPMI_MAX_LAN_LEN];
+    sockaddr_ip_t      ipaddrd;
+    socklen_t          from_len;
+    int                len;
+
+    from_len = sizeof(ipaddrd.s_ipsock);
+    len = recvfrom(fd, data, sizeof(data), 0, (struct sockaddr *)&ipaddrd, 
+		   &from_len);
+
+    if (len < 0)
+	/* Got an error, probably no data, just return. */
+	return;
+
+    ipaddrd.ip_addr_len = from_len;
+    handle_lan_packet(item, data, len, &ipaddrd);
+}
+#endif
+
 /* Note that this puts the address number in data4 of the rspi. */
 int
 ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
@@ -3559,7 +3896,7 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
     if (msg->netfn & 1)
 	return lan_send_addr(lan, addr, addr_len, msg, 0, addr_num, NULL);
 
-    info = ipmi_mem_alloc(sizeof(*info));
+    info = ipmi_mem_pool_get(lan_timer_pool);
     if (!info)
 	return ENOMEM;
     memset(info, 0, sizeof(*info));
@@ -3570,7 +3907,7 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
 
     rv = ipmi->os_hnd->alloc_timer(ipmi->os_hnd, &(info->timer));
     if (rv) {
-	ipmi_mem_free(info);
+	ipmi_mem_pool_put(lan_timer_pool, info);
 	return rv;
     }
 
@@ -3597,7 +3934,7 @@ ipmi_lan_send_command_forceip(ipmi_con_t            *ipmi,
 	if (info) {
 	    if (info->timer)
 		ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-	    ipmi_mem_free(info);
+	    ipmi_mem_pool_put(lan_timer_pool, info);
 	}
     }
     return rv;
@@ -3643,12 +3980,12 @@ lan_send_command_option(ipmi_con_t              *ipmi,
     }
 
     if (!rspi) {
-	rspi = ipmi_mem_alloc(sizeof(*rspi));
+	rspi = ipmi_alloc_msg_item();
 	if (!rspi)
 	    return ENOMEM;
     }
 
-    info = ipmi_mem_alloc(sizeof(*info));
+    info = ipmi_mem_pool_get(lan_timer_pool);
     if (!info) {
 	rv = ENOMEM;
 	goto out_unlock2;
@@ -3665,10 +4002,12 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 
     ipmi_lock(lan->seq_num_lock);
 
-    if (lan->outstanding_msg_count >= lan->max_outstanding_msg_count) {
+    if ((lan->outstanding_msg_count >= lan->cur_window)
+	|| (lan->wait_q != NULL))
+    {
 	lan_wait_queue_t *q_item;
 
-	q_item = ipmi_mem_alloc(sizeof(*q_item));
+	q_item = ipmi_mem_pool_get(lan_wait_pool);
 	if (!q_item) {
 	    ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
 	    rv = ENOMEM;
@@ -3705,7 +4044,7 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 	lan->outstanding_msg_count++;
     else if (!trspi && rspi)
 	/* If we allocated an rspi, free it on error. */
-	ipmi_mem_free(rspi);
+	ipmi_free_msg_item(rspi);
     ipmi_unlock(lan->seq_num_lock);
     return rv;
 
@@ -3715,14 +4054,14 @@ lan_send_command_option(ipmi_con_t              *ipmi,
 	if (info) {
 	    if (info->timer)
 		ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-	    ipmi_mem_free(info);
+	    ipmi_mem_pool_put(lan_timer_pool, info);
 	}
     }
  out_unlock2:
     if (rv) {
 	/* If we allocated an rspi, free it. */
 	if (!trspi && rspi)
-	    ipmi_mem_free(rspi);
+	    ipmi_free_msg_item(rspi);
     }
     return rv;
 }
@@ -4012,7 +4351,7 @@ lan_cleanup(ipmi_con_t *ipmi)
 		info->cancelled = 1;
 	    else {
 		ipmi->os_hnd->free_timer(ipmi->os_hnd, info->timer);
-		ipmi_mem_free(info);
+		ipmi_mem_pool_put(lan_timer_pool, info);
 	    }
 
 	    ipmi_unlock(lan->seq_num_lock);
@@ -4046,8 +4385,8 @@ lan_cleanup(ipmi_con_t *ipmi)
 
 	ipmi_lock(lan->seq_num_lock);
 
-	ipmi_mem_free(q_item->info);
-	ipmi_mem_free(q_item);
+	ipmi_mem_pool_put(lan_timer_pool, q_item->info);
+	ipmi_mem_pool_put(lan_wait_pool, q_item);
     }
     if (lan->audit_info) {
 	rv = ipmi->os_hnd->stop_timer(ipmi->os_hnd, lan->audit_timer);
@@ -5709,6 +6048,8 @@ ipmi_lanp_setup_con(ipmi_lanp_parm_t *parms,
 
     lan->outstanding_msg_count = 0;
     lan->max_outstanding_msg_count = max_outstanding_msg_count;
+    lan->cur_window = max_outstanding_msg_count;
+    lan->min_rtt = -1;
     lan->addr_family = set_addr_family;
     lan->wait_q = NULL;
     lan->wait_q_tail = NULL;
@@ -6998,21 +7339,78 @@ _ipmi_lan_init(os_handler_t *os_hnd)
     if (! lan_setup)
 	return ENOMEM;
 
+    rv = ENOMEM;
+    lan_timer_pool = ipmi_mem_pool_alloc(os_hnd, "lan_timer_info",
+					 sizeof(lan_timer_info_t),
+					 LAN_POOL_MAX_FREE);
+    if (!lan_timer_pool)
+	goto out_err;
+
+    lan_wait_pool = ipmi_mem_pool_alloc(os_hnd, "lan_wait_queue",
+					sizeof(lan_wait_queue_t),
+					LAN_POOL_MAX_FREE);
+    if (!lan_wait_pool)
+	goto out_err;
+
+#ifdef HAVE_RECVMMSG
+    lan_recv_pool = ipmi_mem_pool_alloc(os_hnd, "lan_recv_batch",
+					sizeof(lan_recv_batch_t),
+					LAN_RECV_POOL_MAX_FREE);
+    if (!lan_recv_pool)
+	goto out_err;
+#endif
+
     rv = _ipmi_register_con_type("lan", lan_setup);
     if (rv)
-	return rv;
+	goto out_err;
 
     lan_os_hnd = os_hnd;
 
     return 0;
+
+ out_err:
+    if (lan_timer_pool) {
+	ipmi_mem_pool_destroy(lan_timer_pool);
+	lan_timer_pool = NULL;
+    }
+    if (lan_wait_pool) {
+	ipmi_mem_pool_destroy(lan_wait_pool);
+	lan_wait_pool = NULL;
+    }
+#ifdef HAVE_RECVMMSG
+    if (lan_recv_pool) {
+	ipmi_mem_pool_destroy(lan_recv_pool);
+	lan_recv_pool = NULL;
+    }
+#endif
+    _ipmi_free_con_setup(lan_setup);
+    lan_setup = NULL;
+    return rv;
 }
 
 void
 _ipmi_lan_shutdown(void)
 {
-    _ipmi_unregister_con_type("lan", lan_setup);
-    _ipmi_free_con_setup(lan_setup);
-    lan_setup = NULL;
+    if (lan_setup) {
+	_ipmi_unregister_con_type("lan", lan_setup);
+	_ipmi_free_con_setup(lan_setup);
+	lan_setup = NULL;
+    }
+
+    if (lan_timer_pool) {
+	ipmi_mem_pool_destroy(lan_timer_pool);
+	lan_timer_pool = NULL;
+    }
+    if (lan_wait_pool) {
+	ipmi_mem_pool_destroy(lan_wait_pool);
+	lan_wait_pool = NULL;
+    }
+#ifdef HAVE_RECVMMSG
+    if (lan_recv_pool) {
+	ipmi_mem_pool_destroy(lan_recv_pool);
+	lan_recv_pool = NULL;
+    }
+#endif
 
     if (lan_list_lock) {
 	ipmi_destroy_lock(lan_list_lock);
@@ -7056,14 +7454,12 @@ _ipmi_lan_shutdown(void)
 	e->prev->next = e->next;
 	lan_os_hnd->remove_fd_to_wait_for(lan_os_hnd, e->fd_wait_id);
 	close(e->fd);
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
     while (fd_free_list) {
 	lan_fd_t *e = fd_free_list;
 	fd_free_list = e->next;
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
 #ifdef PF_INET6
     if (fd6_list_lock) {
@@ -7076,14 +7472,12 @@ _ipmi_lan_shutdown(void)
 	e->prev->next = e->next;
 	lan_os_hnd->remove_fd_to_wait_for(lan_os_hnd, e->fd_wait_id);
 	close(e->fd);
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
     while (fd6_free_list) {
 	lan_fd_t *e = fd6_free_list;
 	fd6_free_list = e->next;
-	ipmi_destroy_lock(e->con_lock);
-	ipmi_mem_free(e);
+	free_lan_fd(e);
     }
 #endif
     lan_os_hnd = NULL;
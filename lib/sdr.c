@@ -44,19 +44,31 @@
 #include <OpenIPMI/internal/ipmi_domain.h>
 #include <OpenIPMI/internal/ipmi_mc.h>
 #include <OpenIPMI/internal/ipmi_int.h>
+#include <OpenIPMI/internal/ipmi_cache.h>
 
 /* Max bytes to try to get at a time, the minimum allowed, and the
-   amount to decrement between tries. */
+   amount to decrement between tries.  Reads start at the standard
+   size and grow by the increment after SDR_FETCH_GROW_COUNT good
+   full-sized reads in a row, up to the max or the size that last
+   failed. */
 #define MAX_SDR_FETCH_BYTES 28
 #define STD_SDR_FETCH_BYTES 16
 #define MIN_SDR_FETCH_BYTES 10
 #define SDR_FETCH_BYTES_DECR 6
+#define SDR_FETCH_BYTES_INCR 4
+#define SDR_FETCH_GROW_COUNT 8
 
 /* Do up to this many retries when the reservation is lost. */
 #define MAX_SDR_FETCH_RETRIES 10
 
-/* Number of outstanding fetch requests we can have out. */
-#define MAX_SDR_FETCH_OUTSTANDING 3
+/* Default and max number of outstanding fetch requests we can have
+   out, see ipmi_sdr_set_fetch_window(). */
+#define SDR_FETCH_WINDOW 6
+#define MAX_SDR_FETCH_WINDOW 32
+
+/* The number of records whose headers we may have read but whose
+   bodies are not completely requested yet. */
+#define SDR_FETCH_AHEAD MAX_SDR_FETCH_WINDOW
 
 typedef struct sdr_fetch_handler_s
 {
@@ -84,6 +96,14 @@ typedef struct fetch_info_s
 
 #undef DEBUG_INFO_TRACKING
 
+/* An entry in the sensor index, the key is the owner, LUN, and
+   sensor number. */
+typedef struct sdr_sensor_ent_s
+{
+    unsigned int key;
+    unsigned int pos;
+} sdr_sensor_ent_t;
+
 struct ipmi_sdr_info_s
 {
     char name[IPMI_MC_NAME_LEN+1+20];
@@ -147,15 +167,45 @@ struct ipmi_sdr_info_s
     /* When fetching the data in event-driven mode, these are the
        variables that track what is going on. */
     unsigned int           curr_rec_id;
-    unsigned int           read_offset; /* Next data to read */
 
     unsigned int           fetch_size;
 
+    /* Headers are read one at a time ahead of the bodies, since the
+       next record id comes from the header.  These are the index and
+       record id of the last header requested, whether it has been
+       received yet, and the record id of the next header (0xffff at
+       the end). */
     unsigned int           curr_read_rec_id;
     unsigned int           next_read_rec_id;
     int                    curr_read_idx;
-    int                    next_read_offset; /* -1 if header */
-    int                    read_size;
+    int                    hdr_pending;
+
+    /* Records whose headers we have but whose bodies still have data
+       to request, in index order.  The bodies are read concurrently
+       within the window. */
+    struct {
+	unsigned int idx;
+	unsigned int rec_id;
+	unsigned int offset;
+	unsigned int size;
+    }                      body_q[SDR_FETCH_AHEAD];
+    unsigned int           body_head;
+    unsigned int           body_count;
+
+    /* Read chunk size handling, see SDR_FETCH_GROW_COUNT. */
+    unsigned int           fetch_chunk;
+    unsigned int           fetch_chunk_max;
+    unsigned int           fetch_chunk_good;
+    unsigned int           fetch_chunk_run;
+
+    /* Max number of outstanding reads and the number of fetch info
+       items allocated. */
+    unsigned int           fetch_window;
+    unsigned int           fetch_infos;
+
+    struct timeval         fetch_start;
+    unsigned int           fetch_reads;
+    unsigned int           fetch_bytes;
 
     unsigned int           reservation;
     unsigned int           working_num_sdrs;
@@ -171,11 +221,10 @@ struct ipmi_sdr_info_s
     /* List of fetch info items for an in-progress fetch.  The free
        list holds fetch structures that are not currently in use, the
        outstanding list holds ones that have been sent but have not
-       received a response, and the process queue holds one received
-       out of order. */
+       received a response.  Responses are copied into the working
+       SDRs as they arrive, in whatever order. */
     ilist_t *free_fetch;
     ilist_t *outstanding_fetch;
-    ilist_t *process_fetch;
 
     /* This is used so that start_fetch will only start when nothing
        is outstanding from other fetches.  This avoids getting
@@ -189,10 +238,32 @@ struct ipmi_sdr_info_s
     os_hnd_timer_id_t *restart_timer;
     int               restart_timer_running;
 
-    /* The actual current copy of the SDR repository. */
+    ipmi_domain_stat_t *sdr_good_fetches;
+    ipmi_domain_stat_t *sdr_fetch_reads;
+    ipmi_domain_stat_t *sdr_fetch_bytes;
+    ipmi_domain_stat_t *sdr_fetch_usecs;
+    ipmi_domain_stat_t *sdr_fetch_shrinks;
+
+    /* The actual current copy of the SDR repository.  If sdrs_cache
+       is set, sdrs points into the mapped cache and is read-only. */
     unsigned int num_sdrs;
     unsigned int sdr_array_size;
     ipmi_sdr_t *sdrs;
+    ipmi_cache_t *sdrs_cache;
+
+    /* Indexes into the sdrs array, so lookups do not have to search
+       it.  The hash tables are open addressed and hold the array
+       position plus one, zero means an empty slot.  type_first holds
+       the position plus one of the first SDR of each type.  If
+       index_valid is not set (an allocation failed), the lookups
+       fall back to searching the array. */
+    unsigned int     index_valid : 1;
+    unsigned int     recid_index_size;
+    unsigned int     *recid_index;
+    unsigned int     sensor_index_size;
+    unsigned int     sensor_index_count;
+    sdr_sensor_ent_t *sensor_index;
+    unsigned int     type_first[256];
 
     char db_key[32+5];
     int  db_key_set;
@@ -219,6 +290,8 @@ struct ipmi_sdr_info_s
 };
 
 static void internal_destroy_sdr_info(ipmi_sdr_info_t *sdrs);
+static void sdr_index_rebuild(ipmi_sdr_info_t *sdrs);
+static void sdr_index_free(ipmi_sdr_info_t *sdrs);
 static void restart_timer_cb(void *cb_data, os_hnd_timer_id_t *id);
 
 
@@ -232,6 +305,232 @@ static inline void sdr_unlock(ipmi_sdr_info_t *sdrs)
     ipmi_unlock(sdrs->sdr_lock);
 }
 
+/*
+ * SDR indexes.  All of these must be called with the SDR lock held.
+ */
+#define SDR_INDEX_MIN 32
+
+#define sdr_sensor_key(owner, lun, num) \
+	((((owner) & 0xff) << 10) | (((lun) & 0x3) << 8) | ((num) & 0xff))
+
+static unsigned int
+sdr_index_hash(unsigned int key, unsigned int size)
+{
+    /* Multiplicative hashing, record ids and sensor keys are mostly
+       sequential. */
+    return ((key * 2654435761U) >> 7) & (size - 1);
+}
+
+/* Return the number of sensors in a sensor SDR, 0 if it is not a
+   sensor SDR. */
+static unsigned int
+sdr_sensor_count(ipmi_sdr_t *sdr)
+{
+    unsigned int count;
+
+    switch (sdr->type) {
+    case 1:
+	return 1;
+    case 2:
+	count = sdr->data[18] & 0x0f;
+	break;
+    case 3:
+	count = sdr->data[7] & 0x0f;
+	break;
+    default:
+	return 0;
+    }
+    if (count == 0)
+	count = 1;
+    return count;
+}
+
+/* Do the two SDRs have the same index keys? */
+static int
+sdr_index_keys_equal(ipmi_sdr_t *a, ipmi_sdr_t *b)
+{
+    if ((a->record_id != b->record_id) || (a->type != b->type))
+	return 0;
+    if (sdr_sensor_count(a) == 0)
+	return 1;
+    return ((sdr_sensor_count(a) == sdr_sensor_count(b))
+	    && (memcmp(a->data, b->data, 3) == 0));
+}
+
+static void
+sdr_index_free(ipmi_sdr_info_t *sdrs)
+{
+    if (sdrs->recid_index)
+	ipmi_mem_free(sdrs->recid_index);
+    sdrs->recid_index = NULL;
+    sdrs->recid_index_size = 0;
+    if (sdrs->sensor_index)
+	ipmi_mem_free(sdrs->sensor_index);
+    sdrs->sensor_index = NULL;
+    sdrs->sensor_index_size = 0;
+    sdrs->sensor_index_count = 0;
+    memset(sdrs->type_first, 0, sizeof(sdrs->type_first));
+    sdrs->index_valid = 0;
+}
+
+/* Add the SDR at pos to the indexes, the tables must have room.  If
+   an entry is duplicated the first one wins, like a search of the
+   array would. */
+static void
+sdr_index_insert(ipmi_sdr_info_t *sdrs, unsigned int pos)
+{
+    ipmi_sdr_t   *sdr = &sdrs->sdrs[pos];
+    unsigned int i, j, count, num, key;
+
+    i = sdr_index_hash(sdr->record_id, sdrs->recid_index_size);
+    while (sdrs->recid_index[i]) {
+	if (sdrs->sdrs[sdrs->recid_index[i] - 1].record_id == sdr->record_id)
+	    goto recid_done;
+	i = (i + 1) & (sdrs->recid_index_size - 1);
+    }
+    sdrs->recid_index[i] = pos + 1;
+ recid_done:
+
+    if (!sdrs->type_first[sdr->type])
+	sdrs->type_first[sdr->type] = pos + 1;
+
+    count = sdr_sensor_count(sdr);
+    for (j=0; j<count; j++) {
+	num = sdr->data[2] + j;
+	if (num > 0xff)
+	    break;
+	key = sdr_sensor_key(sdr->data[0], sdr->data[1], num);
+	i = sdr_index_hash(key, sdrs->sensor_index_size);
+	while (sdrs->sensor_index[i].pos) {
+	    if (sdrs->sensor_index[i].key == key)
+		goto sensor_done;
+	    i = (i + 1) & (sdrs->sensor_index_size - 1);
+	}
+	sdrs->sensor_index[i].key = key;
+	sdrs->sensor_index[i].pos = pos + 1;
+	sdrs->sensor_index_count++;
+    sensor_done:
+	;
+    }
+}
+
+/* Build the indexes from scratch, keeping the tables at most half
+   full.  On allocation failure the indexes are just left invalid. */
+static void
+sdr_index_rebuild(ipmi_sdr_info_t *sdrs)
+{
+    unsigned int i, rsize, ssize, nsensors = 0;
+
+    sdr_index_free(sdrs);
+    if (!sdrs->sdrs)
+	return;
+
+    for (i=0; i<sdrs->num_sdrs; i++)
+	nsensors += sdr_sensor_count(&sdrs->sdrs[i]);
+
+    for (rsize = SDR_INDEX_MIN; rsize < sdrs->num_sdrs * 2; rsize *= 2)
+	;
+    for (ssize = SDR_INDEX_MIN; ssize < nsensors * 2; ssize *= 2)
+	;
+
+    sdrs->recid_index = ipmi_mem_alloc(sizeof(unsigned int) * rsize);
+    sdrs->sensor_index = ipmi_mem_alloc(sizeof(sdr_sensor_ent_t) * ssize);
+    if (!sdrs->recid_index || !sdrs->sensor_index) {
+	sdr_index_free(sdrs);
+	return;
+    }
+    memset(sdrs->recid_index, 0, sizeof(unsigned int) * rsize);
+    memset(sdrs->sensor_index, 0, sizeof(sdr_sensor_ent_t) * ssize);
+    sdrs->recid_index_size = rsize;
+    sdrs->sensor_index_size = ssize;
+
+    for (i=0; i<sdrs->num_sdrs; i++)
+	sdr_index_insert(sdrs, i);
+    sdrs->index_valid = 1;
+}
+
+/* A new SDR was added at pos, add it to the indexes, growing them if
+   necessary. */
+static void
+sdr_index_add(ipmi_sdr_info_t *sdrs, unsigned int pos)
+{
+    if (!sdrs->index_valid
+	|| ((sdrs->num_sdrs * 2) > sdrs->recid_index_size)
+	|| (((sdrs->sensor_index_count + sdr_sensor_count(&sdrs->sdrs[pos]))
+	     * 2) > sdrs->sensor_index_size))
+	sdr_index_rebuild(sdrs);
+    else
+	sdr_index_insert(sdrs, pos);
+}
+
+static int
+sdr_index_find_recid(ipmi_sdr_info_t *sdrs, unsigned int recid)
+{
+    unsigned int i, pos;
+
+    if (!sdrs->index_valid) {
+	for (i=0; i<sdrs->num_sdrs; i++) {
+	    if (sdrs->sdrs[i].record_id == recid)
+		return i;
+	}
+	return -1;
+    }
+
+    i = sdr_index_hash(recid, sdrs->recid_index_size);
+    while ((pos = sdrs->recid_index[i])) {
+	if (sdrs->sdrs[pos - 1].record_id == recid)
+	    return pos - 1;
+	i = (i + 1) & (sdrs->recid_index_size - 1);
+    }
+    return -1;
+}
+
+static int
+sdr_index_find_type(ipmi_sdr_info_t *sdrs, unsigned int type)
+{
+    unsigned int i;
+
+    if (!sdrs->index_valid) {
+	for (i=0; i<sdrs->num_sdrs; i++) {
+	    if (sdrs->sdrs[i].type == type)
+		return i;
+	}
+	return -1;
+    }
+
+    return ((int) sdrs->type_first[type & 0xff]) - 1;
+}
+
+static int
+sdr_index_find_sensor(ipmi_sdr_info_t *sdrs, unsigned int key)
+{
+    unsigned int i, j, count, num;
+    ipmi_sdr_t   *sdr;
+
+    if (!sdrs->index_valid) {
+	for (i=0; i<sdrs->num_sdrs; i++) {
+	    sdr = &sdrs->sdrs[i];
+	    count = sdr_sensor_count(sdr);
+	    for (j=0; j<count; j++) {
+		num = sdr->data[2] + j;
+		if (num > 0xff)
+		    break;
+		if (sdr_sensor_key(sdr->data[0], sdr->data[1], num) == key)
+		    return i;
+	    }
+	}
+	return -1;
+    }
+
+    i = sdr_index_hash(key, sdrs->sensor_index_size);
+    while (sdrs->sensor_index[i].pos) {
+	if (sdrs->sensor_index[i].key == key)
+	    return sdrs->sensor_index[i].pos - 1;
+	i = (i + 1) & (sdrs->sensor_index_size - 1);
+    }
+    return -1;
+}
+
 static void
 free_fetch(ilist_iter_t *iter, void *item, void *cb_data)
 {
@@ -252,50 +551,100 @@ static void
 cleanup_fetch_items(ipmi_sdr_info_t *sdrs)
 {
     ilist_iter(sdrs->free_fetch, free_fetch, NULL);
-    ilist_iter(sdrs->process_fetch, free_fetch, NULL);
     ilist_iter(sdrs->outstanding_fetch, cancel_fetch, NULL);
 }
 
 static void
-process_db_data(ipmi_sdr_info_t *sdrs,
-		unsigned char   *db_data,
-		unsigned int    len)
+sdr_release_sdrs(ipmi_sdr_info_t *sdrs)
 {
-    int           num;
-    unsigned char *d;
-    ipmi_sdr_t    *to_free;
-
-    if (len < 9)
-	goto no_db;
-
-    /* Format# is the last byte. */
-    d = db_data + len - 1;
-    if (*d != 1)
-	goto no_db;
-
-    /* timestamps are the 8 bytes before the format#. */
-    d -= 8;
-    sdrs->last_addition_timestamp = ipmi_get_uint32(d);
-    d += 4;
-    sdrs->last_erase_timestamp = ipmi_get_uint32(d);
-    d += 4;
-    len -= 9;
-    num = len / sizeof(ipmi_sdr_t);
-    /* Allocate 9 extra bytes for storing the timestamps and
-     * format#. */
-    to_free = sdrs->sdrs;
-    sdrs->sdrs = ipmi_mem_alloc((sizeof(ipmi_sdr_t) * num) + 9);
-    if (!sdrs->sdrs)
-	goto no_db;
-    memcpy(sdrs->sdrs, db_data, sizeof(ipmi_sdr_t) * num);
+    if (sdrs->sdrs_cache) {
+	ipmi_cache_release(sdrs->sdrs_cache);
+	sdrs->sdrs_cache = NULL;
+    } else if (sdrs->sdrs)
+	ipmi_mem_free(sdrs->sdrs);
+    sdrs->sdrs = NULL;
+}
+
+/* If the SDRs are in the mapped cache, copy them so they can be
+   modified. */
+static int
+sdr_make_writable(ipmi_sdr_info_t *sdrs)
+{
+    ipmi_sdr_t *new_sdrs;
+
+    if (!sdrs->sdrs_cache)
+	return 0;
+
+    new_sdrs = ipmi_mem_alloc(sizeof(ipmi_sdr_t) * (sdrs->num_sdrs + 1));
+    if (!new_sdrs)
+	return ENOMEM;
+    memcpy(new_sdrs, sdrs->sdrs, sizeof(ipmi_sdr_t) * sdrs->num_sdrs);
+    ipmi_cache_release(sdrs->sdrs_cache);
+    sdrs->sdrs_cache = NULL;
+    sdrs->sdrs = new_sdrs;
+    sdrs->sdr_array_size = sdrs->num_sdrs + 1;
+    return 0;
+}
+
+static void
+use_cached_sdrs(ipmi_sdr_info_t *sdrs,
+		ipmi_sdr_t      *new_sdrs,
+		unsigned int    num,
+		uint32_t        add_timestamp,
+		uint32_t        erase_timestamp,
+		ipmi_cache_t    *cache)
+{
+    sdr_release_sdrs(sdrs);
+    sdrs->sdrs = new_sdrs;
+    sdrs->sdrs_cache = cache;
     sdrs->num_sdrs = num;
     sdrs->sdr_array_size = num;
+    sdrs->last_addition_timestamp = add_timestamp;
+    sdrs->last_erase_timestamp = erase_timestamp;
     sdrs->fetched = 1;
-    if (to_free)
-	ipmi_mem_free(to_free);
+    sdr_index_rebuild(sdrs);
+}
 
- no_db:
-    sdrs->os_hnd->database_free(sdrs->os_hnd, db_data);
+/* Handle data from the database.  The caller frees the data. */
+static void
+process_db_data(ipmi_sdr_info_t *sdrs,
+		unsigned char   *db_data,
+		unsigned int    len)
+{
+    ipmi_cache_hdr_t hdr;
+    unsigned int     num;
+    ipmi_sdr_t       *new_sdrs;
+    uint32_t         add_timestamp, erase_timestamp;
+
+    if (ipmi_cache_check(db_data, len, IPMI_CACHE_SDR, sizeof(ipmi_sdr_t),
+			 &hdr) == 0)
+    {
+	num = hdr.count;
+	db_data += hdr.hdr_len;
+	add_timestamp = hdr.stamp1;
+	erase_timestamp = hdr.stamp2;
+    } else {
+	unsigned char *d;
+
+	/* The old format, with the timestamps and format# 1 at the
+	   end. */
+	if (len < 9)
+	    return;
+	d = db_data + len - 1;
+	if (*d != 1)
+	    return;
+	d -= 8;
+	add_timestamp = ipmi_get_uint32(d);
+	erase_timestamp = ipmi_get_uint32(d + 4);
+	num = (len - 9) / sizeof(ipmi_sdr_t);
+    }
+
+    new_sdrs = ipmi_mem_alloc(sizeof(ipmi_sdr_t) * (num ? num : 1));
+    if (!new_sdrs)
+	return;
+    memcpy(new_sdrs, db_data, sizeof(ipmi_sdr_t) * num);
+    use_cached_sdrs(sdrs, new_sdrs, num, add_timestamp, erase_timestamp,
+		    NULL);
 }
 
 static void
@@ -330,6 +679,7 @@ start_db_fetch(void *cb_data, int shutdown)
 {
     ipmi_sdr_info_t *sdrs = cb_data;
     int             rv = ENOSYS;
+    ipmi_cache_t    *cache;
 
     if (shutdown)
 	return OPQ_HANDLER_STARTED;
@@ -340,9 +690,16 @@ start_db_fetch(void *cb_data, int shutdown)
 	return OPQ_HANDLER_ABORTED;
     }
 
-    /* Go ahead and do the database fetch here if we have support. */
-    if (sdrs->os_hnd->database_find && sdrs->db_key_set)
+    /* Use the cache in place if the OS handler can map it. */
+    if (sdrs->db_key_set
+	&& (ipmi_cache_map(sdrs->os_hnd, sdrs->db_key, IPMI_CACHE_SDR,
+			   sizeof(ipmi_sdr_t), &cache) == 0))
     {
+	use_cached_sdrs(sdrs, (ipmi_sdr_t *) ipmi_cache_data(cache),
+			ipmi_cache_count(cache), ipmi_cache_stamp1(cache),
+			ipmi_cache_stamp2(cache), cache);
+	rv = -1; /* Just mark it as done */
+    } else if (sdrs->os_hnd->database_find && sdrs->db_key_set) {
 	unsigned char *db_data;
 	unsigned int  db_data_len;
 	unsigned int  data_fetched = 0;
@@ -358,6 +715,7 @@ start_db_fetch(void *cb_data, int shutdown)
 	if (!rv) {
 	    if (data_fetched) {
 		process_db_data(sdrs, db_data, db_data_len);
+		sdrs->os_hnd->database_free(sdrs->os_hnd, db_data);
 		rv = -1; /* Just mark it as done */
 	    }
 	}
@@ -419,6 +777,10 @@ ipmi_sdr_info_alloc(ipmi_domain_t   *domain,
     sdrs->sdr_wait_q = NULL;
     /* use guaranteed size */
     sdrs->fetch_size = STD_SDR_FETCH_BYTES;
+    sdrs->fetch_chunk = STD_SDR_FETCH_BYTES;
+    sdrs->fetch_chunk_max = MAX_SDR_FETCH_BYTES;
+    sdrs->fetch_chunk_good = STD_SDR_FETCH_BYTES;
+    sdrs->fetch_window = SDR_FETCH_WINDOW;
 
     /* Assume we have a dynamic population until told otherwise. */
     sdrs->dynamic_population = 1;
@@ -445,7 +807,7 @@ ipmi_sdr_info_alloc(ipmi_domain_t   *domain,
 	goto out_done;
     }
 
-    for (i=0; i<MAX_SDR_FETCH_OUTSTANDING; i++) {
+    for (i=0; i<SDR_FETCH_WINDOW; i++) {
 	info = ipmi_mem_alloc(sizeof(*info));
 	if (!info) {
 	    rv = ENOMEM;
@@ -453,12 +815,7 @@ ipmi_sdr_info_alloc(ipmi_domain_t   *domain,
 	}
 	info->sdrs = sdrs;
 	ilist_add_tail(sdrs->free_fetch, info, &info->link);
-    }
-
-    sdrs->process_fetch = alloc_ilist();
-    if (!sdrs->process_fetch) {
-	rv = ENOMEM;
-	goto out_done;
+	sdrs->fetch_infos++;
     }
 
     sdrs->sdr_wait_q = opq_alloc(os_hnd);
@@ -476,13 +833,21 @@ ipmi_sdr_info_alloc(ipmi_domain_t   *domain,
 	    }
 	    if (sdrs->outstanding_fetch)
 		free_ilist(sdrs->outstanding_fetch);
-	    if (sdrs->process_fetch)
-		free_ilist(sdrs->process_fetch);
 	    if (sdrs->sdr_lock)
 		ipmi_destroy_lock(sdrs->sdr_lock);
 	    ipmi_mem_free(sdrs);
 	}
     } else {
+	ipmi_domain_stat_register(domain, "sdr_good_fetches", sdrs->name,
+				  &sdrs->sdr_good_fetches);
+	ipmi_domain_stat_register(domain, "sdr_fetch_reads", sdrs->name,
+				  &sdrs->sdr_fetch_reads);
+	ipmi_domain_stat_register(domain, "sdr_fetch_bytes", sdrs->name,
+				  &sdrs->sdr_fetch_bytes);
+	ipmi_domain_stat_register(domain, "sdr_fetch_usecs", sdrs->name,
+				  &sdrs->sdr_fetch_usecs);
+	ipmi_domain_stat_register(domain, "sdr_fetch_shrinks", sdrs->name,
+				  &sdrs->sdr_fetch_shrinks);
 	*new_sdrs = sdrs;
     }
  out:
@@ -507,7 +872,6 @@ internal_destroy_sdr_info(ipmi_sdr_info_t *sdrs)
 
     free_ilist(sdrs->free_fetch);
     free_ilist(sdrs->outstanding_fetch);
-    free_ilist(sdrs->process_fetch);
 
     /* We don't have to worry about stopping the timer, this can't be
        called if the timer is running, because a fetch operation would
@@ -518,22 +882,32 @@ internal_destroy_sdr_info(ipmi_sdr_info_t *sdrs)
 
     ipmi_destroy_lock(sdrs->sdr_lock);
 
+    if (sdrs->sdr_good_fetches)
+	ipmi_domain_stat_put(sdrs->sdr_good_fetches);
+    if (sdrs->sdr_fetch_reads)
+	ipmi_domain_stat_put(sdrs->sdr_fetch_reads);
+    if (sdrs->sdr_fetch_bytes)
+	ipmi_domain_stat_put(sdrs->sdr_fetch_bytes);
+    if (sdrs->sdr_fetch_usecs)
+	ipmi_domain_stat_put(sdrs->sdr_fetch_usecs);
+    if (sdrs->sdr_fetch_shrinks)
+	ipmi_domain_stat_put(sdrs->sdr_fetch_shrinks);
+
     /* Do this after we have gotten rid of all external dependencies,
        but before it is free. */
     if (sdrs->destroy_handler)
 	sdrs->destroy_handler(sdrs, sdrs->destroy_cb_data);
 
-    if (sdrs->sdrs)
-	ipmi_mem_free(sdrs->sdrs);
+    sdr_release_sdrs(sdrs);
+    sdr_index_free(sdrs);
     ipmi_mem_free(sdrs);
 }
 
 void
 ipmi_sdr_clean_out_sdrs(ipmi_sdr_info_t *sdrs)
 {
-    if (sdrs->sdrs)
-	ipmi_mem_free(sdrs->sdrs);
-    sdrs->sdrs = NULL;
+    sdr_release_sdrs(sdrs);
+    sdr_index_free(sdrs);
     sdrs->dynamic_population = 1;
     sdrs->fetched = 0;
 }
@@ -607,6 +981,30 @@ ipmi_sdr_info_destroy(ipmi_sdr_info_t      *sdrs,
     return 0;
 }
 
+static void
+sdr_stat_add(ipmi_domain_stat_t *stat, int amount)
+{
+    if (stat)
+	ipmi_domain_stat_add(stat, amount);
+}
+
+/* Add the throughput numbers for a successful fetch that read the
+   repository to the statistics. */
+static void
+sdr_fetch_report(ipmi_sdr_info_t *sdrs)
+{
+    struct timeval now;
+    long           usecs;
+
+    sdrs->os_hnd->get_monotonic_time(sdrs->os_hnd, &now);
+    usecs = ((now.tv_sec - sdrs->fetch_start.tv_sec) * 1000000
+	     + (now.tv_usec - sdrs->fetch_start.tv_usec));
+    sdr_stat_add(sdrs->sdr_good_fetches, 1);
+    sdr_stat_add(sdrs->sdr_fetch_reads, sdrs->fetch_reads);
+    sdr_stat_add(sdrs->sdr_fetch_bytes, sdrs->fetch_bytes);
+    sdr_stat_add(sdrs->sdr_fetch_usecs, usecs);
+}
+
 /* Must be called with the SDR locked.  This will unlock the SDR
    before calling the callback, and will return with the sdr unlocked. */
 static void
@@ -614,6 +1012,10 @@ fetch_complete(ipmi_sdr_info_t *sdrs, int err)
 {
     DEBUG_INFO(sdrs);
     sdrs->wait_err = err;
+    if (!err && sdrs->fetch_reads)
+	sdr_fetch_report(sdrs);
+    sdrs->fetch_reads = 0;
+    sdrs->fetch_bytes = 0;
     if (err) {
 	DEBUG_INFO(sdrs);
 	if (sdrs->working_sdrs) {
@@ -621,39 +1023,25 @@ fetch_complete(ipmi_sdr_info_t *sdrs, int err)
 	    sdrs->working_sdrs = NULL;
 	}
     } else {
-	/* The wierd to_free business is because at some points we put
-	   the sdrs into the working_sdrs so they will be restored
-	   properly. */
-	ipmi_sdr_t *to_free = NULL;
-
+	/* If the repository did not change, the current sdrs were put
+	   into working_sdrs and must not be released. */
 	DEBUG_INFO(sdrs);
 	sdrs->fetched = 1;
 	sdrs->num_sdrs = sdrs->curr_read_idx+1;
-	sdrs->sdr_array_size = sdrs->num_sdrs;
-	if (sdrs->sdrs != sdrs->working_sdrs)
-	    to_free = sdrs->sdrs;
+	if (sdrs->sdrs != sdrs->working_sdrs) {
+	    sdr_release_sdrs(sdrs);
+	    sdrs->sdr_array_size = sdrs->num_sdrs;
+	}
 	sdrs->sdrs = sdrs->working_sdrs;
 	sdrs->working_sdrs = NULL;
-	if (to_free)
-	    ipmi_mem_free(to_free);
-
-	if (sdrs->sdrs && sdrs->db_key_set && sdrs->os_hnd->database_store) {
-	    unsigned int  len = sdrs->num_sdrs * sizeof(ipmi_sdr_t);
-	    unsigned char *d = ((unsigned char *) sdrs->sdrs) + len;
-
-	    /* We always allocate 9 extra bytes in the SDR data to put
-	       the timestamps and format at the end. */
-	    ipmi_set_uint32(d, sdrs->last_addition_timestamp);
-	    d += 4;
-	    ipmi_set_uint32(d, sdrs->last_erase_timestamp);
-	    d += 4;
-	    *d = 1; /* format # */
-	    len += 9;
-	    sdrs->os_hnd->database_store(sdrs->os_hnd,
-					 sdrs->db_key,
-					 (unsigned char *) sdrs->sdrs,
-					 len);
-	}
+	sdr_index_rebuild(sdrs);
+
+	/* Only rewrite the cache if the data was actually fetched. */
+	if (sdrs->sdrs && sdrs->sdrs_changed && sdrs->db_key_set)
+	    ipmi_cache_store(sdrs->os_hnd, sdrs->db_key, IPMI_CACHE_SDR,
+			     sizeof(ipmi_sdr_t), sdrs->num_sdrs,
+			     sdrs->last_addition_timestamp,
+			     sdrs->last_erase_timestamp, sdrs->sdrs);
     }
     sdrs->fetch_state = HANDLERS;
     sdr_unlock(sdrs);
@@ -816,36 +1204,6 @@ process_sdr_info(ipmi_sdr_info_t *sdrs, fetch_info_t *info)
 	memcpy(&sdr->data[info->offset-SDR_HEADER_SIZE],
 	       info->data+2, info->read_len);
     }
-    if (info->offset+info->read_len == (uint32_t)sdr->length+SDR_HEADER_SIZE) {
-	sdrs->curr_rec_id = ipmi_get_uint16(info->data);
-	sdrs->read_offset = 0;
-    } else {
-	sdrs->read_offset += info->read_len;
-    }
-}
-
-typedef struct process_info_s
-{
-    ipmi_sdr_info_t *sdrs;
-    int processed;
-} process_info_t;
-
-static void
-check_and_process_info(ilist_iter_t *iter, void *item, void *cb_data)
-{
-    process_info_t  *pinfo = cb_data;
-    ipmi_sdr_info_t *sdrs = pinfo->sdrs;
-    fetch_info_t    *info = item;
-
-    if ((info->sdr_rec == sdrs->curr_rec_id)
-	&& (info->offset == sdrs->read_offset))
-    {
-	if (iter)
-	    ilist_delete(iter);
-	pinfo->processed = 1;
-	process_sdr_info(sdrs, info);
-	ilist_add_tail(sdrs->free_fetch, info, &info->link);
-    }
 }
 
 typedef struct cancel_same_or_newer_s
@@ -865,26 +1223,59 @@ cancel_if_same_or_newer(ilist_iter_t *iter, void *item, void *cb_data)
 }
 
 static void
-free_if_same_or_newer(ilist_iter_t *iter, void *item, void *cb_data)
+cancel_same_or_newer(ipmi_sdr_info_t *sdrs, int idx)
+{
+    cancel_same_or_newer_t info;
+
+    info.sdrs = sdrs;
+    info.idx = idx;
+    ilist_iter(sdrs->outstanding_fetch, cancel_if_same_or_newer, &info);
+}
+
+/* Start reading again from the SDR the info was for, throwing away
+   anything for that SDR or newer ones. */
+static void
+restart_fetch_at(ipmi_sdr_info_t *sdrs, fetch_info_t *info)
 {
-    cancel_same_or_newer_t *info = cb_data;
-    fetch_info_t           *finfo = item;
+    unsigned int last;
 
-    if (finfo->idx >= info->idx) {
-	ilist_delete(iter);
-	ilist_add_tail(info->sdrs->free_fetch, finfo, &finfo->link);
+    cancel_same_or_newer(sdrs, info->idx);
+
+    while (sdrs->body_count) {
+	last = (sdrs->body_head + sdrs->body_count - 1) % SDR_FETCH_AHEAD;
+	if (sdrs->body_q[last].idx < info->idx)
+	    break;
+	sdrs->body_count--;
     }
+
+    sdrs->next_read_rec_id = info->sdr_rec;
+    sdrs->curr_read_idx = info->idx-1;
+    sdrs->hdr_pending = 0;
 }
 
+/* Free fetch items beyond the window, if they are not in use. */
 static void
-cancel_same_or_newer(ipmi_sdr_info_t *sdrs, int idx)
+sdr_fetch_trim(ipmi_sdr_info_t *sdrs)
 {
-    cancel_same_or_newer_t info;
+    fetch_info_t *info;
 
-    info.sdrs = sdrs;
-    info.idx = idx;
-    ilist_iter(sdrs->outstanding_fetch, cancel_if_same_or_newer, &info);
-    ilist_iter(sdrs->process_fetch, free_if_same_or_newer, &info);
+    while (sdrs->fetch_infos > sdrs->fetch_window) {
+	info = ilist_remove_first(sdrs->free_fetch);
+	if (!info)
+	    break;
+	ipmi_mem_free(info);
+	sdrs->fetch_infos--;
+    }
+}
+
+/* Completion codes some systems return instead of "cannot return
+   requested length" when a read is too big. */
+static int
+sdr_fetch_size_err(unsigned char cc)
+{
+    return ((cc == IPMI_REQUEST_DATA_LENGTH_INVALID_CC)
+	    || (cc == IPMI_REQUESTED_DATA_LENGTH_EXCEEDED_CC)
+	    || (cc == IPMI_UNKNOWN_ERR_CC));
 }
 
 static void handle_sdr_data(ipmi_mc_t  *mc,
@@ -918,7 +1309,6 @@ info_send(ipmi_sdr_info_t *sdrs, fetch_info_t *info, ipmi_mc_t *mc)
 			      handle_sdr_data, info);
     if (rv) {
 	DEBUG_INFO(sdrs);
-	ilist_add_tail(sdrs->free_fetch, info, &info->link);
 	ipmi_log(IPMI_LOG_ERR_INFO,
 		 "%ssdr.c(info_send): "
 		 "initial_sdr_fetch: Couldn't send first SDR fetch: %x",
@@ -928,6 +1318,7 @@ info_send(ipmi_sdr_info_t *sdrs, fetch_info_t *info, ipmi_mc_t *mc)
     } else {
 	DEBUG_INFO(sdrs);
 	ilist_add_tail(sdrs->outstanding_fetch, info, &info->link);
+	sdrs->fetch_reads++;
     }
 
     return rv;
@@ -940,7 +1331,6 @@ handle_sdr_data(ipmi_mc_t  *mc,
 {
     fetch_info_t    *info = rsp_data;
     ipmi_sdr_info_t *sdrs = info->sdrs;
-    process_info_t  pinfo;
     int             rv;
 
     sdr_lock(sdrs);
@@ -1049,14 +1439,8 @@ handle_sdr_data(ipmi_mc_t  *mc,
 	    goto out;
 	}
 
-	/* Cancel any current or newer pending operations. */
-	cancel_same_or_newer(sdrs, info->idx);
-
 	/* Re-start the fetch on the SDR. */
-	sdrs->next_read_offset = -1;
-	sdrs->read_size = -1;
-	sdrs->next_read_rec_id = info->sdr_rec;
-	sdrs->curr_read_idx = info->idx-1;
+	restart_fetch_at(sdrs, info);
 
 	ilist_add_tail(sdrs->free_fetch, info, &info->link);
 	goto out_nextmsg;
@@ -1127,13 +1511,16 @@ handle_sdr_data(ipmi_mc_t  *mc,
 	goto out;
     }
 
-    if (rsp->data[0] == IPMI_CANNOT_RETURN_REQ_LENGTH_CC) {
+    if ((rsp->data[0] == IPMI_CANNOT_RETURN_REQ_LENGTH_CC)
+	|| ((info->read_len > sdrs->fetch_chunk_good)
+	    && sdr_fetch_size_err(rsp->data[0])))
+    {
 	/* It's more than the system can return in a single messages,
-	   decrease the size. */
+	   decrease the size and don't grow back to it. */
 	ilist_add_tail(sdrs->free_fetch, info, &info->link);
+	sdr_stat_add(sdrs->sdr_fetch_shrinks, 1);
 
-	sdrs->fetch_size -= SDR_FETCH_BYTES_DECR;
-	if (sdrs->fetch_size < MIN_SDR_FETCH_BYTES) {
+	if (info->read_len <= MIN_SDR_FETCH_BYTES) {
 	    DEBUG_INFO(sdrs);
 	    ipmi_log(IPMI_LOG_ERR_INFO,
 		     "%ssdr.c(handle_sdr_data): "
@@ -1150,15 +1537,21 @@ handle_sdr_data(ipmi_mc_t  *mc,
 	    fetch_complete(sdrs, IPMI_IPMI_ERR_VAL(rsp->data[0]));
 	    goto out;
 	} else {
-	    /* Cancel any current or newer pending operations. */
+	    unsigned int size = info->read_len - SDR_FETCH_BYTES_DECR;
+
 	    DEBUG_INFO(sdrs);
-	    cancel_same_or_newer(sdrs, info->idx);
+	    if (size < MIN_SDR_FETCH_BYTES)
+		size = MIN_SDR_FETCH_BYTES;
+	    if (sdrs->fetch_chunk > size)
+		sdrs->fetch_chunk = size;
+	    sdrs->fetch_chunk_max = sdrs->fetch_chunk;
+	    sdrs->fetch_chunk_run = 0;
+	    /* Writes use the fetch size, too. */
+	    if (sdrs->fetch_size > sdrs->fetch_chunk)
+		sdrs->fetch_size = sdrs->fetch_chunk;
 
 	    /* Re-start the fetch on this SDR. */
-	    sdrs->next_read_offset = -1;
-	    sdrs->read_size = -1;
-	    sdrs->next_read_rec_id = info->sdr_rec;
-	    sdrs->curr_read_idx = info->idx-1;
+	    restart_fetch_at(sdrs, info);
 
 	    goto out_nextmsg;
 	}
@@ -1210,75 +1603,54 @@ handle_sdr_data(ipmi_mc_t  *mc,
 
     /* First handle the info for fetching data. */
     if (info->offset == 0) {
-	/* We read a header. */
+	/* We read a header, queue the body and go on to the next
+	   header. */
+	unsigned int size = rsp->data[7] + SDR_HEADER_SIZE;
+
 	DEBUG_INFO(sdrs);
-	sdrs->read_size = rsp->data[7] + SDR_HEADER_SIZE;
 	sdrs->next_read_rec_id = ipmi_get_uint16(rsp->data+1);
-	sdrs->next_read_offset = info->read_len;
+	sdrs->hdr_pending = 0;
+	if (size > SDR_HEADER_SIZE) {
+	    unsigned int last = ((sdrs->body_head + sdrs->body_count)
+				 % SDR_FETCH_AHEAD);
+
+	    sdrs->body_q[last].idx = info->idx;
+	    sdrs->body_q[last].rec_id = info->sdr_rec;
+	    sdrs->body_q[last].offset = SDR_HEADER_SIZE;
+	    sdrs->body_q[last].size = size;
+	    sdrs->body_count++;
+	}
+    } else if (info->read_len == sdrs->fetch_chunk) {
+	sdrs->fetch_chunk_run++;
+	if ((sdrs->fetch_chunk_run >= SDR_FETCH_GROW_COUNT)
+	    && (sdrs->fetch_chunk < sdrs->fetch_chunk_max))
+	{
+	    sdrs->fetch_chunk += SDR_FETCH_BYTES_INCR;
+	    if (sdrs->fetch_chunk > sdrs->fetch_chunk_max)
+		sdrs->fetch_chunk = sdrs->fetch_chunk_max;
+	    sdrs->fetch_chunk_run = 0;
+	}
     }
+    if (info->read_len > sdrs->fetch_chunk_good)
+	sdrs->fetch_chunk_good = info->read_len;
+    sdrs->fetch_bytes += info->read_len;
 
     /* Now process it for the user. */
-    memcpy(info->data, rsp->data+1, rsp->data_len-1);
-
-    pinfo.processed = 0;
-    pinfo.sdrs = sdrs;
-    check_and_process_info(NULL, info, &pinfo);
-    if (pinfo.processed) {
-	/* Since we may have processed a previous one, check the ones
-	   we have already received that were received out of
-	   order. */
-	DEBUG_INFO(sdrs);
-	ilist_iter(sdrs->process_fetch, check_and_process_info, &pinfo);
-    } else {
-	ilist_iter_t iter;
-	int          pos;
-	fetch_info_t *ninfo;
-	int          found = 0;
-
-	DEBUG_INFO(sdrs);
-	/* It is not the reponse we are expecting, just throw it onto
-           the queue in order to be handled later. */
-	ilist_init_iter(&iter, sdrs->process_fetch);
-	pos = ilist_last(&iter);
-	while (pos) {
-	    ninfo = ilist_get(&iter);
-	    if ((info->idx > ninfo->idx) || (info->offset > ninfo->offset)) {
-		found = 1;
-		break;
-	    }
-	    pos = ilist_prev(&iter);
-	}
+    memcpy(info->data, rsp->data+1, info->read_len+2);
 
-	if (found) {
-	    DEBUG_INFO(sdrs);
-	    ilist_add_after(&iter, info, &info->link);
-	} else {
-	    DEBUG_INFO(sdrs);
-	    ilist_add_before(&iter, info, &info->link);
-	}
-    }
+    process_sdr_info(sdrs, info);
+    ilist_add_tail(sdrs->free_fetch, info, &info->link);
 
  out_nextmsg:
+    sdr_fetch_trim(sdrs);
     while (!ilist_empty(sdrs->free_fetch)) {
-	/* We have some free buffers, see what we can do with them. */
-
-	if (sdrs->next_read_offset == 0)
-	    /* We need to get the SDR header before we can go on. */
-	    break;
-
-	if (sdrs->next_read_offset == sdrs->read_size) {
-	    /* Done with this SDR, time to go to the next. */
-	    if (sdrs->next_read_rec_id == 0xffff) {
-		/* This is the last SDR.  However, we don't go to the
-		   next stage until all the outstanding fetches are
-		   complete. */
-		if (ilist_empty(sdrs->outstanding_fetch)) {
-		    start_reservation_check(sdrs, mc);
-		    goto out;
-		}
-		break;
-	    }
+	/* We have some free buffers, see what we can do with them.
+	   The next header comes first so the bodies can be read
+	   ahead. */
 
+	if (!sdrs->hdr_pending && (sdrs->next_read_rec_id != 0xffff)
+	    && (sdrs->body_count < SDR_FETCH_AHEAD))
+	{
 	    if ((unsigned int) (sdrs->curr_read_idx+1)
 		>= sdrs->working_num_sdrs)
 	    {
@@ -1291,9 +1663,8 @@ handle_sdr_data(ipmi_mc_t  *mc,
 		    unsigned int new_num_sdrs = sdrs->working_num_sdrs + 10;
 		    ipmi_sdr_t *new_sdrs;
 
-		    /* Allocate 9 extra bytes for the db info. */
-		    new_sdrs = ipmi_mem_alloc((sizeof(ipmi_sdr_t)
-					       * new_num_sdrs) + 9);
+		    new_sdrs = ipmi_mem_alloc(sizeof(ipmi_sdr_t)
+					      * new_num_sdrs);
 		    if (!new_sdrs) {
 			ipmi_log(IPMI_LOG_ERR_INFO,
 				 "%ssdr.c(handle_sdr_data): "
@@ -1324,30 +1695,48 @@ handle_sdr_data(ipmi_mc_t  *mc,
 		    goto out;
 		}
 	    }
-	}
 
-	info = ilist_remove_first(sdrs->free_fetch);
-	info->fetch_retry_num = sdrs->fetch_retry_count;
+	    info = ilist_remove_first(sdrs->free_fetch);
+	    info->fetch_retry_num = sdrs->fetch_retry_count;
 
-	if (sdrs->next_read_offset == sdrs->read_size) {
-	    /* header is the next read. */
 	    DEBUG_INFO(sdrs);
 	    sdrs->curr_read_rec_id = sdrs->next_read_rec_id;
 	    sdrs->curr_read_idx++;
-	    sdrs->next_read_offset = 0;
-	    info->offset = sdrs->next_read_offset;
+	    sdrs->hdr_pending = 1;
+	    info->offset = 0;
 	    info->read_len = SDR_HEADER_SIZE;
-	} else {
+	    info->sdr_rec = sdrs->curr_read_rec_id;
+	    info->idx = sdrs->curr_read_idx;
+	} else if (sdrs->body_count) {
+	    unsigned int head = sdrs->body_head;
+
+	    info = ilist_remove_first(sdrs->free_fetch);
+	    info->fetch_retry_num = sdrs->fetch_retry_count;
+
 	    DEBUG_INFO(sdrs);
-	    info->read_len = sdrs->read_size - sdrs->next_read_offset;
-	    if (info->read_len > sdrs->fetch_size)
-		info->read_len = sdrs->fetch_size;
-	    info->offset = sdrs->next_read_offset;
-	    sdrs->next_read_offset += info->read_len;
+	    info->read_len = (sdrs->body_q[head].size
+			      - sdrs->body_q[head].offset);
+	    if (info->read_len > sdrs->fetch_chunk)
+		info->read_len = sdrs->fetch_chunk;
+	    info->offset = sdrs->body_q[head].offset;
+	    info->sdr_rec = sdrs->body_q[head].rec_id;
+	    info->idx = sdrs->body_q[head].idx;
+	    sdrs->body_q[head].offset += info->read_len;
+	    if (sdrs->body_q[head].offset == sdrs->body_q[head].size) {
+		sdrs->body_head = (head + 1) % SDR_FETCH_AHEAD;
+		sdrs->body_count--;
+	    }
+	} else {
+	    /* Nothing to request.  If that was the last SDR, we don't
+	       go to the next stage until all the outstanding fetches
+	       are complete. */
+	    if (!sdrs->hdr_pending && ilist_empty(sdrs->outstanding_fetch)) {
+		start_reservation_check(sdrs, mc);
+		goto out;
+	    }
+	    break;
 	}
-	
-	info->sdr_rec = sdrs->curr_read_rec_id;
-	info->idx = sdrs->curr_read_idx;
+
 	rv = info_send(sdrs, info, mc);
 	if (rv) {
 	    DEBUG_INFO(sdrs);
@@ -1390,6 +1779,8 @@ initial_sdr_fetch(ipmi_sdr_info_t *sdrs, ipmi_mc_t *mc)
     }
     info->sdr_rec = sdrs->curr_rec_id;
     info->offset = 0;
+    sdrs->curr_read_rec_id = sdrs->curr_rec_id;
+    sdrs->hdr_pending = 1;
     /* If all systems were implemented correctly, we could do a big
        fetch here and if it was too big then they would just return
        what was available.  Some systems, though, are picky about the
@@ -1629,8 +2020,8 @@ handle_sdr_info(ipmi_mc_t  *mc,
 	/* No sdrs, so there's nothing to do. */
 	if (sdrs->sdrs) {
 	    DEBUG_INFO(sdrs);
-	    ipmi_mem_free(sdrs->sdrs);
-	    sdrs->sdrs = NULL;
+	    sdr_release_sdrs(sdrs);
+	    sdr_index_free(sdrs);
 	}
 	DEBUG_INFO(sdrs);
 	sdrs->curr_read_idx = -1;
@@ -1638,9 +2029,8 @@ handle_sdr_info(ipmi_mc_t  *mc,
 	goto out;
     }
 
-    /* Allocate 9 extra bytes for the db info. */
-    sdrs->working_sdrs = ipmi_mem_alloc((sizeof(ipmi_sdr_t)
-					* sdrs->working_num_sdrs) + 9);
+    sdrs->working_sdrs = ipmi_mem_alloc(sizeof(ipmi_sdr_t)
+					* sdrs->working_num_sdrs);
     if (!sdrs->working_sdrs) {
 	DEBUG_INFO(sdrs);
 	ipmi_log(IPMI_LOG_ERR_INFO,
@@ -1652,12 +2042,17 @@ handle_sdr_info(ipmi_mc_t  *mc,
     }
 
     sdrs->curr_rec_id = 0;
-    sdrs->read_offset = 0; /* First thing is to read the header. */
 
     sdrs->next_read_rec_id = 0;
     sdrs->curr_read_rec_id = 0;
     sdrs->curr_read_idx = 0;
-    sdrs->next_read_offset = 0; /* First thing is to read the header. */
+    sdrs->hdr_pending = 0;
+    sdrs->body_head = 0;
+    sdrs->body_count = 0;
+
+    sdrs->fetch_reads = 0;
+    sdrs->fetch_bytes = 0;
+    sdrs->os_hnd->get_monotonic_time(sdrs->os_hnd, &sdrs->fetch_start);
 
     if (sdrs->supports_reserve_sdr) {
 	/* Now get the reservation. */
@@ -1967,6 +2362,41 @@ ipmi_sdr_fetch(ipmi_sdr_info_t     *sdrs,
     return info.rv;
 }
 
+int
+ipmi_sdr_set_fetch_window(ipmi_sdr_info_t *sdrs, unsigned int window)
+{
+    fetch_info_t *info;
+    int          rv = 0;
+
+    if ((window < 1) || (window > MAX_SDR_FETCH_WINDOW))
+	return EINVAL;
+
+    sdr_lock(sdrs);
+    if (sdrs->destroyed) {
+	sdr_unlock(sdrs);
+	return EINVAL;
+    }
+
+    while (sdrs->fetch_infos < window) {
+	info = ipmi_mem_alloc(sizeof(*info));
+	if (!info) {
+	    rv = ENOMEM;
+	    goto out_unlock;
+	}
+	info->sdrs = sdrs;
+	ilist_add_tail(sdrs->free_fetch, info, &info->link);
+	sdrs->fetch_infos++;
+    }
+    sdrs->fetch_window = window;
+    /* If a fetch is in progress, the rest will be freed as they come
+       back. */
+    sdr_fetch_trim(sdrs);
+
+ out_unlock:
+    sdr_unlock(sdrs);
+    return rv;
+}
+
 int
 ipmi_get_sdr_count(ipmi_sdr_info_t *sdrs,
 		   unsigned int    *count)
@@ -1988,8 +2418,8 @@ ipmi_get_sdr_by_recid(ipmi_sdr_info_t *sdrs,
 		      int             recid,
 		      ipmi_sdr_t      *return_sdr)
 {
-    unsigned int i;
-    int          rv = ENOENT;
+    int pos;
+    int rv = ENOENT;
 
     sdr_lock(sdrs);
     if (sdrs->destroyed) {
@@ -1997,12 +2427,10 @@ ipmi_get_sdr_by_recid(ipmi_sdr_info_t *sdrs,
 	return EINVAL;
     }
 
-    for (i=0; i<sdrs->num_sdrs; i++) {
-	if (sdrs->sdrs[i].record_id == recid) {
-	    rv = 0;
-	    *return_sdr = sdrs->sdrs[i];
-	    break;
-	}
+    pos = sdr_index_find_recid(sdrs, recid);
+    if (pos >= 0) {
+	rv = 0;
+	*return_sdr = sdrs->sdrs[pos];
     }
 
     sdr_unlock(sdrs);
@@ -2014,8 +2442,8 @@ ipmi_get_sdr_by_type(ipmi_sdr_info_t *sdrs,
 		     int             type,
 		     ipmi_sdr_t      *return_sdr)
 {
-    unsigned int i;
-    int          rv = ENOENT;
+    int pos;
+    int rv = ENOENT;
 
     sdr_lock(sdrs);
     if (sdrs->destroyed) {
@@ -2023,12 +2451,36 @@ ipmi_get_sdr_by_type(ipmi_sdr_info_t *sdrs,
 	return EINVAL;
     }
 
-    for (i=0; i<sdrs->num_sdrs; i++) {
-	if (sdrs->sdrs[i].type == type) {
-	    rv = 0;
-	    *return_sdr = sdrs->sdrs[i];
-	    break;
-	}
+    pos = sdr_index_find_type(sdrs, type);
+    if (pos >= 0) {
+	rv = 0;
+	*return_sdr = sdrs->sdrs[pos];
+    }
+
+    sdr_unlock(sdrs);
+    return rv;
+}
+
+int
+ipmi_get_sdr_by_sensor(ipmi_sdr_info_t *sdrs,
+		       unsigned int    owner,
+		       unsigned int    lun,
+		       unsigned int    num,
+		       ipmi_sdr_t      *return_sdr)
+{
+    int pos;
+    int rv = ENOENT;
+
+    sdr_lock(sdrs);
+    if (sdrs->destroyed) {
+	sdr_unlock(sdrs);
+	return EINVAL;
+    }
+
+    pos = sdr_index_find_sensor(sdrs, sdr_sensor_key(owner, lun, num));
+    if (pos >= 0) {
+	rv = 0;
+	*return_sdr = sdrs->sdrs[pos];
     }
 
     sdr_unlock(sdrs);
@@ -2073,7 +2525,14 @@ ipmi_set_sdr_by_index(ipmi_sdr_info_t *sdrs,
     if ((unsigned int)index >= sdrs->num_sdrs)
 	rv = ENOENT;
     else
+	rv = sdr_make_writable(sdrs);
+    if (!rv) {
+	int rebuild = !sdr_index_keys_equal(&sdrs->sdrs[index], sdr);
+
 	sdrs->sdrs[index] = *sdr;
+	if (rebuild)
+	    sdr_index_rebuild(sdrs);
+    }
 
     sdr_unlock(sdrs);
     return rv;
@@ -2268,11 +2727,13 @@ ipmi_sdr_add(ipmi_sdr_info_t *sdrs,
     int pos;
 
     sdr_lock(sdrs);
+    rv = sdr_make_writable(sdrs);
+    if (rv)
+	goto out_unlock;
     if (sdrs->num_sdrs >= sdrs->sdr_array_size) {
 	ipmi_sdr_t *new_array;
-	/* Allocate 9 extra bytes for the db info. */
-	new_array = ipmi_mem_alloc((sizeof(ipmi_sdr_t)
-				    * (sdrs->sdr_array_size + 10)) + 9);
+	new_array = ipmi_mem_alloc(sizeof(ipmi_sdr_t)
+				   * (sdrs->sdr_array_size + 10));
 	if (!new_array) {
 	    rv = ENOMEM;
 	    goto out_unlock;
@@ -2287,6 +2748,7 @@ ipmi_sdr_add(ipmi_sdr_info_t *sdrs,
     (sdrs->num_sdrs)++;
 
     memcpy(&((sdrs->sdrs)[pos]), sdr, sizeof(*sdr));
+    sdr_index_add(sdrs, pos);
 
  out_unlock:
     sdr_unlock(sdrs);
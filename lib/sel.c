@@ -65,8 +65,16 @@ typedef struct sel_event_holder_s
     unsigned int cancelled : 1;
     unsigned int refcount;
     ipmi_event_t *event;
+
+    /* Link in the event list, and in the record id hash chain. */
+    ilist_item_t              link;
+    struct sel_event_holder_s *hnext;
 } sel_event_holder_t;
 
+/* Starting size of the record id hash table, it doubles as needed.
+   Must be a power of two. */
+#define SEL_HASH_MIN 64
+
 static sel_event_holder_t *
 sel_event_holder_alloc(void)
 {
@@ -179,6 +187,12 @@ struct ipmi_sel_info_s
     unsigned int num_sels;
     unsigned int del_sels;
 
+    /* Every event in the list is also hashed by record id, so
+       finding an event (and the events around it) does not require
+       searching the list. */
+    sel_event_holder_t **recid_hash;
+    unsigned int       recid_hash_size;
+
     /* We serialize operations through here, since we are dealing with
        a locked resource. */
     opq_t *opq;
@@ -220,6 +234,9 @@ static void
 free_event(ilist_iter_t *iter, void *item, void *cb_data)
 {
     sel_event_holder_t *holder = item;
+
+    /* The list link lives in the holder, unlink it before the put. */
+    ilist_delete(iter);
     sel_event_holder_put(holder);
 }
 
@@ -229,18 +246,89 @@ free_events(ilist_t *events)
     ilist_iter(events, free_event, NULL);
 }
 
-static int
-recid_search_cmp(void *item, void *cb_data)
+/* Record ids are usually handed out in order, so the low bits hash
+   them well enough. */
+#define sel_recid_slot(recid, size) ((recid) & ((size) - 1))
+
+static void
+sel_hash_grow(ipmi_sel_info_t *sel)
 {
-    sel_event_holder_t *holder = item;
-    unsigned int       recid = *((unsigned int *) cb_data);
+    unsigned int       size = sel->recid_hash_size * 2;
+    sel_event_holder_t **table;
+    sel_event_holder_t *holder;
+    unsigned int       i, slot;
+
+    table = ipmi_mem_alloc(sizeof(*table) * size);
+    if (!table)
+	/* Just keep using the old table, it will only be slower. */
+	return;
+    memset(table, 0, sizeof(*table) * size);
+
+    for (i=0; i<sel->recid_hash_size; i++) {
+	while ((holder = sel->recid_hash[i])) {
+	    sel->recid_hash[i] = holder->hnext;
+	    slot = sel_recid_slot(ipmi_event_get_record_id(holder->event),
+				  size);
+	    holder->hnext = table[slot];
+	    table[slot] = holder;
+	}
+    }
+    ipmi_mem_free(sel->recid_hash);
+    sel->recid_hash = table;
+    sel->recid_hash_size = size;
+}
+
+/* Add the holder to the end of the event list and to the hash table.
+   The holder's event must be set.  Must be called with the SEL lock
+   held. */
+static void
+sel_add_holder(ipmi_sel_info_t *sel, sel_event_holder_t *holder)
+{
+    unsigned int slot;
+
+    if ((sel->num_sels + sel->del_sels) >= (sel->recid_hash_size * 2))
+	sel_hash_grow(sel);
+
+    /* This cannot fail, we supply the list entry. */
+    ilist_add_tail(sel->events, holder, &holder->link);
+
+    slot = sel_recid_slot(ipmi_event_get_record_id(holder->event),
+			  sel->recid_hash_size);
+    holder->hnext = sel->recid_hash[slot];
+    sel->recid_hash[slot] = holder;
+}
+
+/* Remove the holder from the hash table, the caller must remove it
+   from the event list.  Must be called with the SEL lock held. */
+static void
+sel_unhash_holder(ipmi_sel_info_t *sel, sel_event_holder_t *holder)
+{
+    sel_event_holder_t **prev;
+    unsigned int       slot;
 
-    return ipmi_event_get_record_id(holder->event) == recid;
+    slot = sel_recid_slot(ipmi_event_get_record_id(holder->event),
+			  sel->recid_hash_size);
+    for (prev = &sel->recid_hash[slot]; *prev; prev = &(*prev)->hnext) {
+	if (*prev == holder) {
+	    *prev = holder->hnext;
+	    break;
+	}
+    }
+    holder->hnext = NULL;
 }
+
 static sel_event_holder_t *
-find_event(ilist_t *list, unsigned int recid)
+find_event(ipmi_sel_info_t *sel, unsigned int recid)
 {
-    return ilist_search(list, recid_search_cmp, &recid);
+    sel_event_holder_t *holder;
+
+    holder = sel->recid_hash[sel_recid_slot(recid, sel->recid_hash_size)];
+    while (holder) {
+	if (ipmi_event_get_record_id(holder->event) == recid)
+	    break;
+	holder = holder->hnext;
+    }
+    return holder;
 }
 
 static int
@@ -312,6 +400,14 @@ ipmi_sel_alloc(ipmi_mc_t       *mc,
 	goto out;
     }
 
+    sel->recid_hash = ipmi_mem_alloc(sizeof(*sel->recid_hash) * SEL_HASH_MIN);
+    if (!sel->recid_hash) {
+	rv = ENOMEM;
+	goto out;
+    }
+    memset(sel->recid_hash, 0, sizeof(*sel->recid_hash) * SEL_HASH_MIN);
+    sel->recid_hash_size = SEL_HASH_MIN;
+
     sel->mc = ipmi_mc_convert_to_id(mc);
     sel->destroyed = 0;
     sel->in_destroy = 0;
@@ -343,6 +439,8 @@ ipmi_sel_alloc(ipmi_mc_t       *mc,
 	if (sel) {
 	    if (sel->events)
 		free_ilist(sel->events);
+	    if (sel->recid_hash)
+		ipmi_mem_free(sel->recid_hash);
 	    if (sel->opq)
 		opq_destroy(sel->opq);
 	    if (sel->sel_lock)
@@ -403,6 +501,8 @@ internal_destroy_sel(ipmi_sel_info_t *sel)
 	free_events(sel->events);
 	free_ilist(sel->events);
     }
+    if (sel->recid_hash)
+	ipmi_mem_free(sel->recid_hash);
     sel_unlock(sel);
 
     if (sel->opq)
@@ -528,6 +628,7 @@ free_deleted_event(ilist_iter_t *iter, void *item, void *cb_data)
     ipmi_sel_info_t    *sel = cb_data;
 
     if (holder->deleted) {
+	sel_unhash_holder(sel, holder);
 	ilist_delete(iter);
 	holder->cancelled = 1;
 	sel->del_sels--;
@@ -736,7 +837,7 @@ handle_sel_data(ipmi_mc_t  *mc,
     if ((timestamp > 0) && (timestamp < ipmi_mc_get_startup_SEL_time(mc)))
 	ipmi_event_set_is_old(del_event, 1);
 
-    holder = find_event(sel->events, record_id);
+    holder = find_event(sel, record_id);
     if (!holder) {
 	holder = sel_event_holder_alloc();
 	if (!holder) {
@@ -747,17 +848,9 @@ handle_sel_data(ipmi_mc_t  *mc,
 	    fetch_complete(sel, ENOMEM, 1);
 	    goto out;
 	}
-	if (!ilist_add_tail(sel->events, holder, NULL)) {
-	    ipmi_mem_free(holder);
-	    ipmi_log(IPMI_LOG_ERR_INFO,
-		     "%ssel.c(handle_sel_data): "
-		     "Could not link log onto the log linked list",
-		     sel->name);
-	    fetch_complete(sel, ENOMEM, 1);
-	    goto out;
-	}
 	holder->event = del_event;
 	holder->deleted = 0;
+	sel_add_holder(sel, holder);
 	event_is_new = 1;
 	sel->num_sels++;
 	if (sel->sel_received_events)
@@ -1337,6 +1430,7 @@ free_all_event(ilist_iter_t *iter, void *item, void *cb_data)
 	sel->del_sels--;
 	holder->cancelled = 1;
     }
+    sel_unhash_holder(sel, holder);
     ilist_delete(iter);
     sel_event_holder_put(holder);
 }
@@ -1482,11 +1576,10 @@ handle_sel_delete(ipmi_mc_t  *mc,
 	sel_event_holder_t *real_holder;
 	ilist_iter_t       iter;
 
-	ilist_init_iter(&iter, sel->events);
-	ilist_unpositioned(&iter);
-	real_holder = ilist_search_iter(&iter, recid_search_cmp,
-					&(data->record_id));
+	real_holder = find_event(sel, data->record_id);
 	if (real_holder) {
+	    sel_unhash_holder(sel, real_holder);
+	    ilist_init_iter_at(&iter, sel->events, &real_holder->link);
 	    ilist_delete(&iter);
 	    sel_event_holder_put(real_holder);
 	    sel->del_sels--;
@@ -1836,7 +1929,6 @@ sel_del_event_cb(ipmi_mc_t *mc, void *cb_data)
     ipmi_event_t          *event = info->event;
     int                   cmp_event = info->cmp_event;
     sel_event_holder_t    *real_holder = NULL;
-    ilist_iter_t          iter;
     int                   start_fetch = 0;
 
     sel_lock(sel);
@@ -1846,10 +1938,7 @@ sel_del_event_cb(ipmi_mc_t *mc, void *cb_data)
     }
 
     if (event) {
-	ilist_init_iter(&iter, sel->events);
-	ilist_unpositioned(&iter);
-	real_holder = ilist_search_iter(&iter, recid_search_cmp,
-				    &info->record_id);
+	real_holder = find_event(sel, info->record_id);
 	if (!real_holder) {
 	    info->rv = EINVAL;
 	    goto out_unlock;
@@ -2085,18 +2174,19 @@ ipmi_sel_get_next_event(ipmi_sel_info_t *sel, const ipmi_event_t *event)
     ilist_iter_t iter;
     ipmi_event_t *rv = NULL;
     unsigned int record_id;
+    sel_event_holder_t *holder;
 
     sel_lock(sel);
     if (sel->destroyed) {
 	sel_unlock(sel);
 	return NULL;
     }
-    ilist_init_iter(&iter, sel->events);
-    ilist_unpositioned(&iter);
     record_id = ipmi_event_get_record_id(event);
-    if (ilist_search_iter(&iter, recid_search_cmp, &record_id)) {
+    holder = find_event(sel, record_id);
+    if (holder) {
+	ilist_init_iter_at(&iter, sel->events, &holder->link);
 	if (ilist_next(&iter)) {
-	    sel_event_holder_t *holder = ilist_get(&iter);
+	    holder = ilist_get(&iter);
 
 	    while (holder->deleted) {
 		if (! ilist_next(&iter))
@@ -2117,18 +2207,19 @@ ipmi_sel_get_prev_event(ipmi_sel_info_t *sel, const ipmi_event_t *event)
     ilist_iter_t iter;
     ipmi_event_t *rv = NULL;
     unsigned int record_id;
+    sel_event_holder_t *holder;
 
     sel_lock(sel);
     if (sel->destroyed) {
 	sel_unlock(sel);
 	return NULL;
     }
-    ilist_init_iter(&iter, sel->events);
-    ilist_unpositioned(&iter);
     record_id = ipmi_event_get_record_id(event);
-    if (ilist_search_iter(&iter, recid_search_cmp, &record_id)) {
+    holder = find_event(sel, record_id);
+    if (holder) {
+	ilist_init_iter_at(&iter, sel->events, &holder->link);
 	if (ilist_prev(&iter)) {
-	    sel_event_holder_t *holder = ilist_get(&iter);
+	    holder = ilist_get(&iter);
 
 	    while (holder->deleted) {
 		if (! ilist_prev(&iter))
@@ -2156,7 +2247,7 @@ ipmi_sel_get_event_by_recid(ipmi_sel_info_t *sel,
 	return NULL;
     }
 
-    holder = find_event(sel->events, record_id);
+    holder = find_event(sel, record_id);
     if (!holder)
 	goto out_unlock;
 
@@ -2398,18 +2489,15 @@ ipmi_sel_event_add(ipmi_sel_info_t *sel,
     }
 
     record_id = ipmi_event_get_record_id(new_event);
-    holder = find_event(sel->events, record_id);
+    holder = find_event(sel, record_id);
     if (!holder) {
 	holder = sel_event_holder_alloc();
 	if (!holder) {
 	    rv = ENOMEM;
 	    goto out_unlock;
 	}
-	if (!ilist_add_tail(sel->events, holder, NULL)) {
-	    rv = ENOMEM;
-	    goto out_unlock;
-	}
 	holder->event = ipmi_event_dup(new_event);
+	sel_add_holder(sel, holder);
 	sel->num_sels++;
     } else if (event_cmp(holder->event, new_event) == 0) {
 	/* A duplicate event, just ignore it and return the right
@@ -33,6 +33,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 
 #include <OpenIPMI/ipmiif.h>
@@ -66,6 +67,43 @@ struct ipmi_sensor_info_s
     unsigned int             sensor_count;
 };
 
+/* The conversion factors for a sensor, one set per raw value.  This
+   is several kilobytes, and nearly every sensor on a platform uses
+   one of just a few distinct sets, so the tables are interned in a
+   global hash and shared by refcount.  A table that is not in the
+   hash belongs to a single sensor and may be modified in place. */
+typedef struct sensor_conv_key_s
+{
+    unsigned char linearization;
+    unsigned char analog_data_format;
+
+    struct {
+	int m : 10;
+	unsigned int tolerance : 6;
+	int b : 10;
+	int r_exp : 4;
+	unsigned int accuracy_exp : 2;
+	int accuracy : 10;
+	int b_exp : 4;
+    } conv[256];
+} sensor_conv_key_t;
+
+typedef struct sensor_conv_tab_s sensor_conv_tab_t;
+struct sensor_conv_tab_s
+{
+    unsigned int      refcount;
+    int               interned;
+    unsigned int      hash;
+    sensor_conv_tab_t *next;
+
+    /* Must be fully initialized (including padding) since it is
+       hashed and compared as raw memory. */
+    sensor_conv_key_t k;
+
+    /* Converted value for each raw reading, computed on first use. */
+    double            *lut;
+};
+
 #define SENSOR_ID_LEN 32 /* 16 bytes are allowed for a sensor. */
 struct ipmi_sensor_s
 {
@@ -144,8 +182,6 @@ struct ipmi_sensor_s
     uint16_t mask2;
     uint16_t mask3;
 
-    unsigned int  analog_data_format : 2;
-
     unsigned int  rate_unit : 3;
 
     unsigned int  modifier_unit_use : 2;
@@ -155,17 +191,10 @@ struct ipmi_sensor_s
     unsigned char base_unit;
     unsigned char modifier_unit;
 
-    unsigned char linearization;
-
-    struct {
-	int m : 10;
-	unsigned int tolerance : 6;
-	int b : 10;
-	int r_exp : 4;
-	unsigned int accuracy_exp : 2;
-	int accuracy : 10;
-	int b_exp : 4;
-    } conv[256];
+    /* Linearization, data format and conversion factors.  These are
+       usually shared with other sensors, see the conversion table
+       code below. */
+    sensor_conv_tab_t *conv_tab;
 
     unsigned int  normal_min_specified : 1;
     unsigned int  normal_max_specified : 1;
@@ -226,6 +255,178 @@ struct ipmi_sensor_s
 
 static void sensor_final_destroy(ipmi_sensor_t *sensor);
 
+/***********************************************************************
+ *
+ * Shared conversion tables.
+ *
+ **********************************************************************/
+
+#define SENSOR_CONV_HASH_SIZE 64
+
+static ipmi_lock_t       *conv_lock;
+static sensor_conv_tab_t *conv_hash[SENSOR_CONV_HASH_SIZE];
+
+int
+_ipmi_sensor_init(void)
+{
+    if (conv_lock)
+	return 0;
+    return ipmi_create_global_lock(&conv_lock);
+}
+
+void
+_ipmi_sensor_shutdown(void)
+{
+    if (conv_lock) {
+	ipmi_destroy_lock(conv_lock);
+	conv_lock = NULL;
+    }
+}
+
+static unsigned int
+sensor_conv_hash(const sensor_conv_key_t *k)
+{
+    const unsigned char *d = (const unsigned char *) k;
+    unsigned int        h = 2166136261U;
+    unsigned int        i;
+
+    for (i=0; i<sizeof(*k); i++) {
+	h ^= d[i];
+	h *= 16777619U;
+    }
+    return h;
+}
+
+/* Find the shared table matching the key, or add one, and return it
+   with a reference held. */
+static int
+sensor_conv_intern(const sensor_conv_key_t *k, sensor_conv_tab_t **rtab)
+{
+    unsigned int      hash = sensor_conv_hash(k);
+    unsigned int      idx = hash % SENSOR_CONV_HASH_SIZE;
+    sensor_conv_tab_t *tab;
+
+    ipmi_lock(conv_lock);
+    for (tab = conv_hash[idx]; tab; tab = tab->next) {
+	if ((tab->hash == hash) && (memcmp(&tab->k, k, sizeof(*k)) == 0)) {
+	    tab->refcount++;
+	    goto out;
+	}
+    }
+
+    tab = ipmi_mem_alloc(sizeof(*tab));
+    if (!tab) {
+	ipmi_unlock(conv_lock);
+	return ENOMEM;
+    }
+    memcpy(&tab->k, k, sizeof(*k));
+    tab->refcount = 1;
+    tab->interned = 1;
+    tab->hash = hash;
+    tab->lut = NULL;
+    tab->next = conv_hash[idx];
+    conv_hash[idx] = tab;
+ out:
+    ipmi_unlock(conv_lock);
+    *rtab = tab;
+    return 0;
+}
+
+static void
+sensor_conv_get(sensor_conv_tab_t *tab)
+{
+    ipmi_lock(conv_lock);
+    tab->refcount++;
+    ipmi_unlock(conv_lock);
+}
+
+static void
+sensor_conv_put(sensor_conv_tab_t *tab)
+{
+    sensor_conv_tab_t **p;
+
+    ipmi_lock(conv_lock);
+    tab->refcount--;
+    if (tab->refcount > 0) {
+	ipmi_unlock(conv_lock);
+	return;
+    }
+    if (tab->interned) {
+	p = &conv_hash[tab->hash % SENSOR_CONV_HASH_SIZE];
+	while (*p != tab)
+	    p = &(*p)->next;
+	*p = tab->next;
+    }
+    ipmi_unlock(conv_lock);
+
+    if (tab->lut)
+	ipmi_mem_free(tab->lut);
+    ipmi_mem_free(tab);
+}
+
+static sensor_conv_tab_t *
+sensor_conv_alloc_private(const sensor_conv_key_t *k)
+{
+    sensor_conv_tab_t *tab;
+
+    tab = ipmi_mem_alloc(sizeof(*tab));
+    if (!tab)
+	return NULL;
+    if (k)
+	memcpy(&tab->k, k, sizeof(*k));
+    else
+	memset(&tab->k, 0, sizeof(tab->k));
+    tab->refcount = 1;
+    tab->interned = 0;
+    tab->hash = 0;
+    tab->next = NULL;
+    tab->lut = NULL;
+    return tab;
+}
+
+/* Return the sensor's conversion data for modification, copying the
+   table first if it is shared.  The setters that use this cannot
+   return an error, so an allocation failure just drops the change. */
+static sensor_conv_key_t *
+sensor_conv_writable(ipmi_sensor_t *sensor)
+{
+    sensor_conv_tab_t *tab = sensor->conv_tab;
+
+    if (!tab->interned) {
+	if (tab->lut) {
+	    ipmi_mem_free(tab->lut);
+	    tab->lut = NULL;
+	}
+	return &tab->k;
+    }
+
+    tab = sensor_conv_alloc_private(&tab->k);
+    if (!tab) {
+	ipmi_log(IPMI_LOG_SEVERE,
+		 "%ssensor.c(sensor_conv_writable):"
+		 " Out of memory copying conversion table",
+		 SENSOR_NAME(sensor));
+	return NULL;
+    }
+    sensor_conv_put(sensor->conv_tab);
+    sensor->conv_tab = tab;
+    return &tab->k;
+}
+
+/* Replace a private table with the equivalent shared one, if we can. */
+static void
+sensor_conv_share(ipmi_sensor_t *sensor)
+{
+    sensor_conv_tab_t *tab;
+
+    if (sensor->conv_tab->interned)
+	return;
+    if (sensor_conv_intern(&sensor->conv_tab->k, &tab))
+	return;
+    sensor_conv_put(sensor->conv_tab);
+    sensor->conv_tab = tab;
+}
+
 /***********************************************************************
  *
  * Sensor ID handling.
@@ -823,6 +1024,14 @@ ipmi_sensor_alloc_nonstandard(ipmi_sensor_t **new_sensor)
 
     memset(sensor, 0, sizeof(*sensor));
 
+    /* Kept private until the sensor is added, so the OEM code can
+       fill in the conversion factors cheaply. */
+    sensor->conv_tab = sensor_conv_alloc_private(NULL);
+    if (!sensor->conv_tab) {
+	ipmi_mem_free(sensor);
+	return ENOMEM;
+    }
+
     sensor->hot_swap_requester = -1;
     sensor->usecount = 1;
     sensor->readable = 1;
@@ -945,6 +1154,7 @@ ipmi_sensor_add_nonstandard(ipmi_mc_t              *mc,
     sensor->destroy_handler = destroy_handler;
     sensor->destroy_handler_cb_data = destroy_handler_cb_data;
     sensor_set_name(sensor);
+    sensor_conv_share(sensor);
 
     ipmi_unlock(sensors->idx_lock);
 
@@ -1047,6 +1257,8 @@ sensor_final_destroy(ipmi_sensor_t *sensor)
 	sensor->oem_info_cleanup_handler(sensor, sensor->oem_info);
 
     _ipmi_entity_put(sensor->entity);
+    if (sensor->conv_tab)
+	sensor_conv_put(sensor->conv_tab);
     ipmi_mem_free(sensor);
 }
 
@@ -1182,6 +1394,7 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
     int           id_string_modifier_offset;
     unsigned char *str;
     unsigned int  str_len;
+    sensor_conv_key_t conv;
     
 
     rv = ipmi_get_sdr_count(sdrs, &count);
@@ -1297,6 +1510,7 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 	id_string_mod_type = 0;
 	entity_instance_incr = 0;
 	id_string_modifier_offset = 0;
+	memset(&conv, 0, sizeof(conv));
 
 	s[p]->usecount = 1;
 	s[p]->domain = domain;
@@ -1333,7 +1547,7 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 	    s[p]->mask2 = ipmi_get_uint16(sdr.data+11);
 	    s[p]->mask3 = ipmi_get_uint16(sdr.data+13);
 
-	    s[p]->analog_data_format = (sdr.data[15] >> 6) & 3;
+	    conv.analog_data_format = (sdr.data[15] >> 6) & 3;
 	    s[p]->rate_unit = (sdr.data[15] >> 3) & 7;
 	    s[p]->modifier_unit_use = (sdr.data[15] >> 1) & 3;
 	    s[p]->percentage = sdr.data[15] & 1;
@@ -1343,18 +1557,18 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 
 	if (sdr.type == 1) {
 	    /* A full sensor record. */
-	    s[p]->linearization = sdr.data[18] & 0x7f;
+	    conv.linearization = sdr.data[18] & 0x7f;
 
-	    if (s[p]->linearization <= 11) {
+	    if (conv.linearization <= 11) {
 		for (j=0; j<256; j++) {
-		    s[p]->conv[j].m = sdr.data[19] | ((sdr.data[20] & 0xc0) << 2);
-		    s[p]->conv[j].tolerance = sdr.data[20] & 0x3f;
-		    s[p]->conv[j].b = sdr.data[21] | ((sdr.data[22] & 0xc0) << 2);
-		    s[p]->conv[j].accuracy = ((sdr.data[22] & 0x3f)
+		    conv.conv[j].m = sdr.data[19] | ((sdr.data[20] & 0xc0) << 2);
+		    conv.conv[j].tolerance = sdr.data[20] & 0x3f;
+		    conv.conv[j].b = sdr.data[21] | ((sdr.data[22] & 0xc0) << 2);
+		    conv.conv[j].accuracy = ((sdr.data[22] & 0x3f)
 					     | ((sdr.data[23] & 0xf0) << 2));
-		    s[p]->conv[j].accuracy_exp = (sdr.data[23] >> 2) & 0x3;
-		    s[p]->conv[j].r_exp = (sdr.data[24] >> 4) & 0xf;
-		    s[p]->conv[j].b_exp = sdr.data[24] & 0xf;
+		    conv.conv[j].accuracy_exp = (sdr.data[23] >> 2) & 0x3;
+		    conv.conv[j].r_exp = (sdr.data[24] >> 4) & 0xf;
+		    conv.conv[j].b_exp = sdr.data[24] & 0xf;
 		}
 	    }
 
@@ -1420,6 +1634,10 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 	    id_string_modifier_offset = sdr.data[8] & 0x7f;
 	}
 
+	rv = sensor_conv_intern(&conv, &s[p]->conv_tab);
+	if (rv)
+	    goto out_err_enomem;
+
 	rv = ipmi_get_device_string(&str, str_len,
 				    s[p]->id, IPMI_STR_SDR_SEMANTICS, 0,
 				    &s[p]->id_type, SENSOR_ID_LEN,
@@ -1455,6 +1673,8 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 		    /* In case of error */
 		    s[p+j]->handler_list = NULL;
 
+		    sensor_conv_get(s[p+j]->conv_tab);
+
 		    /* For every sensor except the first, increment the usage
 		       count for the MC so that it will decrement properly.
 		       This cannot fail because we have already gotten it
@@ -1548,6 +1768,8 @@ get_sensors_from_sdrs(ipmi_domain_t      *domain,
 		    locked_list_destroy(s[i]->handler_list);
 		if (s[i]->handler_list_cl)
 		    locked_list_destroy(s[i]->handler_list_cl);
+		if (s[i]->conv_tab)
+		    sensor_conv_put(s[i]->conv_tab);
 		ipmi_mem_free(s[i]);
 	    }
 	ipmi_mem_free(s);
@@ -1612,21 +1834,26 @@ static int cmp_sensor(ipmi_sensor_t *s1,
     if (s1->mask2 != s2->mask2) return 0;
     if (s1->mask3 != s2->mask3) return 0;
     
-    if (s1->analog_data_format != s2->analog_data_format) return 0;
     if (s1->rate_unit != s2->rate_unit) return 0;
     if (s1->modifier_unit_use != s2->modifier_unit_use) return 0;
     if (s1->percentage != s2->percentage) return 0;
     if (s1->base_unit != s2->base_unit) return 0;
     if (s1->modifier_unit != s2->modifier_unit) return 0;
-    if (s1->linearization != s2->linearization) return 0;
-    if (s1->linearization <= 11) {
-	if (s1->conv[0].m != s2->conv[0].m) return 0;
-	if (s1->conv[0].tolerance != s2->conv[0].tolerance) return 0;
-	if (s1->conv[0].b != s2->conv[0].b) return 0;
-	if (s1->conv[0].accuracy != s2->conv[0].accuracy) return 0;
-	if (s1->conv[0].accuracy_exp != s2->conv[0].accuracy_exp) return 0;
-	if (s1->conv[0].r_exp != s2->conv[0].r_exp) return 0;
-	if (s1->conv[0].b_exp != s2->conv[0].b_exp) return 0;
+    if (s1->conv_tab != s2->conv_tab) {
+	sensor_conv_key_t *k1 = &s1->conv_tab->k;
+	sensor_conv_key_t *k2 = &s2->conv_tab->k;
+
+	if (k1->analog_data_format != k2->analog_data_format) return 0;
+	if (k1->linearization != k2->linearization) return 0;
+	if (k1->linearization <= 11) {
+	    if (k1->conv[0].m != k2->conv[0].m) return 0;
+	    if (k1->conv[0].tolerance != k2->conv[0].tolerance) return 0;
+	    if (k1->conv[0].b != k2->conv[0].b) return 0;
+	    if (k1->conv[0].accuracy != k2->conv[0].accuracy) return 0;
+	    if (k1->conv[0].accuracy_exp != k2->conv[0].accuracy_exp) return 0;
+	    if (k1->conv[0].r_exp != k2->conv[0].r_exp) return 0;
+	    if (k1->conv[0].b_exp != k2->conv[0].b_exp) return 0;
+	}
     }
     if (s1->normal_min_specified != s2->normal_min_specified) return 0;
     if (s1->normal_max_specified != s2->normal_max_specified) return 0;
@@ -1949,6 +2176,7 @@ ipmi_sensor_handle_sdrs(ipmi_domain_t   *domain,
 	    opq_destroy(nsensor->waitq);
 	    locked_list_destroy(nsensor->handler_list);
 	    locked_list_destroy(nsensor->handler_list_cl);
+	    sensor_conv_put(nsensor->conv_tab);
 	    ipmi_mem_free(nsensor);
 	    ent_item->sensor = NULL;
 	    sdr_sensors[i] = osensor;
@@ -2689,7 +2917,7 @@ ipmi_sensor_get_analog_data_format(ipmi_sensor_t *sensor)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->analog_data_format;
+    return sensor->conv_tab->k.analog_data_format;
 }
 
 enum ipmi_rate_unit_e
@@ -2737,7 +2965,7 @@ ipmi_sensor_get_linearization(ipmi_sensor_t *sensor)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->linearization;
+    return sensor->conv_tab->k.linearization;
 }
 
 int
@@ -2745,7 +2973,7 @@ ipmi_sensor_get_raw_m(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].m;
+    return sensor->conv_tab->k.conv[val].m;
 }
 
 int
@@ -2753,7 +2981,7 @@ ipmi_sensor_get_raw_tolerance(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].tolerance;
+    return sensor->conv_tab->k.conv[val].tolerance;
 }
 
 int
@@ -2761,7 +2989,7 @@ ipmi_sensor_get_raw_b(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].b;
+    return sensor->conv_tab->k.conv[val].b;
 }
 
 int
@@ -2769,7 +2997,7 @@ ipmi_sensor_get_raw_accuracy(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].accuracy;
+    return sensor->conv_tab->k.conv[val].accuracy;
 }
 
 int
@@ -2777,7 +3005,7 @@ ipmi_sensor_get_raw_accuracy_exp(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].accuracy_exp;
+    return sensor->conv_tab->k.conv[val].accuracy_exp;
 }
 
 int
@@ -2785,7 +3013,7 @@ ipmi_sensor_get_raw_r_exp(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].r_exp;
+    return sensor->conv_tab->k.conv[val].r_exp;
 }
 
 int
@@ -2793,7 +3021,7 @@ ipmi_sensor_get_raw_b_exp(ipmi_sensor_t *sensor, int val)
 {
     CHECK_SENSOR_LOCK(sensor);
 
-    return sensor->conv[val].b_exp;
+    return sensor->conv_tab->k.conv[val].b_exp;
 }
 
 int
@@ -3075,7 +3303,10 @@ void
 ipmi_sensor_set_analog_data_format(ipmi_sensor_t *sensor,
 				   int           analog_data_format)
 {
-    sensor->analog_data_format = analog_data_format;
+    sensor_conv_key_t *k = sensor_conv_writable(sensor);
+
+    if (k)
+	k->analog_data_format = analog_data_format;
 }
 
 void
@@ -3111,49 +3342,73 @@ ipmi_sensor_set_modifier_unit(ipmi_sensor_t *sensor, int modifier_unit)
 void
 ipmi_sensor_set_linearization(ipmi_sensor_t *sensor, int linearization)
 {
-    sensor->linearization = linearization;
+    sensor_conv_key_t *k = sensor_conv_writable(sensor);
+
+    if (k)
+	k->linearization = linearization;
 }
 
 void
 ipmi_sensor_set_raw_m(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].m = val;
+    sensor_conv_key_t *k = sensor_conv_writable(sensor);
+
+    if (k)
+	k->conv[idx].m = val;
 }
 
 void
 ipmi_sensor_set_raw_tolerance(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].tolerance = val;
+    sensor_conv_key_t *k = sensor_conv_writable(sensor);
+
+    if (k)
+	k->conv[idx].tolerance = val;
 }
 
 void
 ipmi_sensor_set_raw_b(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].b = val;
+    sensor_conv_key_t *k = sensor_conv_writable(sensor);
+
+    if (k)
+	k->conv[idx].b = val;
 }
 
 void
 ipmi_sensor_set_raw_accuracy(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].accuracy = val;
+    sensor_conv_key_t *k = sensor_conv_writable(sensor);
+
+    if (k)
+	k->conv[idx].accuracy = val;
 }
 
 void
 ipmi_sensor_set_raw_accuracy_exp(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].accuracy_exp = val;
+    sensor_conv_key_t *k = sensor_conv_writable(sensor);
+
+    if (k)
+	k->conv[idx].accuracy_exp = val;
 }
 
 void
 ipmi_sensor_set_raw_r_exp(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].r_exp = val;
+    sensor_conv_key_t *k = sensor_conv_writable(sensor);
+
+    if (k)
+	k->conv[idx].r_exp = val;
 }
 
 void
 ipmi_sensor_set_raw_b_exp(ipmi_sensor_t *sensor, int idx, int val)
 {
-    sensor->conv[idx].b_exp = val;
+    sensor_conv_key_t *k = sensor_conv_writable(sensor);
+
+    if (k)
+	k->conv[idx].b_exp = val;
 }
 
 void
@@ -4753,6 +5008,7 @@ typedef struct reading_get_info_s
     ipmi_sensor_op_info_t      sdata;
     ipmi_sensor_reading_cb     done;
     void                       *cb_data;
+    int                        free_info; /* Zero if part of a bulk read. */
     ipmi_states_t              states;
     enum ipmi_value_present_e  value_present;
     unsigned int               raw_val;
@@ -4764,13 +5020,16 @@ static void reading_get_done_handler(ipmi_sensor_t *sensor,
 				     void          *sinfo)
 {
     reading_get_info_t *info = sinfo;
+    int                free_info = info->free_info;
 
+    /* A bulk read may free the info in the done handler. */
     if (info->done)
 	info->done(sensor, err, info->value_present,
 		   info->raw_val, info->cooked_val, &info->states,
 		   info->cb_data);
     ipmi_sensor_opq_done(sensor);
-    ipmi_mem_free(info);
+    if (free_info)
+	ipmi_mem_free(info);
 }
 
 static void
@@ -4787,7 +5046,9 @@ reading_get(ipmi_sensor_t *sensor,
 	return;
 
     info->raw_val = rsp->data[1];
-    if (sensor->analog_data_format != IPMI_ANALOG_DATA_FORMAT_NOT_ANALOG) {
+    if (sensor->conv_tab->k.analog_data_format
+	!= IPMI_ANALOG_DATA_FORMAT_NOT_ANALOG)
+    {
 	rv = ipmi_sensor_convert_from_raw(sensor,
 					  info->raw_val,
 					  &info->cooked_val);
@@ -4839,29 +5100,39 @@ reading_get_start(ipmi_sensor_t *sensor, int err, void *cb_data)
 }
 
 static int
-stand_ipmi_sensor_get_reading(ipmi_sensor_t          *sensor,
-			      ipmi_sensor_reading_cb done,
-			      void                   *cb_data)
+reading_get_queue(ipmi_sensor_t          *sensor,
+		  reading_get_info_t     *info,
+		  ipmi_sensor_reading_cb done,
+		  void                   *cb_data)
 {
-    reading_get_info_t *info;
-    int                rv;
-    
     if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
 	/* Not a threshold sensor, it doesn't have readings. */
 	return ENOSYS;
     if (!sensor->readable)
 	return ENOSYS;
 
-    info = ipmi_mem_alloc(sizeof(*info));
-    if (!info)
-	return ENOMEM;
     info->done = done;
     info->cb_data = cb_data;
     info->value_present = IPMI_NO_VALUES_PRESENT;
     info->raw_val = 0;
     info->cooked_val = 0.0;
     ipmi_init_states(&info->states);
-    rv = ipmi_sensor_add_opq(sensor, reading_get_start, &(info->sdata), info);
+    return ipmi_sensor_add_opq(sensor, reading_get_start, &(info->sdata), info);
+}
+
+static int
+stand_ipmi_sensor_get_reading(ipmi_sensor_t          *sensor,
+			      ipmi_sensor_reading_cb done,
+			      void                   *cb_data)
+{
+    reading_get_info_t *info;
+    int                rv;
+    
+    info = ipmi_mem_alloc(sizeof(*info));
+    if (!info)
+	return ENOMEM;
+    info->free_info = 1;
+    rv = reading_get_queue(sensor, info, done, cb_data);
     if (rv)
 	ipmi_mem_free(info);
     return rv;
@@ -4874,6 +5145,7 @@ typedef struct states_get_info_s
     ipmi_sensor_states_cb done;
     void                  *cb_data;
     ipmi_states_t         states;
+    int                   free_info; /* Zero if part of a bulk read. */
 } states_get_info_t;
 
 static void states_get_done_handler(ipmi_sensor_t *sensor,
@@ -4881,11 +5153,14 @@ static void states_get_done_handler(ipmi_sensor_t *sensor,
 				    void          *sinfo)
 {
     states_get_info_t *info = sinfo;
+    int               free_info = info->free_info;
 
+    /* A bulk read may free the info in the done handler. */
     if (info->done)
 	info->done(sensor, err, &info->states, info->cb_data);
     ipmi_sensor_opq_done(sensor);
-    ipmi_mem_free(info);
+    if (free_info)
+	ipmi_mem_free(info);
 }
 
 static void
@@ -4943,26 +5218,36 @@ states_get_start(ipmi_sensor_t *sensor, int err, void *cb_data)
 }
 
 static int
-stand_ipmi_sensor_get_states(ipmi_sensor_t         *sensor,
-			     ipmi_sensor_states_cb done,
-			     void                  *cb_data)
+states_get_queue(ipmi_sensor_t         *sensor,
+		 states_get_info_t     *info,
+		 ipmi_sensor_states_cb done,
+		 void                  *cb_data)
 {
-    states_get_info_t *info;
-    int               rv;
-    
     if (sensor->event_reading_type == IPMI_EVENT_READING_TYPE_THRESHOLD)
 	/* A threshold sensor, it doesn't have states. */
 	return ENOSYS;
     if (!sensor->readable)
 	return ENOSYS;
 
-    info = ipmi_mem_alloc(sizeof(*info));
-    if (!info)
-	return ENOMEM;
     info->done = done;
     info->cb_data = cb_data;
     ipmi_init_states(&info->states);
-    rv = ipmi_sensor_add_opq(sensor, states_get_start, &(info->sdata), info);
+    return ipmi_sensor_add_opq(sensor, states_get_start, &(info->sdata), info);
+}
+
+static int
+stand_ipmi_sensor_get_states(ipmi_sensor_t         *sensor,
+			     ipmi_sensor_states_cb done,
+			     void                  *cb_data)
+{
+    states_get_info_t *info;
+    int               rv;
+    
+    info = ipmi_mem_alloc(sizeof(*info));
+    if (!info)
+	return ENOMEM;
+    info->free_info = 1;
+    rv = states_get_queue(sensor, info, done, cb_data);
     if (rv)
 	ipmi_mem_free(info);
     return rv;
@@ -5041,32 +5326,31 @@ sign_extend(int m, int bits)
 }
 
 static int
-stand_ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
-				   int           val,
-				   double        *result)
+sensor_conv_linearizer(sensor_conv_key_t *k, linearizer *c_func)
 {
-    double m, b, b_exp, r_exp, fval;
-    linearizer c_func;
-
-    if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
-	/* Not a threshold sensor, it doesn't have readings. */
-	return ENOSYS;
-
-    if (sensor->linearization == IPMI_LINEARIZATION_NONLINEAR)
-	c_func = c_linear;
-    else if (sensor->linearization <= 11)
-	c_func = linearize[sensor->linearization];
+    if (k->linearization == IPMI_LINEARIZATION_NONLINEAR)
+	*c_func = c_linear;
+    else if (k->linearization <= 11)
+	*c_func = linearize[k->linearization];
     else
 	return EINVAL;
+    return 0;
+}
 
-    val &= 0xff;
+static int
+sensor_conv_compute(sensor_conv_key_t *k,
+		    linearizer        c_func,
+		    int               val,
+		    double            *result)
+{
+    double m, b, b_exp, r_exp, fval;
 
-    m = sensor->conv[val].m;
-    b = sensor->conv[val].b;
-    r_exp = sensor->conv[val].r_exp;
-    b_exp = sensor->conv[val].b_exp;
+    m = k->conv[val].m;
+    b = k->conv[val].b;
+    r_exp = k->conv[val].r_exp;
+    b_exp = k->conv[val].b_exp;
 
-    switch(sensor->analog_data_format) {
+    switch(k->analog_data_format) {
 	case IPMI_ANALOG_DATA_FORMAT_UNSIGNED:
 	    fval = val;
 	    break;
@@ -5087,6 +5371,85 @@ stand_ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
     return 0;
 }
 
+/* Return the raw-to-reading table for a sensor's conversion factors,
+   building it if this is the first use.  The table is shared by every
+   sensor using the same factors.  Returns NULL if the factors cannot
+   be converted or memory is short; the caller must then compute each
+   value directly. */
+static double *
+sensor_conv_get_lut(ipmi_sensor_t *sensor)
+{
+    sensor_conv_tab_t *tab = sensor->conv_tab;
+    double            *lut = tab->lut;
+    linearizer        c_func;
+    int               i;
+
+    if (lut)
+	return lut;
+
+    if (sensor_conv_linearizer(&tab->k, &c_func))
+	return NULL;
+
+    lut = ipmi_mem_alloc(sizeof(*lut) * 256);
+    if (!lut)
+	return NULL;
+    for (i=0; i<256; i++) {
+	if (sensor_conv_compute(&tab->k, c_func, i, &lut[i])) {
+	    ipmi_mem_free(lut);
+	    return NULL;
+	}
+    }
+
+    /* Somebody else may have built it while we were working. */
+    ipmi_lock(conv_lock);
+    if (tab->lut) {
+	ipmi_mem_free(lut);
+	lut = tab->lut;
+    } else
+	tab->lut = lut;
+    ipmi_unlock(conv_lock);
+    return lut;
+}
+
+static int
+stand_ipmi_sensor_convert_from_raw(ipmi_sensor_t *sensor,
+				   int           val,
+				   double        *result)
+{
+    linearizer c_func;
+    double     *lut;
+    int        rv;
+
+    if (sensor->event_reading_type != IPMI_EVENT_READING_TYPE_THRESHOLD)
+	/* Not a threshold sensor, it doesn't have readings. */
+	return ENOSYS;
+
+    val &= 0xff;
+
+    lut = sensor_conv_get_lut(sensor);
+    if (lut) {
+	*result = lut[val];
+	return 0;
+    }
+
+    rv = sensor_conv_linearizer(&sensor->conv_tab->k, &c_func);
+    if (rv)
+	return rv;
+    return sensor_conv_compute(&sensor->conv_tab->k, c_func, val, result);
+}
+
+/* Convert a raw value for the search below, straight from the table
+   if the sensor uses the standard conversion. */
+static int
+conv_search_val(ipmi_sensor_t *sensor, double *lut, int raw, double *cval)
+{
+    if (lut) {
+	*cval = lut[raw & 0xff];
+	return 0;
+    }
+    return ipmi_sensor_convert_from_raw(sensor, raw, cval);
+}
+
 static int
 stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 				 enum ipmi_round_e rounding,
@@ -5094,6 +5457,7 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 				 int               *result)
 {
     double cval;
+    double *lut = NULL;
     int    lowraw, highraw, raw, maxraw, minraw, next_raw;
     int    rv;
 
@@ -5101,7 +5465,7 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 	/* Not a threshold sensor, it doesn't have readings. */
 	return ENOSYS;
 
-    switch(sensor->analog_data_format) {
+    switch(sensor->conv_tab->k.analog_data_format) {
 	case IPMI_ANALOG_DATA_FORMAT_UNSIGNED:
 	    lowraw = 0;
 	    highraw = 255;
@@ -5127,11 +5491,17 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 	    return EINVAL;
     }
 
+    /* An OEM conversion routine may be in use, only search the
+       table if we know it gives the same answers. */
+    if (sensor->cbs.ipmi_sensor_convert_from_raw
+	== stand_ipmi_sensor_convert_from_raw)
+	lut = sensor_conv_get_lut(sensor);
+
     /* We do a binary search for the right value.  Yuck, but I don't
        have a better plan that will work with non-linear sensors. */
     do {
 	raw = next_raw;
-	rv = ipmi_sensor_convert_from_raw(sensor, raw, &cval);
+	rv = conv_search_val(sensor, lut, raw, &cval);
 	if (rv)
 	    return rv;
 
@@ -5152,7 +5522,7 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 	    if (val > cval) {
 		if (raw < maxraw) {
 		    double nval;
-		    rv = ipmi_sensor_convert_from_raw(sensor, raw+1, &nval);
+		    rv = conv_search_val(sensor, lut, raw+1, &nval);
 		    if (rv)
 			return rv;
 		    nval = cval + ((nval - cval) / 2.0);
@@ -5162,7 +5532,7 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 	    } else {
 		if (raw > minraw) {
 		    double pval;
-		    rv = ipmi_sensor_convert_from_raw(sensor, raw-1, &pval);
+		    rv = conv_search_val(sensor, lut, raw-1, &pval);
 		    if (rv)
 			return rv;
 		    pval = pval + ((cval - pval) / 2.0);
@@ -5183,7 +5553,9 @@ stand_ipmi_sensor_convert_to_raw(ipmi_sensor_t     *sensor,
 	    break;
     }
 
-    if (sensor->analog_data_format == IPMI_ANALOG_DATA_FORMAT_1_COMPL) {
+    if (sensor->conv_tab->k.analog_data_format
+	== IPMI_ANALOG_DATA_FORMAT_1_COMPL)
+    {
 	if (raw < 0)
 	    raw -= 1;
     }
@@ -5204,17 +5576,13 @@ stand_ipmi_sensor_get_tolerance(ipmi_sensor_t *sensor,
 	/* Not a threshold sensor, it doesn't have readings. */
 	return ENOSYS;
 
-    if (sensor->linearization == IPMI_LINEARIZATION_NONLINEAR)
-	c_func = c_linear;
-    else if (sensor->linearization <= 11)
-	c_func = linearize[sensor->linearization];
-    else
+    if (sensor_conv_linearizer(&sensor->conv_tab->k, &c_func))
 	return EINVAL;
 
     val &= 0xff;
 
-    m = sensor->conv[val].m;
-    r_exp = sensor->conv[val].r_exp;
+    m = sensor->conv_tab->k.conv[val].m;
+    r_exp = sensor->conv_tab->k.conv[val].r_exp;
 
     fval = sign_extend(val, 8);
 
@@ -5234,8 +5602,8 @@ stand_ipmi_sensor_get_accuracy(ipmi_sensor_t *sensor, int val, double *accuracy)
 
     val &= 0xff;
 
-    a = sensor->conv[val].accuracy;
-    a_exp = sensor->conv[val].r_exp;
+    a = sensor->conv_tab->k.conv[val].accuracy;
+    a_exp = sensor->conv_tab->k.conv[val].r_exp;
 
     *accuracy = (a * pow(10, a_exp)) / 100.0;
     return 0;
@@ -5952,6 +6320,418 @@ ipmi_sensor_id_get_states(ipmi_sensor_id_t      sensor_id,
 }
 
 
+/***********************************************************************
+ *
+ * Bulk sensor reads.
+ *
+ **********************************************************************/
+
+/* How many reads to keep outstanding to each MC in a bulk read. */
+#define SENSOR_BULK_MC_WINDOW 4
+
+typedef struct sensor_bulk_s sensor_bulk_t;
+
+typedef struct sensor_bulk_item_s
+{
+    sensor_bulk_t         *bulk;
+    ipmi_sensor_reading_t *res;
+    unsigned int          group;
+    int                   start_err;
+
+    /* Used instead of allocating the info for standard sensors. */
+    union {
+	reading_get_info_t r;
+	states_get_info_t  s;
+    } u;
+
+    ipmi_states_t         states;
+} sensor_bulk_item_t;
+
+/* The reads that go to a single MC. */
+typedef struct sensor_bulk_group_s
+{
+    unsigned int next; /* Next entry in the order array to start. */
+    unsigned int end;
+    unsigned int outstanding;
+    int          filling;
+} sensor_bulk_group_t;
+
+struct sensor_bulk_s
+{
+    ipmi_domain_id_t        domain_id;
+    os_handler_t            *os_hnd;
+    ipmi_lock_t             *lock;
+
+    unsigned int            count;
+    ipmi_sensor_reading_t   *results;
+    sensor_bulk_item_t      *items;
+    sensor_bulk_item_t      **order; /* Items sorted by owning MC. */
+    unsigned int            num_groups;
+    sensor_bulk_group_t     *groups;
+
+    unsigned int            remaining;
+    unsigned int            errors;
+    /* While non-zero, something is starting reads and the batch may
+       not complete. */
+    unsigned int            busy;
+    int                     finished;
+    struct timeval          start;
+
+    ipmi_sensor_readings_cb done;
+    void                    *cb_data;
+
+    ipmi_domain_stat_t      *bulk_batches;
+    ipmi_domain_stat_t      *bulk_reads;
+    ipmi_domain_stat_t      *bulk_errors;
+    ipmi_domain_stat_t      *bulk_usecs;
+};
+
+static void sensor_bulk_fill(sensor_bulk_t *bulk, sensor_bulk_group_t *grp);
+
+static void
+bulk_stat_add(ipmi_domain_stat_t *stat, int amount)
+{
+    if (stat)
+	ipmi_domain_stat_add(stat, amount);
+}
+
+static void
+bulk_stat_put(ipmi_domain_stat_t *stat)
+{
+    if (stat)
+	ipmi_domain_stat_put(stat);
+}
+
+static void
+sensor_bulk_free(sensor_bulk_t *bulk)
+{
+    bulk_stat_put(bulk->bulk_batches);
+    bulk_stat_put(bulk->bulk_reads);
+    bulk_stat_put(bulk->bulk_errors);
+    bulk_stat_put(bulk->bulk_usecs);
+    if (bulk->groups)
+	ipmi_mem_free(bulk->groups);
+    if (bulk->order)
+	ipmi_mem_free(bulk->order);
+    if (bulk->items)
+	ipmi_mem_free(bulk->items);
+    if (bulk->results)
+	ipmi_mem_free(bulk->results);
+    if (bulk->lock)
+	ipmi_destroy_lock(bulk->lock);
+    ipmi_mem_free(bulk);
+}
+
+static void
+sensor_bulk_done_cb(ipmi_domain_t *domain, void *cb_data)
+{
+    sensor_bulk_t *bulk = cb_data;
+
+    bulk->done(domain, bulk->results, bulk->count, bulk->cb_data);
+}
+
+static void
+sensor_bulk_finish(sensor_bulk_t *bulk)
+{
+    struct timeval now;
+    long           usecs;
+    int            rv;
+
+    bulk->os_hnd->get_monotonic_time(bulk->os_hnd, &now);
+    usecs = ((now.tv_sec - bulk->start.tv_sec) * 1000000
+	     + (now.tv_usec - bulk->start.tv_usec));
+    bulk_stat_add(bulk->bulk_batches, 1);
+    bulk_stat_add(bulk->bulk_reads, bulk->count);
+    bulk_stat_add(bulk->bulk_errors, bulk->errors);
+    bulk_stat_add(bulk->bulk_usecs, usecs);
+
+    rv = ipmi_domain_pointer_cb(bulk->domain_id, sensor_bulk_done_cb, bulk);
+    if (rv)
+	/* The domain went away, report the results anyway. */
+	bulk->done(NULL, bulk->results, bulk->count, bulk->cb_data);
+
+    sensor_bulk_free(bulk);
+}
+
+/* Must be called with the bulk lock held, this releases it. */
+static void
+sensor_bulk_check_done(sensor_bulk_t *bulk)
+{
+    if ((bulk->remaining == 0) && (bulk->busy == 0) && !bulk->finished) {
+	bulk->finished = 1;
+	ipmi_unlock(bulk->lock);
+	sensor_bulk_finish(bulk);
+	return;
+    }
+    ipmi_unlock(bulk->lock);
+}
+
+/* The result for the item has been filled in. */
+static void
+sensor_bulk_item_done(sensor_bulk_item_t *item)
+{
+    sensor_bulk_t       *bulk = item->bulk;
+    sensor_bulk_group_t *grp = &bulk->groups[item->group];
+
+    ipmi_lock(bulk->lock);
+    grp->outstanding--;
+    bulk->remaining--;
+    if (item->res->err)
+	bulk->errors++;
+    if (!grp->filling) {
+	/* Nobody is starting reads on this MC right now, so start the
+	   next one here. */
+	ipmi_unlock(bulk->lock);
+	sensor_bulk_fill(bulk, grp);
+	return;
+    }
+    sensor_bulk_check_done(bulk);
+}
+
+static void
+sensor_bulk_reading_done(ipmi_sensor_t             *sensor,
+			 int                       err,
+			 enum ipmi_value_present_e value_present,
+			 unsigned int              raw_value,
+			 double                    val,
+			 ipmi_states_t             *states,
+			 void                      *cb_data)
+{
+    sensor_bulk_item_t    *item = cb_data;
+    ipmi_sensor_reading_t *res = item->res;
+
+    res->err = err;
+    if (!err) {
+	res->value_present = value_present;
+	res->raw_value = raw_value;
+	res->val = val;
+	if (states)
+	    ipmi_copy_states(res->states, states);
+    }
+    sensor_bulk_item_done(item);
+}
+
+static void
+sensor_bulk_states_done(ipmi_sensor_t *sensor,
+			int           err,
+			ipmi_states_t *states,
+			void          *cb_data)
+{
+    sensor_bulk_item_t    *item = cb_data;
+    ipmi_sensor_reading_t *res = item->res;
+
+    res->err = err;
+    if (!err && states)
+	ipmi_copy_states(res->states, states);
+    sensor_bulk_item_done(item);
+}
+
+static void
+sensor_bulk_item_start_cb(ipmi_sensor_t *sensor, void *cb_data)
+{
+    sensor_bulk_item_t *item = cb_data;
+    int                rv;
+
+    /* Standard sensors go straight onto the sensor's queue using the
+       storage in the item.  Anything else goes through the OEM
+       handlers. */
+    if (sensor->event_reading_type == IPMI_EVENT_READING_TYPE_THRESHOLD) {
+	if (sensor->cbs.ipmi_sensor_get_reading
+	    == stand_ipmi_sensor_get_reading)
+	{
+	    item->u.r.free_info = 0;
+	    rv = reading_get_queue(sensor, &item->u.r,
+				   sensor_bulk_reading_done, item);
+	} else
+	    rv = ipmi_sensor_get_reading(sensor, sensor_bulk_reading_done,
+					 item);
+    } else {
+	if (sensor->cbs.ipmi_sensor_get_states
+	    == stand_ipmi_sensor_get_states)
+	{
+	    item->u.s.free_info = 0;
+	    rv = states_get_queue(sensor, &item->u.s,
+				  sensor_bulk_states_done, item);
+	} else
+	    rv = ipmi_sensor_get_states(sensor, sensor_bulk_states_done,
+					item);
+    }
+    item->start_err = rv;
+}
+
+static void
+sensor_bulk_item_start(sensor_bulk_item_t *item)
+{
+    int rv;
+
+    item->start_err = 0;
+    rv = ipmi_sensor_pointer_cb(item->res->sensor_id,
+				sensor_bulk_item_start_cb, item);
+    if (!rv)
+	rv = item->start_err;
+    if (rv) {
+	item->res->err = rv;
+	sensor_bulk_item_done(item);
+    }
+}
+
+/* Start reads on the MC until its window is full. */
+static void
+sensor_bulk_fill(sensor_bulk_t *bulk, sensor_bulk_group_t *grp)
+{
+    sensor_bulk_item_t *item;
+
+    ipmi_lock(bulk->lock);
+    bulk->busy++;
+    grp->filling = 1;
+    while ((grp->outstanding < SENSOR_BULK_MC_WINDOW)
+	   && (grp->next < grp->end))
+    {
+	item = bulk->order[grp->next];
+	grp->next++;
+	grp->outstanding++;
+	ipmi_unlock(bulk->lock);
+	sensor_bulk_item_start(item);
+	ipmi_lock(bulk->lock);
+    }
+    grp->filling = 0;
+    bulk->busy--;
+    sensor_bulk_check_done(bulk);
+}
+
+static int
+sensor_bulk_cmp(const void *a, const void *b)
+{
+    const sensor_bulk_item_t *i1 = *((sensor_bulk_item_t * const *) a);
+    const sensor_bulk_item_t *i2 = *((sensor_bulk_item_t * const *) b);
+    const ipmi_sensor_id_t   *id1 = &i1->res->sensor_id;
+    const ipmi_sensor_id_t   *id2 = &i2->res->sensor_id;
+
+    if (id1->mcid.channel != id2->mcid.channel)
+	return id1->mcid.channel < id2->mcid.channel ? -1 : 1;
+    if (id1->mcid.mc_num != id2->mcid.mc_num)
+	return id1->mcid.mc_num < id2->mcid.mc_num ? -1 : 1;
+    if (id1->lun != id2->lun)
+	return id1->lun < id2->lun ? -1 : 1;
+    if (id1->sensor_num != id2->sensor_num)
+	return id1->sensor_num < id2->sensor_num ? -1 : 1;
+    return 0;
+}
+
+int
+ipmi_domain_get_sensor_readings(ipmi_domain_t           *domain,
+				ipmi_sensor_id_t        *ids,
+				unsigned int            count,
+				ipmi_sensor_readings_cb done,
+				void                    *cb_data)
+{
+    sensor_bulk_t    *bulk;
+    ipmi_sensor_id_t *id, *prev;
+    char             name[IPMI_DOMAIN_NAME_LEN];
+    unsigned int     i, g;
+    int              rv;
+
+    CHECK_DOMAIN_LOCK(domain);
+
+    if ((count == 0) || !done)
+	return EINVAL;
+
+    bulk = ipmi_mem_alloc(sizeof(*bulk));
+    if (!bulk)
+	return ENOMEM;
+    memset(bulk, 0, sizeof(*bulk));
+
+    rv = ipmi_create_lock(domain, &bulk->lock);
+    if (rv) {
+	bulk->lock = NULL;
+	goto out_err;
+    }
+
+    rv = ENOMEM;
+    bulk->results = ipmi_mem_alloc(sizeof(*bulk->results) * count);
+    if (!bulk->results)
+	goto out_err;
+    bulk->items = ipmi_mem_alloc(sizeof(*bulk->items) * count);
+    if (!bulk->items)
+	goto out_err;
+    bulk->order = ipmi_mem_alloc(sizeof(*bulk->order) * count);
+    if (!bulk->order)
+	goto out_err;
+    bulk->groups = ipmi_mem_alloc(sizeof(*bulk->groups) * count);
+    if (!bulk->groups)
+	goto out_err;
+
+    bulk->domain_id = ipmi_domain_convert_to_id(domain);
+    bulk->os_hnd = ipmi_domain_get_os_hnd(domain);
+    bulk->count = count;
+    bulk->done = done;
+    bulk->cb_data = cb_data;
+
+    for (i=0; i<count; i++) {
+	sensor_bulk_item_t    *item = &bulk->items[i];
+	ipmi_sensor_reading_t *res = &bulk->results[i];
+
+	res->sensor_id = ids[i];
+	res->err = 0;
+	res->value_present = IPMI_NO_VALUES_PRESENT;
+	res->raw_value = 0;
+	res->val = 0.0;
+	res->states = &item->states;
+	ipmi_init_states(&item->states);
+	item->bulk = bulk;
+	item->res = res;
+	bulk->order[i] = item;
+    }
+
+    /* Group the reads by owning MC, so each MC can have its own
+       window of requests outstanding. */
+    qsort(bulk->order, count, sizeof(*bulk->order), sensor_bulk_cmp);
+    g = 0;
+    prev = NULL;
+    for (i=0; i<count; i++) {
+	id = &bulk->order[i]->res->sensor_id;
+	if (!prev || (prev->mcid.channel != id->mcid.channel)
+	    || (prev->mcid.mc_num != id->mcid.mc_num))
+	{
+	    g = bulk->num_groups;
+	    bulk->num_groups++;
+	    bulk->groups[g].next = i;
+	    bulk->groups[g].outstanding = 0;
+	    bulk->groups[g].filling = 0;
+	}
+	bulk->groups[g].end = i + 1;
+	bulk->order[i]->group = g;
+	prev = id;
+    }
+
+    ipmi_domain_get_name(domain, name, sizeof(name));
+    ipmi_domain_stat_register(domain, "sensor_bulk_batches", name,
+			      &bulk->bulk_batches);
+    ipmi_domain_stat_register(domain, "sensor_bulk_reads", name,
+			      &bulk->bulk_reads);
+    ipmi_domain_stat_register(domain, "sensor_bulk_errors", name,
+			      &bulk->bulk_errors);
+    ipmi_domain_stat_register(domain, "sensor_bulk_usecs", name,
+			      &bulk->bulk_usecs);
+
+    bulk->os_hnd->get_monotonic_time(bulk->os_hnd, &bulk->start);
+    bulk->remaining = count;
+
+    /* Hold the batch open until every MC has been started. */
+    bulk->busy = 1;
+    for (g=0; g<bulk->num_groups; g++)
+	sensor_bulk_fill(bulk, &bulk->groups[g]);
+    ipmi_lock(bulk->lock);
+    bulk->busy--;
+    sensor_bulk_check_done(bulk);
+
+    return 0;
+
+ out_err:
+    sensor_bulk_free(bulk);
+    return rv;
+}
+
 #ifdef IPMI_CHECK_LOCKS
 void
 __ipmi_check_sensor_lock(const ipmi_sensor_t *sensor)
@@ -0,0 +1,203 @@
+/*
+ * posix_cache.c
+ *
+ * File based cache of mappable data for the POSIX OS handlers.
+ *
+ * Author: MontaVista Software, Inc.
+ *         Corey Minyard <minyard@mvista.com>
+ *         source@mvista.com
+ *
+ * Copyright 2002 MontaVista Software Inc.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "posix_cache.h"
+
+typedef struct posix_cache_map_s
+{
+    void   *addr;
+    size_t len;
+} posix_cache_map_t;
+
+/* Return the malloced filename for the key, or NULL on error.  If
+   mkdir is set, create the directory if it doesn't exist. */
+static char *
+cache_filename(const char *dir, const char *key, int mkdir_ok)
+{
+    char *home = NULL;
+    char *name;
+    int  len;
+
+    /* Keys are simple names, they must not escape the directory. */
+    if ((key[0] == '\0') || (key[0] == '.') || strchr(key, '/'))
+	return NULL;
+
+    if (!dir) {
+	home = getenv("HOME");
+	if (!home)
+	    return NULL;
+	len = strlen(home) + strlen(POSIX_CACHE_DIR) + 2;
+    } else
+	len = strlen(dir) + 1;
+
+    name = malloc(len + strlen(key) + 1);
+    if (!name)
+	return NULL;
+    if (dir)
+	strcpy(name, dir);
+    else
+	sprintf(name, "%s/%s", home, POSIX_CACHE_DIR);
+
+    if (mkdir_ok)
+	/* Errors show up when the file is created. */
+	mkdir(name, 0700);
+
+    strcat(name, "/");
+    strcat(name, key);
+    return name;
+}
+
+int
+posix_cache_store(const char          *dir,
+		  const char          *key,
+		  const unsigned char *data,
+		  unsigned int        data_len)
+{
+    char         *name, *tmpname;
+    int          fd;
+    int          rv = 0;
+    unsigned int left = data_len;
+    ssize_t      count;
+
+    name = cache_filename(dir, key, 1);
+    if (!name)
+	return EINVAL;
+
+    /* Write to a temporary file and rename it so readers (and
+       existing mappings) never see a partial file. */
+    tmpname = malloc(strlen(name) + 8);
+    if (!tmpname) {
+	free(name);
+	return ENOMEM;
+    }
+    sprintf(tmpname, "%s.XXXXXX", name);
+    fd = mkstemp(tmpname);
+    if (fd == -1) {
+	rv = errno;
+	goto out;
+    }
+
+    while (left > 0) {
+	count = write(fd, data, left);
+	if (count == -1) {
+	    if (errno == EINTR)
+		continue;
+	    rv = errno;
+	    break;
+	}
+	data += count;
+	left -= count;
+    }
+    if (close(fd) == -1 && !rv)
+	rv = errno;
+    if (!rv && (rename(tmpname, name) == -1))
+	rv = errno;
+    if (rv)
+	unlink(tmpname);
+
+ out:
+    free(tmpname);
+    free(name);
+    return rv;
+}
+
+int
+posix_cache_map(const char          *dir,
+		const char          *key,
+		const unsigned char **data,
+		unsigned int        *data_len,
+		void                **handle)
+{
+    posix_cache_map_t *map;
+    char              *name;
+    struct stat       st;
+    int               fd;
+    int               rv = 0;
+
+    name = cache_filename(dir, key, 0);
+    if (!name)
+	return EINVAL;
+    fd = open(name, O_RDONLY);
+    free(name);
+    if (fd == -1)
+	return errno;
+
+    if (fstat(fd, &st) == -1) {
+	rv = errno;
+	goto out;
+    }
+    if ((st.st_size == 0) || (st.st_size > 0x7fffffff)) {
+	rv = EINVAL;
+	goto out;
+    }
+
+    map = malloc(sizeof(*map));
+    if (!map) {
+	rv = ENOMEM;
+	goto out;
+    }
+    map->len = st.st_size;
+    map->addr = mmap(NULL, map->len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map->addr == MAP_FAILED) {
+	rv = errno;
+	free(map);
+	goto out;
+    }
+
+    *data = map->addr;
+    *data_len = map->len;
+    *handle = map;
+
+ out:
+    close(fd);
+    return rv;
+}
+
+void
+posix_cache_unmap(void *handle)
+{
+    posix_cache_map_t *map = handle;
+
+    munmap(map->addr, map->len);
+    free(map);
+}
@@ -50,6 +50,8 @@
 
 #include <OpenIPMI/ipmi_posix.h>
 
+#include "posix_cache.h"
+
 /* CHEAP HACK - we don't want the user to have to provide this any
    more. */
 extern void posix_vlog(char                 *format,
@@ -65,6 +67,7 @@ typedef struct iposix_info_s
     char *gdbm_filename;
     GDBM_FILE gdbmf;
 #endif
+    char *cache_dir;
 } iposix_info_t;
 
 struct os_hnd_fd_id_s
@@ -551,6 +554,51 @@ set_gdbm_filename(os_handler_t *os_hnd, char *name)
 }
 #endif
 
+static int
+cache_store(os_handler_t        *handler,
+	    const char          *key,
+	    const unsigned char *data,
+	    unsigned int        data_len)
+{
+    iposix_info_t *info = handler->internal_data;
+
+    return posix_cache_store(info->cache_dir, key, data, data_len);
+}
+
+static int
+cache_map(os_handler_t        *handler,
+	  const char          *key,
+	  const unsigned char **data,
+	  unsigned int        *data_len,
+	  void                **handle)
+{
+    iposix_info_t *info = handler->internal_data;
+
+    return posix_cache_map(info->cache_dir, key, data, data_len, handle);
+}
+
+static void
+cache_unmap(os_handler_t *handler,
+	    void         *handle)
+{
+    posix_cache_unmap(handle);
+}
+
+static int
+cache_set_dir(os_handler_t *handler, const char *dir)
+{
+    iposix_info_t *info = handler->internal_data;
+    char          *ndir;
+
+    ndir = strdup(dir);
+    if (!ndir)
+	return ENOMEM;
+    if (info->cache_dir)
+	free(info->cache_dir);
+    info->cache_dir = ndir;
+    return 0;
+}
+
 static void sset_log_handler(os_handler_t *handler,
 			     os_vlog_t    log_handler)
 {
@@ -611,7 +659,11 @@ static os_handler_t ipmi_posix_os_handler =
 #endif
     .set_log_handler = sset_log_handler,
     .get_monotonic_time = get_monotonic_time,
-    .get_real_time = get_real_time
+    .get_real_time = get_real_time,
+    .cache_store = cache_store,
+    .cache_map = cache_map,
+    .cache_unmap = cache_unmap,
+    .cache_set_dir = cache_set_dir
 };
 
 os_handler_t *
@@ -649,6 +701,8 @@ ipmi_posix_free_os_handler(os_handler_t *os_hnd)
     if (info->gdbmf)
 	gdbm_close(info->gdbmf);
 #endif
+    if (info->cache_dir)
+	free(info->cache_dir);
     free(info);
     free(os_hnd);
 }
@@ -55,6 +55,8 @@
 #include <OpenIPMI/selector.h>
 #include <OpenIPMI/ipmi_posix.h>
 
+#include "posix_cache.h"
+
 #include <OpenIPMI/internal/ipmi_int.h>
 
 /* CHEAP HACK - we don't want the user to have to provide this any
@@ -64,7 +66,30 @@ extern void posix_vlog(char                 *format,
 		       va_list              ap);
 #pragma weak posix_vlog
 
-typedef struct pt_os_hnd_data_s
+typedef struct pt_os_hnd_data_s pt_os_hnd_data_t;
+
+/* An event loop, used when the OS handler is set up with more than
+   one loop.  Loop 0 is the selector the user runs (info->sel), the
+   others each have their own selector and a thread that runs it. */
+typedef struct pt_loop_s
+{
+    struct selector_s *sel;
+    pt_os_hnd_data_t  *info;
+
+    /* Number of fds and timers placed on this loop, used to pick
+       the least-loaded one.  Protected by info->loop_lock. */
+    unsigned int      load;
+
+    pthread_t         thread;
+    int               thread_running;
+    volatile int      stopping;
+
+    /* Started to kick the thread out of the selector when
+       stopping. */
+    sel_timer_t       *stop_timer;
+} pt_loop_t;
+
+struct pt_os_hnd_data_s
 {
     struct selector_s *sel;
     os_vlog_t        log_handler;
@@ -75,7 +100,54 @@ typedef struct pt_os_hnd_data_s
     GDBM_FILE gdbmf;
     pthread_mutex_t gdbm_lock;
 #endif
-} pt_os_hnd_data_t;
+    char             *cache_dir;
+    pthread_mutex_t  cache_lock;
+
+    /* Zero if only the single selector is in use. */
+    unsigned int     num_loops;
+    pt_loop_t        *loops;
+    pthread_mutex_t  loop_lock;
+
+    /* Holds the loop the current thread is running, if any. */
+    pthread_key_t    loop_key;
+};
+
+/* Choose the loop to put a new fd or timer on.  If called from a
+   thread running one of the loops, use that loop so that related fds
+   and timers are handled by the same thread.  Otherwise use the loop
+   with the least things on it. */
+static pt_loop_t *
+pick_loop(pt_os_hnd_data_t *info)
+{
+    pt_loop_t    *loop;
+    unsigned int i;
+
+    if (info->num_loops == 0)
+	return NULL;
+
+    loop = pthread_getspecific(info->loop_key);
+    if (loop)
+	return loop;
+
+    pthread_mutex_lock(&info->loop_lock);
+    loop = &info->loops[0];
+    for (i = 1; i < info->num_loops; i++) {
+	if (info->loops[i].load < loop->load)
+	    loop = &info->loops[i];
+    }
+    pthread_mutex_unlock(&info->loop_lock);
+    return loop;
+}
+
+static void
+loop_add_load(pt_os_hnd_data_t *info, pt_loop_t *loop, int change)
+{
+    if (!loop)
+	return;
+    pthread_mutex_lock(&info->loop_lock);
+    loop->load += change;
+    pthread_mutex_unlock(&info->loop_lock);
+}
 
 
 struct os_hnd_fd_id_s
@@ -85,6 +157,8 @@ struct os_hnd_fd_id_s
     os_data_ready_t data_ready;
     os_handler_t    *handler;
     os_fd_data_freed_t freed;
+    struct selector_s *sel;
+    pt_loop_t       *loop;
 };
 
 static void
@@ -120,7 +194,8 @@ add_fd(os_handler_t       *handler,
     os_hnd_fd_id_t   *fd_data;
     int              rv;
     pt_os_hnd_data_t *info = handler->internal_data;
-    struct selector_s *posix_sel = info->sel;
+    pt_loop_t        *loop = pick_loop(info);
+    struct selector_s *posix_sel = loop ? loop->sel : info->sel;
 
     fd_data = malloc(sizeof(*fd_data));
     if (!fd_data)
@@ -131,6 +206,8 @@ add_fd(os_handler_t       *handler,
     fd_data->data_ready = data_ready;
     fd_data->handler = handler;
     fd_data->freed = freed;
+    fd_data->sel = posix_sel;
+    fd_data->loop = loop;
     sel_set_fd_write_handler(posix_sel, fd, SEL_FD_HANDLER_DISABLED);
     sel_set_fd_except_handler(posix_sel, fd, SEL_FD_HANDLER_DISABLED);
     rv = sel_set_fd_handlers(posix_sel, fd, fd_data, fd_handler, NULL, NULL,
@@ -140,6 +217,7 @@ add_fd(os_handler_t       *handler,
 	return rv;
     }
     sel_set_fd_read_handler(posix_sel, fd, SEL_FD_HANDLER_ENABLED);
+    loop_add_load(info, loop, 1);
 
     *id = fd_data;
     return 0;
@@ -149,8 +227,9 @@ static int
 remove_fd(os_handler_t *handler, os_hnd_fd_id_t *fd_data)
 {
     pt_os_hnd_data_t *info = handler->internal_data;
-    struct selector_s *posix_sel = info->sel;
+    struct selector_s *posix_sel = fd_data->sel;
 
+    loop_add_load(info, fd_data->loop, -1);
     sel_set_fd_read_handler(posix_sel, fd_data->fd, SEL_FD_HANDLER_DISABLED);
     sel_clear_fd_handlers(posix_sel, fd_data->fd);
     /* fd_data gets freed in the free_fd_data callback registered at
@@ -166,6 +245,7 @@ struct os_hnd_timer_id_s
     int            running;
     os_handler_t   *handler;
     pthread_mutex_t lock;
+    pt_loop_t      *loop;
 };
 
 static void
@@ -247,7 +327,8 @@ alloc_timer(os_handler_t      *handler,
     os_hnd_timer_id_t *timer_data;
     int               rv;
     pt_os_hnd_data_t  *info = handler->internal_data;
-    struct selector_s *posix_sel = info->sel;
+    pt_loop_t         *loop = pick_loop(info);
+    struct selector_s *posix_sel = loop ? loop->sel : info->sel;
 
     timer_data = malloc(sizeof(*timer_data));
     if (!timer_data)
@@ -262,6 +343,7 @@ alloc_timer(os_handler_t      *handler,
     timer_data->running = 0;
     timer_data->timed_out = NULL;
     timer_data->handler = handler;
+    timer_data->loop = loop;
 
     rv = sel_alloc_timer(posix_sel, timer_handler, timer_data,
 			 &(timer_data->timer));
@@ -270,6 +352,7 @@ alloc_timer(os_handler_t      *handler,
 	free(timer_data);
 	return rv;
     }
+    loop_add_load(info, loop, 1);
 
     *id = timer_data;
     return 0;
@@ -278,6 +361,7 @@ alloc_timer(os_handler_t      *handler,
 static int
 free_timer(os_handler_t *handler, os_hnd_timer_id_t *timer_data)
 {
+    loop_add_load(handler->internal_data, timer_data->loop, -1);
     pthread_mutex_destroy(&timer_data->lock);
     sel_free_timer(timer_data->timer);
     free(timer_data);
@@ -619,6 +703,9 @@ ipmi_posix_thread_free_os_handler(os_handler_t *os_hnd)
     if (info->gdbmf)
 	gdbm_close(info->gdbmf);
 #endif
+    pthread_mutex_destroy(&info->cache_lock);
+    if (info->cache_dir)
+	free(info->cache_dir);
     free(info);
     free(os_hnd);
 }
@@ -676,15 +763,73 @@ operation_loop(os_handler_t *os_hnd)
     pthread_t        self = pthread_self();
     pt_os_hnd_data_t *info = os_hnd->internal_data;
 
+    if (info->num_loops)
+	pthread_setspecific(info->loop_key, &info->loops[0]);
     sel_select_loop(info->sel, posix_thread_send_sig, (long) &self, info);
 }
 
+static void *
+loop_thread(void *data)
+{
+    pt_loop_t *loop = data;
+    pthread_t self = pthread_self();
+    int       rv;
+
+    pthread_setspecific(loop->info->loop_key, loop);
+    while (!loop->stopping) {
+	rv = sel_select(loop->sel, posix_thread_send_sig, (long) &self,
+			loop->info, NULL);
+	if ((rv < 0) && (errno != EINTR))
+	    break;
+    }
+    return NULL;
+}
+
+static void
+loop_stop_timeout(struct selector_s *sel, sel_timer_t *timer, void *data)
+{
+    /* Nothing to do, this just gets the loop thread out of the
+       selector so it sees it is stopping. */
+}
+
+static void
+stop_loops(pt_os_hnd_data_t *info)
+{
+    struct timeval now;
+    pt_loop_t      *loop;
+    unsigned int   i;
+
+    if (!info->loops)
+	return;
+
+    for (i = 1; i < info->num_loops; i++) {
+	loop = &info->loops[i];
+	if (loop->thread_running) {
+	    loop->stopping = 1;
+	    sel_get_monotonic_time(&now);
+	    sel_start_timer(loop->stop_timer, &now);
+	    pthread_join(loop->thread, NULL);
+	}
+	if (loop->stop_timer)
+	    sel_free_timer(loop->stop_timer);
+	if (loop->sel)
+	    sel_free_selector(loop->sel);
+    }
+    pthread_key_delete(info->loop_key);
+    pthread_mutex_destroy(&info->loop_lock);
+    free(info->loops);
+    info->loops = NULL;
+    info->num_loops = 0;
+}
+
 static void
 free_os_handler(os_handler_t *os_hnd)
 {
     pt_os_hnd_data_t *info = os_hnd->internal_data;
 
-    sigaction(info->wake_sig, &info->oldact, NULL);
+    stop_loops(info);
+    if (info->wake_sig)
+	sigaction(info->wake_sig, &info->oldact, NULL);
     sel_free_selector(info->sel);
     ipmi_posix_thread_free_os_handler(os_hnd);
 }
@@ -814,6 +959,61 @@ set_gdbm_filename(os_handler_t *os_hnd, char *name)
 }
 #endif
 
+static int
+cache_store(os_handler_t        *handler,
+	    const char          *key,
+	    const unsigned char *data,
+	    unsigned int        data_len)
+{
+    pt_os_hnd_data_t *info = handler->internal_data;
+    int              rv;
+
+    pthread_mutex_lock(&info->cache_lock);
+    rv = posix_cache_store(info->cache_dir, key, data, data_len);
+    pthread_mutex_unlock(&info->cache_lock);
+    return rv;
+}
+
+static int
+cache_map(os_handler_t        *handler,
+	  const char          *key,
+	  const unsigned char **data,
+	  unsigned int        *data_len,
+	  void                **handle)
+{
+    pt_os_hnd_data_t *info = handler->internal_data;
+    int              rv;
+
+    pthread_mutex_lock(&info->cache_lock);
+    rv = posix_cache_map(info->cache_dir, key, data, data_len, handle);
+    pthread_mutex_unlock(&info->cache_lock);
+    return rv;
+}
+
+static void
+cache_unmap(os_handler_t *handler,
+	    void         *handle)
+{
+    posix_cache_unmap(handle);
+}
+
+static int
+cache_set_dir(os_handler_t *handler, const char *dir)
+{
+    pt_os_hnd_data_t *info = handler->internal_data;
+    char             *ndir;
+
+    ndir = strdup(dir);
+    if (!ndir)
+	return ENOMEM;
+    pthread_mutex_lock(&info->cache_lock);
+    if (info->cache_dir)
+	free(info->cache_dir);
+    info->cache_dir = ndir;
+    pthread_mutex_unlock(&info->cache_lock);
+    return 0;
+}
+
 static void sset_log_handler(os_handler_t *handler,
 			     os_vlog_t    log_handler)
 {
@@ -884,7 +1084,11 @@ static os_handler_t ipmi_posix_thread_os_handler =
 #endif
     .set_log_handler = sset_log_handler,
     .get_monotonic_time = get_monotonic_time,
-    .get_real_time = get_real_time
+    .get_real_time = get_real_time,
+    .cache_store = cache_store,
+    .cache_map = cache_map,
+    .cache_unmap = cache_unmap,
+    .cache_set_dir = cache_set_dir
 };
 
 os_handler_t *
@@ -892,9 +1096,7 @@ ipmi_posix_thread_get_os_handler2(int wake_sig)
 {
     os_handler_t     *rv;
     pt_os_hnd_data_t *info;
-#ifdef HAVE_GDBM
     int              err;
-#endif
 
     rv = malloc(sizeof(*rv));
     if (!rv)
@@ -910,9 +1112,17 @@ ipmi_posix_thread_get_os_handler2(int wake_sig)
     memset(info, 0, sizeof(*info));
     rv->internal_data = info;
 
+    err = pthread_mutex_init(&info->cache_lock, NULL);
+    if (err) {
+	free(info);
+	free(rv);
+	return NULL;
+    }
+
 #ifdef HAVE_GDBM
     err = pthread_mutex_init(&info->gdbm_lock, NULL);
     if (err) {
+	pthread_mutex_destroy(&info->cache_lock);
 	free(info);
 	free(rv);
 	return NULL;
@@ -972,8 +1182,67 @@ slock_unlock(sel_lock_t *l)
     l->os_hnd->unlock(l->os_hnd, l->lock);
 }
 
+static int
+start_loops(os_handler_t *os_hnd, unsigned int num_loops)
+{
+    pt_os_hnd_data_t *info = os_hnd->internal_data;
+    pt_loop_t        *loop;
+    unsigned int     i;
+    int              rv;
+
+    info->loops = calloc(num_loops, sizeof(*info->loops));
+    if (!info->loops)
+	return ENOMEM;
+    rv = pthread_mutex_init(&info->loop_lock, NULL);
+    if (rv) {
+	free(info->loops);
+	info->loops = NULL;
+	return rv;
+    }
+    rv = pthread_key_create(&info->loop_key, NULL);
+    if (rv) {
+	pthread_mutex_destroy(&info->loop_lock);
+	free(info->loops);
+	info->loops = NULL;
+	return rv;
+    }
+
+    info->num_loops = num_loops;
+    info->loops[0].sel = info->sel;
+    info->loops[0].info = info;
+    for (i = 1; i < num_loops; i++) {
+	loop = &info->loops[i];
+	loop->info = info;
+	rv = sel_alloc_selector_thread(&loop->sel, info->wake_sig,
+				       slock_alloc, slock_free,
+				       slock_lock, slock_unlock, os_hnd);
+	if (rv)
+	    goto out_err;
+	rv = sel_alloc_timer(loop->sel, loop_stop_timeout, loop,
+			     &loop->stop_timer);
+	if (rv)
+	    goto out_err;
+	rv = pthread_create(&loop->thread, NULL, loop_thread, loop);
+	if (rv)
+	    goto out_err;
+	loop->thread_running = 1;
+    }
+
+    return 0;
+
+ out_err:
+    stop_loops(info);
+    return rv;
+}
+
 os_handler_t *
 ipmi_posix_thread_setup_os_handler(int wake_sig)
+{
+    return ipmi_posix_thread_setup_os_handler_loops(wake_sig, 1);
+}
+
+os_handler_t *
+ipmi_posix_thread_setup_os_handler_loops(int wake_sig, unsigned int num_loops)
 {
     os_handler_t     *os_hnd;
     pt_os_hnd_data_t *info;
@@ -995,14 +1264,31 @@ ipmi_posix_thread_setup_os_handler(int wake_sig)
 	goto out;
     }
 
-    act.sa_handler = posix_thread_sighandler;
-    sigemptyset(&act.sa_mask);
-    act.sa_flags = 0;
-    rv = sigaction(wake_sig, &act, &info->oldact);
-    if (rv) {
-	ipmi_posix_thread_free_os_handler(os_hnd);
-	os_hnd = NULL;
-	goto out;
+    if (wake_sig) {
+	act.sa_handler = posix_thread_sighandler;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = 0;
+	rv = sigaction(wake_sig, &act, &info->oldact);
+	if (rv) {
+	    sel_free_selector(info->sel);
+	    ipmi_posix_thread_free_os_handler(os_hnd);
+	    os_hnd = NULL;
+	    goto out;
+	}
+    }
+
+    if (num_loops > 1) {
+	/* Start these after the signal handler is installed, the
+	   threads inherit the blocked wake signal from us. */
+	rv = start_loops(os_hnd, num_loops);
+	if (rv) {
+	    if (wake_sig)
+		sigaction(wake_sig, &info->oldact, NULL);
+	    sel_free_selector(info->sel);
+	    ipmi_posix_thread_free_os_handler(os_hnd);
+	    os_hnd = NULL;
+	    goto out;
+	}
     }
 
  out:
@@ -52,8 +52,23 @@
 #include <syslog.h>
 #include <signal.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 #ifdef HAVE_EPOLL_PWAIT
 #include <sys/epoll.h>
+
+/* epoll data for the wake fd.  Real fds use the fd in the lower 32
+   bits and a generation in the upper, so this can't collide. */
+#define SEL_WAKE_EPOLL_DATA	(~((uint64_t) 0))
+
+/* Upper bound and default for the number of events handled per
+   epoll_pwait() call, see sel_set_epoll_batch(). */
+#define SEL_EPOLL_MAX_BATCH	256
+#define SEL_EPOLL_DEFAULT_BATCH	32
 #else
 #define EPOLL_CTL_ADD 0
 #define EPOLL_CTL_DEL 0
@@ -78,8 +93,40 @@ typedef struct fd_control_s
     sel_fd_handler_t handle_read;
     sel_fd_handler_t handle_write;
     sel_fd_handler_t handle_except;
+
+    /* Which of the above are currently being monitored. */
+    int              read_enabled;
+    int              write_enabled;
+    int              except_enabled;
+
+    /* Incremented each time handlers are installed on the fd, and
+       stored in the epoll data.  This lets a batch of epoll events
+       detect an event for an fd that was closed and re-registered by
+       an earlier handler in the same batch. */
+    unsigned int     gen;
+
+    /* Was the fd last registered with EPOLLONESHOT, and if so, is it
+       still armed in the kernel? */
+    int              oneshot;
+    int              armed;
 } fd_control_t;
 
+/* File descriptors are kept in a two-level table indexed by fd.  The
+   top level is an array of pointers to fixed-size chunks that is
+   grown as larger fds are registered; the chunks themselves never
+   move once allocated, so an fd_control_t pointer stays valid when
+   the fd lock is dropped to call a handler. */
+#define SEL_FD_CHUNK_SHIFT	8
+#define SEL_FD_CHUNK_SIZE	(1 << SEL_FD_CHUNK_SHIFT)
+#define SEL_FD_CHUNK_MASK	(SEL_FD_CHUNK_SIZE - 1)
+
+#include "twheel.h"
+
+/* Default timer wheel tick, 2^20ns is about a millisecond. */
+#define SEL_WHEEL_DEFAULT_TICK_SHIFT	20
+#define SEL_WHEEL_MIN_TICK_SHIFT	10
+#define SEL_WHEEL_MAX_TICK_SHIFT	30
+
 typedef struct heap_val_s
 {
     /* Set this to the function to call when the timeout occurs. */
@@ -95,7 +142,11 @@ typedef struct heap_val_s
     /* Who owns me? */
     struct selector_s *sel;
 
-    /* Am I currently running? */
+    /* Links for the timer wheel, if the selector uses one instead of
+       the heap. */
+    twheel_link_t wlink;
+
+    /* Am I currently running (in the heap or the wheel)? */
     int in_heap;
 
     /* Am I currently stopped? */
@@ -175,16 +226,10 @@ struct sel_runner_s
 
 struct selector_s
 {
-    /* This is an array of all the file descriptors possible.  This is
-       moderately wasteful of space, but easy to do.  Hey, memory is
-       cheap. */
-    volatile fd_control_t fds[FD_SETSIZE];
-    
-    /* These are the offical fd_sets used to track what file descriptors
-       need to be monitored. */
-    volatile fd_set read_set;
-    volatile fd_set write_set;
-    volatile fd_set except_set;
+    /* The file descriptor table, see SEL_FD_CHUNK_SHIFT.  Only
+       accessed with fd_lock held. */
+    fd_control_t **fd_chunks;
+    unsigned int num_fd_chunks;
 
     volatile int maxfd; /* The largest file descriptor registered with
 			   this code. */
@@ -194,6 +239,13 @@ struct selector_s
     /* The timer heap. */
     theap_t timer_heap;
 
+    /* If set, timers go here instead of the heap. */
+    twheel_t *timer_wheel;
+
+    /* The wheel tick that waiting threads will wake up at, adding a
+       timer before this wakes them. */
+    uint64_t wheel_wait_tick;
+
     /* This is a list of items waiting to be woken up because they are
        sitting in a select.  See wake_sel_thread() for more info. */
     sel_wait_list_t wait_list;
@@ -205,8 +257,27 @@ struct selector_s
 
     int wake_sig;
 
+    /* Threaded selectors wake threads blocked in the selector by
+       making this readable, see wake_sel_thread().  This is an eventfd
+       if available (both entries are the same fd), or a pipe.  -1 if
+       it could not be allocated, in which case wake_sig is used. */
+    int wake_fds[2];
+
+    /* Set when the wake fd has been written and not yet drained, so
+       multiple wakers only write once. */
+    volatile int wake_pending;
+
 #ifdef HAVE_EPOLL_PWAIT
     int epollfd;
+
+    /* Maximum number of events pulled from the kernel per wakeup. */
+    unsigned int epoll_batch;
+
+    /* If set, fds are registered with EPOLLONESHOT so that only one
+       thread can be handling a given fd at a time, and they are
+       re-armed after their handlers run.  Otherwise they are level
+       triggered and only touched when their interest set changes. */
+    int epoll_oneshot;
 #endif
     sel_lock_t *(*sel_lock_alloc)(void *cb_data);
     void (*sel_lock_free)(sel_lock_t *);
@@ -242,6 +313,77 @@ sel_fd_unlock(struct selector_s *sel)
 	sel->sel_unlock(sel->fd_lock);
 }
 
+static int
+sel_alloc_wake_fd(struct selector_s *sel)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    sel->wake_fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sel->wake_fds[0] != -1) {
+	sel->wake_fds[1] = sel->wake_fds[0];
+	return 0;
+    }
+#endif
+    if (pipe(sel->wake_fds) == -1)
+	goto out_err;
+    if (fcntl(sel->wake_fds[0], F_SETFL, O_NONBLOCK) == -1
+	|| fcntl(sel->wake_fds[1], F_SETFL, O_NONBLOCK) == -1
+	|| fcntl(sel->wake_fds[0], F_SETFD, FD_CLOEXEC) == -1
+	|| fcntl(sel->wake_fds[1], F_SETFD, FD_CLOEXEC) == -1) {
+	close(sel->wake_fds[0]);
+	close(sel->wake_fds[1]);
+	goto out_err;
+    }
+    return 0;
+
+ out_err:
+    sel->wake_fds[0] = -1;
+    sel->wake_fds[1] = -1;
+    return errno;
+}
+
+static void
+sel_free_wake_fd(struct selector_s *sel)
+{
+    if (sel->wake_fds[0] == -1)
+	return;
+    close(sel->wake_fds[0]);
+    if (sel->wake_fds[1] != sel->wake_fds[0])
+	close(sel->wake_fds[1]);
+}
+
+/* Make the wake fd readable, unless it already is. */
+static void
+sel_send_wake(struct selector_s *sel)
+{
+    uint64_t val = 1;
+    int      rv;
+
+    if (sel->wake_pending)
+	return;
+    sel->wake_pending = 1;
+    /* An eventfd needs 8 bytes, a pipe can take them too. */
+    rv = write(sel->wake_fds[1], &val, sizeof(val));
+    (void) rv; /* A full pipe is already readable, so ignore errors. */
+}
+
+/* Called by the thread that saw the wake fd readable.  The fd must
+   be drained before the pending flag is cleared.  Clearing first
+   would let a waker set the flag and write between the two, and the
+   drain would then eat that write while leaving the flag set, so no
+   later wake would ever write again.  This way a waker that sees the
+   flag still set is covered by this thread, which is awake and will
+   recalculate its timeout before it waits again, and one that sees
+   it clear writes after the drain. */
+static void
+sel_clear_wake(struct selector_s *sel)
+{
+    uint64_t val;
+
+    while (read(sel->wake_fds[0], &val, sizeof(val)) > 0)
+	;
+    sel->wake_pending = 0;
+}
+
 /* This function will wake the SEL thread.  It must be called with the
    timer lock held, because it messes with timeout.
 
@@ -251,22 +393,29 @@ sel_fd_unlock(struct selector_s *sel)
    timeout to zero first.  That way, if the select has calculated the
    timeout but has not yet called select, then this will set it to
    zero (causing it to wait zero time).  If select has already been
-   called, then the signal send should wake it up.  We only need to do
-   this after we have calculated the timeout, but before we have
-   called select, thus only things in the wait list matter. */
+   called, then writing the wake fd (or sending the signal if there
+   is no wake fd) should wake it up.  We only need to do this after we
+   have calculated the timeout, but before we have called select,
+   thus only things in the wait list matter. */
 static void
 wake_sel_thread(struct selector_s *sel)
 {
     sel_wait_list_t *item;
 
     item = sel->wait_list.next;
+    if (item == &sel->wait_list)
+	return;
+
     while (item != &sel->wait_list) {
 	item->timeout->tv_sec = 0;
 	item->timeout->tv_usec = 0;
-	if (item->send_sig)
+	if (sel->wake_fds[1] == -1 && item->send_sig)
 	    item->send_sig(item->thread_id, item->send_sig_cb_data);
 	item = item->next;
     }
+
+    if (sel->wake_fds[1] != -1)
+	sel_send_wake(sel);
 }
 
 static void
@@ -276,14 +425,88 @@ wake_fd_sel_thread(struct selector_s *sel)
     sel_fd_unlock(sel);
 }
 
+static uint64_t
+timeval_to_ns(const struct timeval *tv)
+{
+    return ((uint64_t) tv->tv_sec) * 1000000000 + tv->tv_usec * 1000;
+}
+
+static sel_timer_t *
+wlink_to_timer(twheel_link_t *link)
+{
+    return (sel_timer_t *) (((char *) link)
+			    - offsetof(sel_timer_t, val.wlink));
+}
+
+/* Add a timer to the heap or wheel.  These must be called with the
+   timer lock held.  If wake is set, restart waiting threads if the
+   first timer to go off changed. */
 static void
-wake_timer_sel_thread(struct selector_s *sel, volatile sel_timer_t *old_top)
+sel_queue_timer(struct selector_s *sel, sel_timer_t *timer, int wake)
 {
-    if (old_top != theap_get_top(&sel->timer_heap))
+    volatile sel_timer_t *top;
+    uint64_t             tick;
+
+    timer->val.in_heap = 1;
+    if (sel->timer_wheel) {
+	tick = twheel_add(sel->timer_wheel, &timer->val.wlink,
+			  timeval_to_ns(&timer->val.timeout));
+	if (wake && tick < sel->wheel_wait_tick) {
+	    sel->wheel_wait_tick = tick;
+	    wake_sel_thread(sel);
+	}
+	return;
+    }
+
+    top = theap_get_top(&sel->timer_heap);
+    theap_add(&sel->timer_heap, timer);
+    if (wake && top != theap_get_top(&sel->timer_heap))
 	/* If the top value changed, restart the waiting thread. */
 	wake_sel_thread(sel);
 }
 
+static void
+sel_dequeue_timer(struct selector_s *sel, sel_timer_t *timer, int wake)
+{
+    volatile sel_timer_t *top;
+
+    timer->val.in_heap = 0;
+    if (sel->timer_wheel) {
+	/* Waking up early is harmless, don't bother. */
+	twheel_remove(sel->timer_wheel, &timer->val.wlink);
+	return;
+    }
+
+    top = theap_get_top(&sel->timer_heap);
+    theap_remove(&sel->timer_heap, timer);
+    if (wake && top != theap_get_top(&sel->timer_heap))
+	wake_sel_thread(sel);
+}
+
+/* Get the next timer to run as of now, taking it out of the heap or
+   wheel.  With the wheel, all the due timers were moved to its
+   expired list by twheel_advance() in process_timers(). */
+static sel_timer_t *
+sel_get_expired_timer(struct selector_s *sel, struct timeval *now)
+{
+    sel_timer_t   *timer;
+    twheel_link_t *link;
+
+    if (sel->timer_wheel) {
+	link = twheel_get_expired(sel->timer_wheel);
+	if (!link)
+	    return NULL;
+	timer = wlink_to_timer(link);
+    } else {
+	timer = theap_get_top(&sel->timer_heap);
+	if (!timer || cmp_timeval(now, &timer->val.timeout) < 0)
+	    return NULL;
+	theap_remove(&sel->timer_heap, timer);
+    }
+    timer->val.in_heap = 0;
+    return timer;
+}
+
 /* Wait list management.  These *must* be called with the timer list
    locked, and the values in the item *must not* change while in the
    list. */
@@ -318,11 +541,87 @@ init_fd(fd_control_t *fd)
     fd->handle_read = NULL;
     fd->handle_write = NULL;
     fd->handle_except = NULL;
+    fd->read_enabled = 0;
+    fd->write_enabled = 0;
+    fd->except_enabled = 0;
+    fd->oneshot = 0;
+    fd->armed = 0;
 }
 
+static int
+sel_uses_epoll(struct selector_s *sel)
+{
 #ifdef HAVE_EPOLL_PWAIT
+    return sel->epollfd >= 0;
+#else
+    return 0;
+#endif
+}
+
+/* Find the control structure for an fd, or NULL if the fd has never
+   been in the table.  Must be called with the fd lock held. */
+static fd_control_t *
+sel_find_fd(struct selector_s *sel, int fd)
+{
+    unsigned int chunk = ((unsigned int) fd) >> SEL_FD_CHUNK_SHIFT;
+
+    if (fd < 0 || chunk >= sel->num_fd_chunks || !sel->fd_chunks[chunk])
+	return NULL;
+    return &sel->fd_chunks[chunk][fd & SEL_FD_CHUNK_MASK];
+}
+
+/* Like sel_find_fd(), but grow the table to hold the fd if
+   necessary.  Must be called with the fd lock held. */
+static fd_control_t *
+sel_alloc_fd(struct selector_s *sel, int fd)
+{
+    unsigned int chunk = ((unsigned int) fd) >> SEL_FD_CHUNK_SHIFT;
+    unsigned int i;
+
+    if (fd < 0)
+	return NULL;
+
+    if (chunk >= sel->num_fd_chunks) {
+	unsigned int  new_num = sel->num_fd_chunks;
+	fd_control_t **new_chunks;
+
+	if (new_num == 0)
+	    new_num = 4;
+	while (new_num <= chunk)
+	    new_num *= 2;
+	new_chunks = realloc(sel->fd_chunks, new_num * sizeof(*new_chunks));
+	if (!new_chunks)
+	    return NULL;
+	memset(new_chunks + sel->num_fd_chunks, 0,
+	       (new_num - sel->num_fd_chunks) * sizeof(*new_chunks));
+	sel->fd_chunks = new_chunks;
+	sel->num_fd_chunks = new_num;
+    }
+
+    if (!sel->fd_chunks[chunk]) {
+	fd_control_t *fds = malloc(SEL_FD_CHUNK_SIZE * sizeof(*fds));
+
+	if (!fds)
+	    return NULL;
+	for (i = 0; i < SEL_FD_CHUNK_SIZE; i++) {
+	    init_fd(&fds[i]);
+	    fds[i].gen = 0;
+	}
+	sel->fd_chunks[chunk] = fds;
+    }
+
+    return &sel->fd_chunks[chunk][fd & SEL_FD_CHUNK_MASK];
+}
+
+#ifdef HAVE_EPOLL_PWAIT
+static int
+fd_has_interest(fd_control_t *fdc)
+{
+    return fdc->read_enabled || fdc->write_enabled || fdc->except_enabled;
+}
+
 static int
-sel_update_epoll(struct selector_s *sel, int fd, int op)
+sel_update_epoll(struct selector_s *sel, int fd, fd_control_t *fdc, int op)
 {
     struct epoll_event event;
 
@@ -330,21 +629,33 @@ sel_update_epoll(struct selector_s *sel, int fd, int op)
 	return 1;
 
     memset(&event, 0, sizeof(event));
-    event.events = EPOLLONESHOT;
-    event.data.fd = fd;
-    if (FD_ISSET(fd, &sel->read_set))
+    event.data.u64 = ((uint64_t) fdc->gen << 32) | (unsigned int) fd;
+    if (fdc->read_enabled)
 	event.events |= EPOLLIN | EPOLLHUP;
-    if (FD_ISSET(fd, &sel->write_set))
+    if (fdc->write_enabled)
 	event.events |= EPOLLOUT;
-    if (FD_ISSET(fd, &sel->write_set))
+    if (fdc->except_enabled)
 	event.events |= EPOLLERR | EPOLLPRI;
 
-    epoll_ctl(sel->epollfd, op, fd, &event);
+    /* EPOLLERR and EPOLLHUP are always reported, even if not asked
+       for, so an fd with nothing enabled would spin in level
+       triggered mode.  Make it one-shot so it reports at most once
+       until something is enabled again. */
+    if (sel->epoll_oneshot || !event.events)
+	event.events |= EPOLLONESHOT;
+
+    fdc->oneshot = !!(event.events & EPOLLONESHOT);
+    if (op == EPOLL_CTL_DEL) {
+	fdc->armed = 0;
+	epoll_ctl(sel->epollfd, op, fd, &event);
+    } else if (epoll_ctl(sel->epollfd, op, fd, &event) == 0) {
+	fdc->armed = 1;
+    }
     return 0;
 }
 #else
 static int
-sel_update_epoll(struct selector_s *sel, int fd, int op)
+sel_update_epoll(struct selector_s *sel, int fd, fd_control_t *fdc, int op)
 {
     return 1;
 }
@@ -372,8 +683,19 @@ sel_set_fd_handlers(struct selector_s *sel,
     state->use_count = 0;
     state->done = done;
 
+    if (fd < 0 || (!sel_uses_epoll(sel) && fd >= FD_SETSIZE)) {
+	/* select() can't handle fds past FD_SETSIZE. */
+	free(state);
+	return EINVAL;
+    }
+
     sel_fd_lock(sel);
-    fdc = (fd_control_t *) &(sel->fds[fd]);
+    fdc = sel_alloc_fd(sel, fd);
+    if (!fdc) {
+	sel_fd_unlock(sel);
+	free(state);
+	return ENOMEM;
+    }
     if (fdc->state) {
 	oldstate = fdc->state;
 	olddata = fdc->data;
@@ -386,12 +708,14 @@ sel_set_fd_handlers(struct selector_s *sel,
     fdc->handle_except = except_handler;
 
     if (added) {
+	fdc->gen++;
+
 	/* Move maxfd up if necessary. */
 	if (fd > sel->maxfd) {
 	    sel->maxfd = fd;
 	}
 
-	if (sel_update_epoll(sel, fd, EPOLL_CTL_ADD)) {
+	if (sel_update_epoll(sel, fd, fdc, EPOLL_CTL_ADD)) {
 	    wake_fd_sel_thread(sel);
 	    goto out;
 	}
@@ -421,24 +745,28 @@ sel_clear_fd_handlers(struct selector_s *sel,
     void         *olddata = NULL;
 
     sel_fd_lock(sel);
-    fdc = (fd_control_t *) &(sel->fds[fd]);
+    fdc = sel_find_fd(sel, fd);
+    if (!fdc) {
+	sel_fd_unlock(sel);
+	return;
+    }
 
     if (fdc->state) {
 	oldstate = fdc->state;
 	olddata = fdc->data;
 	fdc->state = NULL;
 
-	sel_update_epoll(sel, fd, EPOLL_CTL_DEL);
+	sel_update_epoll(sel, fd, fdc, EPOLL_CTL_DEL);
     }
 
     init_fd(fdc);
-    FD_CLR(fd, &sel->read_set);
-    FD_CLR(fd, &sel->write_set);
-    FD_CLR(fd, &sel->except_set);
 
     /* Move maxfd down if necessary. */
     if (fd == sel->maxfd) {
-	while ((sel->maxfd >= 0) && (! sel->fds[sel->maxfd].state)) {
+	while (sel->maxfd >= 0) {
+	    fdc = sel_find_fd(sel, sel->maxfd);
+	    if (fdc && fdc->state)
+		break;
 	    sel->maxfd--;
 	}
     }
@@ -455,27 +783,30 @@ sel_clear_fd_handlers(struct selector_s *sel,
     }
 }
 
-/* Set whether the file descriptor will be monitored for data ready to
-   read on the file descriptor. */
-void
-sel_set_fd_read_handler(struct selector_s *sel, int fd, int state)
+/* Turn monitoring of one of the handlers of an fd on or off.  The
+   "which" value is the offset of the enable flag in fd_control_t. */
+static void
+sel_set_fd_enable(struct selector_s *sel, int fd, size_t which, int state)
 {
-    fd_control_t *fdc = (fd_control_t *) &(sel->fds[fd]);
+    fd_control_t *fdc;
+    int          *enabled;
 
     sel_fd_lock(sel);
-    if (!fdc->state)
+    fdc = sel_find_fd(sel, fd);
+    if (!fdc || !fdc->state)
 	goto out;
 
+    enabled = (int *) (((char *) fdc) + which);
     if (state == SEL_FD_HANDLER_ENABLED) {
-	if (FD_ISSET(fd, &sel->read_set))
+	if (*enabled)
 	    goto out;
-	FD_SET(fd, &sel->read_set);
+	*enabled = 1;
     } else if (state == SEL_FD_HANDLER_DISABLED) {
-	if (!FD_ISSET(fd, &sel->read_set))
+	if (!*enabled)
 	    goto out;
-	FD_CLR(fd, &sel->read_set);
+	*enabled = 0;
     }
-    if (sel_update_epoll(sel, fd, EPOLL_CTL_MOD)) {
+    if (sel_update_epoll(sel, fd, fdc, EPOLL_CTL_MOD)) {
 	wake_fd_sel_thread(sel);
 	return;
     }
@@ -484,33 +815,20 @@ sel_set_fd_read_handler(struct selector_s *sel, int fd, int state)
     sel_fd_unlock(sel);
 }
 
+/* Set whether the file descriptor will be monitored for data ready to
+   read on the file descriptor. */
+void
+sel_set_fd_read_handler(struct selector_s *sel, int fd, int state)
+{
+    sel_set_fd_enable(sel, fd, offsetof(fd_control_t, read_enabled), state);
+}
+
 /* Set whether the file descriptor will be monitored for when the file
    descriptor can be written to. */
 void
 sel_set_fd_write_handler(struct selector_s *sel, int fd, int state)
 {
-    fd_control_t *fdc = (fd_control_t *) &(sel->fds[fd]);
-
-    sel_fd_lock(sel);
-    if (!fdc->state)
-	goto out;
-
-    if (state == SEL_FD_HANDLER_ENABLED) {
-	if (FD_ISSET(fd, &sel->write_set))
-	    goto out;
-	FD_SET(fd, &sel->write_set);
-    } else if (state == SEL_FD_HANDLER_DISABLED) {
-	if (!FD_ISSET(fd, &sel->write_set))
-	    goto out;
-	FD_CLR(fd, &sel->write_set);
-    }
-    if (sel_update_epoll(sel, fd, EPOLL_CTL_MOD)) {
-	wake_fd_sel_thread(sel);
-	return;
-    }
-
- out:
-    sel_fd_unlock(sel);
+    sel_set_fd_enable(sel, fd, offsetof(fd_control_t, write_enabled), state);
 }
 
 /* Set whether the file descriptor will be monitored for exceptions
@@ -518,28 +836,8 @@ sel_set_fd_write_handler(struct selector_s *sel, int fd, int state)
 void
 sel_set_fd_except_handler(struct selector_s *sel, int fd, int state)
 {
-    fd_control_t *fdc = (fd_control_t *) &(sel->fds[fd]);
-
-    sel_fd_lock(sel);
-    if (!fdc->state)
-	goto out;
-
-    if (state == SEL_FD_HANDLER_ENABLED) {
-	if (FD_ISSET(fd, &sel->except_set))
-	    goto out;
-	FD_SET(fd, &sel->except_set);
-    } else if (state == SEL_FD_HANDLER_DISABLED) {
-	if (!FD_ISSET(fd, &sel->except_set))
-	    goto out;
-	FD_CLR(fd, &sel->except_set);
-    }
-    if (sel_update_epoll(sel, fd, EPOLL_CTL_MOD)) {
-	wake_fd_sel_thread(sel);
-	return;
-    }
-
- out:
-    sel_fd_unlock(sel);
+    sel_set_fd_enable(sel, fd, offsetof(fd_control_t, except_enabled),
+		      state);
 }
 
 static void
@@ -613,7 +911,6 @@ sel_start_timer(sel_timer_t    *timer,
 		struct timeval *timeout)
 {
     struct selector_s *sel = timer->val.sel;
-    volatile sel_timer_t *top;
 
     sel_timer_lock(sel);
     if (timer->val.in_heap) {
@@ -621,19 +918,13 @@ sel_start_timer(sel_timer_t    *timer,
 	return EBUSY;
     }
 
-    top = theap_get_top(&sel->timer_heap);
-
     timer->val.timeout = *timeout;
 
-    if (!timer->val.in_handler) {
+    if (!timer->val.in_handler)
 	/* Wait until the handler returns to start the timer. */
-	theap_add(&sel->timer_heap, timer);
-	timer->val.in_heap = 1;
-    }
+	sel_queue_timer(sel, timer, 1);
     timer->val.stopped = 0;
 
-    wake_timer_sel_thread(sel, top);
-
     sel_timer_unlock(sel);
 
     return 0;
@@ -643,7 +934,6 @@ int
 sel_stop_timer(sel_timer_t *timer)
 {
     struct selector_s *sel = timer->val.sel;
-    volatile sel_timer_t *top;
 
     sel_timer_lock(sel);
     if (timer->val.stopped) {
@@ -651,13 +941,8 @@ sel_stop_timer(sel_timer_t *timer)
 	return ETIMEDOUT;
     }
 
-    if (timer->val.in_heap) {
-	top = theap_get_top(&sel->timer_heap);
-
-	theap_remove(&sel->timer_heap, timer);
-	timer->val.in_heap = 0;
-	wake_timer_sel_thread(sel, top);
-    }
+    if (timer->val.in_heap)
+	sel_dequeue_timer(sel, timer, 1);
     timer->val.stopped = 1;
 
     sel_timer_unlock(sel);
@@ -671,7 +956,6 @@ sel_stop_timer_with_done(sel_timer_t *timer,
 			 void *cb_data)
 {
     struct selector_s *sel = timer->val.sel;
-    volatile sel_timer_t *top;
 
     sel_timer_lock(sel);
     if (timer->val.stopped) {
@@ -686,14 +970,8 @@ sel_stop_timer_with_done(sel_timer_t *timer,
 	return 0;
     }
 
-    if (timer->val.in_heap) {
-	top = theap_get_top(&sel->timer_heap);
-
-	theap_remove(&sel->timer_heap, timer);
-	timer->val.in_heap = 0;
-
-	wake_timer_sel_thread(sel, top);
-    }
+    if (timer->val.in_heap)
+	sel_dequeue_timer(sel, timer, 1);
     timer->val.stopped = 1;
     sel_timer_unlock(sel);
 
@@ -712,6 +990,44 @@ sel_get_monotonic_time(struct timeval *tv)
     tv->tv_usec = (ts.tv_nsec + 500) / 1000;
 }
 
+static uint64_t
+sel_get_monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/* Set the select timeout from the wheel's next event. */
+static void
+sel_wheel_timeout(struct selector_s *sel, volatile struct timeval *timeout)
+{
+    twheel_t *w = sel->timer_wheel;
+    uint64_t next, now_ns, next_ns;
+
+    next = twheel_next_tick(w);
+    sel->wheel_wait_tick = next;
+    if (next == UINT64_MAX) {
+	/* No timers, just set a long time. */
+	timeout->tv_sec = 100000;
+	timeout->tv_usec = 0;
+	return;
+    }
+
+    now_ns = sel_get_monotonic_ns();
+    next_ns = twheel_tick_to_ns(w, next);
+    if (next_ns <= now_ns) {
+	timeout->tv_sec = 0;
+	timeout->tv_usec = 0;
+    } else {
+	/* Round up so we don't wake up just before the tick. */
+	next_ns = (next_ns - now_ns + 999) / 1000;
+	timeout->tv_sec = next_ns / 1000000;
+	timeout->tv_usec = next_ns % 1000000;
+    }
+}
+
 /*
  * Process timers on selector.  The timeout is always set, to a very
  * long value if no timers are waiting.  Note that this *must* be
@@ -726,12 +1042,13 @@ process_timers(struct selector_s       *sel,
     sel_timer_t    *timer;
     int            called = 0;
 
-    timer = theap_get_top(&sel->timer_heap);
     sel_get_monotonic_time(&now);
-    while (timer && cmp_timeval(&now, &timer->val.timeout) >= 0) {
+    if (sel->timer_wheel)
+	/* Expire everything that is due in one batch. */
+	twheel_advance(sel->timer_wheel, timeval_to_ns(&now));
+
+    while ((timer = sel_get_expired_timer(sel, &now))) {
 	called = 1;
-	theap_remove(&(sel->timer_heap), timer);
-	timer->val.in_heap = 0;
 	timer->val.stopped = 1;
 	timer->val.in_handler = 1;
 	sel_timer_unlock(sel);
@@ -748,20 +1065,18 @@ process_timers(struct selector_s       *sel,
 	}
 	if (timer->val.freed)
 	    free(timer);
-	else if (!timer->val.stopped) {
+	else if (!timer->val.stopped)
 	    /* We were restarted while in the handler. */
-	    theap_add(&sel->timer_heap, timer);
-	    timer->val.in_heap = 1;
-	}
-
-	timer = theap_get_top(&sel->timer_heap);
+	    sel_queue_timer(sel, timer, 0);
     }
 
     if (called) {
 	/* If called, set the timeout to zero. */
 	timeout->tv_sec = 0;
 	timeout->tv_usec = 0;
-    } else if (timer) {
+    } else if (sel->timer_wheel) {
+	sel_wheel_timeout(sel, timeout);
+    } else if ((timer = theap_get_top(&sel->timer_heap))) {
 	sel_get_monotonic_time(&now);
 	diff_timeval((struct timeval *) timeout,
 		     (struct timeval *) &timer->val.timeout,
@@ -773,6 +1088,50 @@ process_timers(struct selector_s       *sel,
     }
 }
 
+int
+sel_set_timer_wheel(struct selector_s *sel, unsigned long tick_ns)
+{
+    unsigned int shift;
+    twheel_t     *w;
+    int          rv = 0;
+
+    if (tick_ns == 0) {
+	shift = SEL_WHEEL_DEFAULT_TICK_SHIFT;
+    } else {
+	for (shift = SEL_WHEEL_MIN_TICK_SHIFT;
+	     shift < SEL_WHEEL_MAX_TICK_SHIFT;
+	     shift++)
+	{
+	    if ((1UL << shift) >= tick_ns)
+		break;
+	}
+    }
+
+    w = malloc(sizeof(*w));
+    if (!w)
+	return ENOMEM;
+
+    sel_timer_lock(sel);
+    if (theap_get_top(&sel->timer_heap)
+	|| (sel->timer_wheel
+	    && twheel_next_tick(sel->timer_wheel) != UINT64_MAX))
+    {
+	rv = EBUSY;
+	goto out_unlock;
+    }
+    twheel_init(w, shift, sel_get_monotonic_ns());
+    if (sel->timer_wheel)
+	free(sel->timer_wheel);
+    sel->timer_wheel = w;
+    w = NULL;
+    sel->wheel_wait_tick = UINT64_MAX;
+ out_unlock:
+    sel_timer_unlock(sel);
+    if (w)
+	free(w);
+    return rv;
+}
+
 int
 sel_alloc_runner(struct selector_s *sel, sel_runner_t **new_runner)
 {
@@ -850,34 +1209,39 @@ process_runners(struct selector_s *sel)
 }
 
 static void
-handle_selector_call(struct selector_s *sel, int i, volatile fd_set *fdset,
-		     sel_fd_handler_t handler)
+handle_selector_call(struct selector_s *sel, int fd, fd_control_t *fdc,
+		     int *enabled, sel_fd_handler_t handler)
 {
     void             *data;
     fd_state_t       *state;
 
     if (handler == NULL) {
 	/* Somehow we don't have a handler for this.
-	   Just shut it down. */
-	FD_CLR(i, fdset);
+	   Just shut it down.  With epoll the fd stays armed for the
+	   old interest set until it is modified, and in level
+	   triggered mode it would keep reporting. */
+	if (*enabled) {
+	    *enabled = 0;
+	    sel_update_epoll(sel, fd, fdc, EPOLL_CTL_MOD);
+	}
 	return;
     }
 
-    if (!FD_ISSET(i, fdset))
+    if (!*enabled)
 	/* The value was cleared, ignore it. */
 	return;
 
-    data = sel->fds[i].data;
-    state = sel->fds[i].state;
+    data = fdc->data;
+    state = fdc->state;
     state->use_count++;
     sel_fd_unlock(sel);
-    handler(i, data);
+    handler(fd, data);
     sel_fd_lock(sel);
     state->use_count--;
     if (state->deleted && state->use_count == 0) {
 	if (state->done) {
 	    sel_fd_unlock(sel);
-	    state->done(i, data);
+	    state->done(fd, data);
 	    sel_fd_lock(sel);
 	}
 	free(state);
@@ -893,18 +1257,36 @@ static int
 process_fds(struct selector_s	    *sel,
 	    volatile struct timeval *timeout)
 {
-    fd_set      tmp_read_set;
-    fd_set      tmp_write_set;
-    fd_set      tmp_except_set;
+    fd_set       tmp_read_set;
+    fd_set       tmp_write_set;
+    fd_set       tmp_except_set;
+    fd_control_t *fdc;
     int i;
     int err;
     int num_fds;
 
+    FD_ZERO(&tmp_read_set);
+    FD_ZERO(&tmp_write_set);
+    FD_ZERO(&tmp_except_set);
+    num_fds = 0;
+    if (sel->wake_fds[0] != -1) {
+	FD_SET(sel->wake_fds[0], &tmp_read_set);
+	num_fds = sel->wake_fds[0] + 1;
+    }
     sel_fd_lock(sel);
-    memcpy(&tmp_read_set, (void *) &sel->read_set, sizeof(tmp_read_set));
-    memcpy(&tmp_write_set, (void *) &sel->write_set, sizeof(tmp_write_set));
-    memcpy(&tmp_except_set, (void *) &sel->except_set, sizeof(tmp_except_set));
-    num_fds = sel->maxfd+1;
+    for (i = 0; i <= sel->maxfd; i++) {
+	fdc = sel_find_fd(sel, i);
+	if (!fdc || !fdc->state)
+	    continue;
+	if (fdc->read_enabled)
+	    FD_SET(i, &tmp_read_set);
+	if (fdc->write_enabled)
+	    FD_SET(i, &tmp_write_set);
+	if (fdc->except_enabled)
+	    FD_SET(i, &tmp_except_set);
+    }
+    if (sel->maxfd >= num_fds)
+	num_fds = sel->maxfd+1;
     sel_fd_unlock(sel);
 
     err = select(num_fds,
@@ -915,18 +1297,24 @@ process_fds(struct selector_s	    *sel,
     if (err <= 0)
 	goto out;
 
+    if (sel->wake_fds[0] != -1 && FD_ISSET(sel->wake_fds[0], &tmp_read_set))
+	sel_clear_wake(sel);
+
     /* We got some I/O. */
     sel_fd_lock(sel);
     for (i = 0; i <= sel->maxfd; i++) {
+	fdc = sel_find_fd(sel, i);
+	if (!fdc || !fdc->state)
+	    continue;
 	if (FD_ISSET(i, &tmp_read_set))
-	    handle_selector_call(sel, i, &sel->read_set,
-				 sel->fds[i].handle_read);
-	if (FD_ISSET(i, &tmp_write_set))
-	    handle_selector_call(sel, i, &sel->write_set,
-				 sel->fds[i].handle_write);
-	if (FD_ISSET(i, &tmp_except_set))
-	    handle_selector_call(sel, i, &sel->except_set,
-				 sel->fds[i].handle_except);
+	    handle_selector_call(sel, i, fdc, &fdc->read_enabled,
+				 fdc->handle_read);
+	if (FD_ISSET(i, &tmp_write_set) && fdc->state)
+	    handle_selector_call(sel, i, fdc, &fdc->write_enabled,
+				 fdc->handle_write);
+	if (FD_ISSET(i, &tmp_except_set) && fdc->state)
+	    handle_selector_call(sel, i, fdc, &fdc->except_enabled,
+				 fdc->handle_except);
     }
     sel_fd_unlock(sel);
 out:
@@ -937,8 +1325,8 @@ out:
 static int
 process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout)
 {
-    int rv, fd;
-    struct epoll_event event;
+    int rv, i, fd;
+    struct epoll_event events[SEL_EPOLL_MAX_BATCH];
     int timeout;
     sigset_t sigmask;
 
@@ -951,36 +1339,112 @@ process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout)
 	timeout = ((tvtimeout->tv_sec * 1000) +
 		   (tvtimeout->tv_usec + 999) / 1000);
 
+    if (sel->wake_sig) {
 #ifdef USE_PTHREADS
-    pthread_sigmask(SIG_SETMASK, NULL, &sigmask);
+	pthread_sigmask(SIG_SETMASK, NULL, &sigmask);
 #else
-    sigprocmask(SIG_SETMASK, NULL, &sigmask);
+	sigprocmask(SIG_SETMASK, NULL, &sigmask);
 #endif
-    sigdelset(&sigmask, sel->wake_sig);
-    rv = epoll_pwait(sel->epollfd, &event, 1, timeout, &sigmask);
+	sigdelset(&sigmask, sel->wake_sig);
+	rv = epoll_pwait(sel->epollfd, events, sel->epoll_batch, timeout,
+			 &sigmask);
+    } else {
+	rv = epoll_pwait(sel->epollfd, events, sel->epoll_batch, timeout,
+			 NULL);
+    }
 
     if (rv <= 0)
 	return rv;
 
     sel_fd_lock(sel);
-    fd = event.data.fd;
-    if (event.events & (EPOLLIN | EPOLLHUP))
-	handle_selector_call(sel, fd, &sel->read_set,
-			     sel->fds[fd].handle_read);
-    if (event.events & EPOLLOUT)
-	handle_selector_call(sel, fd, &sel->write_set,
-			     sel->fds[fd].handle_write);
-    if (event.events & (EPOLLERR | EPOLLPRI))
-	handle_selector_call(sel, fd, &sel->except_set,
-			     sel->fds[fd].handle_except);
-
-    /* Rearm the event.  Remember it could have been deleted in the handler. */
-    if (sel->fds[fd].state)
-	sel_update_epoll(sel, fd, EPOLL_CTL_MOD);
+    for (i = 0; i < rv; i++) {
+	uint32_t     ev = events[i].events;
+	unsigned int gen = events[i].data.u64 >> 32;
+	fd_control_t *fdc;
+
+	if (events[i].data.u64 == SEL_WAKE_EPOLL_DATA) {
+	    sel_clear_wake(sel);
+	    continue;
+	}
+
+	fd = events[i].data.u64 & 0xffffffff;
+	fdc = sel_find_fd(sel, fd);
+
+	/* An earlier handler in this batch may have removed the fd,
+	   or removed and re-added it.  Either way this event is
+	   stale. */
+	if (!fdc || !fdc->state || fdc->gen != gen)
+	    continue;
+
+	if (fdc->oneshot)
+	    fdc->armed = 0;
+
+	if (ev & (EPOLLIN | EPOLLHUP))
+	    handle_selector_call(sel, fd, fdc, &fdc->read_enabled,
+				 fdc->handle_read);
+	if ((ev & EPOLLOUT) && fdc->state && fdc->gen == gen)
+	    handle_selector_call(sel, fd, fdc, &fdc->write_enabled,
+				 fdc->handle_write);
+	if ((ev & (EPOLLERR | EPOLLPRI)) && fdc->state && fdc->gen == gen)
+	    handle_selector_call(sel, fd, fdc, &fdc->except_enabled,
+				 fdc->handle_except);
+
+	/* Re-arm a one-shot fd, unless it was removed in the handler,
+	   the handler already re-armed it by changing its interest set,
+	   or nothing is enabled on it any more. */
+	if (fdc->state && fdc->gen == gen && !fdc->armed
+	    && fd_has_interest(fdc))
+	    sel_update_epoll(sel, fd, fdc, EPOLL_CTL_MOD);
+    }
     sel_fd_unlock(sel);
 
+    return rv;
+}
+
+int
+sel_set_epoll_batch(struct selector_s *sel, unsigned int max_events)
+{
+    if (sel->epollfd < 0)
+	return ENOSYS;
+    if (max_events == 0 || max_events > SEL_EPOLL_MAX_BATCH)
+	return EINVAL;
+    sel->epoll_batch = max_events;
+    return 0;
+}
+
+int
+sel_set_epoll_oneshot(struct selector_s *sel, int oneshot)
+{
+    int fd;
+
+    if (sel->epollfd < 0)
+	return ENOSYS;
+
+    sel_fd_lock(sel);
+    if (sel->epoll_oneshot != !!oneshot) {
+	sel->epoll_oneshot = !!oneshot;
+	for (fd = 0; fd <= sel->maxfd; fd++) {
+	    fd_control_t *fdc = sel_find_fd(sel, fd);
+
+	    if (fdc && fdc->state)
+		sel_update_epoll(sel, fd, fdc, EPOLL_CTL_MOD);
+	}
+    }
+    sel_fd_unlock(sel);
     return 0;
 }
+#else
+int
+sel_set_epoll_batch(struct selector_s *sel, unsigned int max_events)
+{
+    return ENOSYS;
+}
+
+int
+sel_set_epoll_oneshot(struct selector_s *sel, int oneshot)
+{
+    return ENOSYS;
+}
 #endif
 
 int
@@ -1052,7 +1516,7 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
 			  void *cb_data)
 {
     struct selector_s *sel;
-    unsigned int i;
+    int               rv;
 
     sel = malloc(sizeof(*sel));
     if (!sel)
@@ -1069,28 +1533,35 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     sel->wait_list.prev = &sel->wait_list;
 
     sel->wake_sig = wake_sig;
-
-    FD_ZERO((fd_set *) &sel->read_set);
-    FD_ZERO((fd_set *) &sel->write_set);
-    FD_ZERO((fd_set *) &sel->except_set);
-
-    for (i=0; i<FD_SETSIZE; i++) {
-	init_fd((fd_control_t *) &(sel->fds[i]));
-    }
+    sel->wake_fds[0] = -1;
+    sel->wake_fds[1] = -1;
+    sel->maxfd = -1;
+#ifdef HAVE_EPOLL_PWAIT
+    sel->epollfd = -1;
+#endif
 
     theap_init(&sel->timer_heap);
 
     if (sel->sel_lock_alloc) {
 	sel->timer_lock = sel->sel_lock_alloc(cb_data);
 	if (!sel->timer_lock) {
-	    free(sel);
-	    return ENOMEM;
+	    rv = ENOMEM;
+	    goto out_err;
 	}
 	sel->fd_lock = sel->sel_lock_alloc(cb_data);
 	if (!sel->fd_lock) {
-	    sel->sel_lock_free(sel->fd_lock);
-	    free(sel);
-	    return ENOMEM;
+	    rv = ENOMEM;
+	    goto out_err;
+	}
+
+	/* Only threaded selectors can have someone else to wake. */
+	rv = sel_alloc_wake_fd(sel);
+	if (rv) {
+	    if (!wake_sig)
+		/* No way to wake other threads. */
+		goto out_err;
+	    syslog(LOG_ERR, "Unable to allocate selector wake fd, falling"
+		   " back to signals: %m");
 	}
     }
 
@@ -1099,21 +1570,33 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     if (sel->epollfd == -1) {
 	syslog(LOG_ERR, "Unable to set up epoll, falling back to select: %m");
     } else {
-	int rv;
-	sigset_t sigset;
-
-	sigemptyset(&sigset);
-	sigaddset(&sigset, wake_sig);
-	rv = sigprocmask(SIG_BLOCK, &sigset, NULL);
-	if (rv == -1) {
-	    rv = errno;
-	    close(sel->epollfd);
-	    if (sel->sel_lock_alloc) {
-		sel->sel_lock_free(sel->fd_lock);
-		sel->sel_lock_free(sel->timer_lock);
+	sel->epoll_batch = SEL_EPOLL_DEFAULT_BATCH;
+	/* Without locks there can only be one thread in the selector,
+	   so there is no need to keep fds one-shot. */
+	sel->epoll_oneshot = sel->sel_lock != NULL;
+
+	if (sel->wake_fds[0] != -1) {
+	    struct epoll_event event;
+
+	    memset(&event, 0, sizeof(event));
+	    event.events = EPOLLIN;
+	    event.data.u64 = SEL_WAKE_EPOLL_DATA;
+	    if (epoll_ctl(sel->epollfd, EPOLL_CTL_ADD, sel->wake_fds[0],
+			  &event) == -1) {
+		rv = errno;
+		goto out_err;
+	    }
+	}
+
+	if (wake_sig) {
+	    sigset_t sigset;
+
+	    sigemptyset(&sigset);
+	    sigaddset(&sigset, wake_sig);
+	    if (sigprocmask(SIG_BLOCK, &sigset, NULL) == -1) {
+		rv = errno;
+		goto out_err;
 	    }
-	    free(sel);
-	    return rv;
 	}
     }
 #endif
@@ -1121,6 +1604,19 @@ sel_alloc_selector_thread(struct selector_s **new_selector, int wake_sig,
     *new_selector = sel;
 
     return 0;
+
+ out_err:
+#ifdef HAVE_EPOLL_PWAIT
+    if (sel->epollfd >= 0)
+	close(sel->epollfd);
+#endif
+    sel_free_wake_fd(sel);
+    if (sel->fd_lock)
+	sel->sel_lock_free(sel->fd_lock);
+    if (sel->timer_lock)
+	sel->sel_lock_free(sel->timer_lock);
+    free(sel);
+    return rv;
 }
 
 int
@@ -1133,7 +1629,9 @@ sel_alloc_selector_nothread(struct selector_s **new_selector)
 int
 sel_free_selector(struct selector_s *sel)
 {
-    sel_timer_t *elem;
+    sel_timer_t   *elem;
+    twheel_link_t *link;
+    unsigned int  i;
 
     elem = theap_get_top(&(sel->timer_heap));
     while (elem) {
@@ -1141,10 +1639,24 @@ sel_free_selector(struct selector_s *sel)
 	free(elem);
 	elem = theap_get_top(&(sel->timer_heap));
     }
+    if (sel->timer_wheel) {
+	while ((link = twheel_get_any(sel->timer_wheel))) {
+	    twheel_remove(sel->timer_wheel, link);
+	    free(wlink_to_timer(link));
+	}
+	free(sel->timer_wheel);
+    }
 #ifdef HAVE_EPOLL_PWAIT
     if (sel->epollfd >= 0)
 	close(sel->epollfd);
 #endif
+    sel_free_wake_fd(sel);
+    for (i = 0; i < sel->num_fd_chunks; i++) {
+	if (sel->fd_chunks[i])
+	    free(sel->fd_chunks[i]);
+    }
+    if (sel->fd_chunks)
+	free(sel->fd_chunks);
     if (sel->fd_lock)
 	sel->sel_lock_free(sel->fd_lock);
     if (sel->timer_lock)
@@ -53,11 +53,15 @@
  *      written permission.
  */
 
+#include <config.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
 #include <OpenIPMI/ipmi_posix.h>
 
 os_handler_t *test_os_hnd;
@@ -161,6 +165,109 @@ timeout_handler(void *cb_data, os_hnd_timer_id_t *id)
     }
 }
 
+#define NUM_TEST_PIPES 8
+int test_pipes[NUM_TEST_PIPES][2];
+os_hnd_fd_id_t *test_fd_ids[NUM_TEST_PIPES];
+os_handler_waiter_t *fd_waiter;
+int fds_read = 0;
+int fds_freed = 0;
+pthread_mutex_t fd_count_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+fd_data_ready(int fd, void *cb_data, os_hnd_fd_id_t *id)
+{
+    int  i = (long) cb_data;
+    char c;
+
+    if (read(fd, &c, 1) != 1)
+	err_leave(errno, "Unable to read test pipe %d\n", i);
+    if (c != 'a' + i)
+	err_leave(0, "Wrong data on test pipe %d: %c\n", i, c);
+    pthread_mutex_lock(&fd_count_lock);
+    fds_read++;
+    pthread_mutex_unlock(&fd_count_lock);
+    test_os_hnd->remove_fd_to_wait_for(test_os_hnd, id);
+}
+
+static void
+fd_data_freed(int fd, void *cb_data)
+{
+    int done;
+
+    /* This is called after the handler returns, so it is the last
+       thing done for the fd. */
+    pthread_mutex_lock(&fd_count_lock);
+    fds_freed++;
+    done = fds_freed == NUM_TEST_PIPES;
+    pthread_mutex_unlock(&fd_count_lock);
+    if (done)
+	os_handler_waiter_release(fd_waiter);
+}
+
+static void
+test_fds(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory)
+{
+    struct timeval tv;
+    int            i, rv;
+    char           c;
+
+    fprintf(stderr, "FD test\n");
+    fd_waiter = os_handler_alloc_waiter(factory);
+    if (!fd_waiter)
+	err_leave(0, "Unable to allocate waiter\n");
+
+    for (i = 0; i < NUM_TEST_PIPES; i++) {
+	if (pipe(test_pipes[i]) == -1)
+	    err_leave(errno, "Unable to allocate pipe\n");
+#ifdef HAVE_EPOLL_PWAIT
+	if (i == 0) {
+	    /* epoll has no FD_SETSIZE limit, make sure the selector
+	       handles an fd past it, if we are allowed to have one. */
+	    struct rlimit lim;
+	    int           high_fd = FD_SETSIZE + 100;
+
+	    if (getrlimit(RLIMIT_NOFILE, &lim) == 0
+		&& lim.rlim_cur <= (rlim_t) high_fd
+		&& lim.rlim_max > (rlim_t) high_fd) {
+		lim.rlim_cur = high_fd + 1;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	    }
+	    if (dup2(test_pipes[i][0], high_fd) == high_fd) {
+		close(test_pipes[i][0]);
+		test_pipes[i][0] = high_fd;
+	    }
+	}
+#endif
+	rv = os_hnd->add_fd_to_wait_for(os_hnd, test_pipes[i][0],
+					fd_data_ready, (void *) (long) i,
+					fd_data_freed, &test_fd_ids[i]);
+	if (rv)
+	    err_leave(rv, "Unable to add fd\n");
+    }
+
+    /* Make them all ready before waiting, so they come in together. */
+    for (i = 0; i < NUM_TEST_PIPES; i++) {
+	c = 'a' + i;
+	if (write(test_pipes[i][1], &c, 1) != 1)
+	    err_leave(errno, "Unable to write test pipe\n");
+    }
+
+    tv.tv_sec = 3;
+    tv.tv_usec = 0;
+    os_handler_waiter_wait(fd_waiter, &tv);
+
+    if (fds_read != NUM_TEST_PIPES)
+	err_leave(0, "Error in fds, only %d read\n", fds_read);
+    if (fds_freed != NUM_TEST_PIPES)
+	err_leave(0, "Error in fds, only %d freed\n", fds_freed);
+
+    for (i = 0; i < NUM_TEST_PIPES; i++) {
+	close(test_pipes[i][0]);
+	close(test_pipes[i][1]);
+    }
+    os_handler_free_waiter(fd_waiter);
+}
+
 static void
 test_os_handler(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory)
 {
@@ -201,6 +308,8 @@ test_os_handler(os_handler_t *os_hnd, os_handler_waiter_factory_t *factory)
 
     os_handler_free_waiter(timer_waiter);
 
+    test_fds(os_hnd, factory);
+
     rv = os_handler_free_waiter_factory(factory);
     if (rv)
 	err_leave(rv, "Error freeing factory\n");
@@ -214,6 +323,8 @@ reset_tests(void)
 {
     expect_log = 0;
     expect_timeout = 0;
+    fds_read = 0;
+    fds_freed = 0;
 }
 
 int ipmi_malloc_init(os_handler_t *os_hnd);
@@ -266,5 +377,47 @@ main(int argc, char *argv[])
 	err_leave(rv, "Unable to allocate waiter factory\n");
     test_os_handler(os_hnd, factory);
 
+    fprintf(stderr, "*** Testing POSIX Threaded OS handler (multiple loops)\n");
+    reset_tests();
+    os_hnd = ipmi_posix_thread_setup_os_handler_loops(SIGUSR1, 4);
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    ipmi_malloc_init(os_hnd);
+    rv = os_handler_alloc_waiter_factory(os_hnd, 0, 0, &factory);
+    if (rv)
+	err_leave(rv, "Unable to allocate waiter factory\n");
+    test_os_handler(os_hnd, factory);
+
+    fprintf(stderr, "*** Testing POSIX Threaded OS handler (no wake signal)\n");
+    reset_tests();
+    os_hnd = ipmi_posix_thread_setup_os_handler(0);
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    ipmi_malloc_init(os_hnd);
+    rv = os_handler_alloc_waiter_factory(os_hnd, 2, 0, &factory);
+    if (rv)
+	err_leave(rv, "Unable to allocate waiter factory\n");
+    test_os_handler(os_hnd, factory);
+
+    fprintf(stderr, "*** Testing POSIX Threaded OS handler (timer wheel)\n");
+    reset_tests();
+    os_hnd = ipmi_posix_thread_setup_os_handler(SIGUSR1);
+    if (!os_hnd) {
+	fprintf(stderr, "ipmi_smi_setup_con: Unable to allocate os handler\n");
+	exit(1);
+    }
+    rv = sel_set_timer_wheel(ipmi_posix_thread_os_handler_get_sel(os_hnd), 0);
+    if (rv)
+	err_leave(rv, "Unable to set up timer wheel\n");
+    ipmi_malloc_init(os_hnd);
+    rv = os_handler_alloc_waiter_factory(os_hnd, 0, 0, &factory);
+    if (rv)
+	err_leave(rv, "Unable to allocate waiter factory\n");
+    test_os_handler(os_hnd, factory);
+
     return 0;
 }
@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
+#include <stddef.h>
 #include <time.h>
 
 #define HEAP_EXPORT_NAME(s) test_ ## s
@@ -64,6 +65,7 @@ heap_cmp_key(heap_val_t *val1, heap_val_t *val2)
 #define HEAP_DEBUG
 
 #include "heap.h"
+#include "twheel.h"
 
 static int random_seed;
 
@@ -78,6 +80,218 @@ handle_fault(int sig)
 #define TEST_SIZE 2048
 test_heap_node_t *(nodes[TEST_SIZE]);
 
+static uint64_t
+rand64(void)
+{
+    return (((uint64_t) rand()) << 62) ^ (((uint64_t) rand()) << 31) ^ rand();
+}
+
+/*
+ * Timer wheel test.  Use a tiny tick so that random times cover all
+ * the levels, and check after each advance that exactly the timers
+ * whose tick has come are on the expired list.
+ */
+#define WHEEL_TEST_TICK_SHIFT 4
+
+typedef struct wheel_test_node_s
+{
+    twheel_link_t link;
+    uint64_t      expires_ns;
+    int           in_wheel;
+} wheel_test_node_t;
+
+static wheel_test_node_t wnodes[TEST_SIZE];
+
+static void
+test_wheel(void)
+{
+    twheel_t          *w;
+    twheel_link_t     *link;
+    wheel_test_node_t *n;
+    uint64_t          now = rand64() & 0xffffffffffULL;
+    uint64_t          now_tick, tick;
+    int               i, j, rand_val, count = 0;
+
+    w = malloc(sizeof(*w));
+    if (!w) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    twheel_init(w, WHEEL_TEST_TICK_SHIFT, now);
+
+    for (i=0; i<TEST_SIZE * 4; i++) {
+	rand_val = rand() & (TEST_SIZE-1);
+	n = &wnodes[rand_val];
+	if (n->in_wheel) {
+	    twheel_remove(w, &n->link);
+	    n->in_wheel = 0;
+	    count--;
+	} else {
+	    /* Mostly short timers, some very long ones that go past
+	       the end of the wheel. */
+	    switch (rand() % 4) {
+	    case 0: n->expires_ns = now + (rand() & 0x3ff); break;
+	    case 1: n->expires_ns = now + (rand() & 0xfffff); break;
+	    case 2: n->expires_ns = now + (rand64() & 0xfffffffffULL); break;
+	    default: n->expires_ns = now + (rand64() & 0xffffffffffffULL);
+	    }
+	    twheel_add(w, &n->link, n->expires_ns);
+	    n->in_wheel = 1;
+	    count++;
+	}
+
+	if ((rand() % 8) != 0)
+	    continue;
+
+	switch (rand() % 3) {
+	case 0: now += rand() & 0xfff; break;
+	case 1: now += rand() & 0xffffff; break;
+	default: now += rand64() & 0xfffffffffULL;
+	}
+	twheel_advance(w, now);
+	now_tick = now >> WHEEL_TEST_TICK_SHIFT;
+	while ((link = twheel_get_expired(w))) {
+	    n = (wheel_test_node_t *) (((char *) link)
+				       - offsetof(wheel_test_node_t, link));
+	    if (!n->in_wheel) {
+		fprintf(stderr, "Wheel expired a removed timer\n");
+		abort();
+	    }
+	    if (n->expires_ns > now) {
+		fprintf(stderr, "Wheel timer expired early\n");
+		abort();
+	    }
+	    n->in_wheel = 0;
+	    count--;
+	}
+	for (j=0; j<TEST_SIZE; j++) {
+	    if (!wnodes[j].in_wheel)
+		continue;
+	    tick = twheel_ns_to_tick(w, wnodes[j].expires_ns);
+	    if (tick <= now_tick) {
+		fprintf(stderr, "Wheel timer did not expire\n");
+		abort();
+	    }
+	}
+	tick = twheel_next_tick(w);
+	if (count && twheel_tick_to_ns(w, tick) <= now) {
+	    fprintf(stderr, "Wheel next tick is in the past\n");
+	    abort();
+	}
+	if (count && tick > now_tick + 1) {
+	    for (j=0; j<TEST_SIZE; j++) {
+		if (wnodes[j].in_wheel
+		    && twheel_ns_to_tick(w, wnodes[j].expires_ns) < tick)
+		{
+		    fprintf(stderr, "Wheel next tick is too late\n");
+		    abort();
+		}
+	    }
+	} else if (!count && tick != UINT64_MAX) {
+	    fprintf(stderr, "Empty wheel has a next tick\n");
+	    abort();
+	}
+    }
+
+    while ((link = twheel_get_any(w)))
+	twheel_remove(w, link);
+    free(w);
+}
+
+/*
+ * Compare the heap and the wheel on a timer workload like message
+ * timeouts: a lot of timers running, most are stopped and started
+ * again before they go off.  Time is simulated, in microseconds.
+ */
+#define BENCH_TIMERS	16384
+#define BENCH_OPS	(BENCH_TIMERS * 256)
+
+static test_heap_node_t   bench_hnodes[BENCH_TIMERS];
+static wheel_test_node_t  bench_wnodes[BENCH_TIMERS];
+
+static double
+bench_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void
+bench_timers(void)
+{
+    test_heap_t       heap;
+    test_heap_node_t  *hn;
+    twheel_t          *w;
+    twheel_link_t     *link;
+    int               now, i, expired;
+    double            start, heap_time, wheel_time;
+
+    test_init(&heap);
+    now = 0;
+    expired = 0;
+    srand(random_seed);
+    for (i=0; i<BENCH_TIMERS; i++) {
+	bench_hnodes[i].val.a = now + 100000 + (rand() % 900000);
+	test_add(&heap, &bench_hnodes[i]);
+    }
+    start = bench_time();
+    for (i=0; i<BENCH_OPS; i++) {
+	hn = &bench_hnodes[rand() % BENCH_TIMERS];
+	test_remove(&heap, hn);
+	hn->val.a = now + 100000 + (rand() % 900000);
+	test_add(&heap, hn);
+	if ((i & 63) == 0) {
+	    now += 1000;
+	    while ((hn = test_get_top(&heap)) && hn->val.a <= now) {
+		test_remove(&heap, hn);
+		expired++;
+		hn->val.a = now + 100000 + (rand() % 900000);
+		test_add(&heap, hn);
+	    }
+	}
+    }
+    heap_time = bench_time() - start;
+    printf("heap:  %d ops, %d expired, %.1f ns/op\n", BENCH_OPS, expired,
+	   heap_time * 1000000000.0 / BENCH_OPS);
+
+    w = malloc(sizeof(*w));
+    if (!w) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    /* About a millisecond per tick, like the selector. */
+    twheel_init(w, 20, 0);
+    now = 0;
+    expired = 0;
+    srand(random_seed);
+    for (i=0; i<BENCH_TIMERS; i++) {
+	bench_wnodes[i].expires_ns = (now + 100000 + (rand() % 900000))
+	    * 1000ULL;
+	twheel_add(w, &bench_wnodes[i].link, bench_wnodes[i].expires_ns);
+    }
+    start = bench_time();
+    for (i=0; i<BENCH_OPS; i++) {
+	link = &bench_wnodes[rand() % BENCH_TIMERS].link;
+	twheel_remove(w, link);
+	twheel_add(w, link, (now + 100000 + (rand() % 900000)) * 1000ULL);
+	if ((i & 63) == 0) {
+	    now += 1000;
+	    twheel_advance(w, now * 1000ULL);
+	    while ((link = twheel_get_expired(w))) {
+		expired++;
+		twheel_add(w, link,
+			   (now + 100000 + (rand() % 900000)) * 1000ULL);
+	    }
+	}
+    }
+    wheel_time = bench_time() - start;
+    printf("wheel: %d ops, %d expired, %.1f ns/op\n", BENCH_OPS, expired,
+	   wheel_time * 1000000000.0 / BENCH_OPS);
+    free(w);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -87,6 +301,7 @@ main(int argc, char *argv[])
     test_heap_node_t *val1;
     struct sigaction act;
     int              rand_val;
+    int              bench = 0;
 
     i = 1;
     while ((i < argc) && (argv[i][0] == '-')) {
@@ -94,6 +309,8 @@ main(int argc, char *argv[])
 	    break;
 	else if (strcmp(argv[i], "-d") == 0)
 	    debug++;
+	else if (strcmp(argv[i], "-b") == 0)
+	    bench = 1;
 	else {
 	    fprintf(stderr, "Invalid option: '%s'\n", argv[i]);
 	    exit(1);
@@ -141,6 +358,12 @@ main(int argc, char *argv[])
     }
     if (debug > 1)
 	test_print(&heap);
+
+    test_wheel();
+
+    if (bench)
+	bench_timers();
+
     if (debug)
 	printf("Seed was %d\n", random_seed);
 
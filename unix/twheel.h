@@ -0,0 +1,362 @@
+/*
+ * twheel.h
+ *
+ * A hierarchical timer wheel.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2 of
+ *  the License, or (at your option) any later version.
+ *
+ *
+ *  THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ *  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ *  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ *  OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ *  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * This is a hashed hierarchical timing wheel, it gives O(1) add and
+ * remove of timers at the cost of a little precision.  Time is kept
+ * as a 64-bit monotonic nanosecond count and divided into ticks of
+ * 2^tick_shift nanoseconds.  A timer never expires early, but may
+ * expire up to a tick late.
+ *
+ * Embed a twheel_link_t in the structure you want to time and use
+ * the link in the calls below; there is no allocation.  Like heap.h,
+ * everything here is static and the wheel does no locking, and it
+ * does not track membership, so be sure that a link belongs to the
+ * wheel it is removed from.
+ *
+ * The wheel has TWHEEL_LEVELS levels of TWHEEL_LEVEL_SIZE slots.
+ * Level 0 slots are one tick, each slot of level n covers all of
+ * level n-1.  Timers past the end of the top level sit in its last
+ * slot and are moved down again when they get there.  Timers move
+ * down a level ("cascade") when the wheel reaches the start of their
+ * slot.
+ *
+ * twheel_advance() moves all timers that are due as of the given
+ * time to the expired list in one go; the caller then takes them off
+ * with twheel_get_expired().  Timers on the expired list are still
+ * in the wheel as far as twheel_remove() is concerned.
+ */
+
+#ifndef _TWHEEL_H
+#define _TWHEEL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define TWHEEL_LEVEL_BITS	6
+#define TWHEEL_LEVEL_SIZE	(1 << TWHEEL_LEVEL_BITS)
+#define TWHEEL_LEVEL_MASK	(TWHEEL_LEVEL_SIZE - 1)
+#define TWHEEL_LEVELS		6
+
+/* Where a link is, in twheel_link_t.slot. */
+#define TWHEEL_SLOT_EXPIRED	0xffff
+
+typedef struct twheel_link_s
+{
+    struct twheel_link_s *next, *prev;
+
+    /* The tick the timer expires on. */
+    uint64_t expires;
+
+    /* level * TWHEEL_LEVEL_SIZE + slot, or TWHEEL_SLOT_EXPIRED. */
+    unsigned int slot;
+} twheel_link_t;
+
+typedef struct twheel_s
+{
+    unsigned int tick_shift;
+
+    /* The next tick to be processed.  Everything before this has
+       been moved to the expired list. */
+    uint64_t curr;
+
+    /* Number of timers in the slots, not counting expired ones. */
+    unsigned int pending;
+
+    /* A bit for each non-empty slot. */
+    uint64_t occupied[TWHEEL_LEVELS];
+
+    twheel_link_t slots[TWHEEL_LEVELS][TWHEEL_LEVEL_SIZE];
+
+    twheel_link_t expired;
+} twheel_t;
+
+static void
+twheel_list_init(twheel_link_t *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void
+twheel_list_add_tail(twheel_link_t *head, twheel_link_t *link)
+{
+    link->next = head;
+    link->prev = head->prev;
+    head->prev->next = link;
+    head->prev = link;
+}
+
+/* Move everything on "from" to the end of "to". */
+static void
+twheel_list_splice_tail(twheel_link_t *to, twheel_link_t *from)
+{
+    if (from->next == from)
+	return;
+    from->next->prev = to->prev;
+    to->prev->next = from->next;
+    from->prev->next = to;
+    to->prev = from->prev;
+    twheel_list_init(from);
+}
+
+static unsigned int
+twheel_ctz64(uint64_t v)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(v);
+#else
+    unsigned int n = 0;
+
+    while (!(v & 1)) {
+	v >>= 1;
+	n++;
+    }
+    return n;
+#endif
+}
+
+static void
+twheel_init(twheel_t *w, unsigned int tick_shift, uint64_t now_ns)
+{
+    int l, i;
+
+    memset(w, 0, sizeof(*w));
+    w->tick_shift = tick_shift;
+    w->curr = now_ns >> tick_shift;
+    for (l = 0; l < TWHEEL_LEVELS; l++) {
+	for (i = 0; i < TWHEEL_LEVEL_SIZE; i++)
+	    twheel_list_init(&w->slots[l][i]);
+    }
+    twheel_list_init(&w->expired);
+}
+
+/* Round up, so timers never go off early. */
+static uint64_t
+twheel_ns_to_tick(twheel_t *w, uint64_t ns)
+{
+    return (ns + (((uint64_t) 1) << w->tick_shift) - 1) >> w->tick_shift;
+}
+
+static uint64_t
+twheel_tick_to_ns(twheel_t *w, uint64_t tick)
+{
+    return tick << w->tick_shift;
+}
+
+/* Put a link with its expires set into the proper slot. */
+static void
+twheel_place(twheel_t *w, twheel_link_t *link)
+{
+    uint64_t     expires = link->expires;
+    uint64_t     delta;
+    unsigned int level, idx;
+
+    if (expires < w->curr)
+	expires = w->curr;
+    delta = expires - w->curr;
+    for (level = 0; level < TWHEEL_LEVELS - 1; level++) {
+	if (delta < ((uint64_t) 1) << ((level + 1) * TWHEEL_LEVEL_BITS))
+	    break;
+    }
+    if (level == TWHEEL_LEVELS - 1
+	&& delta >= ((uint64_t) 1) << (TWHEEL_LEVELS * TWHEEL_LEVEL_BITS))
+	/* Too far out, park it at the end of the wheel. */
+	expires = w->curr
+	    + (((uint64_t) 1) << (TWHEEL_LEVELS * TWHEEL_LEVEL_BITS)) - 1;
+
+    idx = (expires >> (level * TWHEEL_LEVEL_BITS)) & TWHEEL_LEVEL_MASK;
+    link->slot = level * TWHEEL_LEVEL_SIZE + idx;
+    twheel_list_add_tail(&w->slots[level][idx], link);
+    w->occupied[level] |= ((uint64_t) 1) << idx;
+}
+
+/* Add a timer to go off at the given time, returns the tick it will
+   go off on. */
+static uint64_t
+twheel_add(twheel_t *w, twheel_link_t *link, uint64_t expires_ns)
+{
+    link->expires = twheel_ns_to_tick(w, expires_ns);
+    twheel_place(w, link);
+    w->pending++;
+    return link->expires;
+}
+
+static void
+twheel_remove(twheel_t *w, twheel_link_t *link)
+{
+    link->next->prev = link->prev;
+    link->prev->next = link->next;
+
+    if (link->slot != TWHEEL_SLOT_EXPIRED) {
+	unsigned int level = link->slot / TWHEEL_LEVEL_SIZE;
+	unsigned int idx = link->slot % TWHEEL_LEVEL_SIZE;
+
+	if (w->slots[level][idx].next == &w->slots[level][idx])
+	    w->occupied[level] &= ~(((uint64_t) 1) << idx);
+	w->pending--;
+    }
+}
+
+/* Take everything out of a slot and put it back, it will go to a
+   lower level. */
+static void
+twheel_cascade(twheel_t *w, unsigned int level, unsigned int idx)
+{
+    twheel_link_t list;
+    twheel_link_t *link;
+
+    twheel_list_init(&list);
+    twheel_list_splice_tail(&list, &w->slots[level][idx]);
+    w->occupied[level] &= ~(((uint64_t) 1) << idx);
+    while (list.next != &list) {
+	link = list.next;
+	list.next = link->next;
+	link->next->prev = &list;
+	twheel_place(w, link);
+    }
+}
+
+/* Find the first tick at or after w->curr that something has to be
+   done on: either a level 0 slot expires or a higher level slot
+   cascades.  This is a lower bound on the next expiry.  Returns
+   UINT64_MAX if the slots are empty. */
+static uint64_t
+twheel_next_event(twheel_t *w)
+{
+    uint64_t     best = UINT64_MAX;
+    uint64_t     base, bm, t;
+    unsigned int l, shift, start, idx;
+
+    for (l = 0; l < TWHEEL_LEVELS; l++) {
+	bm = w->occupied[l];
+	if (!bm)
+	    continue;
+	shift = l * TWHEEL_LEVEL_BITS;
+	base = w->curr >> shift;
+	/* If we are past the start of the current slot at this level,
+	   it has already been cascaded. */
+	start = (w->curr & ((((uint64_t) 1) << shift) - 1)) ? 1 : 0;
+	idx = (base + start) & TWHEEL_LEVEL_MASK;
+	if (idx)
+	    bm = (bm >> idx) | (bm << (TWHEEL_LEVEL_SIZE - idx));
+	t = (base + start + twheel_ctz64(bm)) << shift;
+	if (t < best)
+	    best = t;
+    }
+
+    return best;
+}
+
+/* The first tick something may expire on, UINT64_MAX if nothing is
+   in the wheel.  If timers are waiting on the expired list, this is
+   the tick before the current one. */
+static uint64_t
+twheel_next_tick(twheel_t *w)
+{
+    if (w->expired.next != &w->expired)
+	return w->curr - 1;
+    if (!w->pending)
+	return UINT64_MAX;
+    return twheel_next_event(w);
+}
+
+/* Run the wheel up to now_ns, moving every timer that is due to the
+   expired list. */
+static void
+twheel_advance(twheel_t *w, uint64_t now_ns)
+{
+    uint64_t     target = now_ns >> w->tick_shift;
+    uint64_t     next;
+    unsigned int l, idx;
+
+    while (w->curr <= target) {
+	if (!w->pending) {
+	    w->curr = target + 1;
+	    break;
+	}
+	next = twheel_next_event(w);
+	if (next > target) {
+	    w->curr = target + 1;
+	    break;
+	}
+	w->curr = next;
+
+	/* Cascade down any levels whose slot starts here, lowest
+	   first, then expire the level 0 slot. */
+	for (l = 1; l < TWHEEL_LEVELS; l++) {
+	    if (w->curr & ((((uint64_t) 1) << (l * TWHEEL_LEVEL_BITS)) - 1))
+		break;
+	    idx = (w->curr >> (l * TWHEEL_LEVEL_BITS)) & TWHEEL_LEVEL_MASK;
+	    if (w->occupied[l] & (((uint64_t) 1) << idx))
+		twheel_cascade(w, l, idx);
+	}
+
+	idx = w->curr & TWHEEL_LEVEL_MASK;
+	if (w->occupied[0] & (((uint64_t) 1) << idx)) {
+	    twheel_link_t *link, *head = &w->slots[0][idx];
+
+	    for (link = head->next; link != head; link = link->next) {
+		link->slot = TWHEEL_SLOT_EXPIRED;
+		w->pending--;
+	    }
+	    twheel_list_splice_tail(&w->expired, head);
+	    w->occupied[0] &= ~(((uint64_t) 1) << idx);
+	}
+	w->curr++;
+    }
+}
+
+/* Take the next timer off the expired list, NULL if there are none. */
+static twheel_link_t *
+twheel_get_expired(twheel_t *w)
+{
+    twheel_link_t *link = w->expired.next;
+
+    if (link == &w->expired)
+	return NULL;
+    twheel_remove(w, link);
+    return link;
+}
+
+/* Return some timer in the wheel, NULL if it is empty.  For tearing
+   down the wheel. */
+static twheel_link_t *
+twheel_get_any(twheel_t *w)
+{
+    unsigned int l;
+
+    if (w->expired.next != &w->expired)
+	return w->expired.next;
+    for (l = 0; l < TWHEEL_LEVELS; l++) {
+	if (w->occupied[l])
+	    return w->slots[l][twheel_ctz64(w->occupied[l])].next;
+    }
+    return NULL;
+}
+
+#endif /* _TWHEEL_H */
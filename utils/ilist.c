@@ -329,6 +329,13 @@ ilist_init_iter(ilist_iter_t *iter, ilist_t *list)
     iter->curr = list->head->next;
 }
 
+void
+ilist_init_iter_at(ilist_iter_t *iter, ilist_t *list, ilist_item_t *entry)
+{
+    iter->list = list;
+    iter->curr = entry;
+}
+
 void
 ilist_sort(ilist_t *list, ilist_sort_cb cmp)
 {
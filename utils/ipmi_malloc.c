@@ -64,6 +64,7 @@
 #include <OpenIPMI/os_handler.h>
 
 #include <OpenIPMI/internal/ipmi_malloc.h>
+#include <OpenIPMI/internal/ipmi_locks.h>
 #include <OpenIPMI/internal/ilist.h>
 
 void (*ipmi_malloc_log)(enum ipmi_log_type_e log_type, const char *format, ...)
@@ -465,6 +466,142 @@ ipmi_strndup(const char *str, int n)
     return rv;
 }
 
+/*
+ * Fixed-size object pools.
+ */
+struct ipmi_mem_pool_s
+{
+    char          *name;
+    unsigned int  size;
+    unsigned int  max_free;
+
+    ipmi_lock_t   *lock;
+    /* Free objects, linked through their first word. */
+    void          *free_list;
+    unsigned int  num_free;
+
+    unsigned long gets;
+    unsigned long misses;
+
+    ipmi_mem_pool_t *next, *prev;
+};
+
+/* All the pools, for reporting statistics.  Pools are created and
+   destroyed when the library is initialized and shut down, so this
+   is not locked. */
+static ipmi_mem_pool_t *pool_list;
+
+ipmi_mem_pool_t *
+ipmi_mem_pool_alloc(os_handler_t *os_hnd,
+		    const char   *name,
+		    unsigned int size,
+		    unsigned int max_free)
+{
+    ipmi_mem_pool_t *pool;
+
+    pool = ipmi_mem_alloc(sizeof(*pool));
+    if (!pool)
+	return NULL;
+    memset(pool, 0, sizeof(*pool));
+
+    pool->name = ipmi_strdup(name);
+    if (!pool->name) {
+	ipmi_mem_free(pool);
+	return NULL;
+    }
+    if (ipmi_create_lock_os_hnd(os_hnd, &pool->lock)) {
+	ipmi_mem_free(pool->name);
+	ipmi_mem_free(pool);
+	return NULL;
+    }
+    if (size < sizeof(void *))
+	size = sizeof(void *);
+    pool->size = size;
+    pool->max_free = max_free;
+
+    pool->next = pool_list;
+    if (pool_list)
+	pool_list->prev = pool;
+    pool_list = pool;
+
+    return pool;
+}
+
+void
+ipmi_mem_pool_destroy(ipmi_mem_pool_t *pool)
+{
+    void *obj;
+
+    if (pool->next)
+	pool->next->prev = pool->prev;
+    if (pool->prev)
+	pool->prev->next = pool->next;
+    else
+	pool_list = pool->next;
+
+    while (pool->free_list) {
+	obj = pool->free_list;
+	pool->free_list = *((void **) obj);
+	ipmi_mem_free(obj);
+    }
+    ipmi_destroy_lock(pool->lock);
+    ipmi_mem_free(pool->name);
+    ipmi_mem_free(pool);
+}
+
+void *
+ipmi_mem_pool_get(ipmi_mem_pool_t *pool)
+{
+    void *obj = NULL;
+
+    ipmi_lock(pool->lock);
+    pool->gets++;
+    /* Don't hide anything from the malloc debugger. */
+    if (pool->free_list && !DEBUG_MALLOC) {
+	obj = pool->free_list;
+	pool->free_list = *((void **) obj);
+	pool->num_free--;
+    } else {
+	pool->misses++;
+    }
+    ipmi_unlock(pool->lock);
+
+    if (!obj)
+	obj = ipmi_mem_alloc(pool->size);
+    return obj;
+}
+
+void
+ipmi_mem_pool_put(ipmi_mem_pool_t *pool, void *obj)
+{
+    ipmi_lock(pool->lock);
+    if (pool->num_free < pool->max_free && !DEBUG_MALLOC) {
+	*((void **) obj) = pool->free_list;
+	pool->free_list = obj;
+	pool->num_free++;
+	obj = NULL;
+    }
+    ipmi_unlock(pool->lock);
+
+    if (obj)
+	ipmi_mem_free(obj);
+}
+
+void
+ipmi_mem_pool_iterate(ipmi_mem_pool_cb handler, void *cb_data)
+{
+    ipmi_mem_pool_t *pool;
+    unsigned long   gets, misses;
+
+    for (pool = pool_list; pool; pool = pool->next) {
+	ipmi_lock(pool->lock);
+	gets = pool->gets;
+	misses = pool->misses;
+	ipmi_unlock(pool->lock);
+	handler(pool, pool->name, gets, misses, cb_data);
+    }
+}
+
 int
 ipmi_malloc_init(os_handler_t *os_hnd)
 {
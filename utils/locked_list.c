@@ -54,19 +54,27 @@
  */
 
 #include <string.h>
+#include <stdint.h>
 
+#include <OpenIPMI/ipmi_types.h>
 #include <OpenIPMI/internal/ipmi_locks.h>
 #include <OpenIPMI/internal/ipmi_malloc.h>
 #include <OpenIPMI/internal/locked_list.h>
 
 #define LOCKED_LIST_ENTRIES_INCREMENT 5
 
+/* Lists with at least this many entries get a hash index on
+   (item1, item2) so finding an entry doesn't walk the list.  Most
+   lists are short and never get one. */
+#define LOCKED_LIST_HASH_MIN	32
+
 struct locked_list_entry_s
 {
     unsigned int destroyed;
     void *item1, *item2;
     locked_list_entry_t *next, *prev;
     locked_list_entry_t *dlist_next;
+    locked_list_entry_t *hash_next;
 };
 
 struct locked_list_s
@@ -78,6 +86,14 @@ struct locked_list_s
     unsigned int        count;
     locked_list_entry_t head;
     locked_list_entry_t *destroy_list;
+
+    /* Hash index of the entries that are not destroyed, NULL if the
+       list is short (or the index could not be allocated, it is only
+       an optimization).  hash_size is a power of two, hash_shift
+   selects the top log2(hash_size) bits of a 32-bit hash. */
+    locked_list_entry_t **hash;
+    unsigned int        hash_size;
+    unsigned int        hash_shift;
 };
 
 static void
@@ -163,16 +179,135 @@ locked_list_destroy(locked_list_t *ll)
 	ipmi_mem_free(entry);
 	entry = next;
     }
+    if (ll->hash)
+	ipmi_mem_free(ll->hash);
     if (ll->lock == ll_std_lock)
 	ipmi_destroy_lock(ll->lock_cb_data);
     ipmi_mem_free(ll);
 }
 
+/* Fold a pointer down to 32 bits.  The double shift keeps it defined
+   where unsigned long is only 32 bits. */
+static uint32_t
+fold_pointer(void *ptr)
+{
+    unsigned long val = (unsigned long) ptr;
+
+    return (uint32_t) val ^ (uint32_t) ((val >> 16) >> 16);
+}
+
+/* Fibonacci hashing.  Pointers have their low bits clear and mostly
+   share their high bits, so multiply by the golden ratio to spread
+   the differing bits and use the top bits of the result, which
+   depend on all of the input. */
+#define LOCKED_LIST_GOLDEN_RATIO 0x9e3779b9U
+
+static unsigned int
+hash_items(locked_list_t *ll, void *item1, void *item2)
+{
+    uint32_t h;
+
+    h = fold_pointer(item1) * LOCKED_LIST_GOLDEN_RATIO;
+    h = (h ^ fold_pointer(item2)) * LOCKED_LIST_GOLDEN_RATIO;
+    return h >> ll->hash_shift;
+}
+
+/* Build or grow the hash index if the list has gotten big enough. */
+static void
+hash_resize(locked_list_t *ll)
+{
+    locked_list_entry_t **new_hash, **old_hash;
+    locked_list_entry_t *entry;
+    unsigned int        new_size, new_shift, h;
+
+    if (ll->count < LOCKED_LIST_HASH_MIN)
+	return;
+    if (ll->hash && ll->count <= ll->hash_size)
+	return;
+
+    new_size = ll->hash_size ? ll->hash_size * 2 : LOCKED_LIST_HASH_MIN * 2;
+    new_hash = ipmi_mem_alloc(new_size * sizeof(*new_hash));
+    if (!new_hash)
+	/* Just keep using what we have. */
+	return;
+    memset(new_hash, 0, new_size * sizeof(*new_hash));
+
+    for (new_shift = 32; (1U << (32 - new_shift)) < new_size; new_shift--)
+	;
+
+    old_hash = ll->hash;
+    ll->hash = new_hash;
+    ll->hash_size = new_size;
+    ll->hash_shift = new_shift;
+    for (entry = ll->head.next; entry != &ll->head; entry = entry->next) {
+	if (entry->destroyed)
+	    continue;
+	h = hash_items(ll, entry->item1, entry->item2);
+	entry->hash_next = new_hash[h];
+	new_hash[h] = entry;
+    }
+    if (old_hash)
+	ipmi_mem_free(old_hash);
+}
+
+static void
+hash_remove(locked_list_t *ll, locked_list_entry_t *entry)
+{
+    locked_list_entry_t **pos;
+
+    if (!ll->hash)
+	return;
+    pos = &ll->hash[hash_items(ll, entry->item1, entry->item2)];
+    while (*pos) {
+	if (*pos == entry) {
+	    *pos = entry->hash_next;
+	    break;
+	}
+	pos = &(*pos)->hash_next;
+    }
+}
+
+/* Put a new entry on the end of the list, the entry must not be a
+   duplicate. */
+static void
+internal_add(locked_list_t *ll, locked_list_entry_t *entry,
+	     void *item1, void *item2)
+{
+    unsigned int h;
+
+    entry->item1 = item1;
+    entry->item2 = item2;
+    entry->destroyed = 0;
+    entry->next = &ll->head;
+    entry->prev = ll->head.prev;
+    entry->prev->next = entry;
+    entry->next->prev = entry;
+    ll->count++;
+
+    if (ll->hash) {
+	h = hash_items(ll, item1, item2);
+	entry->hash_next = ll->hash[h];
+	ll->hash[h] = entry;
+    }
+    /* Done after adding so a new index picks up this entry, too. */
+    hash_resize(ll);
+}
+
 static locked_list_entry_t *
 internal_find(locked_list_t *ll, void *item1, void *item2)
 {
     locked_list_entry_t *entry;
 
+    if (ll->hash) {
+	entry = ll->hash[hash_items(ll, item1, item2)];
+	while (entry) {
+	    if ((entry->item1 == item1) && (entry->item2 == item2))
+		return entry;
+	    entry = entry->hash_next;
+	}
+	return NULL;
+    }
+
     entry = ll->head.next;
     while (entry != &ll->head) {
 	if ((!entry->destroyed)
@@ -206,14 +341,7 @@ locked_list_add_entry(locked_list_t *ll, void *item1, void *item2,
 	goto out_unlock;
     }
 
-    entry->item1 = item1;
-    entry->item2 = item2;
-    entry->destroyed = 0;
-    entry->next = &ll->head;
-    entry->prev = ll->head.prev;
-    entry->prev->next = entry;
-    entry->next->prev = entry;
-    ll->count++;
+    internal_add(ll, entry, item1, item2);
 
  out_unlock:
     ll->unlock(ll->lock_cb_data);
@@ -243,14 +371,7 @@ locked_list_add_entry_nolock(locked_list_t *ll, void *item1, void *item2,
 	goto out;
     }
 
-    entry->item1 = item1;
-    entry->item2 = item2;
-    entry->destroyed = 0;
-    entry->next = &ll->head;
-    entry->prev = ll->head.prev;
-    entry->prev->next = entry;
-    entry->next->prev = entry;
-    ll->count++;
+    internal_add(ll, entry, item1, item2);
 
  out:
     return rv;
@@ -274,6 +395,8 @@ locked_list_remove_nolock(locked_list_t *ll, void *item1, void *item2)
     } else {
 	rv = 1;
 	ll->count--;
+	/* Destroyed entries are never in the index. */
+	hash_remove(ll, entry);
 	if (ll->cb_count) {
 	    /* We are in callbacks, just mark it destroyed and let the
 	       last call back exit clear it up. */
@@ -172,6 +172,11 @@ single_waiter_thread(void *data)
 	    os_hnd->lock(os_hnd, factory->lock);
 	}
 
+	/* We may have been told to stop while running the event loop
+	   above, and that wakeup is lost, so check before waiting. */
+	if (factory->stop_threads)
+	    break;
+
 	/* Wait for someone to tell us there are more event to run */
 	os_hnd->cond_wait(os_hnd, factory->single_thread_cond, factory->lock);
     }